@@ -0,0 +1,300 @@
+//
+// Single file archive of assets. A header, the file contents one after the other, then an index sorted by the hash
+// of each file's path (relative to the project root) with its offset, size and compression. The whole pack is mapped
+// into memory once and files are handed out as views into that mapping, so reading an asset costs no system call.
+//
+
+#ifndef PROJECT_BASE_ASSET_PACK_H
+#define PROJECT_BASE_ASSET_PACK_H
+
+#include <stb_image.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// read only bytes of a file, either inside a mapping or a buffer owned by the view. Copies share the backing
+struct FileView {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    std::shared_ptr<const void> backing;
+
+    explicit operator bool() const {
+        return (bool) backing;
+    }
+
+    std::string String() const {
+        return std::string((const char *) data, size);
+    }
+};
+
+// a whole file mapped read only, unmapped with its last reference
+class MappedFile {
+public:
+    static std::shared_ptr<MappedFile> Open(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return nullptr;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+            close(fd);
+            return nullptr;
+        }
+        std::shared_ptr<MappedFile> file(new MappedFile());
+        file->size = info.st_size;
+        // an empty file cannot be mapped, it is an empty view instead
+        if (file->size > 0) {
+            void *mapping = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                return nullptr;
+            }
+            file->data = (const unsigned char *) mapping;
+        }
+        // the mapping stays valid without the descriptor
+        close(fd);
+        return file;
+    }
+
+    ~MappedFile() {
+        if (data)
+            munmap((void *) data, size);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const unsigned char *Data() const {
+        return data;
+    }
+
+    size_t Size() const {
+        return size;
+    }
+
+    // asks the kernel to read the whole file ahead instead of page by page on first touch
+    void WillNeed() const {
+        if (data)
+            madvise((void *) data, size, MADV_WILLNEED);
+    }
+
+private:
+    MappedFile() = default;
+
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+};
+
+class AssetPack {
+public:
+    enum Compression : uint32_t {
+        Stored = 0,
+        // zlib stream, inflated into a buffer of its own on every Find
+        Zlib = 1
+    };
+
+    // 64 bit FNV-1a of the path as stored in the index
+    static uint64_t HashPath(const std::string &path) {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c: path) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // maps the pack and checks its index, false when it is missing or damaged
+    bool Open(const std::string &path) {
+        std::shared_ptr<MappedFile> file = MappedFile::Open(path);
+        if (!file)
+            return false;
+        Header header;
+        if (file->Size() < sizeof(Header)) {
+            std::cout << "ERROR::ASSET_PACK::INVALID " << path << std::endl;
+            return false;
+        }
+        std::memcpy(&header, file->Data(), sizeof(Header));
+        uint64_t indexBytes = (uint64_t) header.entryCount * sizeof(Entry);
+        if (std::memcmp(header.magic, "PBPK", 4) != 0 || header.version != Version ||
+            header.indexOffset > file->Size() || indexBytes > file->Size() - header.indexOffset ||
+            header.stringsOffset > file->Size()) {
+            std::cout << "ERROR::ASSET_PACK::INVALID " << path << std::endl;
+            return false;
+        }
+        const Entry *index = (const Entry *) (file->Data() + header.indexOffset);
+        for (uint32_t i = 0; i < header.entryCount; i++)
+            if (index[i].offset > file->Size() || index[i].storedSize > file->Size() - index[i].offset ||
+                index[i].pathOffset > file->Size() - header.stringsOffset) {
+                std::cout << "ERROR::ASSET_PACK::INVALID " << path << std::endl;
+                return false;
+            }
+        mapping = file;
+        entries = index;
+        entryCount = header.entryCount;
+        strings = (const char *) file->Data() + header.stringsOffset;
+        stringsSize = file->Size() - header.stringsOffset;
+        return true;
+    }
+
+    bool IsOpen() const {
+        return (bool) mapping;
+    }
+
+    size_t Size() const {
+        return entryCount;
+    }
+
+    // the file stored under path, relative to the project root, an empty view when the pack does not have it
+    FileView Find(const std::string &path) const {
+        if (!mapping)
+            return FileView();
+        uint64_t hash = HashPath(path);
+        const Entry *end = entries + entryCount;
+        const Entry *entry = std::lower_bound(entries, end, hash,
+                                              [](const Entry &e, uint64_t value) { return e.hash < value; });
+        // paths sharing a hash sit next to each other
+        for (; entry != end && entry->hash == hash; entry++) {
+            if (pathOf(*entry) != path)
+                continue;
+            const unsigned char *stored = mapping->Data() + entry->offset;
+            FileView view;
+            if (entry->compression == Stored) {
+                view.data = stored;
+                view.size = entry->size;
+                view.backing = mapping;
+                return view;
+            }
+            if (entry->compression == Zlib) {
+                int length = 0;
+                char *inflated = stbi_zlib_decode_malloc_guesssize_headerflag(
+                        (const char *) stored, (int) entry->storedSize, (int) entry->size, &length, 1);
+                if (!inflated || (uint64_t) length != entry->size) {
+                    std::cout << "ERROR::ASSET_PACK::CANNOT_INFLATE " << path << std::endl;
+                    free(inflated);
+                    return FileView();
+                }
+                view.data = (const unsigned char *) inflated;
+                view.size = length;
+                view.backing = std::shared_ptr<const void>(inflated, free);
+                return view;
+            }
+            std::cout << "ERROR::ASSET_PACK::UNKNOWN_COMPRESSION " << path << std::endl;
+            return FileView();
+        }
+        return FileView();
+    }
+
+    // every path in the pack
+    std::vector<std::string> Paths() const {
+        std::vector<std::string> paths;
+        for (size_t i = 0; i < entryCount; i++)
+            paths.push_back(pathOf(entries[i]));
+        return paths;
+    }
+
+    // reads the given files, relative to root, into a new pack stored uncompressed. The same files always give the
+    // same bytes, whatever order they are listed in
+    static bool Write(const std::string &packPath, const std::string &root, std::vector<std::string> paths) {
+        std::sort(paths.begin(), paths.end());
+        paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+        std::string temporary = packPath + ".tmp";
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << "ERROR::ASSET_PACK::CANNOT_WRITE " << packPath << std::endl;
+            return false;
+        }
+        Header header;
+        out.write((const char *) &header, sizeof(Header));
+
+        std::vector<Entry> index;
+        std::string names;
+        for (const std::string &path: paths) {
+            std::shared_ptr<MappedFile> file = MappedFile::Open(root.empty() ? path : root + '/' + path);
+            if (!file) {
+                std::cout << "ERROR::ASSET_PACK::CANNOT_READ " << path << std::endl;
+                return false;
+            }
+            Entry entry;
+            entry.hash = HashPath(path);
+            entry.offset = align(out);
+            entry.size = entry.storedSize = file->Size();
+            entry.compression = Stored;
+            entry.pathOffset = names.size();
+            names += path;
+            names += '\0';
+            out.write((const char *) file->Data(), file->Size());
+            index.push_back(entry);
+        }
+        std::stable_sort(index.begin(), index.end(), [](const Entry &a, const Entry &b) { return a.hash < b.hash; });
+
+        header.entryCount = index.size();
+        header.indexOffset = align(out);
+        out.write((const char *) index.data(), index.size() * sizeof(Entry));
+        header.stringsOffset = out.tellp();
+        out.write(names.data(), names.size());
+        out.seekp(0);
+        out.write((const char *) &header, sizeof(Header));
+        out.close();
+        if (!out) {
+            std::cout << "ERROR::ASSET_PACK::CANNOT_WRITE " << packPath << std::endl;
+            return false;
+        }
+        return std::rename(temporary.c_str(), packPath.c_str()) == 0;
+    }
+
+private:
+    static const uint32_t Version = 1;
+
+    struct Header {
+        char magic[4] = {'P', 'B', 'P', 'K'};
+        uint32_t version = Version;
+        uint32_t entryCount = 0;
+        uint32_t reserved = 0;
+        uint64_t indexOffset = 0;
+        uint64_t stringsOffset = 0;
+    };
+
+    struct Entry {
+        uint64_t hash;
+        uint64_t offset;
+        uint64_t size;
+        uint64_t storedSize;
+        uint32_t compression;
+        // into the string table at the end of the pack
+        uint32_t pathOffset;
+    };
+
+    std::shared_ptr<MappedFile> mapping;
+    const Entry *entries = nullptr;
+    size_t entryCount = 0;
+    const char *strings = nullptr;
+    size_t stringsSize = 0;
+
+    std::string pathOf(const Entry &entry) const {
+        const char *path = strings + entry.pathOffset;
+        return std::string(path, strnlen(path, stringsSize - entry.pathOffset));
+    }
+
+    // every file starts 16 byte aligned, so views can be read as arrays of their structs
+    static uint64_t align(std::ofstream &out) {
+        uint64_t position = out.tellp();
+        static const char zeros[16] = {};
+        out.write(zeros, (16 - position % 16) % 16);
+        return out.tellp();
+    }
+};
+
+#endif //PROJECT_BASE_ASSET_PACK_H
@@ -0,0 +1,492 @@
+//
+// Loads textures and models while the program runs without stalling the render thread. A loader thread owns a
+// hidden window whose context shares objects with the main one: it reads, decodes and uploads, fences the upload
+// and hands the asset back through a lock-free queue. Update, on the render thread, makes an asset resident once its
+// fence has signalled and never waits for one. Until then the handle is not resident and the caller draws a
+// placeholder, e.g. Placeholder() or the previous version of the asset.
+// A model built from Model::ImportCoarse is refined the same way: its full meshes follow one at a time, those
+// covering most of the screen first, and the full textures replace the thumbnails once every mesh is in.
+//
+
+#ifndef PROJECT_BASE_ASSET_STREAMER_H
+#define PROJECT_BASE_ASSET_STREAMER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <learnopengl/model.h>
+
+#include <spsc_queue.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class AssetStreamer {
+public:
+    // state of a streamed asset, only read it on the render thread
+    struct TextureAsset {
+        std::string path;
+        bool resident = false;
+        bool failed = false;
+        unsigned int id = 0;
+    };
+
+    struct ModelAsset {
+        std::string path;
+        bool textureArrays = false;
+        bool resident = false;
+        bool failed = false;
+        std::unique_ptr<Model> model;
+    };
+
+    typedef std::shared_ptr<TextureAsset> TextureHandle;
+    typedef std::shared_ptr<ModelAsset> ModelHandle;
+
+    // must be created on the render thread with its context current
+    explicit AssetStreamer(GLFWwindow *window) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        loaderWindow = glfwCreateWindow(1, 1, "Loader", NULL, window);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (loaderWindow == NULL)
+            std::cout << "ERROR::ASSET_STREAMER::CANNOT_CREATE_LOADER_CONTEXT" << std::endl;
+
+        // mid gray, drawn in place of textures that are not resident yet
+        const unsigned char gray[3] = {128, 128, 128};
+        glGenTextures(1, &placeholder);
+        glBindTexture(GL_TEXTURE_2D, placeholder);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, gray);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        if (loaderWindow)
+            loader = std::thread([this] { loaderLoop(); });
+    }
+
+    AssetStreamer(const AssetStreamer &) = delete;
+    AssetStreamer &operator=(const AssetStreamer &) = delete;
+
+    // returns right away, resident runs on the render thread in the Update that makes the texture resident. It may
+    // take the texture over by setting the asset's id to 0, the streamer then no longer deletes it
+    TextureHandle LoadTexture(const std::string &path,
+                              std::function<void(TextureAsset &)> resident = std::function<void(TextureAsset &)>()) {
+        TextureHandle texture = std::make_shared<TextureAsset>();
+        texture->path = path;
+        Request request;
+        request.texture = texture;
+        request.textureResident = resident;
+        submit(request);
+        return texture;
+    }
+
+    // the model is imported, decoded and uploaded on the loader thread, only its vertex array is created by Update
+    ModelHandle LoadModel(const std::string &path, bool textureArrays,
+                          std::function<void(ModelAsset &)> resident = std::function<void(ModelAsset &)>()) {
+        ModelHandle model = std::make_shared<ModelAsset>();
+        model->path = path;
+        model->textureArrays = textureArrays;
+        Request request;
+        request.model = model;
+        request.modelResident = resident;
+        submit(request);
+        return model;
+    }
+
+    // streams the full meshes and textures of a model built from Model::ImportCoarse into it, nothing for any other
+    // model. Meshes come in the order of the model's Coverage, so keep calling UpdateCoverage. The model's pool must
+    // not be added to elsewhere until the model is refined or StopRefining returned
+    void Refine(Model &model) {
+        const std::vector<uint64_t> &offsets = model.FullMeshOffsets();
+        if (offsets.empty())
+            return;
+        std::shared_ptr<Refinement> refinement = std::make_shared<Refinement>();
+        refinement->model = &model;
+        refinement->pool = model.pool;
+        refinement->cachePath = model.SourceFile() + ".meshcache";
+        refinement->directory = model.directory;
+        refinement->textureArrays = model.UsesTextureArrays();
+        refinement->textures = model.textures_loaded;
+        refinement->offsets = offsets;
+        refinement->priorities.assign(offsets.size(), 0.0f);
+        refinement->queued.assign(offsets.size(), true);
+        refinement->remaining = offsets.size();
+        refining.push_back(refinement);
+        if (!loaderWindow) {
+            int mesh;
+            while (pick(*refinement, mesh)) {
+                Request request;
+                request.refinement = refinement;
+                refine(*refinement, mesh, request);
+                publish(request);
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            refinements.push_back(refinement);
+        }
+        wake.notify_one();
+    }
+
+    // drops what is left of the model's refinement, waiting for a mesh the loader is uploading right now. Call before
+    // the model's meshes or pool are replaced or released
+    void StopRefining(Model &model) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (size_t i = 0; i < refining.size();) {
+            if (refining[i]->model != &model) {
+                i++;
+                continue;
+            }
+            refining[i]->cancelled = true;
+            refinements.erase(std::remove(refinements.begin(), refinements.end(), refining[i]), refinements.end());
+            refining.erase(refining.begin() + i);
+        }
+        idle.wait(lock, [this, &model] { return !busy || busy->model != &model; });
+    }
+
+    // the texture to bind for a handle, the placeholder until it is resident
+    unsigned int TextureId(const TextureHandle &texture) const {
+        return texture && texture->resident ? texture->id : placeholder;
+    }
+
+    unsigned int Placeholder() const {
+        return placeholder;
+    }
+
+    // publishes the assets whose uploads the GPU has finished, call once per frame on the render thread
+    void Update() {
+        // the loader picks the next mesh by the coverage of the last frame
+        for (const std::shared_ptr<Refinement> &refinement: refining) {
+            const std::vector<float> &coverage = refinement->model->Coverage();
+            if (coverage.size() != refinement->priorities.size())
+                continue;
+            std::lock_guard<std::mutex> lock(mutex);
+            refinement->priorities = coverage;
+        }
+
+        Request done;
+        while (completed.Pop(done))
+            uploading.push_back(std::move(done));
+
+        for (size_t i = 0; i < uploading.size();) {
+            if (uploading[i].fence) {
+                // a zero timeout only asks, the render thread never waits on the loader
+                GLenum status = glClientWaitSync(uploading[i].fence, 0, 0);
+                if (status == GL_TIMEOUT_EXPIRED) {
+                    i++;
+                    continue;
+                }
+                glDeleteSync(uploading[i].fence);
+            }
+            // out of the list first, a callback may queue the next asset
+            Request request = std::move(uploading[i]);
+            std::swap(uploading[i], uploading.back());
+            uploading.pop_back();
+            publish(request);
+        }
+    }
+
+    // requests not resident yet, queued or in flight
+    unsigned int Pending() const {
+        return pending;
+    }
+
+    unsigned int Loaded() const {
+        return loaded;
+    }
+
+    // loader thread time of the last asset, read plus decode plus upload
+    float LastMilliseconds() const {
+        return lastMilliseconds;
+    }
+
+    // stops the loader and deletes every texture and model it made, call before the context goes away
+    void Release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (loader.joinable())
+            loader.join();
+        // assets still on their way are not published, their objects are deleted with the rest below
+        Request done;
+        while (completed.Pop(done))
+            uploading.push_back(std::move(done));
+        for (Request &request: uploading) {
+            if (request.fence)
+                glDeleteSync(request.fence);
+            if (request.refinedTextures)
+                request.refinedTextures->Release();
+        }
+        uploading.clear();
+        refinements.clear();
+        refining.clear();
+        for (const TextureHandle &texture: textures)
+            if (texture->id)
+                glDeleteTextures(1, &texture->id);
+        for (const ModelHandle &model: models)
+            if (model->model)
+                model->model->Release();
+        textures.clear();
+        models.clear();
+        glDeleteTextures(1, &placeholder);
+        if (loaderWindow)
+            glfwDestroyWindow(loaderWindow);
+        loaderWindow = NULL;
+    }
+
+private:
+    struct Refinement {
+        Model *model = nullptr;
+        MeshPool *pool = nullptr;
+        std::string cachePath;
+        std::string directory;
+        bool textureArrays = false;
+        std::vector<Texture> textures;
+        std::vector<uint64_t> offsets;
+        // under the mutex
+        std::vector<float> priorities;
+        std::vector<bool> queued;
+        unsigned int remaining = 0;
+        bool texturesQueued = true;
+        bool cancelled = false;
+        // only used by the loader, kept mapped so a cache rewritten meanwhile cannot mix with the offsets
+        MeshCache::Reader cache;
+    };
+
+    struct Request {
+        TextureHandle texture;
+        ModelHandle model;
+        std::function<void(TextureAsset &)> textureResident;
+        std::function<void(ModelAsset &)> modelResident;
+        // a refinement step: one full mesh, or with mesh -1 the full textures
+        std::shared_ptr<Refinement> refinement;
+        int mesh = -1;
+        bool refined = false;
+        MeshData meshData;
+        MeshPool::Range range = {0, 0, 0};
+        std::shared_ptr<Model> refinedTextures;
+        GLsync fence = 0;
+        float milliseconds = 0.0f;
+    };
+
+    GLFWwindow *loaderWindow = NULL;
+    unsigned int placeholder = 0;
+    std::thread loader;
+    // render thread -> loader, rare enough for a lock
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Request> requests;
+    // refinements with steps left for the loader, and the one it is working on
+    std::deque<std::shared_ptr<Refinement>> refinements;
+    Refinement *busy = nullptr;
+    std::condition_variable idle;
+    bool stopping = false;
+    // loader -> render thread
+    SpscQueue<Request, 64> completed;
+    // finished on the loader, waiting for their fence
+    std::vector<Request> uploading;
+    // every asset made, for Release
+    std::vector<TextureHandle> textures;
+    std::vector<ModelHandle> models;
+    // refinements not published to the end, render thread only
+    std::vector<std::shared_ptr<Refinement>> refining;
+    unsigned int pending = 0;
+    unsigned int loaded = 0;
+    float lastMilliseconds = 0.0f;
+
+    void submit(const Request &request) {
+        if (request.texture)
+            textures.push_back(request.texture);
+        else
+            models.push_back(request.model);
+        pending++;
+        if (!loaderWindow) {
+            // without a second context the asset is loaded right here, stalling like a plain load would
+            Request loadedHere = request;
+            load(loadedHere);
+            uploading.push_back(std::move(loadedHere));
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.push_back(request);
+        }
+        wake.notify_one();
+    }
+
+    void publish(Request &request) {
+        if (request.refinement) {
+            publishRefinement(request);
+            return;
+        }
+        pending--;
+        lastMilliseconds = request.milliseconds;
+        if (request.texture) {
+            TextureAsset &texture = *request.texture;
+            texture.resident = !texture.failed;
+            if (texture.resident)
+                loaded++;
+            if (texture.resident && request.textureResident)
+                request.textureResident(texture);
+        } else {
+            ModelAsset &model = *request.model;
+            if (!model.failed)
+                model.model->AttachVertexArray();
+            model.resident = !model.failed;
+            if (model.resident)
+                loaded++;
+            if (model.resident && request.modelResident)
+                request.modelResident(model);
+        }
+    }
+
+    void publishRefinement(Request &request) {
+        Refinement &refinement = *request.refinement;
+        lastMilliseconds = request.milliseconds;
+        if (request.mesh >= 0) {
+            if (!refinement.cancelled && request.refined && request.mesh < (int) refinement.model->meshes.size())
+                refinement.model->RefineMesh(request.mesh, std::move(request.meshData), request.range);
+            return;
+        }
+        // the textures are the last step
+        if (!refinement.cancelled)
+            refinement.model->AdoptTextures(*request.refinedTextures);
+        request.refinedTextures->Release();
+        request.refinedTextures.reset();
+        refining.erase(std::remove(refining.begin(), refining.end(), request.refinement), refining.end());
+    }
+
+    // the next step of a refinement: the uncovered mesh covering most of the screen, then the textures. false when
+    // nothing is left. Under the mutex when the loader runs
+    static bool pick(Refinement &refinement, int &mesh) {
+        if (refinement.remaining > 0) {
+            mesh = -1;
+            for (size_t i = 0; i < refinement.queued.size(); i++)
+                if (refinement.queued[i] && (mesh < 0 || refinement.priorities[i] > refinement.priorities[mesh]))
+                    mesh = (int) i;
+            refinement.queued[mesh] = false;
+            refinement.remaining--;
+            return true;
+        }
+        if (refinement.texturesQueued) {
+            refinement.texturesQueued = false;
+            mesh = -1;
+            return true;
+        }
+        return false;
+    }
+
+    static void refine(Refinement &refinement, int mesh, Request &request) {
+        auto start = std::chrono::steady_clock::now();
+        request.mesh = mesh;
+        if (mesh < 0) {
+            request.refinedTextures.reset(new Model(
+                    Model::LoadTextures(refinement.directory, refinement.textureArrays, refinement.textures),
+                    false, nullptr, false));
+        } else {
+            if (!refinement.cache.file)
+                refinement.cache.Open(refinement.cachePath);
+            MeshData &data = request.meshData;
+            // the pool was reserved for the full meshes, growing it here would pull its buffers from under the
+            // render thread
+            if (MeshCache::LoadMesh(refinement.cache, refinement.offsets[mesh], data) &&
+                refinement.pool->Fits(data.vertices.size(), data.indices.size())) {
+                request.range = refinement.pool->Add(data.vertices, data.indices);
+                refinement.pool->Upload();
+                request.refined = true;
+            } else
+                std::cout << "ERROR::ASSET_STREAMER::CANNOT_REFINE " << refinement.cachePath << " mesh " << mesh
+                          << std::endl;
+        }
+        request.milliseconds = std::chrono::duration<float, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+    static void load(Request &request) {
+        auto start = std::chrono::steady_clock::now();
+        if (request.texture)
+            loadTexture(*request.texture);
+        else
+            loadModel(*request.model);
+        request.milliseconds = std::chrono::duration<float, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+    void loaderLoop() {
+        glfwMakeContextCurrent(loaderWindow);
+        for (;;) {
+            Request request;
+            int mesh = -1;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !requests.empty() || !refinements.empty(); });
+                if (stopping)
+                    break;
+                // requested assets go first, refinement fills the time in between
+                if (!requests.empty()) {
+                    request = std::move(requests.front());
+                    requests.pop_front();
+                } else {
+                    std::shared_ptr<Refinement> refinement = refinements.front();
+                    bool picked = pick(*refinement, mesh);
+                    // a refinement leaves the queue with its last step
+                    if (refinement->remaining == 0 && !refinement->texturesQueued)
+                        refinements.pop_front();
+                    if (!picked)
+                        continue;
+                    request.refinement = refinement;
+                    busy = refinement.get();
+                }
+            }
+
+            if (request.refinement)
+                refine(*request.refinement, mesh, request);
+            else
+                load(request);
+            // the fence has to reach the GPU before the render thread can see it signal
+            request.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+            if (request.refinement) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    busy = nullptr;
+                }
+                idle.notify_all();
+            }
+
+            while (!completed.Push(std::move(request)))
+                std::this_thread::yield();
+        }
+        glfwMakeContextCurrent(NULL);
+    }
+
+    static void loadTexture(TextureAsset &texture) {
+        DecodedImage image;
+        if (!DecodeImage(texture.path, image)) {
+            std::cout << "Texture failed to load at path: " << texture.path << std::endl;
+            texture.failed = true;
+            return;
+        }
+        glGenTextures(1, &texture.id);
+        TextureFromImage(texture.id, image);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    static void loadModel(ModelAsset &model) {
+        model.model.reset(new Model(Model::Load(model.path, model.textureArrays), false, nullptr, false));
+        model.failed = model.model->meshes.empty();
+    }
+};
+
+#endif //PROJECT_BASE_ASSET_STREAMER_H
@@ -0,0 +1,83 @@
+//
+// Lets Assimp read through the virtual file system, so a model and the files it references (an .obj's .mtl) come
+// from the same pack or loose directory as every other asset.
+//
+
+#ifndef PROJECT_BASE_ASSIMP_FILE_SYSTEM_H
+#define PROJECT_BASE_ASSIMP_FILE_SYSTEM_H
+
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+#include <learnopengl/filesystem.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+// read only stream over a view, the importer never writes
+class FileViewStream : public Assimp::IOStream {
+public:
+    explicit FileViewStream(const FileView &view) : view(view) {}
+
+    size_t Read(void *buffer, size_t size, size_t count) override {
+        if (size == 0)
+            return 0;
+        count = std::min(count, (view.size - position) / size);
+        std::memcpy(buffer, view.data + position, size * count);
+        position += size * count;
+        return count;
+    }
+
+    size_t Write(const void *, size_t, size_t) override {
+        return 0;
+    }
+
+    aiReturn Seek(size_t offset, aiOrigin origin) override {
+        size_t base = origin == aiOrigin_SET ? 0 : origin == aiOrigin_CUR ? position : view.size;
+        if (offset > view.size - base)
+            return aiReturn_FAILURE;
+        position = base + offset;
+        return aiReturn_SUCCESS;
+    }
+
+    size_t Tell() const override {
+        return position;
+    }
+
+    size_t FileSize() const override {
+        return view.size;
+    }
+
+    void Flush() override {}
+
+private:
+    FileView view;
+    size_t position = 0;
+};
+
+// hand a new one to Importer::SetIOHandler, the importer deletes it
+class AssimpFileSystem : public Assimp::IOSystem {
+public:
+    bool Exists(const char *path) const override {
+        return FileSystem::files().Exists(path);
+    }
+
+    char getOsSeparator() const override {
+        return '/';
+    }
+
+    Assimp::IOStream *Open(const char *path, const char *mode = "rb") override {
+        // writing is never asked for by the importers used here
+        if (std::strchr(mode, 'w') || std::strchr(mode, 'a'))
+            return nullptr;
+        FileView view = FileSystem::open(path);
+        return view ? new FileViewStream(view) : nullptr;
+    }
+
+    void Close(Assimp::IOStream *stream) override {
+        delete stream;
+    }
+};
+
+#endif //PROJECT_BASE_ASSIMP_FILE_SYSTEM_H
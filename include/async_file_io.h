@@ -0,0 +1,522 @@
+//
+// Asynchronous whole-file reads for the loaders. On Linux the reads go through an io_uring set up with the raw
+// system calls: Read only queues, Submit hands every queued read to the kernel in one call, and a reaper thread
+// passes each finished buffer to a job on the ThreadPool, where it is decoded. Files of DirectThreshold bytes or more
+// are read with O_DIRECT, around the page cache. Without io_uring (old kernel, seccomp) every read is a blocking
+// pread job on the pool instead. With an asset pack mounted the files are already mapped, they skip the reads and
+// their completions get views into the mapping on the pool. O_DIRECT therefore only ever applies to loose files: the
+// pack's pages come in through the page cache as the decoders touch them, and its 16 byte aligned entries could not
+// be read with O_DIRECT's page aligned offsets without reading around each one. No file shipped in resources/ is
+// near DirectThreshold (the largest is under 3 MiB), so for the current assets the O_DIRECT path never runs.
+//
+
+#ifndef PROJECT_BASE_ASYNC_FILE_IO_H
+#define PROJECT_BASE_ASYNC_FILE_IO_H
+
+#include <learnopengl/filesystem.h>
+
+#include <thread_pool.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class AsyncFileIo {
+public:
+    // runs on a pool worker with the whole file, an empty view when it could not be read
+    typedef std::function<void(const std::string &path, const FileView &file)> Completion;
+
+    // measured, O_DIRECT beats a cold buffered read at every size up to 32 MiB but is about twice as slow as a
+    // warm one at any size, so this is a guess at which large files are cold rather than a crossover
+    static const size_t DirectThreshold = 8u << 20;
+
+    // without useRing every read is a pool job, without usePacks files are read from disk even when a pack has them,
+    // both e.g. to compare the paths
+    explicit AsyncFileIo(ThreadPool &pool, bool useRing = true, bool usePacks = true)
+        : pool(pool), usePacks(usePacks) {
+        if (useRing && setupRing(Entries))
+            reaper = std::thread([this] { reapLoop(); });
+    }
+
+    ~AsyncFileIo() {
+        Wait();
+        if (ringFd < 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // a no-op with user_data 0 stops the reaper
+            prepareSqe()->opcode = IORING_OP_NOP;
+            publishSqe();
+            enter(1, 0, 0);
+        }
+        reaper.join();
+        munmap(sqes, sqeBytes);
+        munmap(sqRing, sqRingBytes);
+        if (cqRing != sqRing)
+            munmap(cqRing, cqRingBytes);
+        close(ringFd);
+    }
+
+    AsyncFileIo(const AsyncFileIo &) = delete;
+    AsyncFileIo &operator=(const AsyncFileIo &) = delete;
+
+    // queues a read of the whole file, nothing reaches the kernel before Submit. Any thread
+    void Read(const std::string &path, Completion done) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            outstanding++;
+        }
+        // packed files are views into the mapped pack already
+        bool packed = usePacks && FileSystem::files().HasPacks();
+        if (packed || ringFd < 0) {
+            pool.Submit([this, path, done, packed] {
+                done(path, packed ? FileSystem::open(path) : readBlocking(path));
+                finished();
+            });
+            return;
+        }
+        std::unique_ptr<Pending> pending(new Pending());
+        pending->path = path;
+        pending->done = done;
+        if (!openFile(*pending)) {
+            complete(pending.release(), false);
+            return;
+        }
+        if (pending->size == 0) {
+            complete(pending.release(), true);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        queued.push_back(pending.release());
+    }
+
+    // hands every queued read to the kernel in one system call
+    void Submit() {
+        std::lock_guard<std::mutex> lock(mutex);
+        submitQueued();
+    }
+
+    // submits what is queued and blocks until every read's completion has returned
+    void Wait() {
+        Submit();
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return outstanding == 0; });
+    }
+
+    bool UsesIoUring() const {
+        return ringFd >= 0;
+    }
+
+    // the blocking read the fallback uses, also the baseline of IoBenchmark
+    static FileView readBlocking(const std::string &path) {
+        FileView view;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return view;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            return view;
+        }
+        std::shared_ptr<std::vector<unsigned char>> bytes = std::make_shared<std::vector<unsigned char>>(info.st_size);
+        size_t done = 0;
+        while (done < bytes->size()) {
+            ssize_t got = pread(fd, bytes->data() + done, bytes->size() - done, done);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                break;
+            done += got;
+        }
+        close(fd);
+        bytes->resize(done);
+        view.data = bytes->data();
+        view.size = done;
+        view.backing = bytes;
+        return view;
+    }
+
+private:
+    struct Pending {
+        std::string path;
+        Completion done;
+        int fd = -1;
+        bool direct = false;
+        size_t size = 0;
+        // page aligned, and rounded up to whole pages for O_DIRECT
+        unsigned char *buffer = nullptr;
+        size_t capacity = 0;
+        size_t read = 0;
+        iovec span;
+    };
+
+    static const unsigned int Entries = 64;
+
+    ThreadPool &pool;
+    bool usePacks;
+    int ringFd = -1;
+    std::thread reaper;
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::deque<Pending *> queued;
+    // reads the kernel has, and every read whose completion has not returned yet
+    unsigned int inFlight = 0;
+    unsigned int outstanding = 0;
+
+    // the shared rings, laid out as io_uring_setup's offsets say
+    void *sqRing = nullptr, *cqRing = nullptr;
+    size_t sqRingBytes = 0, cqRingBytes = 0, sqeBytes = 0;
+    unsigned int *sqHead = nullptr, *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+    unsigned int *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+    unsigned int sqEntries = 0;
+    io_uring_sqe *sqes = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    bool setupRing(unsigned int entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0)
+            return false;
+        sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sqRingBytes = cqRingBytes = std::max(sqRingBytes, cqRingBytes);
+        sqRing = mmap(nullptr, sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        cqRing = single ? sqRing : mmap(nullptr, cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                        IORING_OFF_CQ_RING);
+        sqeBytes = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqeMap = cqRing == MAP_FAILED ? MAP_FAILED : mmap(nullptr, sqeBytes, PROT_READ | PROT_WRITE,
+                                                                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqeMap == MAP_FAILED) {
+            if (cqRing != MAP_FAILED && cqRing != sqRing)
+                munmap(cqRing, cqRingBytes);
+            munmap(sqRing, sqRingBytes);
+            close(fd);
+            return false;
+        }
+        unsigned char *sq = (unsigned char *) sqRing, *cq = (unsigned char *) cqRing;
+        sqHead = (unsigned int *) (sq + params.sq_off.head);
+        sqTail = (unsigned int *) (sq + params.sq_off.tail);
+        sqMask = (unsigned int *) (sq + params.sq_off.ring_mask);
+        sqArray = (unsigned int *) (sq + params.sq_off.array);
+        cqHead = (unsigned int *) (cq + params.cq_off.head);
+        cqTail = (unsigned int *) (cq + params.cq_off.tail);
+        cqMask = (unsigned int *) (cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+        sqes = (io_uring_sqe *) sqeMap;
+        sqEntries = params.sq_entries;
+        ringFd = fd;
+        return true;
+    }
+
+    int enter(unsigned int submit, unsigned int wait, unsigned int flags) {
+        return (int) syscall(__NR_io_uring_enter, ringFd, submit, wait, flags, nullptr, 0);
+    }
+
+    // a cleared entry at the tail, the kernel only sees it after publishSqe. Called with the mutex held
+    io_uring_sqe *prepareSqe() {
+        unsigned int index = *sqTail & *sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        return sqe;
+    }
+
+    // the release store orders the entry's contents before the new tail
+    void publishSqe() {
+        __atomic_store_n(sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+    }
+
+    // as many queued reads as the submission ring has room for, the completion ring is twice as large. Called with
+    // the mutex held
+    void submitQueued() {
+        unsigned int submitted = 0;
+        while (!queued.empty() && inFlight < sqEntries) {
+            Pending *pending = queued.front();
+            queued.pop_front();
+            pending->span.iov_base = pending->buffer + pending->read;
+            pending->span.iov_len = pending->capacity - pending->read;
+            io_uring_sqe *sqe = prepareSqe();
+            sqe->opcode = IORING_OP_READV;
+            sqe->fd = pending->fd;
+            sqe->addr = (uint64_t) (uintptr_t) &pending->span;
+            sqe->len = 1;
+            sqe->off = pending->read;
+            sqe->user_data = (uint64_t) (uintptr_t) pending;
+            publishSqe();
+            inFlight++;
+            submitted++;
+        }
+        while (submitted > 0) {
+            int taken = enter(submitted, 0, 0);
+            if (taken < 0 && errno == EINTR)
+                continue;
+            if (taken <= 0) {
+                std::cout << "ERROR::ASYNC_FILE_IO::SUBMIT_FAILED " << std::strerror(errno) << std::endl;
+                break;
+            }
+            submitted -= taken;
+        }
+    }
+
+    bool openFile(Pending &pending) {
+        struct stat info;
+        if (stat(pending.path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+            return false;
+        pending.size = info.st_size;
+        pending.direct = pending.size >= DirectThreshold;
+        pending.fd = open(pending.path.c_str(), O_RDONLY | O_CLOEXEC | (pending.direct ? O_DIRECT : 0));
+        // not every file system takes O_DIRECT
+        if (pending.fd < 0 && pending.direct) {
+            pending.direct = false;
+            pending.fd = open(pending.path.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        if (pending.fd < 0)
+            return false;
+        const size_t page = 4096;
+        pending.capacity = pending.direct ? (pending.size + page - 1) / page * page : pending.size;
+        void *buffer = nullptr;
+        if (posix_memalign(&buffer, page, std::max(pending.capacity, page)) != 0)
+            return false;
+        pending.buffer = (unsigned char *) buffer;
+        return true;
+    }
+
+    void reapLoop() {
+        for (;;) {
+            if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EAGAIN) {
+                std::cout << "ERROR::ASYNC_FILE_IO::WAIT_FAILED " << std::strerror(errno) << std::endl;
+                return;
+            }
+            bool stop = false;
+            unsigned int head = *cqHead;
+            unsigned int tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            std::vector<std::pair<Pending *, int>> results;
+            for (; head != tail; head++) {
+                const io_uring_cqe &cqe = cqes[head & *cqMask];
+                if (cqe.user_data == 0)
+                    stop = true;
+                else
+                    results.emplace_back((Pending *) (uintptr_t) cqe.user_data, cqe.res);
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+            // the ring already orders a read's setup before its completion, but out of sight of race checkers. The
+            // reads were queued under the mutex, taking it once makes that order visible to them too
+            { std::lock_guard<std::mutex> lock(mutex); }
+            for (const std::pair<Pending *, int> &result: results)
+                handle(result.first, result.second);
+            std::lock_guard<std::mutex> lock(mutex);
+            inFlight -= results.size();
+            submitQueued();
+            if (stop)
+                return;
+        }
+    }
+
+    void handle(Pending *pending, int result) {
+        // O_DIRECT can still be refused at read time, the rest is read through the page cache
+        if (result == -EINVAL && pending->direct) {
+            close(pending->fd);
+            pending->direct = false;
+            pending->fd = open(pending->path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (pending->fd >= 0) {
+                requeue(pending);
+                return;
+            }
+        }
+        if (result < 0) {
+            complete(pending, false);
+            return;
+        }
+        pending->read += result;
+        if (result == 0 || pending->read >= pending->size) {
+            complete(pending, true);
+            return;
+        }
+        // a short read, direct reads have to continue at a page boundary so those finish blocking
+        if (pending->direct && pending->read % 4096 != 0) {
+            while (pending->read < pending->size) {
+                ssize_t got = pread(pending->fd, pending->buffer + pending->read, pending->size - pending->read,
+                                    pending->read);
+                if (got <= 0)
+                    break;
+                pending->read += got;
+            }
+            complete(pending, true);
+            return;
+        }
+        requeue(pending);
+    }
+
+    void requeue(Pending *pending) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued.push_front(pending);
+    }
+
+    // hands the buffer over to the completion on the pool
+    void complete(Pending *pending, bool success) {
+        if (pending->fd >= 0)
+            close(pending->fd);
+        FileView view;
+        if (success) {
+            view.data = pending->buffer;
+            view.size = std::min(pending->read, pending->size);
+            view.backing = std::shared_ptr<void>(pending->buffer, free);
+        } else
+            free(pending->buffer);
+        std::string path = pending->path;
+        Completion done = pending->done;
+        delete pending;
+        pool.Submit([this, path, done, view] {
+            done(path, view);
+            finished();
+        });
+    }
+
+    void finished() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--outstanding == 0)
+            idle.notify_all();
+    }
+};
+
+// reads every file under a directory the blocking way the loaders used to (ifstream), through AsyncFileIo with the
+// pool fallback and through io_uring, each once after dropping the files from the page cache and once warm.
+// Runs on its own thread and pool, results go to stdout
+class IoBenchmark {
+public:
+    ~IoBenchmark() {
+        if (runner.joinable())
+            runner.join();
+    }
+
+    bool Running() const {
+        return running;
+    }
+
+    void Start(const std::string &directory) {
+        if (running)
+            return;
+        if (runner.joinable())
+            runner.join();
+        running = true;
+        runner = std::thread([this, directory] {
+            run(directory);
+            running = false;
+        });
+    }
+
+private:
+    std::thread runner;
+    std::atomic<bool> running{false};
+
+    static void listFiles(const std::string &directory, std::vector<std::string> &files) {
+        DIR *dir = opendir(directory.c_str());
+        if (!dir)
+            return;
+        while (dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name == "." || name == "..")
+                continue;
+            std::string path = directory + '/' + name;
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0)
+                continue;
+            if (S_ISDIR(info.st_mode))
+                listFiles(path, files);
+            else if (S_ISREG(info.st_mode))
+                files.push_back(path);
+        }
+        closedir(dir);
+    }
+
+    // asks the kernel to drop the files' clean pages, the closest to a cold start without root
+    static void evict(const std::vector<std::string> &files) {
+        for (const std::string &path: files) {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                continue;
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+
+    static double streams(const std::vector<std::string> &files, size_t &bytes) {
+        auto start = std::chrono::steady_clock::now();
+        for (const std::string &path: files) {
+            std::ifstream in(path, std::ios::binary);
+            std::stringstream contents;
+            contents << in.rdbuf();
+            bytes += contents.str().size();
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static double async(const std::vector<std::string> &files, ThreadPool &pool, bool useRing, size_t &bytes) {
+        std::atomic<size_t> total{0};
+        auto start = std::chrono::steady_clock::now();
+        {
+            AsyncFileIo io(pool, useRing, false);
+            for (const std::string &path: files)
+                io.Read(path, [&total](const std::string &, const FileView &file) { total += file.size; });
+            io.Wait();
+        }
+        bytes += total;
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void run(const std::string &directory) {
+        std::vector<std::string> files;
+        listFiles(directory, files);
+        ThreadPool pool;
+        bool ring = AsyncFileIo(pool).UsesIoUring();
+        std::cout << "I/O benchmark, " << files.size() << " files under " << directory << (ring ? "" : ", no io_uring")
+                  << " (method, cache, ms, MB/s)" << std::endl;
+        const char *methods[] = {"ifstream", "pool", "io_uring"};
+        for (int method = 0; method < 3; method++) {
+            if (method == 2 && !ring)
+                continue;
+            for (int warm = 0; warm < 2; warm++) {
+                if (!warm)
+                    evict(files);
+                size_t bytes = 0;
+                double milliseconds = method == 0 ? streams(files, bytes) : async(files, pool, method == 2, bytes);
+                std::cout << methods[method] << '\t' << (warm ? "warm" : "cold") << '\t' << milliseconds << '\t'
+                          << bytes / 1048576.0 / (milliseconds / 1000.0) << std::endl;
+            }
+        }
+    }
+};
+
+#endif //PROJECT_BASE_ASYNC_FILE_IO_H
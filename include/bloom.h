@@ -0,0 +1,146 @@
+//
+// Bloom for whatever outshines the threshold, in practice the emissive pyramids. The HDR colour is reduced through a
+// chain of Levels textures, each half the size of the one before, with a 13 tap filter whose first step also keeps
+// only the light above the threshold. The chain is then walked back up with a 9 tap tent filter, each level blended
+// onto the next larger one, so the half resolution level ends up holding every width of glow at once. The
+// post-processing chain adds it to the picture in one texture read (see BLOOM in post_process.fs).
+//
+
+#ifndef PROJECT_BASE_BLOOM_H
+#define PROJECT_BASE_BLOOM_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+
+class Bloom {
+public:
+    // half to 1/64 of the screen
+    static const int Levels = 6;
+
+    struct Settings {
+        // brightness where light starts to glow, the scene without the pyramids rarely goes past 1
+        float threshold = 1.0f;
+        // width of the soft transition below the threshold
+        float knee = 0.25f;
+        // how much of the glow is added to the picture
+        float strength = 0.1f;
+    };
+
+    // read by every Compute and Bind, may change between frames
+    Settings settings;
+
+    Bloom() = default;
+
+    Bloom(const Bloom &) = delete;
+    Bloom &operator=(const Bloom &) = delete;
+
+    // deletes the textures and framebuffers, call before the context goes away
+    void Release() {
+        glDeleteTextures(Levels, levels);
+        glDeleteFramebuffers(Levels, framebuffers);
+        glDeleteVertexArrays(1, &emptyVAO);
+        std::fill(levels, levels + Levels, 0u);
+        std::fill(framebuffers, framebuffers + Levels, 0u);
+        emptyVAO = 0;
+        size = glm::ivec2(0);
+    }
+
+    // blurs the light in color, a texture of width x height, into Texture(). Expects depth testing off, as the
+    // post-processing chain runs it, and leaves the default framebuffer bound with the full viewport
+    void Compute(Shader &downsampleShader, Shader &upsampleShader, GLuint color, int width, int height) {
+        if (width <= 0 || height <= 0)
+            return;
+        if (width != size.x || height != size.y)
+            resize(width, height);
+        glBindVertexArray(emptyVAO);
+        glActiveTexture(GL_TEXTURE0);
+
+        downsampleShader.use();
+        downsampleShader.setInt("source", 0);
+        downsampleShader.setFloat("threshold", settings.threshold);
+        downsampleShader.setFloat("knee", settings.knee);
+        glm::ivec2 source = size;
+        for (int level = 0; level < Levels; level++) {
+            glm::ivec2 destination = levelSize(level);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[level]);
+            glViewport(0, 0, destination.x, destination.y);
+            glBindTexture(GL_TEXTURE_2D, level == 0 ? color : levels[level - 1]);
+            downsampleShader.setBool("prefilter", level == 0);
+            downsampleShader.setVec2("texelSize", glm::vec2(1.0f) / glm::vec2(source));
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            source = destination;
+        }
+
+        // each level keeps its own light and gets the wider glow of the ones below it on top
+        upsampleShader.use();
+        upsampleShader.setInt("source", 0);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        for (int level = Levels - 1; level > 0; level--) {
+            glm::ivec2 destination = levelSize(level - 1);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[level - 1]);
+            glViewport(0, 0, destination.x, destination.y);
+            glBindTexture(GL_TEXTURE_2D, levels[level]);
+            upsampleShader.setVec2("texelSize", glm::vec2(1.0f) / glm::vec2(levelSize(level)));
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glDisable(GL_BLEND);
+
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, width, height);
+    }
+
+    // the glow on unit for a post_process.fs variant built with BLOOM defined
+    void Bind(Shader &shader, int unit) const {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, levels[0]);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("bloom", unit);
+        shader.setFloat("bloomStrength", settings.strength);
+    }
+
+    GLuint Texture() const {
+        return levels[0];
+    }
+
+private:
+    GLuint levels[Levels] = {};
+    GLuint framebuffers[Levels] = {};
+    // the full-screen triangle is made up in the vertex shader, core profiles still want a VAO bound
+    GLuint emptyVAO = 0;
+    glm::ivec2 size = glm::ivec2(0);
+
+    glm::ivec2 levelSize(int level) const {
+        return glm::max(size / (2 << level), glm::ivec2(1));
+    }
+
+    void resize(int width, int height) {
+        Release();
+        size = glm::ivec2(width, height);
+        glGenTextures(Levels, levels);
+        glGenFramebuffers(Levels, framebuffers);
+        for (int level = 0; level < Levels; level++) {
+            glm::ivec2 extent = levelSize(level);
+            glBindTexture(GL_TEXTURE_2D, levels[level]);
+            // no alpha and no sign, half the bandwidth of RGBA16F
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, extent.x, extent.y, 0, GL_RGB, GL_HALF_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[level]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, levels[level], 0);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenVertexArrays(1, &emptyVAO);
+    }
+};
+
+#endif //PROJECT_BASE_BLOOM_H
@@ -0,0 +1,133 @@
+//
+// Colour grading through a 3D lookup table. The table starts as the identity or as a LUT painted by an artist, stored
+// the usual way as a strip of N tiles of N x N (red across a tile, green down it, blue from tile to tile), and the
+// contrast, saturation and temperature settings are baked on top of it on the CPU. However many adjustments there are,
+// grading costs the post-processing chain one filtered texture read (see GRADING in post_process.fs).
+//
+
+#ifndef PROJECT_BASE_COLOR_GRADING_H
+#define PROJECT_BASE_COLOR_GRADING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <iostream>
+#include <vector>
+
+class ColorGrading {
+public:
+    // entries along each axis of the table when no LUT was given
+    static const int Size = 32;
+
+    struct Settings {
+        float contrast = 1.0f;
+        float saturation = 1.0f;
+        // below 0 cooler, above 0 warmer
+        float temperature = 0.0f;
+
+        bool operator==(const Settings &other) const {
+            return contrast == other.contrast && saturation == other.saturation && temperature == other.temperature;
+        }
+    };
+
+    // baked by the next Update, may change between frames
+    Settings settings;
+
+    ColorGrading() = default;
+
+    ColorGrading(const ColorGrading &) = delete;
+    ColorGrading &operator=(const ColorGrading &) = delete;
+
+    // deletes the table, call before the context goes away
+    void Release() {
+        glDeleteTextures(1, &table);
+        table = 0;
+    }
+
+    // an artist's LUT, decoded to rows from the top down. False when the image is not a strip of N x N tiles, the
+    // previous LUT is then kept
+    bool SetLut(const unsigned char *pixels, int width, int height, int channels) {
+        if (height < 2 || width != height * height || channels < 3) {
+            std::cout << "ERROR::COLOR_GRADING::NOT_A_LUT_STRIP " << width << "x" << height << std::endl;
+            return false;
+        }
+        lutSize = height;
+        lut.assign(pixels, pixels + (size_t) width * height * channels);
+        lutChannels = channels;
+        dirty = true;
+        return true;
+    }
+
+    // back to the identity
+    void ClearLut() {
+        lut.clear();
+        lutSize = 0;
+        dirty = true;
+    }
+
+    // rebakes the table when the settings or the LUT changed since the last call
+    void Update() {
+        if (!dirty && table != 0 && settings == baked)
+            return;
+        baked = settings;
+        dirty = false;
+        int size = lut.empty() ? Size : lutSize;
+        std::vector<unsigned char> texels((size_t) size * size * size * 4);
+        glm::vec3 warmth(1.0f + 0.1f * settings.temperature, 1.0f, 1.0f - 0.1f * settings.temperature);
+        unsigned char *texel = texels.data();
+        for (int b = 0; b < size; b++)
+            for (int g = 0; g < size; g++)
+                for (int r = 0; r < size; r++, texel += 4) {
+                    glm::vec3 color;
+                    if (lut.empty())
+                        color = glm::vec3(r, g, b) / (float) (size - 1);
+                    else {
+                        const unsigned char *source = &lut[((size_t) g * size * size + b * size + r) * lutChannels];
+                        color = glm::vec3(source[0], source[1], source[2]) / 255.0f;
+                    }
+                    color = (color - 0.5f) * settings.contrast + 0.5f;
+                    float luma = glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+                    color = glm::mix(glm::vec3(luma), color, settings.saturation) * warmth;
+                    color = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+                    texel[0] = (unsigned char) color.r;
+                    texel[1] = (unsigned char) color.g;
+                    texel[2] = (unsigned char) color.b;
+                    texel[3] = 255;
+                }
+
+        if (table == 0)
+            glGenTextures(1, &table);
+        glBindTexture(GL_TEXTURE_3D, table);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, size, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+
+    // the table on unit for a post_process.fs variant built with GRADING defined
+    void Bind(Shader &shader, int unit) const {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_3D, table);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("gradingLut", unit);
+    }
+
+    bool HasLut() const {
+        return !lut.empty();
+    }
+
+private:
+    GLuint table = 0;
+    std::vector<unsigned char> lut;
+    int lutSize = 0;
+    int lutChannels = 0;
+    Settings baked;
+    bool dirty = true;
+};
+
+#endif //PROJECT_BASE_COLOR_GRADING_H
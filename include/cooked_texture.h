@@ -0,0 +1,418 @@
+//
+// Textures as asset_cooker writes them: <path>.ctex next to the source, or <directory>/cubemap.ctex for the six faces
+// of a skybox. Every mip level is built ahead of time and, unless cooked uncompressed, block compressed as BC1 (opaque)
+// or BC3 (with alpha), so loading is one read and one upload per level instead of a JPEG/PNG decode followed by
+// glGenerateMipmap. The levels lie back to back in the file and reach the driver in one buffer upload. The encoder uses
+// integer math only, the same pixels always cook to the same bytes.
+//
+
+#ifndef PROJECT_BASE_COOKED_TEXTURE_H
+#define PROJECT_BASE_COOKED_TEXTURE_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/filesystem.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// S3TC is an extension, not part of the generated loader
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+namespace CookedTexture {
+
+const uint32_t Version = 1;
+// the order of the faces in a cooked cubemap, and the file names asset_cooker looks for
+const char *const CubeFaces[6] = {"right", "left", "top", "bottom", "front", "back"};
+
+enum Format : uint32_t {
+    RGBA8 = 0,
+    // 4x4 blocks of 8 bytes, colour only
+    BC1 = 1,
+    // 4x4 blocks of 16 bytes, alpha then colour
+    BC3 = 2
+};
+
+// one mip level of one face, pointing into the file it was parsed from
+struct Level {
+    int width;
+    int height;
+    const unsigned char *data;
+    size_t size;
+};
+
+struct Image {
+    Format format = RGBA8;
+    int faces = 0;
+    int levels = 0;
+    // every level of face 0, then every level of face 1, ...
+    std::vector<Level> mips;
+    // keeps the bytes of the levels alive
+    FileView file;
+};
+
+struct Header {
+    char magic[4] = {'P', 'B', 'T', 'X'};
+    uint32_t version = Version;
+    uint32_t format = RGBA8;
+    uint32_t faces = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t levels = 0;
+    uint32_t reserved = 0;
+};
+
+inline size_t LevelSize(Format format, int width, int height) {
+    size_t blocks = (size_t) ((width + 3) / 4) * ((height + 3) / 4);
+    if (format == BC1)
+        return blocks * 8;
+    if (format == BC3)
+        return blocks * 16;
+    return (size_t) width * height * 4;
+}
+
+inline int LevelCount(int width, int height) {
+    int levels = 1;
+    while ((width >> levels) > 0 || (height >> levels) > 0)
+        levels++;
+    return levels;
+}
+
+// 5:6:5 of an 8 bit colour, rounded, and back the way the hardware expands it
+inline uint16_t pack565(int r, int g, int b) {
+    return (uint16_t) (((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | (b * 31 + 127) / 255);
+}
+
+inline void unpack565(uint16_t color, int rgb[3]) {
+    int r = color >> 11 & 31, g = color >> 5 & 63, b = color & 31;
+    rgb[0] = r << 3 | r >> 2;
+    rgb[1] = g << 2 | g >> 4;
+    rgb[2] = b << 3 | b >> 2;
+}
+
+// 16 RGBA texels to 8 bytes. The endpoints are the corners of the block's bounding box, inset a little and laid along
+// the diagonal the colours follow, then every texel takes the closest of the four palette colours
+inline void compressColorBlock(const unsigned char block[64], unsigned char out[8]) {
+    int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0}, sum[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 3; c++) {
+            lo[c] = std::min(lo[c], (int) block[i * 4 + c]);
+            hi[c] = std::max(hi[c], (int) block[i * 4 + c]);
+            sum[c] += block[i * 4 + c];
+        }
+    // red and blue running against green put the endpoints on the other diagonal
+    long long redGreen = 0, blueGreen = 0;
+    for (int i = 0; i < 16; i++) {
+        long long green = block[i * 4 + 1] * 16 - sum[1];
+        redGreen += (block[i * 4] * 16 - sum[0]) * green;
+        blueGreen += (block[i * 4 + 2] * 16 - sum[2]) * green;
+    }
+    if (redGreen < 0)
+        std::swap(lo[0], hi[0]);
+    if (blueGreen < 0)
+        std::swap(lo[2], hi[2]);
+    for (int c = 0; c < 3; c++) {
+        int inset = (hi[c] - lo[c]) / 16;
+        hi[c] -= inset;
+        lo[c] += inset;
+    }
+    uint16_t c0 = pack565(hi[0], hi[1], hi[2]), c1 = pack565(lo[0], lo[1], lo[2]);
+    // c0 > c1 selects the four colour mode
+    if (c0 < c1)
+        std::swap(c0, c1);
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        int palette[4][3];
+        unpack565(c0, palette[0]);
+        unpack565(c1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; i++) {
+            int best = 0, bestDistance = 1 << 30;
+            for (int p = 0; p < 4; p++) {
+                int distance = 0;
+                for (int c = 0; c < 3; c++) {
+                    int d = block[i * 4 + c] - palette[p][c];
+                    distance += d * d;
+                }
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= (uint32_t) best << (2 * i);
+        }
+    }
+    out[0] = c0 & 0xff;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xff;
+    out[3] = c1 >> 8;
+    for (int b = 0; b < 4; b++)
+        out[4 + b] = (indices >> (8 * b)) & 0xff;
+}
+
+// the alpha of 16 RGBA texels to 8 bytes: the block's extremes and six steps between them
+inline void compressAlphaBlock(const unsigned char block[64], unsigned char out[8]) {
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++) {
+        lo = std::min(lo, (int) block[i * 4 + 3]);
+        hi = std::max(hi, (int) block[i * 4 + 3]);
+    }
+    uint64_t indices = 0;
+    if (hi != lo) {
+        int palette[8] = {hi, lo};
+        for (int k = 1; k < 7; k++)
+            palette[k + 1] = ((7 - k) * hi + k * lo) / 7;
+        for (int i = 0; i < 16; i++) {
+            int best = 0;
+            for (int p = 1; p < 8; p++)
+                if (std::abs(block[i * 4 + 3] - palette[p]) < std::abs(block[i * 4 + 3] - palette[best]))
+                    best = p;
+            indices |= (uint64_t) best << (3 * i);
+        }
+    }
+    out[0] = (unsigned char) hi;
+    out[1] = (unsigned char) lo;
+    for (int b = 0; b < 6; b++)
+        out[2 + b] = (indices >> (8 * b)) & 0xff;
+}
+
+// an RGBA8 level in format, texels past the right and bottom edge repeat the last row and column
+inline void Compress(Format format, const unsigned char *rgba, int width, int height, std::vector<unsigned char> &out) {
+    if (format == RGBA8) {
+        out.assign(rgba, rgba + (size_t) width * height * 4);
+        return;
+    }
+    size_t blockBytes = format == BC1 ? 8 : 16;
+    int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+    out.resize((size_t) blocksWide * blocksHigh * blockBytes);
+    unsigned char block[64];
+    for (int by = 0; by < blocksHigh; by++)
+        for (int bx = 0; bx < blocksWide; bx++) {
+            for (int i = 0; i < 16; i++) {
+                int x = std::min(bx * 4 + i % 4, width - 1), y = std::min(by * 4 + i / 4, height - 1);
+                std::memcpy(block + i * 4, rgba + ((size_t) y * width + x) * 4, 4);
+            }
+            unsigned char *target = &out[((size_t) by * blocksWide + bx) * blockBytes];
+            if (format == BC3) {
+                compressAlphaBlock(block, target);
+                target += 8;
+            }
+            compressColorBlock(block, target);
+        }
+}
+
+// the next smaller mip of an RGBA8 level by 2x2 box filtering, an odd last row or column is dropped
+inline void halve(const std::vector<unsigned char> &src, int width, int height, std::vector<unsigned char> &dst) {
+    int w = std::max(1, width / 2), h = std::max(1, height / 2);
+    dst.resize((size_t) w * h * 4);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+            int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            for (int c = 0; c < 4; c++)
+                dst[((size_t) y * w + x) * 4 + c] = (unsigned char) ((src[((size_t) y0 * width + x0) * 4 + c] +
+                                                                       src[((size_t) y0 * width + x1) * 4 + c] +
+                                                                       src[((size_t) y1 * width + x0) * 4 + c] +
+                                                                       src[((size_t) y1 * width + x1) * 4 + c] + 2) / 4);
+        }
+}
+
+// cooks 1 face, or the 6 of a cubemap in CubeFaces order, each RGBA8 of width x height, into path with every mip
+// level in format
+inline bool Write(const std::string &path, Format format, int width, int height,
+                  const std::vector<const unsigned char *> &faces) {
+    Header header;
+    header.format = format;
+    header.faces = faces.size();
+    header.width = width;
+    header.height = height;
+    header.levels = LevelCount(width, height);
+
+    std::vector<std::vector<unsigned char>> payload;
+    for (const unsigned char *face: faces) {
+        std::vector<unsigned char> level(face, face + (size_t) width * height * 4), smaller;
+        for (uint32_t i = 0; i < header.levels; i++) {
+            int w = std::max(1, width >> i), h = std::max(1, height >> i);
+            payload.emplace_back();
+            Compress(format, level.data(), w, h, payload.back());
+            if (i + 1 < header.levels) {
+                halve(level, w, h, smaller);
+                level.swap(smaller);
+            }
+        }
+    }
+
+    // written under a temporary name first, a crash mid write must not leave a truncated texture behind
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << "ERROR::COOKED_TEXTURE::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        out.write((const char *) &header, sizeof(Header));
+        uint64_t offset = sizeof(Header) + payload.size() * 2 * sizeof(uint64_t);
+        for (const std::vector<unsigned char> &level: payload) {
+            uint64_t entry[2] = {offset, level.size()};
+            out.write((const char *) entry, sizeof(entry));
+            offset += level.size();
+        }
+        for (const std::vector<unsigned char> &level: payload)
+            out.write((const char *) level.data(), level.size());
+        if (!out) {
+            std::cout << "ERROR::COOKED_TEXTURE::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+// checks a cooked file and points image's levels into it, false when it is damaged
+inline bool Parse(const FileView &file, Image &image) {
+    Header header;
+    if (!file || file.size < sizeof(Header))
+        return false;
+    std::memcpy(&header, file.data, sizeof(Header));
+    if (std::memcmp(header.magic, "PBTX", 4) != 0 || header.version != Version || header.format > BC3 ||
+        (header.faces != 1 && header.faces != 6) || header.width == 0 || header.height == 0 ||
+        header.width > 16384 || header.height > 16384 ||
+        header.levels != (uint32_t) LevelCount(header.width, header.height))
+        return false;
+    size_t count = (size_t) header.faces * header.levels;
+    if (count * 2 * sizeof(uint64_t) > file.size - sizeof(Header))
+        return false;
+    image.format = (Format) header.format;
+    image.faces = header.faces;
+    image.levels = header.levels;
+    image.mips.clear();
+    for (size_t i = 0; i < count; i++) {
+        uint64_t entry[2];
+        std::memcpy(entry, file.data + sizeof(Header) + i * sizeof(entry), sizeof(entry));
+        Level level;
+        level.width = std::max(1, (int) header.width >> (i % header.levels));
+        level.height = std::max(1, (int) header.height >> (i % header.levels));
+        level.size = LevelSize(image.format, level.width, level.height);
+        if (entry[1] != level.size || entry[0] > file.size || entry[1] > file.size - entry[0])
+            return false;
+        level.data = file.data + entry[0];
+        image.mips.push_back(level);
+    }
+    image.file = file;
+    return true;
+}
+
+// whether the driver takes S3TC. Asks GL, so the first call has to come from a thread with a context
+inline bool Supported() {
+    static int supported = -1;
+    if (supported < 0) {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+        std::vector<GLint> formats(std::max(count, 0));
+        if (count > 0)
+            glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
+        supported = std::count(formats.begin(), formats.end(), GL_COMPRESSED_RGB_S3TC_DXT1_EXT) > 0 &&
+                    std::count(formats.begin(), formats.end(), GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) > 0;
+    }
+    return supported > 0;
+}
+
+// whether cooked exists and the driver can take its format: RGBA8 always, BC1 and BC3 only with S3TC. Only the
+// header is read, Parse checks the rest
+inline bool Usable(const std::string &cooked) {
+    FileView file = FileSystem::open(cooked);
+    Header header;
+    if (file.size < sizeof(Header))
+        return false;
+    std::memcpy(&header, file.data, sizeof(Header));
+    return header.format == RGBA8 || Supported();
+}
+
+// <path>.ctex when it exists, the driver can take it and path was not edited after it was cooked, otherwise empty
+inline std::string Find(const std::string &path) {
+    std::string cooked = path + ".ctex";
+    if (VirtualFileSystem::EditedAfter(path, cooked) || !Usable(cooked))
+        return std::string();
+    return cooked;
+}
+
+// the cooked cubemap of faces, given in CubeFaces order, the same way
+inline std::string FindCubemap(const std::vector<std::string> &faces) {
+    if (faces.size() != 6)
+        return std::string();
+    std::string cooked = faces[0].substr(0, faces[0].find_last_of('/') + 1) + "cubemap.ctex";
+    for (const std::string &face: faces)
+        if (VirtualFileSystem::EditedAfter(face, cooked))
+            return std::string();
+    return Usable(cooked) ? cooked : std::string();
+}
+
+// the bytes of every level, from the first level's start to the last one's end
+inline size_t PayloadSize(const Image &image) {
+    const unsigned char *begin = image.mips.front().data, *end = begin;
+    for (const Level &level: image.mips) {
+        begin = std::min(begin, level.data);
+        end = std::max(end, level.data + level.size);
+    }
+    return end - begin;
+}
+
+// every level of image into textureID, a new texture when 0, as a 2D texture or a cubemap. Returns the texture
+inline unsigned int Upload(const Image &image, unsigned int textureID = 0) {
+    GLenum target = image.faces == 6 ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    GLenum internalFormat = image.format == BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    if (textureID == 0)
+        glGenTextures(1, &textureID);
+    glBindTexture(target, textureID);
+    // the whole payload goes into one pixel unpack buffer, every level is then specified from an offset into it and
+    // the driver copies on the GPU instead of taking the file piece by piece
+    const unsigned char *payload = image.mips.front().data;
+    for (const Level &level: image.mips)
+        payload = std::min(payload, level.data);
+    unsigned int buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, PayloadSize(image), payload, GL_STREAM_DRAW);
+    for (int face = 0; face < image.faces; face++)
+        for (int i = 0; i < image.levels; i++) {
+            const Level &level = image.mips[face * image.levels + i];
+            GLenum levelTarget = image.faces == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+            const void *offset = (const void *) (level.data - payload);
+            if (image.format == RGBA8)
+                glTexImage2D(levelTarget, i, GL_RGBA, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                             offset);
+            else
+                glCompressedTexImage2D(levelTarget, i, internalFormat, level.width, level.height, 0,
+                                       (GLsizei) level.size, offset);
+        }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, image.levels - 1);
+    GLint wrap = target == GL_TEXTURE_CUBE_MAP ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, wrap);
+    if (target == GL_TEXTURE_CUBE_MAP)
+        glTexParameteri(target, GL_TEXTURE_WRAP_R, wrap);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return textureID;
+}
+
+}
+
+#endif //PROJECT_BASE_COOKED_TEXTURE_H
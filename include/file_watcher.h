@@ -0,0 +1,119 @@
+//
+// Watches files for changes with inotify on a background thread. Directories are watched rather than the files
+// themselves, editors often save by writing a new file and renaming it over the old one. A file is reported once
+// it has been quiet for a short while, so the several events of one save collapse into one change.
+//
+
+#ifndef PROJECT_BASE_FILE_WATCHER_H
+#define PROJECT_BASE_FILE_WATCHER_H
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FileWatcher {
+public:
+    FileWatcher() {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) {
+            std::cout << "ERROR::FILE_WATCHER::INOTIFY_UNAVAILABLE" << std::endl;
+            return;
+        }
+        thread = std::thread([this] { watchLoop(); });
+    }
+
+    ~FileWatcher() {
+        stopping = true;
+        if (thread.joinable())
+            thread.join();
+        if (fd >= 0)
+            close(fd);
+    }
+
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    // reports changes to path from now on, paths come back exactly as given here
+    void Watch(const std::string &path) {
+        if (fd < 0)
+            return;
+        size_t slash = path.find_last_of('/');
+        std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+        std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (wd < 0) {
+            std::cout << "ERROR::FILE_WATCHER::CANNOT_WATCH " << directory << std::endl;
+            return;
+        }
+        // inotify hands the same descriptor back for a directory that is already watched
+        watched[wd][name] = path;
+    }
+
+    // files that changed and have settled since the last call
+    std::vector<std::string> Poll() {
+        // a save is often several events in a row, wait until they stop
+        const std::chrono::milliseconds settleTime(50);
+        std::vector<std::string> settled;
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto change = changed.begin(); change != changed.end();) {
+            if (now - change->second < settleTime) {
+                ++change;
+                continue;
+            }
+            settled.push_back(change->first);
+            change = changed.erase(change);
+        }
+        return settled;
+    }
+
+private:
+    int fd = -1;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+    std::mutex mutex;
+    // watch descriptor -> file name inside the directory -> path as registered
+    std::map<int, std::map<std::string, std::string>> watched;
+    // path -> time of its latest event
+    std::map<std::string, std::chrono::steady_clock::time_point> changed;
+
+    void watchLoop() {
+        alignas(inotify_event) char buffer[4096];
+        pollfd descriptor{fd, POLLIN, 0};
+        while (!stopping) {
+            // the timeout bounds how long the destructor waits for the thread
+            if (poll(&descriptor, 1, 100) <= 0)
+                continue;
+            ssize_t length;
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+                auto now = std::chrono::steady_clock::now();
+                std::lock_guard<std::mutex> lock(mutex);
+                for (char *at = buffer; at < buffer + length;) {
+                    const inotify_event *event = (const inotify_event *) at;
+                    at += sizeof(inotify_event) + event->len;
+                    if (event->len == 0)
+                        continue;
+                    auto directory = watched.find(event->wd);
+                    if (directory == watched.end())
+                        continue;
+                    auto file = directory->second.find(event->name);
+                    if (file != directory->second.end())
+                        changed[file->second] = now;
+                }
+            }
+        }
+    }
+};
+
+#endif //PROJECT_BASE_FILE_WATCHER_H
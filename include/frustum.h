@@ -0,0 +1,58 @@
+//
+// View frustum planes extracted from a projection * view matrix, with bounding volume tests.
+//
+
+#ifndef PROJECT_BASE_FRUSTUM_H
+#define PROJECT_BASE_FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+struct Frustum {
+    // left, right, bottom, top, near, far; xyz is the inward normal, w the distance
+    glm::vec4 planes[6];
+
+    Frustum() = default;
+
+    explicit Frustum(const glm::mat4 &viewProjection) {
+        const glm::mat4 &m = viewProjection;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                planes[i * 2][j] = m[j][3] + m[j][i];
+                planes[i * 2 + 1][j] = m[j][3] - m[j][i];
+            }
+        }
+        for (glm::vec4 &plane: planes)
+            plane /= glm::length(glm::vec3(plane.x, plane.y, plane.z));
+    }
+
+    // true when the axis aligned box is at least partially inside
+    bool IntersectsBox(const glm::vec3 &min, const glm::vec3 &max) const {
+        for (const glm::vec4 &plane: planes) {
+            glm::vec3 positive(plane.x > 0.0f ? max.x : min.x,
+                               plane.y > 0.0f ? max.y : min.y,
+                               plane.z > 0.0f ? max.z : min.z);
+            if (glm::dot(glm::vec3(plane.x, plane.y, plane.z), positive) + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    bool IntersectsSphere(const glm::vec3 &center, float radius) const {
+        for (const glm::vec4 &plane: planes) {
+            if (glm::dot(glm::vec3(plane.x, plane.y, plane.z), center) + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    // sphere given in model space, xyz center and w radius, under a transform that may scale
+    bool IntersectsSphere(const glm::mat4 &transform, const glm::vec4 &sphere) const {
+        float scale = glm::max(glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+                               glm::max(glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])),
+                                        glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]))));
+        glm::vec3 center = glm::vec3(transform * glm::vec4(glm::vec3(sphere), 1.0f));
+        return IntersectsSphere(center, sphere.w * glm::sqrt(scale));
+    }
+};
+
+#endif //PROJECT_BASE_FRUSTUM_H
@@ -0,0 +1,61 @@
+//
+// GL_TIME_ELAPSED based GPU timer. Queries are kept in a small ring and read back a few frames late, so reading
+// a timing never stalls the pipeline.
+//
+
+#ifndef PROJECT_BASE_GPU_TIMER_H
+#define PROJECT_BASE_GPU_TIMER_H
+
+#include <glad/glad.h>
+
+class GpuTimer {
+public:
+    GpuTimer() {
+        glGenQueries(Latency, queries);
+    }
+
+    // deletes the queries, call before the context goes away
+    void Release() {
+        glDeleteQueries(Latency, queries);
+    }
+
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    // only one GL_TIME_ELAPSED query may be active at a time, timers do not nest
+    void Begin() {
+        glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+    }
+
+    void End() {
+        glEndQuery(GL_TIME_ELAPSED);
+        issued[current] = true;
+        current = (current + 1) % Latency;
+
+        // the slot we will overwrite next is the oldest one, collect it if the GPU is done with it
+        if (issued[current]) {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[current], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(queries[current], GL_QUERY_RESULT, &nanoseconds);
+                milliseconds = (float) ((double) nanoseconds / 1.0e6);
+            }
+            issued[current] = false;
+        }
+    }
+
+    // most recent completed measurement
+    float Milliseconds() const {
+        return milliseconds;
+    }
+
+private:
+    static const int Latency = 4;
+    GLuint queries[Latency];
+    bool issued[Latency] = {false, false, false, false};
+    int current = 0;
+    float milliseconds = 0.0f;
+};
+
+#endif //PROJECT_BASE_GPU_TIMER_H
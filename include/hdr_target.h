@@ -0,0 +1,89 @@
+//
+// The scene's render target: floating point colour so lights can go past 1 until the post-processing chain maps them
+// to the screen, and a depth texture the SSAO and Hi-Z passes copy from like they would from the default framebuffer.
+//
+
+#ifndef PROJECT_BASE_HDR_TARGET_H
+#define PROJECT_BASE_HDR_TARGET_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+class HdrTarget {
+public:
+    HdrTarget() = default;
+
+    HdrTarget(const HdrTarget &) = delete;
+    HdrTarget &operator=(const HdrTarget &) = delete;
+
+    // deletes the textures and the framebuffer, call before the context goes away
+    void Release() {
+        glDeleteTextures(1, &color);
+        glDeleteTextures(1, &depth);
+        glDeleteFramebuffers(1, &framebuffer);
+        color = depth = framebuffer = 0;
+        size = glm::ivec2(0);
+    }
+
+    // binds the target for drawing with a viewport covering it, resized to the window's framebuffer first
+    void Bind(int width, int height) {
+        width = std::max(width, 1);
+        height = std::max(height, 1);
+        if (width != size.x || height != size.y)
+            resize(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, width, height);
+    }
+
+    GLuint Framebuffer() const {
+        return framebuffer;
+    }
+
+    GLuint Color() const {
+        return color;
+    }
+
+    glm::ivec2 Size() const {
+        return size;
+    }
+
+private:
+    GLuint color = 0;
+    GLuint depth = 0;
+    GLuint framebuffer = 0;
+    glm::ivec2 size = glm::ivec2(0);
+
+    void resize(int width, int height) {
+        Release();
+        size = glm::ivec2(width, height);
+
+        // half floats keep the range of the emissive pyramids, alpha stays for the blended passes
+        glGenTextures(1, &color);
+        glBindTexture(GL_TEXTURE_2D, color);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        // the same format as the SSAO and Hi-Z copies, so copying it converts nothing
+        glGenTextures(1, &depth);
+        glBindTexture(GL_TEXTURE_2D, depth);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::HDR_TARGET::FRAMEBUFFER_INCOMPLETE" << std::endl;
+    }
+};
+
+#endif //PROJECT_BASE_HDR_TARGET_H
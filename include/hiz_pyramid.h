@@ -0,0 +1,124 @@
+//
+// Hierarchical depth pyramid (GL 4.3). The finished frame's depth buffer is copied and reduced with a compute shader,
+// every texel holding the farthest depth below it, so next frame's culling can reject objects hidden behind it.
+//
+
+#ifndef PROJECT_BASE_HIZ_PYRAMID_H
+#define PROJECT_BASE_HIZ_PYRAMID_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+
+class HiZPyramid {
+public:
+    HiZPyramid() = default;
+
+    HiZPyramid(const HiZPyramid &) = delete;
+    HiZPyramid &operator=(const HiZPyramid &) = delete;
+
+    // deletes the textures, call before the context goes away
+    void Release() {
+        glDeleteTextures(1, &depthTexture);
+        glDeleteTextures(1, &pyramid);
+        depthTexture = pyramid = 0;
+        valid = false;
+    }
+
+    // copies the depth of framebuffer, the finished frame, and builds the pyramid from it. viewProjection is the
+    // matrix the frame was rendered with, culling reprojects into it.
+    void Capture(Shader &buildShader, GLuint framebuffer, int width, int height, const glm::mat4 &viewProjection) {
+        if (width <= 0 || height <= 0)
+            return;
+        if (width != size.x || height != size.y)
+            resize(width, height);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+        buildShader.use();
+        buildShader.setInt("depthTexture", 0);
+        glm::ivec2 source = size;
+        for (int level = 0; level < levels; level++) {
+            glm::ivec2 destination = level == 0 ? size : glm::max(source / 2, glm::ivec2(1));
+            buildShader.setBool("fromDepth", level == 0);
+            if (level > 0)
+                glBindImageTexture(0, pyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+            glBindImageTexture(1, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glUniform2i(glGetUniformLocation(buildShader.ID, "sourceSize"), source.x, source.y);
+            glUniform2i(glGetUniformLocation(buildShader.ID, "destinationSize"), destination.x, destination.y);
+            glDispatchCompute((destination.x + 7) / 8, (destination.y + 7) / 8, 1);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            source = destination;
+        }
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        capturedViewProjection = viewProjection;
+        valid = true;
+    }
+
+    // dropped after a resize or when culling was off, a stale pyramid would hide visible objects
+    void Invalidate() {
+        valid = false;
+    }
+
+    bool Valid() const {
+        return valid;
+    }
+
+    GLuint Texture() const {
+        return pyramid;
+    }
+
+    int Levels() const {
+        return levels;
+    }
+
+    glm::ivec2 Size() const {
+        return size;
+    }
+
+    const glm::mat4 &ViewProjection() const {
+        return capturedViewProjection;
+    }
+
+private:
+    GLuint depthTexture = 0;
+    GLuint pyramid = 0;
+    glm::ivec2 size = glm::ivec2(0);
+    int levels = 0;
+    glm::mat4 capturedViewProjection = glm::mat4(1.0f);
+    bool valid = false;
+
+    void resize(int width, int height) {
+        Release();
+        size = glm::ivec2(width, height);
+        levels = 1;
+        while ((std::max(width, height) >> levels) > 0)
+            levels++;
+
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        // every level allocated up front, each one is bound as an image while reducing
+        glGenTextures(1, &pyramid);
+        glBindTexture(GL_TEXTURE_2D, pyramid);
+        glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
+
+#endif //PROJECT_BASE_HIZ_PYRAMID_H
@@ -0,0 +1,159 @@
+//
+// Reloads shaders, textures and models while the program runs. The FileWatcher notices edits on its thread, Update
+// then runs the reloads on the render thread between frames, so a frame never sees half of a change. Only what
+// depends on a changed file is rebuilt, and a shader that fails to compile keeps its old program.
+//
+
+#ifndef PROJECT_BASE_HOT_RELOAD_H
+#define PROJECT_BASE_HOT_RELOAD_H
+
+#include <learnopengl/model.h>
+#include <learnopengl/shader.h>
+
+#include <asset_streamer.h>
+#include <file_watcher.h>
+#include <shader_permutations.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class HotReload {
+public:
+    // reload gets the changed file and reports whether it succeeded. It runs once per Update even when several
+    // of its files changed together.
+    void Watch(const std::vector<std::string> &files, std::function<bool(const std::string &)> reload) {
+        unsigned int handler = handlers.size();
+        handlers.push_back(reload);
+        for (const std::string &file: files) {
+            watcher.Watch(file);
+            handlersByFile[file].push_back(handler);
+        }
+    }
+
+    // the objects must outlive the HotReload. Files an edit #includes are watched from its reload on
+    void Watch(Shader &shader) {
+        unsigned int handler = handlers.size();
+        const std::set<std::string> &files = shader.sourceFiles();
+        Watch(std::vector<std::string>(files.begin(), files.end()), [this, &shader, handler](const std::string &) {
+            if (!shader.reload())
+                return false;
+            watchMore(handler, shader.sourceFiles());
+            return true;
+        });
+    }
+
+    // only the variants compiled so far are reloaded, later ones read the new files anyway
+    void Watch(ShaderPermutations &permutations) {
+        unsigned int handler = handlers.size();
+        std::set<std::string> files = permutations.SourceFiles();
+        Watch(std::vector<std::string>(files.begin(), files.end()),
+              [this, &permutations, handler](const std::string &) {
+            if (!permutations.Reload())
+                return false;
+            watchMore(handler, permutations.SourceFiles());
+            return true;
+        });
+    }
+
+    // a changed model file re-imports the model, a changed texture only decodes that texture again. reloaded runs
+    // after a successful re-import, for whatever was derived from the old meshes
+    void Watch(Model &model, std::function<void()> reloaded = std::function<void()>()) {
+        Watch({model.SourceFile()}, [&model, reloaded](const std::string &) {
+            if (!model.Reload())
+                return false;
+            if (reloaded)
+                reloaded();
+            return true;
+        });
+        watchTextures(model);
+    }
+
+    // like Watch(model), but the re-import runs on the streamer's loader thread. The old meshes are drawn until the
+    // new ones are resident, a failed import never replaces them
+    void Watch(Model &model, AssetStreamer &streamer, std::function<void()> reloaded = std::function<void()>()) {
+        Watch({model.SourceFile()}, [&model, &streamer, reloaded](const std::string &file) {
+            streamer.LoadModel(file, model.UsesTextureArrays(), [&model, &streamer, reloaded](AssetStreamer::ModelAsset &asset) {
+                // a refinement still streaming into the old meshes would land in the wrong model
+                streamer.StopRefining(model);
+                model.Adopt(*asset.model);
+                asset.model->Release();
+                asset.model.reset();
+                if (reloaded)
+                    reloaded();
+            });
+            return true;
+        });
+        watchTextures(model);
+    }
+
+    // runs the reloads for every file that changed and settled since the last call, call between frames
+    void Update() {
+        std::vector<std::string> changed = watcher.Poll();
+        if (changed.empty())
+            return;
+        auto start = std::chrono::steady_clock::now();
+        std::set<unsigned int> done;
+        for (const std::string &file: changed) {
+            // a copy, shader reloads may add files to watch
+            std::vector<unsigned int> fileHandlers = handlersByFile[file];
+            for (unsigned int handler: fileHandlers) {
+                if (!done.insert(handler).second)
+                    continue;
+                if (!handlers[handler](file))
+                    failures++;
+                reloads++;
+                lastFile = file;
+            }
+        }
+        lastMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    unsigned int Reloads() const {
+        return reloads;
+    }
+
+    unsigned int Failures() const {
+        return failures;
+    }
+
+    const std::string &LastFile() const {
+        return lastFile;
+    }
+
+    // how long the reloads of the last Update that had any took
+    float LastMilliseconds() const {
+        return lastMilliseconds;
+    }
+
+private:
+    FileWatcher watcher;
+    std::vector<std::function<bool(const std::string &)>> handlers;
+    std::map<std::string, std::vector<unsigned int>> handlersByFile;
+    unsigned int reloads = 0;
+    unsigned int failures = 0;
+    std::string lastFile;
+    float lastMilliseconds = 0.0f;
+
+    // adds the files handler is not run for yet
+    void watchMore(unsigned int handler, const std::set<std::string> &files) {
+        for (const std::string &file: files) {
+            std::vector<unsigned int> &fileHandlers = handlersByFile[file];
+            if (std::find(fileHandlers.begin(), fileHandlers.end(), handler) != fileHandlers.end())
+                continue;
+            watcher.Watch(file);
+            fileHandlers.push_back(handler);
+        }
+    }
+
+    void watchTextures(Model &model) {
+        for (const std::string &texture: model.TextureFiles())
+            Watch({texture}, [&model](const std::string &file) { return model.ReloadTexture(file); });
+    }
+};
+
+#endif //PROJECT_BASE_HOT_RELOAD_H
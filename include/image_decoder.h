@@ -0,0 +1,383 @@
+//
+// Image decoding behind one interface, the backend is picked by the file's signature. JPEG goes through
+// libjpeg-turbo (SIMD IDCT, upsampling and colour conversion), or a plain libjpeg for all but RGBA output, and PNG
+// through libpng's simplified API (SIMD filters where the library was built with them), each compiled in when CMake
+// finds the library (PROJECT_BASE_HAS_JPEG, PROJECT_BASE_HAS_PNG). stb_image decodes everything else, and whatever a
+// backend refuses. Decoders write into memory the caller provides, e.g. a mapped pixel unpack buffer, and flip rows
+// while writing them instead of afterwards.
+//
+
+#ifndef PROJECT_BASE_IMAGE_DECODER_H
+#define PROJECT_BASE_IMAGE_DECODER_H
+
+#include <asset_pack.h>
+
+#include <stb_image.h>
+
+#ifdef PROJECT_BASE_HAS_JPEG
+#include <cstdio>
+#include <csetjmp>
+#include <jpeglib.h>
+#endif
+#ifdef PROJECT_BASE_HAS_PNG
+#include <png.h>
+#endif
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ImageInfo {
+    int width = 0;
+    int height = 0;
+    // as stored in the file
+    int channels = 0;
+};
+
+class ImageDecoder {
+public:
+    virtual ~ImageDecoder() = default;
+
+    virtual const char *Name() const = 0;
+
+    // whether the bytes carry this decoder's signature
+    virtual bool Accepts(const FileView &file) const = 0;
+
+    virtual bool Info(const FileView &file, ImageInfo &info) const = 0;
+
+    // width * height * components bytes into out, rows bottom up when flip is set. components is 1 to 4. false when
+    // the file cannot be decoded, out is then undefined
+    virtual bool Decode(const FileView &file, int components, bool flip, unsigned char *out) const = 0;
+};
+
+// the fallback, takes everything stb_image knows. stb decodes into a buffer of its own, so this one costs a copy
+class StbDecoder : public ImageDecoder {
+public:
+    const char *Name() const override {
+        return "stb_image";
+    }
+
+    bool Accepts(const FileView &file) const override {
+        return (bool) file;
+    }
+
+    bool Info(const FileView &file, ImageInfo &info) const override {
+        return file && stbi_info_from_memory(file.data, (int) file.size, &info.width, &info.height, &info.channels);
+    }
+
+    bool Decode(const FileView &file, int components, bool flip, unsigned char *out) const override {
+        int width, height, channels;
+        unsigned char *data = stbi_load_from_memory(file.data, (int) file.size, &width, &height, &channels,
+                                                    components);
+        if (!data)
+            return false;
+        size_t row = (size_t) width * components;
+        for (int y = 0; y < height; y++)
+            std::memcpy(out + (flip ? height - 1 - y : y) * row, data + y * row, row);
+        stbi_image_free(data);
+        return true;
+    }
+};
+
+#ifdef PROJECT_BASE_HAS_JPEG
+class JpegDecoder : public ImageDecoder {
+public:
+    const char *Name() const override {
+        return "libjpeg-turbo";
+    }
+
+    bool Accepts(const FileView &file) const override {
+        return file.size >= 3 && file.data[0] == 0xff && file.data[1] == 0xd8 && file.data[2] == 0xff;
+    }
+
+    bool Info(const FileView &file, ImageInfo &info) const override {
+        Session session;
+        if (!session.Start(file))
+            return false;
+        info.width = session.cinfo.image_width;
+        info.height = session.cinfo.image_height;
+        info.channels = session.cinfo.num_components;
+        return true;
+    }
+
+    bool Decode(const FileView &file, int components, bool flip, unsigned char *out) const override {
+        Session session;
+        if (!session.Start(file))
+            return false;
+        jpeg_decompress_struct &cinfo = session.cinfo;
+        // grey with alpha and CMYK are left to stb
+        if (components == 2 || (cinfo.jpeg_color_space != JCS_GRAYSCALE && cinfo.jpeg_color_space != JCS_YCbCr &&
+                                cinfo.jpeg_color_space != JCS_RGB))
+            return false;
+#ifdef JCS_EXTENSIONS
+        cinfo.out_color_space = components == 1 ? JCS_GRAYSCALE : components == 3 ? JCS_RGB : JCS_EXT_RGBA;
+#else
+        // a plain libjpeg has no RGBA output, stb adds the alpha
+        if (components == 4)
+            return false;
+        cinfo.out_color_space = components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+#endif
+        if (setjmp(session.error.jump))
+            return false;
+        jpeg_start_decompress(&cinfo);
+        size_t row = (size_t) cinfo.output_width * components;
+        while (cinfo.output_scanline < cinfo.output_height) {
+            unsigned int y = cinfo.output_scanline;
+            JSAMPROW target = out + (flip ? cinfo.output_height - 1 - y : y) * row;
+            jpeg_read_scanlines(&cinfo, &target, 1);
+        }
+        jpeg_finish_decompress(&cinfo);
+        return true;
+    }
+
+private:
+    // libjpeg reports errors by calling error_exit, which would end the process. It jumps back here instead
+    struct Error {
+        jpeg_error_mgr manager;
+        jmp_buf jump;
+    };
+
+    struct Session {
+        jpeg_decompress_struct cinfo;
+        Error error;
+        bool created = false;
+
+        ~Session() {
+            if (created)
+                jpeg_destroy_decompress(&cinfo);
+        }
+
+        bool Start(const FileView &file) {
+            if (!file)
+                return false;
+            cinfo.err = jpeg_std_error(&error.manager);
+            error.manager.error_exit = [](j_common_ptr common) { longjmp(((Error *) common->err)->jump, 1); };
+            // warnings about slightly damaged files go nowhere, stb does not print them either
+            error.manager.output_message = [](j_common_ptr) {};
+            if (setjmp(error.jump))
+                return false;
+            jpeg_create_decompress(&cinfo);
+            created = true;
+            jpeg_mem_src(&cinfo, file.data, file.size);
+            jpeg_read_header(&cinfo, TRUE);
+            return true;
+        }
+    };
+};
+#endif
+
+#ifdef PROJECT_BASE_HAS_PNG
+class PngDecoder : public ImageDecoder {
+public:
+    const char *Name() const override {
+        return "libpng";
+    }
+
+    bool Accepts(const FileView &file) const override {
+        static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        return file.size >= 8 && std::memcmp(file.data, signature, 8) == 0;
+    }
+
+    bool Info(const FileView &file, ImageInfo &info) const override {
+        png_image image;
+        if (!begin(file, image))
+            return false;
+        info.width = image.width;
+        info.height = image.height;
+        info.channels = PNG_IMAGE_SAMPLE_CHANNELS(image.format);
+        png_image_free(&image);
+        return true;
+    }
+
+    bool Decode(const FileView &file, int components, bool flip, unsigned char *out) const override {
+        png_image image;
+        if (!begin(file, image))
+            return false;
+        // libpng would treat 16 bit samples as linear and gamma encode them, composite instead of dropping alpha and
+        // weigh colours differently when making grey. stb does it its way, so those files go to it and look the same
+        // whichever backend is compiled in
+        bool alphaDropped = (image.format & PNG_FORMAT_FLAG_ALPHA) && components % 2 == 1;
+        bool colourDropped = (image.format & PNG_FORMAT_FLAG_COLOR) && components < 3;
+        if ((image.format & PNG_FORMAT_FLAG_LINEAR) || alphaDropped || colourDropped) {
+            png_image_free(&image);
+            return false;
+        }
+        const png_uint_32 formats[4] = {PNG_FORMAT_GRAY, PNG_FORMAT_GA, PNG_FORMAT_RGB, PNG_FORMAT_RGBA};
+        image.format = formats[components - 1];
+        // a negative stride writes the rows bottom up
+        png_int_32 stride = (png_int_32) image.width * components;
+        bool decoded = png_image_finish_read(&image, nullptr, out, flip ? -stride : stride, nullptr) != 0;
+        png_image_free(&image);
+        return decoded;
+    }
+
+private:
+    static bool begin(const FileView &file, png_image &image) {
+        std::memset(&image, 0, sizeof(image));
+        image.version = PNG_IMAGE_VERSION;
+        return file && png_image_begin_read_from_memory(&image, file.data, file.size) != 0;
+    }
+};
+#endif
+
+namespace ImageDecoders {
+
+// every backend, the fallback last
+inline const std::vector<const ImageDecoder *> &All() {
+    static const std::vector<const ImageDecoder *> decoders = [] {
+        std::vector<const ImageDecoder *> list;
+#ifdef PROJECT_BASE_HAS_JPEG
+        static JpegDecoder jpeg;
+        list.push_back(&jpeg);
+#endif
+#ifdef PROJECT_BASE_HAS_PNG
+        static PngDecoder png;
+        list.push_back(&png);
+#endif
+        static StbDecoder stb;
+        list.push_back(&stb);
+        return list;
+    }();
+    return decoders;
+}
+
+inline const ImageDecoder &Fallback() {
+    return *All().back();
+}
+
+inline const ImageDecoder &For(const FileView &file) {
+    for (const ImageDecoder *decoder: All())
+        if (decoder->Accepts(file))
+            return *decoder;
+    return Fallback();
+}
+
+inline std::atomic<bool> &flipVertically() {
+    static std::atomic<bool> flip{false};
+    return flip;
+}
+
+// whether images are decoded bottom up by default, as GL expects them. Set once at startup
+inline void SetFlipVertically(bool flip) {
+    flipVertically() = flip;
+}
+
+inline bool FlipVertically() {
+    return flipVertically();
+}
+
+inline bool Info(const FileView &file, ImageInfo &info) {
+    return For(file).Info(file, info) || Fallback().Info(file, info);
+}
+
+// into out, which holds info.width * info.height * components bytes for the info Info gave. Safe on any thread
+inline bool Decode(const FileView &file, int components, bool flip, unsigned char *out) {
+    const ImageDecoder &decoder = For(file);
+    return decoder.Decode(file, components, flip, out) ||
+           (&decoder != &Fallback() && Fallback().Decode(file, components, flip, out));
+}
+
+}
+
+// decodes every JPEG and PNG under a directory with every backend that takes it, results to stdout. Runs on its own
+// thread like IoBenchmark
+class ImageDecodeBenchmark {
+public:
+    ~ImageDecodeBenchmark() {
+        if (runner.joinable())
+            runner.join();
+    }
+
+    bool Running() const {
+        return running;
+    }
+
+    void Start(const std::string &directory) {
+        if (running)
+            return;
+        if (runner.joinable())
+            runner.join();
+        running = true;
+        runner = std::thread([this, directory] {
+            run(directory);
+            running = false;
+        });
+    }
+
+private:
+    std::thread runner;
+    std::atomic<bool> running{false};
+
+    static void listImages(const std::string &directory, std::vector<std::string> &files) {
+        DIR *dir = opendir(directory.c_str());
+        if (!dir)
+            return;
+        while (dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name == "." || name == "..")
+                continue;
+            std::string path = directory + '/' + name;
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0)
+                continue;
+            if (S_ISDIR(info.st_mode))
+                listImages(path, files);
+            else if (name.size() > 4 && (name.compare(name.size() - 4, 4, ".jpg") == 0 ||
+                                         name.compare(name.size() - 4, 4, ".png") == 0))
+                files.push_back(path);
+        }
+        closedir(dir);
+        std::sort(files.begin(), files.end());
+    }
+
+    static void run(const std::string &directory) {
+        std::vector<std::string> files;
+        listImages(directory, files);
+        std::cout << "Decode benchmark, " << files.size() << " images under " << directory
+                  << " (file, decoder, ms, MB/s of pixels)" << std::endl;
+        const int repeats = 3;
+        for (const std::string &path: files) {
+            std::shared_ptr<MappedFile> mapped = MappedFile::Open(path);
+            if (!mapped)
+                continue;
+            FileView file;
+            file.data = mapped->Data();
+            file.size = mapped->Size();
+            file.backing = mapped;
+            ImageInfo info;
+            if (!ImageDecoders::Info(file, info))
+                continue;
+            std::vector<unsigned char> pixels((size_t) info.width * info.height * 4);
+            for (const ImageDecoder *decoder: ImageDecoders::All()) {
+                if (!decoder->Accepts(file))
+                    continue;
+                // the fastest of a few runs, the first one also pays for page faults in the output
+                double best = 1e30;
+                bool decoded = true;
+                for (int i = 0; i < repeats && decoded; i++) {
+                    auto start = std::chrono::steady_clock::now();
+                    decoded = decoder->Decode(file, 4, true, pixels.data());
+                    best = std::min(best, std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count());
+                }
+                if (!decoded) {
+                    std::cout << path << '\t' << decoder->Name() << "\tfailed" << std::endl;
+                    continue;
+                }
+                std::cout << path.substr(directory.size() + 1) << '\t' << decoder->Name() << '\t' << best << '\t'
+                          << pixels.size() / 1048576.0 / (best / 1000.0) << std::endl;
+            }
+        }
+    }
+};
+
+#endif //PROJECT_BASE_IMAGE_DECODER_H
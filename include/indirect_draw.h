@@ -0,0 +1,328 @@
+//
+// Multi-draw indirect submission for pooled meshes (GL 4.3). Every visible mesh becomes one command in an indirect
+// buffer and one entry in a per-draw storage buffer, the whole list goes out with a single glMultiDrawElementsIndirect.
+// Visibility is decided either on the CPU per mesh or meshlet, or by a compute shader testing the frustum, the
+// meshlets' normal cones and a Hi-Z pyramid.
+//
+
+#ifndef PROJECT_BASE_INDIRECT_DRAW_H
+#define PROJECT_BASE_INDIRECT_DRAW_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/model.h>
+#include <learnopengl/shader.h>
+
+#include <frustum.h>
+#include <hiz_pyramid.h>
+#include <meshlet.h>
+
+#include <algorithm>
+#include <vector>
+
+// layout fixed by GL
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// std430 layout of DrawParams in model_shader_indirect.vs and gpu_cull.cs
+struct IndirectDrawParams {
+    glm::mat4 model;
+    glm::ivec4 textureLayers;
+};
+
+// std430 layout of CullObject in gpu_cull.cs, a whole mesh or one of its meshlets
+struct IndirectCullObject {
+    glm::vec4 bounds;
+    glm::vec4 cone;
+    GLuint count;
+    GLuint firstIndex;
+    GLint baseVertex;
+    // entry in the per-draw parameters, shared by all meshlets of a mesh
+    GLuint draw;
+};
+
+class IndirectDrawList {
+public:
+    // the instanced draw id attribute, shader location 5
+    static const GLuint DrawIDLocation = 5;
+    // storage buffer bindings shared with the shaders
+    static const GLuint ParamsBinding = 0;
+    static const GLuint ObjectsBinding = 1;
+    static const GLuint CommandsBinding = 2;
+    static const GLuint CounterBinding = 3;
+
+    // gl_DrawID needs GL 4.6 or ARB_shader_draw_parameters, so the draw index travels through baseInstance and
+    // an instanced attribute instead, which 4.3 core covers
+    static bool Supported() {
+        return GLAD_GL_VERSION_4_3 != 0;
+    }
+
+    IndirectDrawList() {
+        glGenBuffers(1, &commandBuffer);
+        glGenBuffers(1, &paramsBuffer);
+        glGenBuffers(1, &drawIDBuffer);
+        glGenBuffers(1, &objectBuffer);
+        glGenBuffers(1, &counterBuffer);
+        glGenBuffers(CounterLatency, counterReadback);
+
+        GLuint zero = 0;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, counterBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_COPY);
+        for (GLuint readback: counterReadback) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, readback);
+            glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint), &zero, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    IndirectDrawList(const IndirectDrawList &) = delete;
+    IndirectDrawList &operator=(const IndirectDrawList &) = delete;
+
+    // deletes the buffers, call before the context goes away
+    void Release() {
+        glDeleteBuffers(1, &commandBuffer);
+        glDeleteBuffers(1, &paramsBuffer);
+        glDeleteBuffers(1, &drawIDBuffer);
+        glDeleteBuffers(1, &objectBuffer);
+        glDeleteBuffers(1, &counterBuffer);
+        glDeleteBuffers(CounterLatency, counterReadback);
+    }
+
+    // queues every mesh of the model whose bounding sphere touches the frustum. The model must be loaded with
+    // texture arrays, per mesh textures cannot change inside one multi-draw.
+    void AddModel(const Model &model, const glm::mat4 &transform, const Frustum &frustum) {
+        for (const Mesh &mesh: model.meshes) {
+            if (!frustum.IntersectsSphere(transform, mesh.bounds))
+                continue;
+
+            DrawElementsIndirectCommand command;
+            command.count = mesh.range.indexCount;
+            command.instanceCount = 1;
+            command.firstIndex = mesh.range.firstIndex;
+            command.baseVertex = mesh.range.baseVertex;
+            command.baseInstance = params.size();
+            commands.push_back(command);
+            params.push_back(IndirectDrawParams{transform, mesh.layers});
+            visibleObjects++;
+        }
+        queuedObjects += model.meshes.size();
+    }
+
+    // queues the visible meshlets of every mesh whose bounding sphere passes culling, neighbouring meshlets are merged
+    // into one command
+    void AddModel(const Model &model, const glm::mat4 &transform, MeshletCulling &culling) {
+        unsigned int total = culling.total, visible = culling.visible;
+        for (const Mesh &mesh: model.meshes) {
+            if (!culling.frustum.IntersectsSphere(glm::vec3(mesh.bounds), mesh.bounds.w)) {
+                culling.total += mesh.meshlets.size();
+                continue;
+            }
+            if (!mesh.CullMeshlets(culling))
+                continue;
+
+            for (size_t i = 0; i < culling.counts.size(); i++) {
+                DrawElementsIndirectCommand command;
+                command.count = culling.counts[i];
+                command.instanceCount = 1;
+                command.firstIndex = (GLuint) ((size_t) culling.offsets[i] / sizeof(GLuint));
+                command.baseVertex = mesh.range.baseVertex;
+                command.baseInstance = params.size();
+                commands.push_back(command);
+            }
+            params.push_back(IndirectDrawParams{transform, mesh.layers});
+        }
+        queuedObjects += culling.total - total;
+        visibleObjects += culling.visible - visible;
+    }
+
+    // queues every mesh of the model without testing it, CullOnGpu decides what gets drawn. With meshlets set the
+    // clustered meshes are tested meshlet by meshlet.
+    void AddModel(const Model &model, const glm::mat4 &transform, bool meshlets) {
+        for (const Mesh &mesh: model.meshes) {
+            if (mesh.range.indexCount == 0)
+                continue;
+            GLuint draw = params.size();
+            params.push_back(IndirectDrawParams{transform, mesh.layers});
+            if (!meshlets || mesh.meshlets.empty()) {
+                objects.push_back(IndirectCullObject{mesh.bounds, glm::vec4(0.0f, 0.0f, 0.0f, 2.0f), mesh.range.indexCount,
+                                                     mesh.range.firstIndex, mesh.range.baseVertex, draw});
+                continue;
+            }
+            for (const Meshlet &meshlet: mesh.meshlets)
+                objects.push_back(IndirectCullObject{meshlet.sphere, meshlet.cone, meshlet.indexCount,
+                                                     mesh.range.firstIndex + meshlet.firstIndex, mesh.range.baseVertex, draw});
+        }
+    }
+
+    // tests the objects queued with AddModel(model, transform, meshlets) in a compute shader and writes the compacted
+    // draw commands on the GPU. Occlusion is only tested when the pyramid holds a previous frame, with coneCulling set
+    // meshlets facing away from cameraPosition are dropped too.
+    void CullOnGpu(Shader &cullShader, const Frustum &frustum, const HiZPyramid &hiZ, const glm::vec3 &cameraPosition,
+                   bool coneCulling) {
+        gpuDrawCount = objects.size();
+        if (objects.empty())
+            return;
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, paramsBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, params.size() * sizeof(IndirectDrawParams), params.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, objects.size() * sizeof(IndirectCullObject), objects.data(), GL_STREAM_DRAW);
+        // zeroed commands draw nothing, so the tail past the visible count needs no CPU side draw count
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, objects.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ParamsBinding, paramsBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ObjectsBinding, objectBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CommandsBinding, commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CounterBinding, counterBuffer);
+
+        cullShader.use();
+        glUniform1ui(glGetUniformLocation(cullShader.ID, "objectCount"), objects.size());
+        glUniform4fv(glGetUniformLocation(cullShader.ID, "frustumPlanes"), 6, &frustum.planes[0][0]);
+        cullShader.setBool("useConeCulling", coneCulling);
+        cullShader.setVec3("cameraPosition", cameraPosition);
+        cullShader.setBool("useOcclusion", hiZ.Valid());
+        if (hiZ.Valid()) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, hiZ.Texture());
+            cullShader.setInt("hiZ", 0);
+            glUniform2i(glGetUniformLocation(cullShader.ID, "hiZSize"), hiZ.Size().x, hiZ.Size().y);
+            cullShader.setInt("hiZLevels", hiZ.Levels());
+            cullShader.setMat4("hiZViewProjection", hiZ.ViewProjection());
+        }
+        glDispatchCompute((objects.size() + 63) / 64, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // the visible count is only for statistics, read it a few frames late instead of stalling on it
+        glBindBuffer(GL_COPY_READ_BUFFER, counterBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, counterReadback[counterFrame]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(GLuint));
+        counterFrame = (counterFrame + 1) % CounterLatency;
+        GLuint visible = 0;
+        glBindBuffer(GL_COPY_READ_BUFFER, counterReadback[counterFrame]);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(GLuint), &visible);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        gpuVisible = std::min<unsigned int>(visible, objects.size());
+
+        objects.clear();
+        params.clear();
+    }
+
+    // submits everything queued since the last call with one draw call. All queued models must live in pool.
+    void Draw(MeshPool &pool) {
+        if (gpuDrawCount > 0) {
+            drawnLastFrame = gpuVisible;
+            culledLastFrame = gpuDrawCount - gpuVisible;
+        } else {
+            drawnLastFrame = visibleObjects;
+            culledLastFrame = queuedObjects - visibleObjects;
+        }
+        queuedObjects = visibleObjects = 0;
+        lastDrawCount = std::max<unsigned int>(commands.size(), gpuDrawCount);
+        if (commands.empty() && gpuDrawCount == 0)
+            return;
+
+        glBindVertexArray(pool.VAO);
+        attachDrawIDs(pool, std::max<unsigned int>(commands.size(), gpuDrawCount));
+
+        if (gpuDrawCount > 0) {
+            // commands and parameters were written by CullOnGpu
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ParamsBinding, paramsBuffer);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, gpuDrawCount, 0);
+        } else {
+            // orphan and refill, the previous frame's contents may still be in flight
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, paramsBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, params.size() * sizeof(IndirectDrawParams), params.data(), GL_STREAM_DRAW);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ParamsBinding, paramsBuffer);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, commands.size(), 0);
+        }
+        gpuDrawCount = 0;
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindVertexArray(0);
+        commands.clear();
+        params.clear();
+    }
+
+    // issues the last Draw again from the buffers it left filled, for a second pass over the same meshes with
+    // another shader, e.g. lighting after a depth prepass
+    void Redraw(MeshPool &pool) {
+        if (lastDrawCount == 0)
+            return;
+        glBindVertexArray(pool.VAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ParamsBinding, paramsBuffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, lastDrawCount, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+    unsigned int DrawnLastFrame() const {
+        return drawnLastFrame;
+    }
+
+    unsigned int CulledLastFrame() const {
+        return culledLastFrame;
+    }
+
+private:
+    static const int CounterLatency = 3;
+
+    GLuint commandBuffer, paramsBuffer, drawIDBuffer;
+    GLuint objectBuffer, counterBuffer;
+    GLuint counterReadback[CounterLatency];
+    int counterFrame = 0;
+    unsigned int drawIDCapacity = 0;
+    GLuint attachedVAO = 0;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<IndirectDrawParams> params;
+    std::vector<IndirectCullObject> objects;
+    unsigned int gpuDrawCount = 0;
+    unsigned int gpuVisible = 0;
+    // meshes or meshlets tested on the CPU and those that passed
+    unsigned int queuedObjects = 0;
+    unsigned int visibleObjects = 0;
+    unsigned int drawnLastFrame = 0;
+    unsigned int culledLastFrame = 0;
+    // commands the last Draw issued, what Redraw repeats
+    unsigned int lastDrawCount = 0;
+
+    // instanced attribute holding 0..n-1, with baseInstance = i every draw reads its own index
+    void attachDrawIDs(MeshPool &pool, unsigned int count) {
+        if (count > drawIDCapacity) {
+            drawIDCapacity = std::max<unsigned int>(count, drawIDCapacity * 2);
+            std::vector<GLuint> ids(drawIDCapacity);
+            for (unsigned int i = 0; i < drawIDCapacity; i++)
+                ids[i] = i;
+            glBindBuffer(GL_ARRAY_BUFFER, drawIDBuffer);
+            glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(GLuint), ids.data(), GL_STATIC_DRAW);
+        }
+        // the VAO refers to the buffer by name, reallocating its storage does not need a new pointer
+        if (attachedVAO != pool.VAO) {
+            glBindBuffer(GL_ARRAY_BUFFER, drawIDBuffer);
+            glEnableVertexAttribArray(DrawIDLocation);
+            glVertexAttribIPointer(DrawIDLocation, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void *) 0);
+            glVertexAttribDivisor(DrawIDLocation, 1);
+            attachedVAO = pool.VAO;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
+
+#endif //PROJECT_BASE_INDIRECT_DRAW_H
@@ -5,6 +5,8 @@
 #include <cstdlib>
 #include "root_directory.h" // This is a configuration file generated by CMake.
 
+#include <virtual_file_system.h>
+
 class FileSystem
 {
 private:
@@ -17,6 +19,25 @@ public:
     return (*pathBuilder)(path);
   }
 
+  // mounts an asset pack, files in it are then served from memory. Call before any loader thread starts
+  static bool mount(const std::string& packPath)
+  {
+    return files().Mount(packPath);
+  }
+
+  // every asset read goes through here, packed or loose. Loose files override packed ones unless
+  // LOGL_PACKED_ONLY is set, which saves a failed open per packed file
+  static FileView open(const std::string& path)
+  {
+    return files().Open(path);
+  }
+
+  static VirtualFileSystem& files()
+  {
+    static VirtualFileSystem vfs(getRoot(), getenv("LOGL_PACKED_ONLY") == nullptr);
+    return vfs;
+  }
+
 private:
   static std::string const & getRoot()
   {
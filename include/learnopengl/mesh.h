@@ -8,6 +8,9 @@
 
 #include <learnopengl/shader.h>
 
+#include <meshlet.h>
+
+#include <algorithm>
 #include <string>
 #include <vector>
 using namespace std;
@@ -23,6 +26,12 @@ struct Vertex {
     glm::vec3 Tangent;
     // bitangent
     glm::vec3 Bitangent;
+    // ambient occlusion baked at import (vertex_occlusion.h), 255 where nothing is near. Padded to keep the vertex
+    // four byte aligned
+    unsigned char Occlusion = 255;
+    unsigned char Padding[3] = {};
+    // place in the model's lightmap (lightmap.h), 0 to 65535 across the atlas
+    unsigned short LightmapCoords[2] = {};
 };
 
 
@@ -31,6 +40,174 @@ struct Texture {
     unsigned int id;
     string type;
     string path;
+    // layer inside a GL_TEXTURE_2D_ARRAY when the model packs its textures, -1 for a plain 2D texture
+    int layer = -1;
+};
+
+// one vertex buffer, one index buffer and one VAO shared by many meshes, possibly from several models.
+// meshes keep their own indices and are drawn with glDrawElementsBaseVertex at their offsets.
+class MeshPool {
+public:
+    // where a mesh landed inside the pool
+    struct Range {
+        GLint baseVertex;
+        unsigned int firstIndex;
+        unsigned int indexCount;
+    };
+
+    unsigned int VAO;
+
+    // without vertexArray only the buffers are created, e.g. on a loader thread's context: vertex arrays are not
+    // shared between contexts, AttachVertexArray then creates it on the context that draws
+    explicit MeshPool(bool vertexArray = true)
+    {
+        VAO = 0;
+        if(vertexArray)
+            glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+    }
+
+    MeshPool(const MeshPool &) = delete;
+    MeshPool &operator=(const MeshPool &) = delete;
+
+    // queues the geometry, it reaches the GPU with the next Upload
+    Range Add(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+    {
+        Range range;
+        range.baseVertex = (GLint) (vertexCount + pendingVertices.size());
+        range.firstIndex = indexCount + pendingIndices.size();
+        range.indexCount = indices.size();
+        pendingVertices.insert(pendingVertices.end(), vertices.begin(), vertices.end());
+        pendingIndices.insert(pendingIndices.end(), indices.begin(), indices.end());
+        return range;
+    }
+
+    // makes room for that much more geometry in one step. Once reserved, Upload never replaces the buffers while
+    // what was reserved is being filled, so another context may append to them while this one draws
+    void Reserve(size_t vertices, size_t indices)
+    {
+        bool grown = grow(VBO, vertexCapacity, vertexCount, pendingVertices.size() + vertices, sizeof(Vertex));
+        grown |= grow(EBO, indexCapacity, indexCount, pendingIndices.size() + indices, sizeof(unsigned int));
+        if(grown && VAO)
+            pointVertexArray();
+    }
+
+    // true when that much geometry can still be added without growing the buffers
+    bool Fits(size_t vertices, size_t indices) const
+    {
+        return vertexCount + pendingVertices.size() + vertices <= vertexCapacity &&
+               indexCount + pendingIndices.size() + indices <= indexCapacity;
+    }
+
+    // appends everything added since the last call, growing the buffers on the GPU when they are full
+    void Upload()
+    {
+        if(pendingIndices.empty() && pendingVertices.empty())
+            return;
+
+        bool grown = grow(VBO, vertexCapacity, vertexCount, pendingVertices.size(), sizeof(Vertex));
+        grown |= grow(EBO, indexCapacity, indexCount, pendingIndices.size(), sizeof(unsigned int));
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, vertexCount * sizeof(Vertex), pendingVertices.size() * sizeof(Vertex), pendingVertices.data());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, indexCount * sizeof(unsigned int), pendingIndices.size() * sizeof(unsigned int), pendingIndices.data());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        vertexCount += pendingVertices.size();
+        indexCount += pendingIndices.size();
+        vector<Vertex>().swap(pendingVertices);
+        vector<unsigned int>().swap(pendingIndices);
+
+        // the VAO captured the old buffer names, point it at the new ones
+        if(grown && VAO)
+            pointVertexArray();
+    }
+
+    void AttachVertexArray()
+    {
+        glGenVertexArrays(1, &VAO);
+        pointVertexArray();
+    }
+
+    // deletes the GL objects, call before the context goes away
+    void Release()
+    {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+    }
+
+    unsigned int VertexCount() const { return vertexCount; }
+    unsigned int IndexCount() const { return indexCount; }
+
+    // attribute layout of Vertex, expects the VAO and GL_ARRAY_BUFFER to be bound
+    static void SetVertexAttributes()
+    {
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        // vertex tangent
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        // vertex bitangent
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        // baked occlusion, normalized to [0, 1]. Location 5 is the indirect draw id
+        glEnableVertexAttribArray(6);
+        glVertexAttribPointer(6, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex, Occlusion));
+        // lightmap coords, normalized to [0, 1]
+        glEnableVertexAttribArray(7);
+        glVertexAttribPointer(7, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex, LightmapCoords));
+    }
+
+private:
+    unsigned int VBO, EBO;
+    unsigned int vertexCount = 0, indexCount = 0;
+    unsigned int vertexCapacity = 0, indexCapacity = 0;
+    vector<Vertex> pendingVertices;
+    vector<unsigned int> pendingIndices;
+
+    void pointVertexArray()
+    {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        SetVertexAttributes();
+        glBindVertexArray(0);
+    }
+
+    // makes room for count + extra elements, copying the existing contents on the GPU. true if the buffer was replaced
+    static bool grow(unsigned int &buffer, unsigned int &capacity, unsigned int count, size_t extra, size_t elementSize)
+    {
+        if(count + extra <= capacity)
+            return false;
+
+        // the first upload is sized exactly, later ones double so repeated model loads stay amortized
+        unsigned int newCapacity = capacity == 0 ? count + extra : std::max<size_t>(capacity * 2, count + extra);
+        unsigned int newBuffer;
+        glGenBuffers(1, &newBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, newCapacity * elementSize, nullptr, GL_STATIC_DRAW);
+        if(count > 0)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, count * elementSize);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        buffer = newBuffer;
+        capacity = newCapacity;
+        return true;
+    }
 };
 
 class Mesh {
@@ -42,20 +219,59 @@ public:
 
     unsigned int VAO;
     std::string glslIdentifierPrefix;
+    // set when the geometry lives in a shared pool instead of the mesh's own buffers
+    MeshPool *pool = nullptr;
+    MeshPool::Range range = {0, 0, 0};
+    // bounding sphere in model space, xyz center and w radius
+    glm::vec4 bounds;
+    // first diffuse, specular, normal and height layer inside the model's texture arrays, -1 where there is none
+    glm::ivec4 layers;
+    // clusters of the index buffer, each a contiguous range of indices; empty when the mesh was not clustered
+    vector<Meshlet> meshlets;
+    MeshletCullData meshletBounds;
+    // 0 for the full geometry, higher for a simplified stand-in that Refine replaces later
+    int lod = 0;
     // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, MeshPool *pool = nullptr,
+         vector<Meshlet> meshlets = vector<Meshlet>())
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->pool = pool;
+        this->meshlets = meshlets;
+        meshletBounds.Build(meshlets);
+        computeBounds();
+        computeLayers();
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
     }
 
-    // render the mesh
-    void Draw(Shader &shader)
+    // swaps in the full geometry for a pooled stand-in, already uploaded to the pool at range
+    void Refine(vector<Vertex> vertices, vector<unsigned int> indices, vector<Meshlet> meshlets, MeshPool::Range range)
+    {
+        this->vertices.swap(vertices);
+        this->indices.swap(indices);
+        this->meshlets.swap(meshlets);
+        this->range = range;
+        meshletBounds.Build(this->meshlets);
+        computeBounds();
+        lod = 0;
+    }
+
+    void SetTextures(vector<Texture> textures)
+    {
+        this->textures.swap(textures);
+        computeLayers();
+    }
+
+    // render the mesh, with culling set only the meshlets that pass it
+    void Draw(Shader &shader, MeshletCulling *culling = nullptr)
     {
+        if(culling && !CullMeshlets(*culling))
+            return;
+
         // bind appropriate textures
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
@@ -85,21 +301,112 @@ public:
 
 
         // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        drawElements(culling);
 
         // always good practice to set everything back to defaults once configured.
         glActiveTexture(GL_TEXTURE0);
     }
 
+    // render the mesh with its textures packed into arrays that the model has already bound,
+    // only the layer indices change between meshes
+    void DrawLayered(Shader &shader, MeshletCulling *culling = nullptr)
+    {
+        if(culling && !CullMeshlets(*culling))
+            return;
+        glUniform4i(glGetUniformLocation(shader.ID, "textureLayers"), layers.x, layers.y, layers.z, layers.w);
+        drawElements(culling);
+    }
+
+    // leaves the index ranges of the visible meshlets in culling.counts and culling.offsets, relative to the buffer
+    // the mesh is drawn from. false when nothing is left to draw.
+    bool CullMeshlets(MeshletCulling &culling) const
+    {
+        culling.counts.clear();
+        culling.offsets.clear();
+        if(meshlets.empty())
+        {
+            // not clustered, the whole mesh is one range
+            culling.counts.push_back(indices.size());
+            culling.offsets.push_back((void*)((pool ? range.firstIndex : 0) * sizeof(unsigned int)));
+            return !indices.empty();
+        }
+        culling.total += meshlets.size();
+        culling.visible += Meshlets::Cull(meshletBounds, meshlets, culling.frustum.planes, culling.camera, culling.cone,
+                                          pool ? range.firstIndex : 0, culling.counts, culling.offsets);
+        return !culling.counts.empty();
+    }
+
 private:
     // render data
     unsigned int VBO, EBO;
 
+    void computeBounds()
+    {
+        if(vertices.empty())
+        {
+            bounds = glm::vec4(0.0f);
+            return;
+        }
+        glm::vec3 min = vertices[0].Position, max = vertices[0].Position;
+        for(const Vertex &vertex: vertices)
+        {
+            min = glm::min(min, vertex.Position);
+            max = glm::max(max, vertex.Position);
+        }
+        glm::vec3 center = (min + max) * 0.5f;
+        float radius = 0.0f;
+        for(const Vertex &vertex: vertices)
+            radius = std::max(radius, glm::length(vertex.Position - center));
+        bounds = glm::vec4(center, radius);
+    }
+
+    void computeLayers()
+    {
+        layers = glm::ivec4(-1);
+        const char *types[4] = {"texture_diffuse", "texture_specular", "texture_normal", "texture_height"};
+        for(const Texture &texture: textures)
+            for(int i = 0; i < 4; i++)
+                if(texture.type == types[i] && texture.layer >= 0 && layers[i] < 0)
+                    layers[i] = texture.layer;
+    }
+
+    // pooled meshes expect the pool's VAO to be bound already (Model::Draw binds it once for all of its meshes)
+    void drawElements(MeshletCulling *culling)
+    {
+        if(culling)
+        {
+            // the ranges CullMeshlets left behind
+            culling->baseVertices.assign(culling->counts.size(), pool ? range.baseVertex : 0);
+            if(!pool)
+                glBindVertexArray(VAO);
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, culling->counts.data(), GL_UNSIGNED_INT, culling->offsets.data(),
+                                          culling->counts.size(), culling->baseVertices.data());
+            if(!pool)
+                glBindVertexArray(0);
+            return;
+        }
+        if(pool)
+        {
+            glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT,
+                                     (void*)(range.firstIndex * sizeof(unsigned int)), range.baseVertex);
+            return;
+        }
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+    }
+
     // initializes all the buffer objects/arrays
     void setupMesh()
     {
+        if(pool)
+        {
+            VAO = pool->VAO;
+            VBO = EBO = 0;
+            range = pool->Add(vertices, indices);
+            return;
+        }
+
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
@@ -117,21 +424,7 @@ private:
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
         // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        MeshPool::SetVertexAttributes();
 
         glBindVertexArray(0);
     }
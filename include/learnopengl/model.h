@@ -5,23 +5,71 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include <stb_image.h>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <learnopengl/filesystem.h>
 #include <learnopengl/mesh.h>
 #include <learnopengl/shader.h>
 
+#include <assimp_file_system.h>
+#include <frustum.h>
+#include <image_decoder.h>
+#include <lightmap.h>
+#include <mesh_cache.h>
+#include <mesh_lod.h>
+#include <meshlet.h>
+#include <vertex_occlusion.h>
+
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 #include <map>
+#include <memory>
 #include <vector>
 using namespace std;
 
+// one decoded image, owned so it can be handed from a worker thread to the render thread
+struct DecodedImage {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    vector<unsigned char> pixels;
+};
+
+// everything a Model is built from, read and decoded without touching GL so it can be filled on worker threads
+struct ModelData {
+    string path;
+    string directory;
+    bool textureArrays = false;
+    vector<MeshData> meshes;
+    // every texture file once, with its decoded image and, when packed, the array size it is resampled to
+    vector<Texture> textures;
+    vector<DecodedImage> images;
+    vector<pair<int, int>> packedSizes;
+    // set by ImportCoarse: meshes are simplified stand-ins and images are thumbnails, the full meshes are at
+    // fullOffsets in <path>.meshcache
+    bool coarse = false;
+    vector<uint64_t> fullOffsets;
+    uint64_t fullVertices = 0;
+    uint64_t fullIndices = 0;
+    // whether the vertices carry LightmapCoords, false with Lightmap off or when no layout fit the atlas
+    bool lightmapLayout = false;
+};
+
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+bool TextureIntoObject(unsigned int textureID, const string &filename);
+bool DecodeImage(const string &filename, DecodedImage &image, int components = 0,
+                 bool flip = ImageDecoders::FlipVertically());
+bool DecodeImage(const FileView &file, DecodedImage &image, int components = 0,
+                 bool flip = ImageDecoders::FlipVertically());
+bool DecodeIntoTexture(GLenum target, const vector<FileView> &files, int components,
+                       bool flip = ImageDecoders::FlipVertically());
+void TextureFromImage(unsigned int textureID, const DecodedImage &image);
+void MipmapTexture2D();
 
 
 
@@ -33,47 +81,581 @@ public:
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
+    // one GL_TEXTURE_2D_ARRAY per texture type, only filled when the model packs its textures
+    vector<Texture> texture_arrays;
+    // vertex and index storage of all meshes, owned by the model unless one was passed in to share between models
+    MeshPool *pool;
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // with textureArrays set, every texture of a type is packed into one array and meshes sharing a material are merged,
+    // so the whole model draws with a single set of texture bindings.
+    // the imported geometry, split into meshlets and with lightmap coords and baked occlusion when Lightmap and
+    // VertexOcclusion are enabled, is cached in <path>.meshcache for the next start
+    Model(string const &path, bool gamma = false, bool textureArrays = false, MeshPool *sharedPool = nullptr)
+        : Model(Load(path, textureArrays), gamma, sharedPool)
+    {
+    }
+
+    // constructor for a model read and decoded elsewhere (Import and DecodeTexture), only creates the GL objects.
+    // without vertexArray the model can be built on a loader context, see AttachVertexArray
+    explicit Model(ModelData &&data, bool gamma = false, MeshPool *sharedPool = nullptr, bool vertexArray = true)
+        : directory(data.directory), gammaCorrection(gamma), textureArrays(data.textureArrays),
+          lightmapLayout(data.lightmapLayout), sourcePath(data.path)
+    {
+        if(!sharedPool)
+            ownedPool.reset(new MeshPool(vertexArray));
+        pool = sharedPool ? sharedPool : ownedPool.get();
+        // room for the full meshes too, so refining never has to grow the buffers under the render thread
+        if(data.coarse)
+        {
+            size_t vertices = data.fullVertices, indices = data.fullIndices;
+            for(const MeshData &mesh: data.meshes)
+            {
+                vertices += mesh.vertices.size();
+                indices += mesh.indices.size();
+            }
+            pool->Reserve(vertices, indices);
+            fullOffsets = data.fullOffsets;
+        }
+        createObjects(data);
+        pool->Upload();
+        if(data.coarse)
+            for(Mesh &mesh: meshes)
+                mesh.lod = 1;
+    }
+
+    // reads the geometry, from <path>.meshcache or through Assimp, and lists the textures without decoding them.
+    // touches no GL state, so it can run on any thread
+    static ModelData Import(string const &path, bool textureArrays)
+    {
+        ModelData data;
+        data.path = path;
+        // retrieve the directory path of the filepath
+        data.directory = path.substr(0, path.find_last_of('/'));
+        data.textureArrays = textureArrays;
+
+        string cachePath = path + ".meshcache";
+        uint64_t stamp = MeshCache::SourceStamp(path);
+        uint32_t flags = cacheFlags(textureArrays), found = 0;
+        bool cached = !VirtualFileSystem::EditedAfter(path, cachePath) &&
+                      MeshCache::Load(cachePath, stamp, flags, data.meshes, &found);
+        if(cached)
+            data.lightmapLayout = (found & MeshCache::LightmapCoords) != 0;
+        else
+        {
+            if(!importModel(path, textureArrays, data.meshes))
+                return data;
+            bakeVertices(data);
+        }
+
+        listTextures(data);
+        if(!cached)
+            MeshCache::Save(cachePath, stamp, cacheFlags(data), data.meshes, makeCoarse(data));
+        if(textureArrays)
+            choosePackedSizes(data);
+        return data;
+    }
+
+    // only the front of <path>.meshcache: simplified meshes and thumbnail textures, ready without any decoding.
+    // Build the model from it, then stream the full meshes and textures in with AssetStreamer::Refine. Without a
+    // usable cache this is a full Load, which also writes the cache for the next start
+    static ModelData ImportCoarse(string const &path, bool textureArrays)
+    {
+        ModelData data;
+        data.path = path;
+        data.directory = path.substr(0, path.find_last_of('/'));
+        data.textureArrays = textureArrays;
+
+        CoarseModel coarse;
+        uint32_t flags = cacheFlags(textureArrays);
+        string cachePath = path + ".meshcache";
+        if(VirtualFileSystem::EditedAfter(path, cachePath) ||
+           !MeshCache::LoadCoarse(cachePath, MeshCache::SourceStamp(path), flags, coarse))
+            return Load(path, textureArrays);
+
+        data.coarse = true;
+        data.meshes.swap(coarse.meshes);
+        data.fullOffsets.swap(coarse.fullOffsets);
+        data.fullVertices = coarse.fullVertices;
+        data.fullIndices = coarse.fullIndices;
+        data.lightmapLayout = (coarse.flags & MeshCache::LightmapCoords) != 0;
+        listTextures(data);
+        for(unsigned int i = 0; i < data.textures.size(); i++)
+            for(TextureThumbnail &thumbnail: coarse.thumbnails)
+            {
+                if(thumbnail.path != data.textures[i].path)
+                    continue;
+                DecodedImage &image = data.images[i];
+                image.width = image.height = MeshCache::ThumbnailSize;
+                image.channels = 4;
+                image.pixels.swap(thumbnail.pixels);
+                if(textureArrays)
+                    data.packedSizes[i] = make_pair(image.width, image.height);
+            }
+        return data;
+    }
+
+    // decodes texture i of data, different textures may be decoded on different threads at once
+    static void DecodeTexture(ModelData &data, unsigned int i)
+    {
+        DecodeTexture(data, i, FileSystem::open(TexturePath(data, i)));
+    }
+
+    // the same from the texture's bytes read elsewhere, e.g. by AsyncFileIo
+    static void DecodeTexture(ModelData &data, unsigned int i, const FileView &file)
+    {
+        DecodedImage &image = data.images[i];
+        if(!file || !DecodeImage(file, image, data.textureArrays ? 4 : 0))
+        {
+            std::cout << "Texture failed to load at path: " << data.textures[i].path << std::endl;
+            return;
+        }
+        if(!data.textureArrays)
+            return;
+        // packed layers all have the size of their array
+        pair<int, int> size = data.packedSizes[i];
+        if(size.first == 0)
+            image.pixels.clear();
+        else if(image.width != size.first || image.height != size.second)
+        {
+            vector<unsigned char> resampled;
+            resampleRGBA(image.pixels.data(), image.width, image.height, resampled, size.first, size.second);
+            image.pixels.swap(resampled);
+            image.width = size.first;
+            image.height = size.second;
+        }
+    }
+
+    // where texture i of data is read from
+    static string TexturePath(const ModelData &data, unsigned int i)
+    {
+        return data.directory + '/' + data.textures[i].path;
+    }
+
+    // Import and every DecodeTexture on the calling thread
+    static ModelData Load(string const &path, bool textureArrays)
+    {
+        ModelData data = Import(path, textureArrays);
+        for(unsigned int i = 0; i < data.textures.size(); i++)
+            DecodeTexture(data, i);
+        return data;
+    }
+
+    // just the given textures of a model, decoded on the calling thread. A Model built from it has no meshes and
+    // hands its textures over with AdoptTextures
+    static ModelData LoadTextures(const string &directory, bool textureArrays, const vector<Texture> &textures)
+    {
+        ModelData data;
+        data.directory = directory;
+        data.textureArrays = textureArrays;
+        for(Texture texture: textures)
+        {
+            texture.id = 0;
+            texture.layer = -1;
+            data.textures.push_back(texture);
+        }
+        data.images.resize(data.textures.size());
+        data.packedSizes.resize(data.textures.size());
+        if(textureArrays)
+            choosePackedSizes(data);
+        for(unsigned int i = 0; i < data.textures.size(); i++)
+            DecodeTexture(data, i);
+        return data;
+    }
+
+    // imports path through Assimp whatever cache there is and writes <path>.meshcache stamped 0, for asset_cooker:
+    // the same source always cooks to the same bytes. Lists the texture files the cache was built from
+    static bool Cook(string const &path, bool textureArrays, vector<string> &textureFiles)
+    {
+        ModelData data;
+        data.path = path;
+        data.directory = path.substr(0, path.find_last_of('/'));
+        data.textureArrays = textureArrays;
+        if(!importModel(path, textureArrays, data.meshes))
+            return false;
+        bakeVertices(data);
+        listTextures(data);
+        for(const Texture &texture: data.textures)
+            textureFiles.push_back(data.directory + '/' + texture.path);
+        return MeshCache::Save(path + ".meshcache", 0, cacheFlags(data), data.meshes, makeCoarse(data));
+    }
+
+    Model(const Model &) = delete;
+    Model &operator=(const Model &) = delete;
+
+    // deletes the GL objects owned by the model, call before the context goes away
+    void Release()
+    {
+        if(ownedPool)
+            ownedPool->Release();
+        for(Texture &array: texture_arrays)
+            glDeleteTextures(1, &array.id);
+        for(Texture &texture: textures_loaded)
+            if(texture.layer < 0)
+                glDeleteTextures(1, &texture.id);
+    }
+
+    // imports the model file again and swaps the new meshes and textures in. A file that fails to import leaves
+    // the model as it was. With a shared pool the old geometry stays in the pool as unused space.
+    bool Reload()
+    {
+        Model fresh(sourcePath, gammaCorrection, textureArrays, ownedPool ? nullptr : pool);
+        bool imported = !fresh.meshes.empty();
+        if(imported)
+            Adopt(fresh);
+        fresh.Release();
+        return imported;
+    }
+
+    // takes over the meshes and textures of another model of the same file, which is left with the old ones and
+    // should be released
+    void Adopt(Model &fresh)
     {
-        loadModel(path);
+        meshes.swap(fresh.meshes);
+        textures_loaded.swap(fresh.textures_loaded);
+        texture_arrays.swap(fresh.texture_arrays);
+        ownedPool.swap(fresh.ownedPool);
+        std::swap(pool, fresh.pool);
+        fullOffsets.swap(fresh.fullOffsets);
+        std::swap(lightmapLayout, fresh.lightmapLayout);
+        coverage.clear();
+        SetShaderTextureNamePrefix(glslIdentifierPrefix);
+    }
+
+    // swaps in the full geometry of a coarse mesh, uploaded to the model's pool at range
+    void RefineMesh(unsigned int i, MeshData &&mesh, MeshPool::Range range)
+    {
+        meshes[i].Refine(std::move(mesh.vertices), std::move(mesh.indices), std::move(mesh.meshlets), range);
+    }
+
+    // takes over the textures of a model built from the same textures and hands its own over in exchange, the other
+    // model should be released. Used to replace thumbnails with the full images
+    void AdoptTextures(Model &fresh)
+    {
+        textures_loaded.swap(fresh.textures_loaded);
+        texture_arrays.swap(fresh.texture_arrays);
+        for(Mesh &mesh: meshes)
+        {
+            vector<Texture> textures = mesh.textures;
+            for(Texture &texture: textures)
+                texture = findLoadedTexture(texture.path);
+            mesh.SetTextures(textures);
+        }
+    }
+
+    // estimates how much of the screen every mesh's bounding sphere covers, projScale is projection[1][1]. Sets
+    // what Coverage returns, call once a frame while the model is refining
+    void UpdateCoverage(const glm::mat4 &transform, const glm::vec3 &cameraPosition, float projScale)
+    {
+        float scale = std::max(glm::length(glm::vec3(transform[0])),
+                               std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+        coverage.resize(meshes.size());
+        for(unsigned int i = 0; i < meshes.size(); i++)
+        {
+            glm::vec3 center = glm::vec3(transform * glm::vec4(glm::vec3(meshes[i].bounds), 1.0f));
+            float radius = meshes[i].bounds.w * scale;
+            float distance = std::max(glm::length(center - cameraPosition), radius);
+            // the sphere's projected radius relative to half the screen height, squared for an area
+            float projected = radius * projScale / std::max(distance, 1e-4f);
+            coverage[i] = projected * projected;
+        }
+    }
+
+    // per mesh, from the last UpdateCoverage; empty before the first one
+    const vector<float> &Coverage() const
+    {
+        return coverage;
+    }
+
+    // where the full meshes of a model built from ImportCoarse are in the cache, empty otherwise
+    const vector<uint64_t> &FullMeshOffsets() const
+    {
+        return fullOffsets;
+    }
+
+    // the level of detail mesh i is drawn at, 0 once its full geometry is resident
+    int MeshLod(unsigned int i) const
+    {
+        return meshes[i].lod;
+    }
+
+    unsigned int ResidentMeshes() const
+    {
+        unsigned int resident = 0;
+        for(const Mesh &mesh: meshes)
+            resident += mesh.lod == 0;
+        return resident;
+    }
+
+    // creates the vertex array of a model built without one, on the context that draws it
+    void AttachVertexArray()
+    {
+        if(!ownedPool || ownedPool->VAO)
+            return;
+        ownedPool->AttachVertexArray();
+        for(Mesh &mesh: meshes)
+            mesh.VAO = ownedPool->VAO;
+    }
+
+    // decodes one texture file again into the texture it was loaded to, packed textures replace their layer.
+    // file is one of TextureFiles(), the old image stays when the new one cannot be decoded
+    bool ReloadTexture(const string &file)
+    {
+        for(const Texture &texture: textures_loaded)
+        {
+            if(directory + '/' + texture.path != file)
+                continue;
+            if(texture.layer < 0)
+                return TextureIntoObject(texture.id, file);
+            return reloadLayer(texture, file);
+        }
+        return false;
+    }
+
+    const string &SourceFile() const
+    {
+        return sourcePath;
+    }
+
+    // paths of the texture files the model uses
+    vector<string> TextureFiles() const
+    {
+        vector<string> files;
+        for(const Texture &texture: textures_loaded)
+            files.push_back(directory + '/' + texture.path);
+        return files;
     }
 
     // draws the model, and thus all its meshes
     void Draw(Shader &shader)
     {
-        for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        drawMeshes(shader, nullptr, glm::mat4(1.0f), nullptr);
+    }
+
+    // draws the meshes whose bounding sphere touches the frustum, transform is the model matrix set on the shader.
+    // returns how many meshes were drawn
+    unsigned int Draw(Shader &shader, const glm::mat4 &transform, const Frustum &frustum)
+    {
+        return drawMeshes(shader, &frustum, transform, nullptr);
+    }
+
+    // draws the meshes whose bounding sphere passes culling, and of those only the visible meshlets.
+    // returns how many meshes were drawn, culling.total and culling.visible count the meshlets
+    unsigned int Draw(Shader &shader, MeshletCulling &culling)
+    {
+        return drawMeshes(shader, nullptr, glm::mat4(1.0f), &culling);
+    }
+
+    unsigned int MeshletCount() const
+    {
+        unsigned int count = 0;
+        for(const Mesh &mesh: meshes)
+            count += mesh.meshlets.size();
+        return count;
+    }
+
+    bool UsesTextureArrays() const
+    {
+        return textureArrays;
+    }
+
+    // whether a lightmap baked for the model has coordinates to be sampled at
+    bool HasLightmapLayout() const
+    {
+        return lightmapLayout;
+    }
+
+    // binds the packed textures of a model loaded with textureArrays, meshes then only select layers
+    void BindTextureArrays(Shader &shader)
+    {
+        for(const char *type: textureTypes)
+            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + type + "1").c_str()), Unused2DUnit);
+        for(unsigned int i = 0; i < texture_arrays.size(); i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, texture_arrays[i].id);
+            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + texture_arrays[i].type + "Array").c_str()), i);
+        }
+        glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + "useTextureArrays").c_str()), 1);
+        glActiveTexture(GL_TEXTURE0);
     }
 
     void SetShaderTextureNamePrefix(std::string prefix) {
+        glslIdentifierPrefix = prefix;
         for (Mesh& mesh: meshes) {
             mesh.glslIdentifierPrefix = prefix;
         }
     }
 private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+    // samplers of different types may not share a texture unit, the ones a draw does not use are parked here
+    static const int Unused2DUnit = 14;
+    static const int UnusedArrayUnit = 15;
+    static constexpr const char *textureTypes[4] = {"texture_diffuse", "texture_specular", "texture_normal", "texture_height"};
+
+    bool textureArrays;
+    bool lightmapLayout;
+    string sourcePath;
+    std::string glslIdentifierPrefix;
+    std::unique_ptr<MeshPool> ownedPool;
+    vector<uint64_t> fullOffsets;
+    vector<float> coverage;
+
+    unsigned int drawMeshes(Shader &shader, const Frustum *frustum, const glm::mat4 &transform, MeshletCulling *culling)
+    {
+        if(textureArrays)
+            BindTextureArrays(shader);
+        else
+        {
+            // keep the unused array samplers off the units the meshes bind 2D textures to
+            for(const char *type: textureTypes)
+                glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + type + "Array").c_str()), UnusedArrayUnit);
+            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + "useTextureArrays").c_str()), 0);
+        }
+
+        unsigned int drawn = 0;
+        glBindVertexArray(pool->VAO);
+        for(unsigned int i = 0; i < meshes.size(); i++)
+        {
+            if(frustum && !frustum->IntersectsSphere(transform, meshes[i].bounds))
+                continue;
+            // culling's frustum is already in model space
+            if(culling && !culling->frustum.IntersectsSphere(glm::vec3(meshes[i].bounds), meshes[i].bounds.w))
+            {
+                culling->total += meshes[i].meshlets.size();
+                continue;
+            }
+            if(textureArrays)
+                meshes[i].DrawLayered(shader, culling);
+            else
+                meshes[i].Draw(shader, culling);
+            drawn++;
+        }
+        glBindVertexArray(0);
+        return drawn;
+    }
+
+    // creates the textures and meshes of a model that was read and decoded
+    void createObjects(const ModelData &data)
+    {
+        for(unsigned int i = 0; i < data.textures.size(); i++)
+        {
+            Texture texture = data.textures[i];
+            texture.id = 0;
+            // packed textures are uploaded by packTextureArrays
+            if(!textureArrays)
+            {
+                glGenTextures(1, &texture.id);
+                if(!data.images[i].pixels.empty())
+                    TextureFromImage(texture.id, data.images[i]);
+            }
+            textures_loaded.push_back(texture);
+        }
+        // packed textures are uploaded together once the whole model is known
+        if(textureArrays)
+            packTextureArrays(data);
+
+        for(const MeshData &mesh: data.meshes)
+        {
+            vector<Texture> textures = mesh.textures;
+            for(Texture &texture: textures)
+                texture = findLoadedTexture(texture.path);
+            meshes.push_back(Mesh(mesh.vertices, mesh.indices, textures, pool, mesh.meshlets));
+        }
+    }
+
+    // what the cache of a model imported with these settings is marked with
+    static uint32_t cacheFlags(bool textureArrays)
+    {
+        return (textureArrays ? MeshCache::MergedByMaterial : 0) |
+               (VertexOcclusion::Enabled() ? MeshCache::BakedOcclusion : 0) |
+               (Lightmap::Enabled() ? MeshCache::LightmapCoords : 0);
+    }
+
+    // what the cache of data is written with, a lightmap layout that did not fit is marked as such
+    static uint32_t cacheFlags(const ModelData &data)
+    {
+        uint32_t flags = cacheFlags(data.textureArrays);
+        if((flags & MeshCache::LightmapCoords) && !data.lightmapLayout)
+            flags = (flags & ~MeshCache::LightmapCoords) | MeshCache::LightmapFailed;
+        return flags;
+    }
+
+    // the lightmap layout, baked occlusion and meshlets of freshly imported meshes
+    static void bakeVertices(ModelData &data)
+    {
+        data.lightmapLayout = Lightmap::Enabled() && Lightmap::Generate(data.meshes);
+        if(VertexOcclusion::Enabled())
+            VertexOcclusion::Bake(data.meshes);
+        for(MeshData &mesh: data.meshes)
+            mesh.meshlets = Meshlets::Build(mesh.vertices, mesh.indices);
+    }
+
+    // check if texture was listed before and if so, skip it, to ensure we won't load duplicate textures
+    static void listTextures(ModelData &data)
+    {
+        for(const MeshData &mesh: data.meshes)
+            for(const Texture &texture: mesh.textures)
+            {
+                bool listed = false;
+                for(const Texture &other: data.textures)
+                    listed |= other.path == texture.path;
+                if(!listed)
+                    data.textures.push_back(texture);
+            }
+        data.images.resize(data.textures.size());
+        data.packedSizes.resize(data.textures.size());
+    }
+
+    // the front of the cache: every mesh simplified and every texture shrunk to a thumbnail. Decodes the textures
+    // once more, only paid when the cache is written
+    static CoarseModel makeCoarse(const ModelData &data)
+    {
+        CoarseModel coarse;
+        for(const MeshData &mesh: data.meshes)
+        {
+            MeshData simplified;
+            MeshLod::Simplify(mesh.vertices, mesh.indices, MeshLod::CoarseResolution, simplified.vertices, simplified.indices);
+            simplified.textures = mesh.textures;
+            coarse.meshes.push_back(std::move(simplified));
+        }
+        for(const Texture &texture: data.textures)
+        {
+            DecodedImage image;
+            if(!DecodeImage(data.directory + '/' + texture.path, image, 4))
+                continue;
+            // box filtered down close to the size first, the bilinear resample alone would skip most of the texels
+            while(image.width >= 2 * MeshCache::ThumbnailSize && image.height >= 2 * MeshCache::ThumbnailSize)
+                halveRGBA(image);
+            TextureThumbnail thumbnail;
+            thumbnail.path = texture.path;
+            resampleRGBA(image.pixels.data(), image.width, image.height, thumbnail.pixels,
+                         MeshCache::ThumbnailSize, MeshCache::ThumbnailSize);
+            coarse.thumbnails.push_back(std::move(thumbnail));
+        }
+        return coarse;
+    }
+
+    static bool importModel(string const &path, bool textureArrays, vector<MeshData> &data)
     {
         // read file via ASSIMP
         Assimp::Importer importer;
+        importer.SetIOHandler(new AssimpFileSystem());
         const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            return false;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
         // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        map<string, unsigned int> meshByMaterial;
+        processNode(scene->mRootNode, scene, textureArrays, data, meshByMaterial);
+        return true;
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    static void processNode(aiNode *node, const aiScene *scene, bool textureArrays, vector<MeshData> &data, map<string, unsigned int> &meshByMaterial)
     {
         // process each mesh located at the current node
         for(unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -81,17 +663,18 @@ private:
             // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            processMesh(mesh, scene, textureArrays, data, meshByMaterial);
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, textureArrays, data, meshByMaterial);
         }
 
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // with texture arrays the draw state only depends on the material, meshes sharing one are merged into one entry
+    static void processMesh(aiMesh *mesh, const aiScene *scene, bool textureArrays, vector<MeshData> &data, map<string, unsigned int> &meshByMaterial)
     {
         // data to fill
         vector<Vertex> vertices;
@@ -178,44 +761,213 @@ private:
 
 
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        if(!textureArrays)
+        {
+            data.push_back(MeshData{vertices, indices, {}, textures});
+            return;
+        }
+
+        // the loader does not apply node transforms, so meshes with the same material can simply be concatenated
+        string key;
+        for(const Texture &texture: textures)
+            key += texture.type + ':' + texture.path + ';';
+        auto found = meshByMaterial.find(key);
+        if(found == meshByMaterial.end())
+        {
+            found = meshByMaterial.emplace(key, (unsigned int) data.size()).first;
+            data.push_back(MeshData{{}, {}, {}, textures});
+        }
+        MeshData &merged = data[found->second];
+        unsigned int baseVertex = merged.vertices.size();
+        merged.vertices.insert(merged.vertices.end(), vertices.begin(), vertices.end());
+        for(unsigned int index: indices)
+            merged.indices.push_back(baseVertex + index);
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
+    // collects the material textures of a given type, they are loaded once the whole model is known.
     // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+    static vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
     {
         vector<Texture> textures;
         for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
+            Texture texture;
+            texture.id = 0;
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
+        }
+        return textures;
+    }
+
+    Texture findLoadedTexture(const string &path) const
+    {
+        for(const Texture &texture: textures_loaded)
+            if(texture.path == path)
+                return texture;
+        return Texture{0, "", path, -1};
+    }
+
+    // every texture of a type is packed at the most common size of its type, textures of any other size are
+    // resampled to it. Only the headers are read here, the images are decoded later
+    static void choosePackedSizes(ModelData &data)
+    {
+        vector<pair<int, int>> sizes(data.textures.size());
+        for(const char *type: textureTypes)
+        {
+            map<pair<int, int>, unsigned int> sizeCounts;
+            for(unsigned int i = 0; i < data.textures.size(); i++)
             {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
+                if(data.textures[i].type != type)
+                    continue;
+                // only the pages holding the header are touched
+                FileView file = FileSystem::open(data.directory + '/' + data.textures[i].path);
+                ImageInfo info;
+                if(!ImageDecoders::Info(file, info))
+                    continue;
+                sizes[i] = make_pair(info.width, info.height);
+                sizeCounts[sizes[i]]++;
+            }
+            if(sizeCounts.empty())
+                continue;
+
+            pair<int, int> size = sizeCounts.begin()->first;
+            for(const auto &count: sizeCounts)
+                if(count.second > sizeCounts[size])
+                    size = count.first;
+            for(unsigned int i = 0; i < data.textures.size(); i++)
+                if(data.textures[i].type == type && sizes[i].first != 0)
+                    data.packedSizes[i] = size;
+        }
+    }
+
+    // uploads every decoded texture into one RGBA8 array per texture type
+    void packTextureArrays(const ModelData &data)
+    {
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+        for(const char *type: textureTypes)
+        {
+            vector<unsigned int> members;
+            for(unsigned int i = 0; i < data.textures.size(); i++)
+            {
+                if(data.textures[i].type != type || data.images[i].pixels.empty())
+                    continue;
+                if((GLint) members.size() == maxLayers)
                 {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
+                    std::cout << "ERROR::MODEL::TEXTURE_ARRAY_FULL " << data.textures[i].path << std::endl;
+                    continue;
                 }
+                members.push_back(i);
             }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+            if(members.empty())
+                continue;
+
+            pair<int, int> size = data.packedSizes[members[0]];
+            Texture array;
+            array.type = type;
+            array.path = type;
+            glGenTextures(1, &array.id);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, array.id);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, size.first, size.second, members.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+            int layer = 0;
+            for(unsigned int member: members)
+            {
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, size.first, size.second, 1, GL_RGBA, GL_UNSIGNED_BYTE, data.images[member].pixels.data());
+                textures_loaded[member].id = array.id;
+                textures_loaded[member].layer = layer++;
+            }
+
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            texture_arrays.push_back(array);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    bool reloadLayer(const Texture &texture, const string &file)
+    {
+        DecodedImage image;
+        if(!DecodeImage(file, image, 4))
+        {
+            std::cout << "Texture failed to load at path: " << texture.path << std::endl;
+            return false;
+        }
+        int width = image.width, height = image.height;
+        const unsigned char *data = image.pixels.data();
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture.id);
+        GLint arrayWidth = 0, arrayHeight = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_WIDTH, &arrayWidth);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_HEIGHT, &arrayHeight);
+        // the array keeps its size, an image that changed size is resampled like when it was packed
+        vector<unsigned char> resampled;
+        const unsigned char *pixels = data;
+        if(width != arrayWidth || height != arrayHeight)
+        {
+            resampleRGBA(data, width, height, resampled, arrayWidth, arrayHeight);
+            pixels = resampled.data();
+        }
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, texture.layer, arrayWidth, arrayHeight, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return true;
+    }
+
+    // 2x2 box filter of an RGBA8 image
+    static void halveRGBA(DecodedImage &image)
+    {
+        int width = image.width / 2, height = image.height / 2;
+        vector<unsigned char> half((size_t) width * height * 4);
+        for(int y = 0; y < height; y++)
+            for(int x = 0; x < width; x++)
+                for(int c = 0; c < 4; c++)
+                {
+                    const unsigned char *row0 = &image.pixels[((size_t) (2 * y) * image.width + 2 * x) * 4 + c];
+                    const unsigned char *row1 = row0 + (size_t) image.width * 4;
+                    half[((size_t) y * width + x) * 4 + c] = (unsigned char) ((row0[0] + row0[4] + row1[0] + row1[4] + 2) / 4);
+                }
+        image.pixels.swap(half);
+        image.width = width;
+        image.height = height;
+    }
+
+    // bilinear resize of an RGBA8 image
+    static void resampleRGBA(const unsigned char *src, int srcWidth, int srcHeight,
+                             vector<unsigned char> &dst, int dstWidth, int dstHeight)
+    {
+        dst.resize((size_t) dstWidth * dstHeight * 4);
+        for(int y = 0; y < dstHeight; y++)
+        {
+            float sy = glm::clamp((y + 0.5f) * srcHeight / dstHeight - 0.5f, 0.0f, (float) (srcHeight - 1));
+            int y0 = (int) sy;
+            int y1 = std::min(y0 + 1, srcHeight - 1);
+            float fy = sy - y0;
+            for(int x = 0; x < dstWidth; x++)
+            {
+                float sx = glm::clamp((x + 0.5f) * srcWidth / dstWidth - 0.5f, 0.0f, (float) (srcWidth - 1));
+                int x0 = (int) sx;
+                int x1 = std::min(x0 + 1, srcWidth - 1);
+                float fx = sx - x0;
+                for(int c = 0; c < 4; c++)
+                {
+                    float top = src[(y0 * srcWidth + x0) * 4 + c] * (1.0f - fx) + src[(y0 * srcWidth + x1) * 4 + c] * fx;
+                    float bottom = src[(y1 * srcWidth + x0) * 4 + c] * (1.0f - fx) + src[(y1 * srcWidth + x1) * 4 + c] * fx;
+                    dst[((size_t) y * dstWidth + x) * 4 + c] = (unsigned char) (top * (1.0f - fy) + bottom * fy + 0.5f);
+                }
             }
         }
-        return textures;
     }
 };
 
+constexpr const char *Model::textureTypes[4];
+
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
 {
@@ -224,36 +976,119 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
 
     unsigned int textureID;
     glGenTextures(1, &textureID);
+    if (!TextureIntoObject(textureID, filename))
+        std::cout << "Texture failed to load at path: " << path << std::endl;
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format = 0;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
+    return textureID;
+}
+
+// decodes an image file into an existing texture object, which is left untouched when decoding fails
+bool TextureIntoObject(unsigned int textureID, const string &filename)
+{
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    if (!DecodeIntoTexture(GL_TEXTURE_2D, vector<FileView>{FileSystem::open(filename)}, 0))
+        return false;
+    MipmapTexture2D();
+    return true;
+}
+
+// components forces the channel count (1-4), 0 keeps the file's. Safe on any thread
+bool DecodeImage(const string &filename, DecodedImage &image, int components, bool flip)
+{
+    FileView file = FileSystem::open(filename);
+    return file && DecodeImage(file, image, components, flip);
+}
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+// from bytes read elsewhere, e.g. by AsyncFileIo. The decoder writes straight into image.pixels
+bool DecodeImage(const FileView &file, DecodedImage &image, int components, bool flip)
+{
+    ImageInfo info;
+    if (!ImageDecoders::Info(file, info))
+        return false;
+    image.width = info.width;
+    image.height = info.height;
+    image.channels = components != 0 ? components : info.channels;
+    image.pixels.resize((size_t) image.width * image.height * image.channels);
+    return ImageDecoders::Decode(file, image.channels, flip, image.pixels.data());
+}
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+static GLenum imageFormat(int channels)
+{
+    const GLenum formats[4] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    return formats[channels - 1];
+}
 
-        stbi_image_free(data);
+// decodes every file straight into one mapped pixel unpack buffer, then uploads level 0 of target + i from file i
+// into the texture bound there, so the pixels are never copied on the CPU. Every file is decoded before anything is
+// uploaded, a failure leaves the texture as it was
+bool DecodeIntoTexture(GLenum target, const vector<FileView> &files, int components, bool flip)
+{
+    vector<ImageInfo> infos(files.size());
+    vector<size_t> offsets(files.size() + 1, 0);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (!ImageDecoders::Info(files[i], infos[i]))
+            return false;
+        if (components != 0)
+            infos[i].channels = components;
+        offsets[i + 1] = offsets[i] + (size_t) infos[i].width * infos[i].height * infos[i].channels;
     }
-    else
+
+    unsigned int buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, offsets.back(), nullptr, GL_STREAM_DRAW);
+    unsigned char *mapped = (unsigned char *) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, offsets.back(),
+                                                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    // a driver that refuses the mapping gets the pixels from client memory
+    vector<unsigned char> staging;
+    if (!mapped)
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        staging.resize(offsets.back());
     }
+    unsigned char *pixels = mapped ? mapped : staging.data();
+    bool decoded = true;
+    for (size_t i = 0; i < files.size() && decoded; i++)
+        decoded = ImageDecoders::Decode(files[i], infos[i].channels, flip, pixels + offsets[i]);
+    // the contents can be lost while mapped, e.g. on a mode switch
+    if (mapped && !glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+        decoded = false;
 
-    return textureID;
+    if (decoded)
+    {
+        // rows of 3 channel images are not 4 byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            GLenum format = imageFormat(infos[i].channels);
+            glTexImage2D(target + (GLenum) i, 0, format, infos[i].width, infos[i].height, 0, format, GL_UNSIGNED_BYTE,
+                         mapped ? (const void *) offsets[i] : staging.data() + offsets[i]);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    return decoded;
+}
+
+void TextureFromImage(unsigned int textureID, const DecodedImage &image)
+{
+    GLenum format = imageFormat(image.channels);
+
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.data());
+    MipmapTexture2D();
+}
+
+// mipmaps and sampling of the texture bound to GL_TEXTURE_2D
+void MipmapTexture2D()
+{
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 }
 #endif
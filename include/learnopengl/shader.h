@@ -4,11 +4,47 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <set>
+#include <vector>
 #include <common.h>
+#include <learnopengl/filesystem.h>
+#include <program_cache.h>
+
+// preprocessor symbols injected into every stage of a program, right after #version. Kept sorted so the same set
+// always produces the same source and the same key.
+class ShaderDefines
+{
+public:
+    ShaderDefines &Set(const std::string &name, const std::string &value = "1")
+    {
+        values[name] = value;
+        return *this;
+    }
+    // "NAME=VALUE;" for every define, identifies a permutation
+    std::string Key() const
+    {
+        std::string key;
+        for(const auto &define : values)
+            key += define.first + '=' + define.second + ';';
+        return key;
+    }
+    std::string Source() const
+    {
+        std::string source;
+        for(const auto &define : values)
+            source += "#define " + define.first + ' ' + define.second + '\n';
+        return source;
+    }
+private:
+    std::map<std::string, std::string> values;
+};
+
 class Shader
 {
 public:
@@ -16,102 +52,106 @@ public:
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+        : Shader(vertexPath, fragmentPath, ShaderDefines(), geometryPath)
     {
-        std::string vertexPathString(vertexPath);
-        std::string fragmentPathString(fragmentPath);
-
-        vertexPath = vertexPathString.c_str();
-        fragmentPath= fragmentPathString.c_str();
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-            // if geometry shader path is present, also load a geometry shader
-            if(geometryPath != nullptr)
-            {
-                std::string geometryPathString(geometryPath);
-                geometryPath = geometryPathString.c_str();
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
-            }
-        }
-        catch (std::ifstream::failure& e)
-        {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-        }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // if geometry shader is given, compile geometry shader
-        unsigned int geometry = 0;
-        if(geometryPath != nullptr)
-        {
-            const char * gShaderCode = geometryCode.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gShaderCode, NULL);
-            glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
-        }
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
+    }
+    // constructor for one permutation of a program, the defines are visible to every stage
+    // ------------------------------------------------------------------------
+    Shader(const char* vertexPath, const char* fragmentPath, const ShaderDefines &defines, const char* geometryPath = nullptr)
+        : defines(defines)
+    {
+        stagePaths.emplace_back(GL_VERTEX_SHADER, vertexPath);
+        stagePaths.emplace_back(GL_FRAGMENT_SHADER, fragmentPath);
+        // if geometry shader is given, also load a geometry shader
         if(geometryPath != nullptr)
-            glAttachShader(ID, geometry);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+            stagePaths.emplace_back(GL_GEOMETRY_SHADER, geometryPath);
+        build(readStages());
+    }
+    // constructor for transform feedback programs: vertex (+ optional geometry) stages only, the listed
+    // outputs are captured interleaved into the bound feedback buffer
+    // ------------------------------------------------------------------------
+    Shader(const char* vertexPath, const char* geometryPath, const std::vector<std::string> &feedbackVaryings)
+        : feedbackVaryings(feedbackVaryings)
+    {
+        stagePaths.emplace_back(GL_VERTEX_SHADER, vertexPath);
         if(geometryPath != nullptr)
-            glDeleteShader(geometry);
-
+            stagePaths.emplace_back(GL_GEOMETRY_SHADER, geometryPath);
+        build(readStages());
+    }
+    // constructor for compute programs (GL 4.3)
+    // ------------------------------------------------------------------------
+    explicit Shader(const char* computePath)
+    {
+        stagePaths.emplace_back(GL_COMPUTE_SHADER, computePath);
+        build(readStages());
     }
-    // activate the shader
+    // activate the shader, waiting for its compile and link the first time
     // ------------------------------------------------------------------------
     void use() 
     { 
+        finish();
         glUseProgram(ID); 
     }
+    // true once the driver is done compiling and linking, without blocking when
+    // GL_KHR_parallel_shader_compile is available
+    // ------------------------------------------------------------------------
+    bool ready() const
+    {
+        if(pendingShaders.empty() || !GLAD_GL_KHR_parallel_shader_compile)
+            return true;
+        GLint done = GL_FALSE;
+        glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+    // reports compile and link errors and stores the binary, called by use() or by a ShaderBatch
+    // ------------------------------------------------------------------------
+    void finish()
+    {
+        if(pendingShaders.empty())
+            return;
+        for(const auto &shader : pendingShaders)
+            checkCompileErrors(shader.first, shader.second);
+        GLint linked = checkCompileErrors(ID, "PROGRAM");
+        // delete the shaders as they're linked into our program now and no longer necessery
+        for(const auto &shader : pendingShaders)
+            glDeleteShader(shader.first);
+        pendingShaders.clear();
+        if(linked)
+            ProgramCache::Save(ID, pendingKey);
+    }
+    // rebuilds the program from its files, e.g. after an edit. Uniform values carry over to the new program; when
+    // it does not compile or link the errors are printed and the old program stays in use
+    // ------------------------------------------------------------------------
+    bool reload()
+    {
+        finish();
+        unsigned int previous = ID;
+        build(readStages());
+        finish();
+        GLint linked = GL_FALSE;
+        glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+        if(!linked)
+        {
+            glDeleteProgram(ID);
+            ID = previous;
+            return false;
+        }
+        copyUniforms(previous, ID);
+        glDeleteProgram(previous);
+        return true;
+    }
+    // every file the program was built from, includes too
+    // ------------------------------------------------------------------------
+    const std::set<std::string> &sourceFiles() const
+    {
+        return files;
+    }
     // delete the shader
     // ------------------------------------------------------------------------
     void deleteProgram() {
+        for(const auto &shader : pendingShaders)
+            glDeleteShader(shader.first);
+        pendingShaders.clear();
         glDeleteProgram(ID);
         ID = 0;
     }
@@ -175,9 +215,220 @@ public:
     }
 
 private:
+    // stages of a program whose compile and link were submitted but not checked yet, with their type names
+    std::vector<std::pair<unsigned int, std::string>> pendingShaders;
+    uint64_t pendingKey = 0;
+    // what the program is built from, kept for reload()
+    std::vector<std::pair<GLenum, std::string>> stagePaths;
+    ShaderDefines defines;
+    std::vector<std::string> feedbackVaryings;
+    std::set<std::string> files;
+
+    std::vector<std::pair<GLenum, std::string>> readStages()
+    {
+        files.clear();
+        std::vector<std::pair<GLenum, std::string>> stages;
+        for(const auto &stage : stagePaths)
+            stages.emplace_back(stage.first, injectDefines(readSource(stage.second.c_str()), defines));
+        return stages;
+    }
+
+    // reads a stage's source, replacing every #include "file" line (relative to the including file) with the file.
+    // a file is only included once per stage, like #pragma once
+    std::string readSource(const char* path)
+    {
+        std::set<std::string> included;
+        return preprocess(path, included);
+    }
+
+    std::string preprocess(const std::string &path, std::set<std::string> &included)
+    {
+        if(!included.insert(path).second)
+            return std::string();
+        files.insert(path);
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+        std::stringstream source(readFile(path));
+        std::stringstream result;
+        std::string line;
+        int number = 0;
+        while(std::getline(source, line))
+        {
+            number++;
+            size_t start = line.find_first_not_of(" \t");
+            if(start == std::string::npos || line.compare(start, 8, "#include") != 0)
+            {
+                result << line << '\n';
+                continue;
+            }
+            size_t open = line.find('"', start);
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            if(close == std::string::npos)
+            {
+                std::cout << "ERROR::SHADER::INVALID_INCLUDE: " << path << ":" << number << std::endl;
+                continue;
+            }
+            // #line keeps compile errors pointing at the right lines of each file
+            result << "#line 1\n" << preprocess(directory + line.substr(open + 1, close - open - 1), included);
+            result << "#line " << number + 1 << '\n';
+        }
+        return result.str();
+    }
+
+    std::string readFile(const std::string &path)
+    {
+        FileView file = FileSystem::open(path);
+        if(!file)
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << std::endl;
+        return file.String();
+    }
+
+    // defines have to follow #version, which must stay the first statement
+    static std::string injectDefines(const std::string &code, const ShaderDefines &defines)
+    {
+        std::string block = defines.Source();
+        if(block.empty())
+            return code;
+        size_t version = code.find("#version");
+        size_t end = version == std::string::npos ? std::string::npos : code.find('\n', version);
+        if(end == std::string::npos)
+            return block + code;
+        int line = 1 + std::count(code.begin(), code.begin() + end, '\n');
+        return code.substr(0, end + 1) + block + "#line " + std::to_string(line + 1) + '\n' + code.substr(end + 1);
+    }
+
+    // links the program from its stages, or loads the binary of an identical program linked by an earlier run.
+    // nothing here waits for the driver: the status checks are left to finish(), so several programs can
+    // compile at once
+    void build(const std::vector<std::pair<GLenum, std::string>> &stages)
+    {
+        uint64_t key = ProgramCache::Supported() ? ProgramCache::Key(stages, feedbackVaryings) : 0;
+        ID = glCreateProgram();
+        // a rejected binary leaves the program unlinked, it is then linked from source like any other
+        if(ProgramCache::Load(ID, key))
+            return;
+
+        for(const auto &stage : stages)
+        {
+            unsigned int shader = compileStage(stage.first, stage.second);
+            glAttachShader(ID, shader);
+            pendingShaders.emplace_back(shader, stageName(stage.first));
+        }
+        if(!feedbackVaryings.empty())
+        {
+            std::vector<const char*> varyings;
+            for(const std::string &varying : feedbackVaryings)
+                varyings.push_back(varying.c_str());
+            glTransformFeedbackVaryings(ID, (GLsizei)varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+        }
+        ProgramCache::PrepareForSave(ID);
+        glLinkProgram(ID);
+        pendingKey = key;
+    }
+
+    static std::string stageName(GLenum stage)
+    {
+        switch(stage)
+        {
+            case GL_VERTEX_SHADER: return "VERTEX";
+            case GL_FRAGMENT_SHADER: return "FRAGMENT";
+            case GL_GEOMETRY_SHADER: return "GEOMETRY";
+            case GL_COMPUTE_SHADER: return "COMPUTE";
+        }
+        return "UNKNOWN";
+    }
+
+    unsigned int compileStage(GLenum stage, const std::string &code)
+    {
+        const char* source = code.c_str();
+        unsigned int shader = glCreateShader(stage);
+        glShaderSource(shader, 1, &source, NULL);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    // copies the value of every uniform the two programs share, by name and type. Uniforms in blocks have no
+    // location and are skipped, their values live in buffers anyway
+    static void copyUniforms(GLuint from, GLuint to)
+    {
+        std::map<std::string, std::pair<GLenum, GLint>> targets = activeUniforms(to);
+        GLint current = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+        glUseProgram(to);
+        for(const auto &uniform : activeUniforms(from))
+        {
+            auto target = targets.find(uniform.first);
+            if(target == targets.end() || target->second.first != uniform.second.first)
+                continue;
+            GLint size = std::min(uniform.second.second, target->second.second);
+            for(GLint element = 0; element < size; element++)
+            {
+                std::string name = size > 1 ? uniform.first + '[' + std::to_string(element) + ']' : uniform.first;
+                GLint source = glGetUniformLocation(from, name.c_str());
+                GLint location = glGetUniformLocation(to, name.c_str());
+                if(source >= 0 && location >= 0)
+                    copyUniform(from, source, location, uniform.second.first);
+            }
+        }
+        glUseProgram(current);
+    }
+
+    // name -> type and array size, arrays are listed by their name without [0]
+    static std::map<std::string, std::pair<GLenum, GLint>> activeUniforms(GLuint program)
+    {
+        std::map<std::string, std::pair<GLenum, GLint>> uniforms;
+        GLint count = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        for(GLint i = 0; i < count; i++)
+        {
+            GLchar name[256];
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(program, i, sizeof(name), &length, &size, &type, name);
+            std::string uniform(name, length);
+            if(uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0)
+                uniform.resize(uniform.size() - 3);
+            uniforms[uniform] = std::make_pair(type, size);
+        }
+        return uniforms;
+    }
+
+    // expects the target program to be bound
+    static void copyUniform(GLuint from, GLint source, GLint target, GLenum type)
+    {
+        GLfloat f[16];
+        GLint i[4];
+        GLuint u[4];
+        switch(type)
+        {
+            case GL_FLOAT: glGetUniformfv(from, source, f); glUniform1fv(target, 1, f); break;
+            case GL_FLOAT_VEC2: glGetUniformfv(from, source, f); glUniform2fv(target, 1, f); break;
+            case GL_FLOAT_VEC3: glGetUniformfv(from, source, f); glUniform3fv(target, 1, f); break;
+            case GL_FLOAT_VEC4: glGetUniformfv(from, source, f); glUniform4fv(target, 1, f); break;
+            case GL_FLOAT_MAT2: glGetUniformfv(from, source, f); glUniformMatrix2fv(target, 1, GL_FALSE, f); break;
+            case GL_FLOAT_MAT3: glGetUniformfv(from, source, f); glUniformMatrix3fv(target, 1, GL_FALSE, f); break;
+            case GL_FLOAT_MAT4: glGetUniformfv(from, source, f); glUniformMatrix4fv(target, 1, GL_FALSE, f); break;
+            case GL_FLOAT_MAT2x3: glGetUniformfv(from, source, f); glUniformMatrix2x3fv(target, 1, GL_FALSE, f); break;
+            case GL_FLOAT_MAT2x4: glGetUniformfv(from, source, f); glUniformMatrix2x4fv(target, 1, GL_FALSE, f); break;
+            case GL_FLOAT_MAT3x2: glGetUniformfv(from, source, f); glUniformMatrix3x2fv(target, 1, GL_FALSE, f); break;
+            case GL_FLOAT_MAT3x4: glGetUniformfv(from, source, f); glUniformMatrix3x4fv(target, 1, GL_FALSE, f); break;
+            case GL_FLOAT_MAT4x2: glGetUniformfv(from, source, f); glUniformMatrix4x2fv(target, 1, GL_FALSE, f); break;
+            case GL_FLOAT_MAT4x3: glGetUniformfv(from, source, f); glUniformMatrix4x3fv(target, 1, GL_FALSE, f); break;
+            case GL_INT_VEC2: case GL_BOOL_VEC2: glGetUniformiv(from, source, i); glUniform2iv(target, 1, i); break;
+            case GL_INT_VEC3: case GL_BOOL_VEC3: glGetUniformiv(from, source, i); glUniform3iv(target, 1, i); break;
+            case GL_INT_VEC4: case GL_BOOL_VEC4: glGetUniformiv(from, source, i); glUniform4iv(target, 1, i); break;
+            case GL_UNSIGNED_INT: glGetUniformuiv(from, source, u); glUniform1uiv(target, 1, u); break;
+            case GL_UNSIGNED_INT_VEC2: glGetUniformuiv(from, source, u); glUniform2uiv(target, 1, u); break;
+            case GL_UNSIGNED_INT_VEC3: glGetUniformuiv(from, source, u); glUniform3uiv(target, 1, u); break;
+            case GL_UNSIGNED_INT_VEC4: glGetUniformuiv(from, source, u); glUniform4uiv(target, 1, u); break;
+            // int, bool and every sampler and image type
+            default: glGetUniformiv(from, source, i); glUniform1iv(target, 1, i); break;
+        }
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    GLint checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -199,6 +450,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success;
     }
 };
 #endif
@@ -0,0 +1,266 @@
+//
+// A second UV set for lightmaps, generated at import time. Triangles are grouped into charts: connected triangles
+// whose normals point the same way along the same major axis, so each chart projects onto that axis' plane without
+// any triangle turning over. The charts are shelf packed into one Resolution sized atlas for the whole model, scaled
+// by one texel density so every surface gets texels in proportion to its area, with Padding texels between charts for
+// the bilinear filter. Vertices on a seam between charts are split. Everything is sorted, not hashed, so a model always
+// gets the same layout: lightmap_baker and the runtime rely on it. The baked light is stored next to the model as
+// <model>.lightmap.ctex, RGBM encoded so it survives BC3: rgb times alpha times Range is the light.
+//
+
+#ifndef PROJECT_BASE_LIGHTMAP_H
+#define PROJECT_BASE_LIGHTMAP_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Lightmap {
+
+// texels along each side of a model's lightmap
+const int Resolution = 1024;
+// at least this many texels separate two charts
+const int Padding = 3;
+// the brightest light an RGBM texel holds, model_shader.fs decodes with the same factor
+const float Range = 8.0f;
+
+// where lightmap_baker writes the lightmap of the model at path
+inline std::string Path(const std::string &model) {
+    return model + ".lightmap.ctex";
+}
+
+// off by default, the runtime, asset_cooker and lightmap_baker turn it on so their caches carry the same flag
+inline std::atomic<bool> &enabledFlag() {
+    static std::atomic<bool> enabled(false);
+    return enabled;
+}
+
+inline void SetEnabled(bool enabled) {
+    enabledFlag().store(enabled);
+}
+
+inline bool Enabled() {
+    return enabledFlag().load();
+}
+
+struct Chart {
+    unsigned int mesh;
+    // 0 to 5: +x, -x, +y, -y, +z, -z
+    int axis;
+    std::vector<unsigned int> triangles;
+    // bounds of the projected triangles, in model units
+    glm::vec2 lower, upper;
+    // the chart's rectangle in the atlas, in texels
+    int x = 0, y = 0, width = 0, height = 0;
+};
+
+inline glm::vec2 project(const glm::vec3 &position, int axis) {
+    int major = axis / 2;
+    return glm::vec2(position[(major + 1) % 3], position[(major + 2) % 3]);
+}
+
+inline int majorAxis(const glm::vec3 &normal) {
+    glm::vec3 magnitude(std::fabs(normal.x), std::fabs(normal.y), std::fabs(normal.z));
+    int major = magnitude.x >= magnitude.y ? (magnitude.x >= magnitude.z ? 0 : 2) : (magnitude.y >= magnitude.z ? 1 : 2);
+    return major * 2 + (normal[major] < 0.0f ? 1 : 0);
+}
+
+// the charts of one mesh. Triangles are connected across edges whose end positions match exactly, vertices of a hard
+// edge are usually separate but sit in the same place
+template<typename VertexType>
+void buildCharts(unsigned int mesh, const std::vector<VertexType> &vertices, const std::vector<unsigned int> &indices,
+                 std::vector<Chart> &charts) {
+    unsigned int triangleCount = (unsigned int) (indices.size() / 3);
+    // one id per distinct position
+    std::vector<unsigned int> order(vertices.size()), welded(vertices.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
+    auto less = [&](unsigned int a, unsigned int b) {
+        const glm::vec3 &p = vertices[a].Position, &q = vertices[b].Position;
+        return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z != q.z ? p.z < q.z : a < b;
+    };
+    std::sort(order.begin(), order.end(), less);
+    unsigned int id = 0;
+    for (unsigned int i = 0; i < order.size(); i++) {
+        if (i > 0 && vertices[order[i]].Position != vertices[order[i - 1]].Position)
+            id++;
+        welded[order[i]] = id;
+    }
+
+    // every edge once per triangle, sorted so the triangles sharing it are next to each other
+    struct Edge {
+        unsigned int a, b, triangle;
+        bool operator<(const Edge &other) const {
+            return a != other.a ? a < other.a : b != other.b ? b < other.b : triangle < other.triangle;
+        }
+    };
+    std::vector<Edge> edges;
+    edges.reserve(indices.size());
+    std::vector<int> axes(triangleCount);
+    for (unsigned int t = 0; t < triangleCount; t++) {
+        const glm::vec3 &p0 = vertices[indices[3 * t]].Position, &p1 = vertices[indices[3 * t + 1]].Position,
+                &p2 = vertices[indices[3 * t + 2]].Position;
+        axes[t] = majorAxis(glm::cross(p1 - p0, p2 - p0));
+        for (int corner = 0; corner < 3; corner++) {
+            unsigned int a = welded[indices[3 * t + corner]], b = welded[indices[3 * t + (corner + 1) % 3]];
+            edges.push_back(Edge{std::min(a, b), std::max(a, b), t});
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    // neighbours of triangle t are neighbours[offsets[t] .. offsets[t + 1])
+    std::vector<unsigned int> offsets(triangleCount + 1, 0), neighbours;
+    std::vector<std::pair<unsigned int, unsigned int>> pairs;
+    for (size_t begin = 0, end; begin < edges.size(); begin = end) {
+        for (end = begin + 1; end < edges.size() && edges[end].a == edges[begin].a && edges[end].b == edges[begin].b;)
+            end++;
+        for (size_t i = begin; i < end; i++)
+            for (size_t j = begin; j < end; j++)
+                if (i != j)
+                    pairs.emplace_back(edges[i].triangle, edges[j].triangle);
+    }
+    std::sort(pairs.begin(), pairs.end());
+    for (const auto &pair: pairs) {
+        offsets[pair.first + 1]++;
+        neighbours.push_back(pair.second);
+    }
+    for (unsigned int t = 0; t < triangleCount; t++)
+        offsets[t + 1] += offsets[t];
+
+    std::vector<bool> assigned(triangleCount, false);
+    std::vector<unsigned int> queue;
+    for (unsigned int seed = 0; seed < triangleCount; seed++) {
+        if (assigned[seed])
+            continue;
+        Chart chart;
+        chart.mesh = mesh;
+        chart.axis = axes[seed];
+        assigned[seed] = true;
+        queue.assign(1, seed);
+        for (size_t next = 0; next < queue.size(); next++) {
+            unsigned int t = queue[next];
+            chart.triangles.push_back(t);
+            for (unsigned int i = offsets[t]; i < offsets[t + 1]; i++) {
+                unsigned int neighbour = neighbours[i];
+                if (!assigned[neighbour] && axes[neighbour] == chart.axis) {
+                    assigned[neighbour] = true;
+                    queue.push_back(neighbour);
+                }
+            }
+        }
+        chart.lower = glm::vec2(1e30f);
+        chart.upper = glm::vec2(-1e30f);
+        for (unsigned int t: chart.triangles)
+            for (int corner = 0; corner < 3; corner++) {
+                glm::vec2 uv = project(vertices[indices[3 * t + corner]].Position, chart.axis);
+                chart.lower = glm::min(chart.lower, uv);
+                chart.upper = glm::max(chart.upper, uv);
+            }
+        charts.push_back(std::move(chart));
+    }
+}
+
+// shelf packs the charts at density texels per unit, tallest first. False when they do not fit
+inline bool pack(std::vector<Chart> &charts, const std::vector<unsigned int> &order, float density) {
+    for (Chart &chart: charts) {
+        glm::vec2 extent = (chart.upper - chart.lower) * density;
+        // the texel centres covered plus the padding around them
+        chart.width = (int) std::ceil(extent.x) + 1 + Padding;
+        chart.height = (int) std::ceil(extent.y) + 1 + Padding;
+        if (chart.width > Resolution || chart.height > Resolution)
+            return false;
+    }
+    int x = 0, y = 0, shelfHeight = 0;
+    for (unsigned int i: order) {
+        Chart &chart = charts[i];
+        if (x + chart.width > Resolution) {
+            x = 0;
+            y += shelfHeight;
+            shelfHeight = 0;
+        }
+        if (y + chart.height > Resolution)
+            return false;
+        chart.x = x;
+        chart.y = y;
+        x += chart.width;
+        shelfHeight = std::max(shelfHeight, chart.height);
+    }
+    return true;
+}
+
+// replaces the vertices and indices of every mesh, each a struct with vertices and indices like MeshData, by ones
+// with LightmapCoords set. All the meshes share one atlas, they are meant to be the parts of one model
+template<typename MeshType>
+bool Generate(std::vector<MeshType> &meshes) {
+    std::vector<Chart> charts;
+    for (unsigned int m = 0; m < meshes.size(); m++)
+        buildCharts(m, meshes[m].vertices, meshes[m].indices, charts);
+    if (charts.empty())
+        return true;
+
+    double area = 0.0;
+    for (const Chart &chart: charts)
+        area += (double) (chart.upper.x - chart.lower.x) * (chart.upper.y - chart.lower.y);
+    std::vector<unsigned int> order(charts.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+        float ha = charts[a].upper.y - charts[a].lower.y, hb = charts[b].upper.y - charts[b].lower.y;
+        return ha != hb ? ha > hb : a < b;
+    });
+    // start from the density that would fill the atlas if nothing was wasted, back off until everything fits
+    float density = (float) std::sqrt((double) Resolution * Resolution / std::max(area, 1e-12));
+    int attempt = 0;
+    while (!pack(charts, order, density)) {
+        if (++attempt == 100) {
+            std::cout << "ERROR::LIGHTMAP::TOO_MANY_CHARTS " << charts.size() << std::endl;
+            return false;
+        }
+        density *= 0.92f;
+    }
+    // the chart's projection starts this far into its rectangle, half the padding is left on either side
+    const float margin = 0.5f * (Padding + 1);
+
+    // one new vertex per original vertex and chart it is used in, in the order they are first met
+    std::vector<std::map<unsigned int, unsigned int>> remap(meshes.size());
+    std::vector<decltype(MeshType::vertices)> vertices(meshes.size());
+    std::vector<std::vector<unsigned int>> indices(meshes.size());
+    for (unsigned int m = 0; m < meshes.size(); m++)
+        indices[m].resize(meshes[m].indices.size());
+    for (unsigned int c = 0; c < charts.size(); c++) {
+        const Chart &chart = charts[c];
+        const auto &source = meshes[chart.mesh];
+        std::map<unsigned int, unsigned int> &split = remap[chart.mesh];
+        split.clear();
+        for (unsigned int t: chart.triangles)
+            for (int corner = 0; corner < 3; corner++) {
+                unsigned int original = source.indices[3 * t + corner];
+                auto found = split.emplace(original, (unsigned int) vertices[chart.mesh].size());
+                if (found.second) {
+                    auto vertex = source.vertices[original];
+                    glm::vec2 texel = glm::vec2(chart.x + margin, chart.y + margin) +
+                                      (project(vertex.Position, chart.axis) - chart.lower) * density;
+                    for (int k = 0; k < 2; k++)
+                        vertex.LightmapCoords[k] = (unsigned short) std::lround(
+                                glm::clamp(texel[k] / Resolution, 0.0f, 1.0f) * 65535.0f);
+                    vertices[chart.mesh].push_back(vertex);
+                }
+                indices[chart.mesh][3 * t + corner] = found.first->second;
+            }
+    }
+    for (unsigned int m = 0; m < meshes.size(); m++) {
+        meshes[m].vertices.swap(vertices[m]);
+        meshes[m].indices.swap(indices[m]);
+    }
+    return true;
+}
+
+}
+
+#endif //PROJECT_BASE_LIGHTMAP_H
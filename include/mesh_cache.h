@@ -0,0 +1,288 @@
+//
+// Binary cache of imported model geometry, written next to the source file as <path>.meshcache. Holds the vertices,
+// the meshlet ordered indices, the meshlets and the texture references of every mesh, so a warm start skips Assimp
+// and the meshlet build. A cache is stale when the source's size or modification time changed. A cooked cache, written
+// by asset_cooker, is stamped 0 instead so the same source always cooks to the same bytes, and is used until the
+// source is edited after it.
+// The file starts with a coarse copy of the model, simplified meshes and small texture thumbnails, followed by the
+// offset of every full mesh: reading just the front is enough to draw something, the rest can follow mesh by mesh.
+//
+
+#ifndef PROJECT_BASE_MESH_CACHE_H
+#define PROJECT_BASE_MESH_CACHE_H
+
+#include <learnopengl/filesystem.h>
+#include <learnopengl/mesh.h>
+
+#include <meshlet.h>
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// one mesh as it comes out of the importer, before any GL object exists
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<Meshlet> meshlets;
+    // only type and path are meaningful, the textures are loaded after the geometry
+    std::vector<Texture> textures;
+};
+
+// square RGBA8 stand-in for a texture
+struct TextureThumbnail {
+    std::string path;
+    std::vector<unsigned char> pixels;
+};
+
+// the front of a cache file
+struct CoarseModel {
+    // simplified geometry without meshlets, with the texture references of the full meshes
+    std::vector<MeshData> meshes;
+    std::vector<TextureThumbnail> thumbnails;
+    // where each full mesh starts in the file, for LoadMesh
+    std::vector<uint64_t> fullOffsets;
+    uint64_t fullVertices = 0;
+    uint64_t fullIndices = 0;
+    // as the cache was written, see the flags below
+    uint32_t flags = 0;
+};
+
+namespace MeshCache {
+
+const uint32_t Version = 4;
+const int ThumbnailSize = 64;
+// set when meshes sharing a material were merged into one, the layout differs from a plain import
+const uint32_t MergedByMaterial = 1u << 0;
+// set when the vertices carry baked occlusion, see vertex_occlusion.h
+const uint32_t BakedOcclusion = 1u << 1;
+// set when the vertices carry a lightmap layout, see lightmap.h
+const uint32_t LightmapCoords = 1u << 2;
+// set instead of LightmapCoords when no layout fit the atlas, the cache still stands for the same import
+const uint32_t LightmapFailed = 1u << 3;
+
+// changes whenever the source file does, 0 when it cannot be read
+inline uint64_t SourceStamp(const std::string &path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return 0;
+    return ((uint64_t) info.st_size << 32) ^ (uint64_t) info.st_mtime;
+}
+
+template<typename T>
+void writeValue(std::ofstream &out, const T &value) {
+    out.write((const char *) &value, sizeof(T));
+}
+
+template<typename T>
+void writeArray(std::ofstream &out, const std::vector<T> &values) {
+    writeValue(out, (uint32_t) values.size());
+    out.write((const char *) values.data(), values.size() * sizeof(T));
+}
+
+inline void writeString(std::ofstream &out, const std::string &value) {
+    writeValue(out, (uint32_t) value.size());
+    out.write(value.data(), value.size());
+}
+
+// a cache file opened through the virtual file system, read in place
+struct Reader {
+    FileView file;
+    size_t position = 0;
+
+    bool Open(const std::string &cachePath) {
+        file = FileSystem::open(cachePath);
+        position = 0;
+        return (bool) file;
+    }
+
+    bool Read(void *out, size_t bytes) {
+        if (bytes > file.size - position)
+            return false;
+        std::memcpy(out, file.data + position, bytes);
+        position += bytes;
+        return true;
+    }
+
+    bool Seek(uint64_t offset) {
+        if (offset > file.size)
+            return false;
+        position = offset;
+        return true;
+    }
+
+    size_t Remaining() const {
+        return file.size - position;
+    }
+};
+
+template<typename T>
+bool readValue(Reader &in, T &value) {
+    return in.Read(&value, sizeof(T));
+}
+
+template<typename T>
+bool readArray(Reader &in, std::vector<T> &values) {
+    uint32_t count;
+    // a damaged count must not allocate past the end of the file
+    if (!readValue(in, count) || (size_t) count * sizeof(T) > in.Remaining())
+        return false;
+    values.resize(count);
+    return in.Read(values.data(), (size_t) count * sizeof(T));
+}
+
+inline bool readString(Reader &in, std::string &value) {
+    uint32_t length;
+    if (!readValue(in, length) || length > 4096 || length > in.Remaining())
+        return false;
+    value.resize(length);
+    return in.Read(&value[0], length);
+}
+
+// the struct sizes are part of the header so a layout change invalidates old caches
+inline void header(uint32_t words[6], uint64_t stamp, uint32_t flags) {
+    std::memcpy(&words[0], "PBMC", 4);
+    words[1] = Version;
+    words[2] = sizeof(Vertex);
+    words[3] = sizeof(Meshlet);
+    words[4] = flags;
+    words[5] = (uint32_t) (stamp ^ (stamp >> 32));
+}
+
+// false when there is no usable cache. A cache without its source (stamp 0) is still accepted, so shipped builds
+// can drop the source models, and so is a cooked one. A cache whose lightmap layout failed stands in for one with
+// LightmapCoords, coarse.flags tells them apart
+inline bool LoadCoarse(Reader &in, uint64_t stamp, uint32_t flags, CoarseModel &coarse) {
+    uint32_t expected[6], found[6];
+    header(expected, stamp, flags);
+    if (!in.Read(found, sizeof(found)) || std::memcmp(expected, found, 4 * sizeof(uint32_t)) != 0 ||
+        (stamp != 0 && found[5] != 0 && expected[5] != found[5]))
+        return false;
+    if (found[4] != flags &&
+        !((flags & LightmapCoords) && found[4] == ((flags & ~LightmapCoords) | LightmapFailed)))
+        return false;
+    coarse.flags = found[4];
+
+    uint32_t meshCount, thumbnailCount;
+    if (!readValue(in, meshCount))
+        return false;
+    coarse.meshes.assign(meshCount, MeshData());
+    for (MeshData &mesh: coarse.meshes) {
+        uint32_t textureCount;
+        if (!readArray(in, mesh.vertices) || !readArray(in, mesh.indices) || !readValue(in, textureCount))
+            return false;
+        mesh.textures.resize(textureCount);
+        for (Texture &texture: mesh.textures) {
+            texture.id = 0;
+            if (!readString(in, texture.type) || !readString(in, texture.path))
+                return false;
+        }
+    }
+    if (!readValue(in, thumbnailCount))
+        return false;
+    coarse.thumbnails.resize(thumbnailCount);
+    for (TextureThumbnail &thumbnail: coarse.thumbnails)
+        if (!readString(in, thumbnail.path) || !readArray(in, thumbnail.pixels) ||
+            thumbnail.pixels.size() != (size_t) ThumbnailSize * ThumbnailSize * 4)
+            return false;
+    coarse.fullOffsets.resize(meshCount);
+    return readValue(in, coarse.fullVertices) && readValue(in, coarse.fullIndices) &&
+           in.Read(coarse.fullOffsets.data(), meshCount * sizeof(uint64_t));
+}
+
+inline bool LoadCoarse(const std::string &cachePath, uint64_t stamp, uint32_t flags, CoarseModel &coarse) {
+    Reader in;
+    return in.Open(cachePath) && LoadCoarse(in, stamp, flags, coarse);
+}
+
+// one full mesh, offset from CoarseModel::fullOffsets. The textures are in the coarse mesh of the same index.
+inline bool LoadMesh(Reader &in, uint64_t offset, MeshData &mesh) {
+    return in.Seek(offset) && readArray(in, mesh.vertices) && readArray(in, mesh.indices) &&
+           readArray(in, mesh.meshlets);
+}
+
+// every full mesh at once, foundFlags gets the flags the cache was written with
+inline bool Load(const std::string &cachePath, uint64_t stamp, uint32_t flags, std::vector<MeshData> &meshes,
+                 uint32_t *foundFlags = nullptr) {
+    Reader in;
+    CoarseModel coarse;
+    if (!in.Open(cachePath) || !LoadCoarse(in, stamp, flags, coarse))
+        return false;
+    if (foundFlags)
+        *foundFlags = coarse.flags;
+    meshes.assign(coarse.meshes.size(), MeshData());
+    for (size_t i = 0; i < meshes.size(); i++) {
+        if (!LoadMesh(in, coarse.fullOffsets[i], meshes[i])) {
+            meshes.clear();
+            return false;
+        }
+        meshes[i].textures = coarse.meshes[i].textures;
+    }
+    return true;
+}
+
+inline bool Save(const std::string &cachePath, uint64_t stamp, uint32_t flags, const std::vector<MeshData> &meshes,
+                 const CoarseModel &coarse) {
+    // written under a temporary name first, a crash mid write must not leave a truncated cache behind
+    std::string temporary = cachePath + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << "ERROR::MESH_CACHE::CANNOT_WRITE " << cachePath << std::endl;
+            return false;
+        }
+        uint32_t words[6];
+        header(words, stamp, flags);
+        out.write((const char *) words, sizeof(words));
+        writeValue(out, (uint32_t) meshes.size());
+        for (const MeshData &mesh: coarse.meshes) {
+            writeArray(out, mesh.vertices);
+            writeArray(out, mesh.indices);
+            writeValue(out, (uint32_t) mesh.textures.size());
+            for (const Texture &texture: mesh.textures) {
+                writeString(out, texture.type);
+                writeString(out, texture.path);
+            }
+        }
+        writeValue(out, (uint32_t) coarse.thumbnails.size());
+        for (const TextureThumbnail &thumbnail: coarse.thumbnails) {
+            writeString(out, thumbnail.path);
+            writeArray(out, thumbnail.pixels);
+        }
+        uint64_t fullVertices = 0, fullIndices = 0;
+        for (const MeshData &mesh: meshes) {
+            fullVertices += mesh.vertices.size();
+            fullIndices += mesh.indices.size();
+        }
+        writeValue(out, fullVertices);
+        writeValue(out, fullIndices);
+
+        // the offsets are only known once the meshes are written, their table is filled in afterwards
+        std::streampos table = out.tellp();
+        std::vector<uint64_t> offsets(meshes.size());
+        out.write((const char *) offsets.data(), offsets.size() * sizeof(uint64_t));
+        for (size_t i = 0; i < meshes.size(); i++) {
+            offsets[i] = (uint64_t) out.tellp();
+            writeArray(out, meshes[i].vertices);
+            writeArray(out, meshes[i].indices);
+            writeArray(out, meshes[i].meshlets);
+        }
+        out.seekp(table);
+        out.write((const char *) offsets.data(), offsets.size() * sizeof(uint64_t));
+        if (!out) {
+            std::cout << "ERROR::MESH_CACHE::CANNOT_WRITE " << cachePath << std::endl;
+            return false;
+        }
+    }
+    return std::rename(temporary.c_str(), cachePath.c_str()) == 0;
+}
+
+}
+
+#endif //PROJECT_BASE_MESH_CACHE_H
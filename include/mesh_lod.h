@@ -0,0 +1,81 @@
+//
+// Coarse levels of detail by vertex clustering: the mesh's bounding box is cut into a grid, every vertex in a cell
+// (and facing the same way) collapses into one, and triangles whose corners collapsed together disappear. Crude
+// next to edge collapse, but linear time and good enough for the stand-in drawn while the full mesh streams in.
+//
+
+#ifndef PROJECT_BASE_MESH_LOD_H
+#define PROJECT_BASE_MESH_LOD_H
+
+#include <learnopengl/mesh.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace MeshLod {
+
+// cells along the longest side of the bounding box
+const unsigned int CoarseResolution = 16;
+
+// simplified copy of vertices/indices with its own compact vertex list
+inline void Simplify(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices,
+                     unsigned int resolution, std::vector<Vertex> &outVertices, std::vector<unsigned int> &outIndices) {
+    outVertices.clear();
+    outIndices.clear();
+    if (vertices.empty())
+        return;
+    glm::vec3 min = vertices[0].Position, max = vertices[0].Position;
+    for (const Vertex &vertex: vertices) {
+        min = glm::min(min, vertex.Position);
+        max = glm::max(max, vertex.Position);
+    }
+    glm::vec3 extent = max - min;
+    float cell = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f)) / resolution;
+
+    // cell coordinates and the octant of the normal, so the two sides of a thin wall do not merge
+    std::unordered_map<uint64_t, unsigned int> clusters;
+    std::vector<unsigned int> remap(vertices.size());
+    std::vector<unsigned int> members;
+    for (size_t i = 0; i < vertices.size(); i++) {
+        glm::uvec3 c = glm::uvec3(glm::min((vertices[i].Position - min) / cell, glm::vec3(resolution)));
+        const glm::vec3 &n = vertices[i].Normal;
+        uint64_t octant = (n.x < 0.0f ? 1 : 0) | (n.y < 0.0f ? 2 : 0) | (n.z < 0.0f ? 4 : 0);
+        uint64_t key = (uint64_t) c.x | ((uint64_t) c.y << 20) | ((uint64_t) c.z << 40) | (octant << 60);
+        auto found = clusters.emplace(key, (unsigned int) outVertices.size());
+        if (found.second) {
+            outVertices.push_back(vertices[i]);
+            outVertices.back().Position = glm::vec3(0.0f);
+            outVertices.back().Normal = glm::vec3(0.0f);
+            members.push_back(0);
+        }
+        unsigned int cluster = found.first->second;
+        // positions and normals average, the rest comes from the cluster's first vertex
+        outVertices[cluster].Position += vertices[i].Position;
+        outVertices[cluster].Normal += vertices[i].Normal;
+        members[cluster]++;
+        remap[i] = cluster;
+    }
+    for (size_t i = 0; i < outVertices.size(); i++) {
+        outVertices[i].Position /= (float) members[i];
+        float length = glm::length(outVertices[i].Normal);
+        if (length > 0.0f)
+            outVertices[i].Normal /= length;
+    }
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        unsigned int a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+        if (a == b || b == c || a == c)
+            continue;
+        outIndices.push_back(a);
+        outIndices.push_back(b);
+        outIndices.push_back(c);
+    }
+}
+
+}
+
+#endif //PROJECT_BASE_MESH_LOD_H
@@ -0,0 +1,296 @@
+//
+// Meshlets: small clusters of triangles (at most 64 vertices / 124 triangles) laid out as contiguous ranges of a
+// mesh's index buffer, each with a bounding sphere and a normal cone. Culling them four at a time with SSE rejects
+// clusters that are off screen or face away from the camera; surviving neighbours merge back into longer draws.
+//
+
+#ifndef PROJECT_BASE_MESHLET_H
+#define PROJECT_BASE_MESHLET_H
+
+#include <glm/glm.hpp>
+
+#include <frustum.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MESHLET_SSE2 1
+#endif
+
+struct Meshlet {
+    // model space bounding sphere, xyz center and w radius
+    glm::vec4 sphere;
+    // xyz average normal, w sine of the normal spread; above 1 when the normals are too spread to ever cull
+    glm::vec4 cone;
+    // range inside the mesh's index buffer
+    unsigned int firstIndex;
+    unsigned int indexCount;
+};
+
+// structure of arrays copy of the meshlet bounds, padded to a multiple of four for the SSE loop
+struct MeshletCullData {
+    std::vector<float> x, y, z, radius;
+    std::vector<float> axisX, axisY, axisZ, cutoff;
+
+    void Build(const std::vector<Meshlet> &meshlets) {
+        size_t padded = (meshlets.size() + 3) & ~size_t(3);
+        for (std::vector<float> *v: {&x, &y, &z, &radius, &axisX, &axisY, &axisZ, &cutoff})
+            v->assign(padded, 0.0f);
+        for (size_t i = 0; i < meshlets.size(); i++) {
+            x[i] = meshlets[i].sphere.x;
+            y[i] = meshlets[i].sphere.y;
+            z[i] = meshlets[i].sphere.z;
+            radius[i] = meshlets[i].sphere.w;
+            axisX[i] = meshlets[i].cone.x;
+            axisY[i] = meshlets[i].cone.y;
+            axisZ[i] = meshlets[i].cone.z;
+            cutoff[i] = meshlets[i].cone.w;
+        }
+        // padding lanes sit behind every plane and are never reported
+        for (size_t i = meshlets.size(); i < padded; i++)
+            radius[i] = -1.0e30f;
+    }
+};
+
+// per model inputs of the meshlet culling, moved into the model's own space once so no meshlet needs transforming.
+// the cone test assumes the model matrix scales uniformly.
+struct MeshletCulling {
+    Frustum frustum;
+    glm::vec3 camera;
+    bool cone;
+    // meshlets of the meshes tested and of those that survived
+    unsigned int total = 0;
+    unsigned int visible = 0;
+    // visible ranges of the last culled mesh, reused between meshes
+    std::vector<int> counts;
+    std::vector<const void *> offsets;
+    std::vector<int> baseVertices;
+
+    MeshletCulling(const glm::mat4 &viewProjection, const glm::mat4 &transform, const glm::vec3 &cameraPosition, bool cone)
+        : frustum(viewProjection * transform),
+          camera(glm::vec3(glm::inverse(transform) * glm::vec4(cameraPosition, 1.0f))), cone(cone) {}
+};
+
+namespace Meshlets {
+
+const unsigned int MaxVertices = 64;
+const unsigned int MaxTriangles = 124;
+
+inline Meshlet computeBounds(const std::vector<glm::vec3> &positions, const unsigned int *indices, unsigned int indexCount) {
+    glm::vec3 min(1.0e30f), max(-1.0e30f);
+    for (unsigned int i = 0; i < indexCount; i++) {
+        min = glm::min(min, positions[indices[i]]);
+        max = glm::max(max, positions[indices[i]]);
+    }
+    glm::vec3 center = (min + max) * 0.5f;
+    float radius = 0.0f;
+    for (unsigned int i = 0; i < indexCount; i++)
+        radius = std::max(radius, glm::length(positions[indices[i]] - center));
+
+    // counter clockwise front faces, same as GL's default
+    std::vector<glm::vec3> normals;
+    glm::vec3 axis(0.0f);
+    for (unsigned int i = 0; i + 2 < indexCount; i += 3) {
+        glm::vec3 a = positions[indices[i]], b = positions[indices[i + 1]], c = positions[indices[i + 2]];
+        glm::vec3 n = glm::cross(b - a, c - a);
+        float length = glm::length(n);
+        if (length <= 1.0e-12f)
+            continue;
+        normals.push_back(n / length);
+        axis += normals.back();
+    }
+    float cutoff = 2.0f;
+    float axisLength = glm::length(axis);
+    if (axisLength > 1.0e-6f) {
+        axis /= axisLength;
+        float minDot = 1.0f;
+        for (const glm::vec3 &n: normals)
+            minDot = std::min(minDot, glm::dot(n, axis));
+        // a cone wider than ~84 degrees is never fully back facing from outside the sphere
+        if (minDot > 0.1f)
+            cutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+
+    Meshlet meshlet;
+    meshlet.sphere = glm::vec4(center, radius);
+    meshlet.cone = glm::vec4(axis, cutoff);
+    meshlet.firstIndex = 0;
+    meshlet.indexCount = indexCount;
+    return meshlet;
+}
+
+// clusters the triangles greedily, growing each meshlet through the triangles sharing the most vertices with it.
+// indices is rewritten so every meshlet is one contiguous range.
+template<typename VertexType>
+std::vector<Meshlet> Build(const std::vector<VertexType> &vertices, std::vector<unsigned int> &indices) {
+    std::vector<Meshlet> meshlets;
+    unsigned int triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return meshlets;
+
+    std::vector<glm::vec3> positions(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+        positions[i] = vertices[i].Position;
+
+    // triangles around each vertex
+    std::vector<unsigned int> offsets(vertices.size() + 1, 0);
+    for (unsigned int i = 0; i < triangleCount * 3; i++)
+        offsets[indices[i] + 1]++;
+    for (size_t i = 0; i < vertices.size(); i++)
+        offsets[i + 1] += offsets[i];
+    std::vector<unsigned int> adjacency(triangleCount * 3);
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (unsigned int i = 0; i < triangleCount * 3; i++)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    std::vector<bool> emitted(triangleCount, false);
+    // meshlet a vertex was last added to, +1 so zero means none
+    std::vector<unsigned int> vertexMeshlet(vertices.size(), 0);
+    std::vector<unsigned int> reordered;
+    reordered.reserve(indices.size());
+    std::vector<unsigned int> candidates;
+    unsigned int seed = 0;
+
+    while (true) {
+        while (seed < triangleCount && emitted[seed])
+            seed++;
+        if (seed == triangleCount)
+            break;
+
+        unsigned int stamp = meshlets.size() + 1;
+        unsigned int first = reordered.size();
+        unsigned int vertexCount = 0, triangles = 0;
+        candidates.assign(1, seed);
+
+        while (triangles < MaxTriangles && !candidates.empty()) {
+            // the candidate adding the fewest new vertices
+            int best = -1;
+            unsigned int bestNew = 4;
+            for (size_t c = 0; c < candidates.size(); c++) {
+                unsigned int t = candidates[c];
+                if (emitted[t])
+                    continue;
+                unsigned int fresh = 0;
+                for (int k = 0; k < 3; k++)
+                    fresh += vertexMeshlet[indices[t * 3 + k]] != stamp;
+                if (fresh < bestNew && vertexCount + fresh <= MaxVertices) {
+                    best = (int) c;
+                    bestNew = fresh;
+                    if (fresh == 0)
+                        break;
+                }
+            }
+            if (best < 0)
+                break;
+
+            unsigned int t = candidates[best];
+            candidates[best] = candidates.back();
+            candidates.pop_back();
+            emitted[t] = true;
+            triangles++;
+            for (int k = 0; k < 3; k++) {
+                unsigned int v = indices[t * 3 + k];
+                reordered.push_back(v);
+                if (vertexMeshlet[v] == stamp)
+                    continue;
+                vertexMeshlet[v] = stamp;
+                vertexCount++;
+                for (unsigned int a = offsets[v]; a < offsets[v + 1]; a++)
+                    if (!emitted[adjacency[a]])
+                        candidates.push_back(adjacency[a]);
+            }
+            // drop the stale entries once in a while so the scan stays short
+            if (candidates.size() > 512)
+                candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                                [&](unsigned int c) { return emitted[c]; }), candidates.end());
+        }
+
+        Meshlet meshlet = computeBounds(positions, reordered.data() + first, reordered.size() - first);
+        meshlet.firstIndex = first;
+        meshlets.push_back(meshlet);
+    }
+
+    indices.swap(reordered);
+    return meshlets;
+}
+
+// true when the meshlet can be skipped. planes are the frustum planes in the mesh's model space, normalized,
+// camera is the camera position in the same space
+inline bool culled(const MeshletCullData &data, size_t i, const glm::vec4 planes[6], const glm::vec3 &camera, bool cone) {
+    glm::vec3 center(data.x[i], data.y[i], data.z[i]);
+    for (int p = 0; p < 6; p++)
+        if (glm::dot(glm::vec3(planes[p]), center) + planes[p].w < -data.radius[i])
+            return true;
+    if (!cone)
+        return false;
+    glm::vec3 view = center - camera;
+    return glm::dot(view, glm::vec3(data.axisX[i], data.axisY[i], data.axisZ[i])) >=
+           data.cutoff[i] * glm::length(view) + data.radius[i];
+}
+
+// appends the index ranges of potentially visible meshlets as (count, byte offset) pairs for
+// glMultiDrawElementsBaseVertex. Neighbouring visible meshlets are merged into one range.
+inline unsigned int Cull(const MeshletCullData &data, const std::vector<Meshlet> &meshlets, const glm::vec4 planes[6],
+                         const glm::vec3 &camera, bool cone, unsigned int baseIndex,
+                         std::vector<int> &counts, std::vector<const void *> &offsets) {
+    unsigned int visible = 0;
+    auto emit = [&](size_t i) {
+        visible++;
+        size_t offset = (size_t) (baseIndex + meshlets[i].firstIndex) * sizeof(unsigned int);
+        if (!counts.empty() && (size_t) offsets.back() + counts.back() * sizeof(unsigned int) == offset) {
+            counts.back() += meshlets[i].indexCount;
+            return;
+        }
+        counts.push_back(meshlets[i].indexCount);
+        offsets.push_back((const void *) offset);
+    };
+
+    size_t i = 0;
+#ifdef MESHLET_SSE2
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+    for (int p = 0; p < 6; p++) {
+        planeX[p] = _mm_set1_ps(planes[p].x);
+        planeY[p] = _mm_set1_ps(planes[p].y);
+        planeZ[p] = _mm_set1_ps(planes[p].z);
+        planeW[p] = _mm_set1_ps(planes[p].w);
+    }
+    __m128 camX = _mm_set1_ps(camera.x), camY = _mm_set1_ps(camera.y), camZ = _mm_set1_ps(camera.z);
+    __m128 zero = _mm_setzero_ps();
+    size_t padded = data.x.size();
+    for (; i < padded; i += 4) {
+        __m128 x = _mm_loadu_ps(&data.x[i]), y = _mm_loadu_ps(&data.y[i]), z = _mm_loadu_ps(&data.z[i]);
+        __m128 radius = _mm_loadu_ps(&data.radius[i]);
+        __m128 negRadius = _mm_sub_ps(zero, radius);
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                                         _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+        }
+        if (cone) {
+            __m128 vx = _mm_sub_ps(x, camX), vy = _mm_sub_ps(y, camY), vz = _mm_sub_ps(z, camZ);
+            __m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_loadu_ps(&data.axisX[i])),
+                                                 _mm_mul_ps(vy, _mm_loadu_ps(&data.axisY[i]))),
+                                      _mm_mul_ps(vz, _mm_loadu_ps(&data.axisZ[i])));
+            __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+            __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&data.cutoff[i]), distance), radius);
+            inside = _mm_andnot_ps(_mm_cmpge_ps(along, limit), inside);
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; lane++)
+            if (mask & (1 << lane))
+                emit(i + lane);
+    }
+#endif
+    for (; i < meshlets.size(); i++)
+        if (!culled(data, i, planes, camera, cone))
+            emit(i);
+    return visible;
+}
+
+}
+
+#endif //PROJECT_BASE_MESHLET_H
@@ -0,0 +1,139 @@
+//
+// Hash based value noise and fractal sums. The batch functions evaluate four samples at a time with SSE2
+// and fall back to the scalar path on other targets; both paths use the same hash and operation order.
+//
+
+#ifndef PROJECT_BASE_NOISE_H
+#define PROJECT_BASE_NOISE_H
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define NOISE_SSE2 1
+#endif
+
+struct FractalSettings {
+    int octaves = 6;
+    float frequency = 0.004f;
+    float lacunarity = 2.0f;
+    float gain = 0.5f;
+    float amplitude = 40.0f;
+    uint32_t seed = 1337u;
+};
+
+namespace Noise {
+
+inline uint32_t hash(int32_t x, int32_t z, uint32_t seed) {
+    uint32_t h = (uint32_t) x * 0x27d4eb2du ^ (uint32_t) z * 0x165667b1u ^ seed;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+// lattice value in [-1, 1]
+inline float lattice(int32_t x, int32_t z, uint32_t seed) {
+    return (float) (hash(x, z, seed) & 0xffffffu) * (2.0f / 16777215.0f) - 1.0f;
+}
+
+inline float fade(float t) {
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+inline float Value2D(float x, float z, uint32_t seed) {
+    float fx = std::floor(x), fz = std::floor(z);
+    int32_t ix = (int32_t) fx, iz = (int32_t) fz;
+    float u = fade(x - fx), v = fade(z - fz);
+    float a = lattice(ix, iz, seed), b = lattice(ix + 1, iz, seed);
+    float c = lattice(ix, iz + 1, seed), d = lattice(ix + 1, iz + 1, seed);
+    float top = a + (b - a) * u;
+    float bottom = c + (d - c) * u;
+    return top + (bottom - top) * v;
+}
+
+inline float Fractal(float x, float z, const FractalSettings &s) {
+    float sum = 0.0f, amp = 1.0f, freq = s.frequency;
+    for (int i = 0; i < s.octaves; i++) {
+        sum += amp * Value2D(x * freq, z * freq, s.seed + (uint32_t) i);
+        freq *= s.lacunarity;
+        amp *= s.gain;
+    }
+    return sum * s.amplitude;
+}
+
+#ifdef NOISE_SSE2
+// SSE2 has no 32 bit low multiply, build it from two 32x32->64 multiplies
+inline __m128i mullo32(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+inline __m128 lattice4(__m128i x, __m128i z, __m128i seed) {
+    __m128i h = _mm_xor_si128(_mm_xor_si128(mullo32(x, _mm_set1_epi32((int32_t) 0x27d4eb2du)),
+                                            mullo32(z, _mm_set1_epi32((int32_t) 0x165667b1u))), seed);
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+    h = mullo32(h, _mm_set1_epi32((int32_t) 0x2c1b3c6du));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 12));
+    __m128 value = _mm_cvtepi32_ps(_mm_and_si128(h, _mm_set1_epi32(0xffffff)));
+    return _mm_sub_ps(_mm_mul_ps(value, _mm_set1_ps(2.0f / 16777215.0f)), _mm_set1_ps(1.0f));
+}
+
+inline __m128 floor4(__m128 x, __m128i &ix) {
+    __m128i t = _mm_cvttps_epi32(x);
+    __m128 ft = _mm_cvtepi32_ps(t);
+    // truncation rounds towards zero, step negative non-integers down by one
+    __m128 correction = _mm_and_ps(_mm_cmpgt_ps(ft, x), _mm_set1_ps(1.0f));
+    ft = _mm_sub_ps(ft, correction);
+    ix = _mm_cvttps_epi32(ft);
+    return ft;
+}
+
+inline __m128 fade4(__m128 t) {
+    __m128 inner = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))),
+                              _mm_set1_ps(10.0f));
+    return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+}
+
+inline __m128 value2D4(__m128 x, __m128 z, __m128i seed) {
+    __m128i ix, iz;
+    __m128 fx = floor4(x, ix), fz = floor4(z, iz);
+    __m128 u = fade4(_mm_sub_ps(x, fx)), v = fade4(_mm_sub_ps(z, fz));
+    __m128i one = _mm_set1_epi32(1);
+    __m128i ix1 = _mm_add_epi32(ix, one), iz1 = _mm_add_epi32(iz, one);
+    __m128 a = lattice4(ix, iz, seed), b = lattice4(ix1, iz, seed);
+    __m128 c = lattice4(ix, iz1, seed), d = lattice4(ix1, iz1, seed);
+    __m128 top = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), u));
+    __m128 bottom = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), u));
+    return _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), v));
+}
+#endif
+
+// evaluates Fractal() for `count` points; x/z/out need no particular alignment
+inline void FractalBatch(const float *x, const float *z, float *out, int count, const FractalSettings &s) {
+    int i = 0;
+#ifdef NOISE_SSE2
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i), pz = _mm_loadu_ps(z + i);
+        __m128 sum = _mm_setzero_ps();
+        float amp = 1.0f, freq = s.frequency;
+        for (int o = 0; o < s.octaves; o++) {
+            __m128 f = _mm_set1_ps(freq);
+            __m128 n = value2D4(_mm_mul_ps(px, f), _mm_mul_ps(pz, f), _mm_set1_epi32((int32_t) (s.seed + (uint32_t) o)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(n, _mm_set1_ps(amp)));
+            freq *= s.lacunarity;
+            amp *= s.gain;
+        }
+        _mm_storeu_ps(out + i, _mm_mul_ps(sum, _mm_set1_ps(s.amplitude)));
+    }
+#endif
+    for (; i < count; i++)
+        out[i] = Fractal(x[i], z[i], s);
+}
+
+}
+
+#endif //PROJECT_BASE_NOISE_H
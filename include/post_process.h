@@ -0,0 +1,258 @@
+//
+// Post-processing chain from the HDR scene to the screen. Each stage is a #define of one fragment shader, and the
+// enabled stages are grouped into as few full-screen passes as they allow: a stage that only reads its own pixel runs
+// in the same pass as the stage before it, only a stage that reads around its pixel (FXAA) needs the picture finished
+// in a texture first and starts a new pass. Each group is a ShaderPermutations variant with the group's defines, so
+// adding a per-pixel stage costs its arithmetic, not another full-screen read and write. Work a stage needs before
+// the passes, like bloom's blur, runs in its prepare. Every prepare and every pass is timed on the GPU.
+//
+
+#ifndef PROJECT_BASE_POST_PROCESS_H
+#define PROJECT_BASE_POST_PROCESS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+#include <gpu_timer.h>
+#include <shader_batch.h>
+#include <shader_permutations.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+class PostProcess {
+public:
+    struct Stage {
+        // shown with the timings
+        std::string name;
+        // compiles the stage into the fragment shader
+        std::string define;
+        bool enabled = true;
+        // reads its input around the pixel, so it starts a pass of its own on what the pass before it finished. The
+        // chain's input itself never goes straight to it, the passes write luma to alpha for it
+        bool neighbourhood = false;
+        // leaves colours between 0 and 1, what follows can be kept in 8 bits
+        bool displayRange = false;
+        // runs before the passes with the chain's input, e.g. to blur it
+        std::function<void(GLuint input, int width, int height)> prepare;
+        // sets the stage's uniforms and binds its textures on the program of the pass it runs in
+        std::function<void(Shader &)> bind;
+    };
+
+    struct Timing {
+        std::string name;
+        float milliseconds;
+    };
+
+    PostProcess(const std::string &vertexPath, const std::string &fragmentPath)
+            : programs(vertexPath, fragmentPath) {}
+
+    PostProcess(const PostProcess &) = delete;
+    PostProcess &operator=(const PostProcess &) = delete;
+
+    // stages run in the order they are added, which has to be the order the fragment shader applies them in. The
+    // reference stays valid as more are added
+    Stage &Add(const std::string &name, const std::string &define) {
+        stages.emplace_back();
+        stages.back().name = name;
+        stages.back().define = define;
+        return stages.back();
+    }
+
+    // submits the program of every combination of stages, toggling them later never waits on the compiler
+    void Prepare(ShaderBatch &batch) {
+        // combinations share passes, each program goes in once
+        std::set<Shader *> prepared;
+        for (unsigned int mask = 0; mask < (1u << stages.size()); mask++) {
+            std::vector<unsigned int> enabled;
+            for (unsigned int i = 0; i < stages.size(); i++)
+                if (mask & (1u << i))
+                    enabled.push_back(i);
+            for (const auto &pass: group(enabled))
+                if (prepared.insert(&program(pass)).second)
+                    batch.Add(program(pass));
+        }
+    }
+
+    // runs the chain on input, a width x height texture, and writes the result to the default framebuffer. Leaves
+    // the default framebuffer bound with the full viewport and depth testing on
+    void Render(GLuint input, int width, int height) {
+        if (width <= 0 || height <= 0)
+            return;
+        if (emptyVAO == 0)
+            glGenVertexArrays(1, &emptyVAO);
+        glDisable(GL_DEPTH_TEST);
+        timings.clear();
+
+        std::vector<unsigned int> enabled;
+        for (unsigned int i = 0; i < stages.size(); i++)
+            if (stages[i].enabled)
+                enabled.push_back(i);
+        for (unsigned int i: enabled) {
+            if (!stages[i].prepare)
+                continue;
+            GpuTimer &timer = *timerFor(prepareTimers, i);
+            timer.Begin();
+            stages[i].prepare(input, width, height);
+            timer.End();
+            timings.push_back(Timing{stages[i].name, timer.Milliseconds()});
+        }
+
+        passes = group(enabled);
+        GLuint source = input;
+        bool displayRange = false;
+        glBindVertexArray(emptyVAO);
+        for (unsigned int p = 0; p < passes.size(); p++) {
+            std::string name;
+            for (unsigned int i: passes[p]) {
+                displayRange |= stages[i].displayRange;
+                name += (name.empty() ? "" : " + ") + stages[i].name;
+            }
+            bool last = p + 1 == passes.size();
+            // 8 bits once the colours are in display range, half floats before
+            Target *target = last ? nullptr : &targetFor(p, displayRange ? GL_RGBA8 : GL_RGBA16F, width, height);
+            glBindFramebuffer(GL_FRAMEBUFFER, target ? target->framebuffer : 0);
+            glViewport(0, 0, width, height);
+
+            GpuTimer &timer = *timerFor(passTimers, p);
+            timer.Begin();
+            Shader &shader = program(passes[p]);
+            shader.use();
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, source);
+            shader.setInt("source", 0);
+            shader.setVec2("texelSize", glm::vec2(1.0f) / glm::vec2(width, height));
+            for (unsigned int i: passes[p])
+                if (stages[i].bind)
+                    stages[i].bind(shader);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            timer.End();
+            timings.push_back(Timing{name.empty() ? "copy" : name, timer.Milliseconds()});
+            if (target)
+                source = target->texture;
+        }
+
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    // the stage's prepares, then one entry per pass, from the last Render. GPU times lag a few frames
+    const std::vector<Timing> &Timings() const {
+        return timings;
+    }
+
+    unsigned int PassCount() const {
+        return passes.size();
+    }
+
+    unsigned int EnabledStageCount() const {
+        unsigned int count = 0;
+        for (const Stage &stage: stages)
+            count += stage.enabled;
+        return count;
+    }
+
+    // for hot reload
+    ShaderPermutations &Programs() {
+        return programs;
+    }
+
+    // deletes the programs, textures, framebuffers and timers, call before the context goes away
+    void Release() {
+        programs.Release();
+        for (Target &target: targets) {
+            glDeleteTextures(1, &target.texture);
+            glDeleteFramebuffers(1, &target.framebuffer);
+        }
+        targets.clear();
+        for (auto &timer: prepareTimers)
+            if (timer)
+                timer->Release();
+        for (auto &timer: passTimers)
+            if (timer)
+                timer->Release();
+        prepareTimers.clear();
+        passTimers.clear();
+        glDeleteVertexArrays(1, &emptyVAO);
+        emptyVAO = 0;
+    }
+
+private:
+    struct Target {
+        GLuint texture = 0;
+        GLuint framebuffer = 0;
+        GLenum format = 0;
+        glm::ivec2 size = glm::ivec2(0);
+    };
+
+    ShaderPermutations programs;
+    std::deque<Stage> stages;
+    std::vector<std::vector<unsigned int>> passes;
+    // what pass p writes when it is not the last one
+    std::vector<Target> targets;
+    std::vector<std::unique_ptr<GpuTimer>> prepareTimers;
+    std::vector<std::unique_ptr<GpuTimer>> passTimers;
+    std::vector<Timing> timings;
+    // the full-screen triangle is made up in the vertex shader, core profiles still want a VAO bound
+    GLuint emptyVAO = 0;
+
+    // the passes the stages run in. A pass keeps taking stages until one needs its neighbours. The first pass is
+    // there even without stages, it copies the input to the screen or into a texture for the next pass
+    std::vector<std::vector<unsigned int>> group(const std::vector<unsigned int> &enabled) const {
+        std::vector<std::vector<unsigned int>> grouped(1);
+        for (unsigned int i: enabled) {
+            if (stages[i].neighbourhood)
+                grouped.emplace_back();
+            grouped.back().push_back(i);
+        }
+        return grouped;
+    }
+
+    Shader &program(const std::vector<unsigned int> &pass) {
+        ShaderDefines defines;
+        for (unsigned int i: pass)
+            defines.Set(stages[i].define);
+        return programs.Get(defines);
+    }
+
+    static std::unique_ptr<GpuTimer> &timerFor(std::vector<std::unique_ptr<GpuTimer>> &timers, unsigned int index) {
+        if (timers.size() <= index)
+            timers.resize(index + 1);
+        if (!timers[index])
+            timers[index].reset(new GpuTimer());
+        return timers[index];
+    }
+
+    Target &targetFor(unsigned int pass, GLenum format, int width, int height) {
+        if (targets.size() <= pass)
+            targets.resize(pass + 1);
+        Target &target = targets[pass];
+        if (target.format == format && target.size == glm::ivec2(width, height))
+            return target;
+        if (target.texture == 0) {
+            glGenTextures(1, &target.texture);
+            glGenFramebuffers(1, &target.framebuffer);
+        }
+        target.format = format;
+        target.size = glm::ivec2(width, height);
+        glBindTexture(GL_TEXTURE_2D, target.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA,
+                     format == GL_RGBA8 ? GL_UNSIGNED_BYTE : GL_HALF_FLOAT, nullptr);
+        // FXAA samples between texels
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
+        return target;
+    }
+};
+
+#endif //PROJECT_BASE_POST_PROCESS_H
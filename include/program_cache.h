@@ -0,0 +1,153 @@
+//
+// On-disk cache of linked program binaries (GL 4.1 glGetProgramBinary / glProgramBinary). A program is keyed by a
+// hash of its preprocessed stage sources, which already carry the permutation defines, and of the driver's vendor,
+// renderer and version strings, so a shader edit or a driver update simply misses. A binary the driver rejects is
+// deleted and the program is compiled from source as usual.
+//
+
+#ifndef PROJECT_BASE_PROGRAM_CACHE_H
+#define PROJECT_BASE_PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ProgramCache {
+
+const char *const Directory = "cache/shaders/";
+const uint32_t Magic = 0x50424743; // "CGBP"
+// anything larger is a corrupt length field
+const uint32_t MaxBinarySize = 64u << 20;
+
+inline void hashBytes(uint64_t &hash, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+inline void hashString(uint64_t &hash, const std::string &value) {
+    // the length separates neighbouring strings, "ab"+"c" and "a"+"bc" must differ
+    uint64_t length = value.size();
+    hashBytes(hash, &length, sizeof(length));
+    hashBytes(hash, value.data(), value.size());
+}
+
+inline bool Supported() {
+    static int formats = -1;
+    if (formats < 0) {
+        formats = 0;
+        if (GLAD_GL_VERSION_4_1)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    }
+    return formats > 0;
+}
+
+// FNV-1a over the driver strings, every stage and the transform feedback outputs
+inline uint64_t Key(const std::vector<std::pair<GLenum, std::string>> &stages,
+                    const std::vector<std::string> &feedbackVaryings) {
+    uint64_t hash = 14695981039346656037ull;
+    for (GLenum name: {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        const char *value = (const char *) glGetString(name);
+        hashString(hash, value ? value : "");
+    }
+    for (const auto &stage: stages) {
+        hashBytes(hash, &stage.first, sizeof(stage.first));
+        hashString(hash, stage.second);
+    }
+    for (const std::string &varying: feedbackVaryings)
+        hashString(hash, varying);
+    return hash;
+}
+
+inline std::string path(uint64_t key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long) key);
+    return std::string(Directory) + name;
+}
+
+// marks a program about to be linked so its binary can be read back afterwards
+inline void PrepareForSave(GLuint program) {
+    if (Supported())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+// true when the program was loaded from the cache and is linked
+inline bool Load(GLuint program, uint64_t key) {
+    if (!Supported())
+        return false;
+    std::ifstream in(path(key), std::ios::binary);
+    if (!in)
+        return false;
+    uint32_t magic = 0;
+    uint64_t storedKey = 0;
+    GLenum format = 0;
+    uint32_t length = 0;
+    in.read((char *) &magic, sizeof(magic));
+    in.read((char *) &storedKey, sizeof(storedKey));
+    in.read((char *) &format, sizeof(format));
+    in.read((char *) &length, sizeof(length));
+    bool valid = in && magic == Magic && storedKey == key && length <= MaxBinarySize;
+    std::vector<char> binary(valid ? length : 0);
+    if (!valid || !in.read(binary.data(), length)) {
+        in.close();
+        std::remove(path(key).c_str());
+        return false;
+    }
+
+    glProgramBinary(program, format, binary.data(), length);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+        // the driver may reject binaries at any time, e.g. after an update that kept the version string
+        in.close();
+        std::remove(path(key).c_str());
+        return false;
+    }
+    return true;
+}
+
+inline void Save(GLuint program, uint64_t key) {
+    if (!Supported())
+        return;
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+    mkdir("cache", 0755);
+    mkdir(Directory, 0755);
+    // written under a temporary name first, a crash mid write must not leave a truncated binary behind
+    std::string target = path(key);
+    std::string temporary = target + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        uint32_t size = length;
+        out.write((const char *) &Magic, sizeof(Magic));
+        out.write((const char *) &key, sizeof(key));
+        out.write((const char *) &format, sizeof(format));
+        out.write((const char *) &size, sizeof(size));
+        out.write(binary.data(), length);
+        if (!out) {
+            std::cout << "ERROR::PROGRAM_CACHE::CANNOT_WRITE " << target << std::endl;
+            return;
+        }
+    }
+    std::rename(temporary.c_str(), target.c_str());
+}
+
+}
+
+#endif //PROJECT_BASE_PROGRAM_CACHE_H
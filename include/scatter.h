@@ -0,0 +1,596 @@
+//
+// Instanced grass and rock scattering over the terrain. Instances are generated per tile on the worker pool,
+// tiles are frustum culled on the CPU and instances fade out with distance. Optionally every instance is also
+// culled on the GPU with a transform feedback pass, which only needs GL 3.3.
+//
+
+#ifndef PROJECT_BASE_SCATTER_H
+#define PROJECT_BASE_SCATTER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <frustum.h>
+#include <noise.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ScatterSettings {
+    float tileSize = 16.0f;
+    float grassPerSquareMeter = 12.0f;
+    float rocksPerSquareMeter = 0.04f;
+    float densityScale = 1.0f;
+    float grassFadeStart = 25.0f;
+    float grassFadeEnd = 60.0f;
+    float rockFadeStart = 60.0f;
+    float rockFadeEnd = 95.0f;
+    float maxSlope = 0.35f;             // 1 - normal.y above which nothing grows
+    glm::vec2 clearCenter = glm::vec2(100.0f, 0.0f);
+    float clearRadius = 12.0f;          // keeps the house footprint free
+    int uploadsPerFrame = 4;
+};
+
+struct ScatterInstance {
+    // world position and uniform scale
+    glm::vec4 PositionScale;
+    // rotation around y, fade threshold, colour variation, unused
+    glm::vec4 Params;
+};
+
+class Scatter {
+public:
+    enum Kind {
+        Grass,
+        Rock,
+        KindCount
+    };
+
+    ScatterSettings settings;
+    // terrain height query, must be thread safe
+    std::function<float(float, float)> heightAt;
+
+    Scatter(ThreadPool &pool, std::function<float(float, float)> heightFunction,
+            ScatterSettings scatterSettings = ScatterSettings())
+            : settings(scatterSettings), heightAt(std::move(heightFunction)), pool(pool),
+              completed(std::make_shared<CompletedQueue>()) {
+        setupMeshes();
+    }
+
+    // deletes the GL objects, call before the context goes away
+    void Release() {
+        Clear();
+        for (int kind = 0; kind < KindCount; kind++) {
+            glDeleteBuffers(1, &meshVBO[kind]);
+            if (!culledVBO[kind][0])
+                continue;
+            glDeleteBuffers(CullRing, culledVBO[kind]);
+            glDeleteVertexArrays(CullRing, culledVAO[kind]);
+            glDeleteQueries(CullRing, culledQuery[kind]);
+            for (int i = 0; i < CullRing; i++) {
+                culledVBO[kind][i] = culledVAO[kind][i] = culledQuery[kind][i] = 0;
+                culledCapacity[kind][i] = 0;
+                culledIssued[kind][i] = false;
+            }
+        }
+    }
+
+    // drops every tile, e.g. after the density or the height function changed
+    void Clear() {
+        for (auto &entry: tiles)
+            releaseTile(entry.second);
+        tiles.clear();
+        generation++;
+    }
+
+    void SetHeightFunction(std::function<float(float, float)> heightFunction) {
+        heightAt = std::move(heightFunction);
+        Clear();
+    }
+
+    void Update(const glm::vec3 &cameraPosition) {
+        centerX = (int) std::floor(cameraPosition.x / settings.tileSize);
+        centerZ = (int) std::floor(cameraPosition.z / settings.tileSize);
+        scheduleMissing();
+        collectCompleted();
+        evict();
+    }
+
+    // draws every kind; with gpuCulling the instances drawn are the ones culled in the previous frame
+    void Draw(Shader &shader, Shader &cullShader, const Frustum &frustum, const glm::vec3 &cameraPosition,
+              bool gpuCulling) {
+        drawnInstances = 0;
+        frame++;
+        for (int kind = 0; kind < KindCount; kind++) {
+            float fadeEnd = kind == Grass ? settings.grassFadeEnd : settings.rockFadeEnd;
+            float fadeStart = kind == Grass ? settings.grassFadeStart : settings.rockFadeStart;
+
+            // tile level culling and density LOD: instances are sorted by fade threshold, so the ones that can
+            // still be visible at the tile's nearest distance are a prefix
+            std::vector<std::pair<Tile *, int>> visible;
+            for (auto &entry: tiles) {
+                Tile &tile = entry.second;
+                if (tile.state != Resident || tile.count[kind] == 0)
+                    continue;
+                glm::vec3 boundsMin = tile.boundsMin;
+                glm::vec3 boundsMax = tile.boundsMax + glm::vec3(0.0f, kind == Grass ? 1.0f : 1.5f, 0.0f);
+                glm::vec3 closest = glm::clamp(cameraPosition, boundsMin, boundsMax);
+                float density = fadeDensity(glm::distance(closest, cameraPosition), fadeStart, fadeEnd);
+                int count = (int) std::ceil(density * tile.count[kind]);
+                if (count == 0 || !frustum.IntersectsBox(boundsMin, boundsMax))
+                    continue;
+                visible.push_back(std::make_pair(&tile, count));
+            }
+
+            if (gpuCulling) {
+                cullInstances(cullShader, (Kind) kind, visible, frustum, cameraPosition, fadeStart, fadeEnd);
+                drawCulled(shader, (Kind) kind, cameraPosition, fadeStart, fadeEnd);
+            } else {
+                shader.use();
+                setDrawUniforms(shader, (Kind) kind, cameraPosition, fadeStart, fadeEnd);
+                for (std::pair<Tile *, int> &entry: visible) {
+                    glBindVertexArray(entry.first->VAO[kind]);
+                    glDrawArraysInstanced(GL_TRIANGLES, 0, meshVertexCount[kind], entry.second);
+                    drawnInstances += entry.second;
+                }
+                glBindVertexArray(0);
+            }
+        }
+    }
+
+    int TileCount() const { return (int) tiles.size(); }
+    long long DrawnInstances() const { return drawnInstances; }
+
+    long long ResidentInstances() const {
+        long long total = 0;
+        for (auto &entry: tiles)
+            total += entry.second.count[Grass] + entry.second.count[Rock];
+        return total;
+    }
+
+private:
+    enum TileState {
+        Pending,
+        Resident
+    };
+
+    struct TileData {
+        int64_t key;
+        uint64_t generation;
+        std::vector<ScatterInstance> instances[KindCount];
+        glm::vec3 boundsMin, boundsMax;
+    };
+
+    struct Tile {
+        int x, z;
+        TileState state = Pending;
+        unsigned int VBO[KindCount] = {0, 0};
+        unsigned int VAO[KindCount] = {0, 0};
+        unsigned int cullVAO[KindCount] = {0, 0};
+        int count[KindCount] = {0, 0};
+        glm::vec3 boundsMin, boundsMax;
+    };
+
+    struct CompletedQueue {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<TileData>> items;
+    };
+
+    ThreadPool &pool;
+    std::shared_ptr<CompletedQueue> completed;
+    std::unordered_map<int64_t, Tile> tiles;
+    int centerX = 0, centerZ = 0;
+    int inFlight = 0;
+    uint64_t generation = 0;
+    uint64_t frame = 0;
+    long long drawnInstances = 0;
+
+    unsigned int meshVBO[KindCount] = {0, 0};
+    int meshVertexCount[KindCount] = {0, 0};
+    // transform feedback output, a ring of CullRing frames like GpuTimer's so that reading a count never waits on
+    // the GPU. Made on the first GPU culled frame, each buffer holds culledCapacity instances and grows with the
+    // resident ones before it is written. culledCount is the last count that was available
+    static const int CullRing = 3;
+    unsigned int culledVBO[KindCount][CullRing] = {};
+    unsigned int culledVAO[KindCount][CullRing] = {};
+    unsigned int culledQuery[KindCount][CullRing] = {};
+    long long culledCapacity[KindCount][CullRing] = {};
+    bool culledIssued[KindCount][CullRing] = {};
+    GLuint culledCount[KindCount] = {0, 0};
+
+    static int64_t makeKey(int x, int z) {
+        return ((int64_t) x << 32) ^ (int64_t) (uint32_t) z;
+    }
+
+    int radius() const {
+        return (int) std::ceil(std::max(settings.grassFadeEnd, settings.rockFadeEnd) / settings.tileSize) + 1;
+    }
+
+    bool inRange(int x, int z) const {
+        int dx = x - centerX, dz = z - centerZ, r = radius();
+        return dx * dx + dz * dz <= r * r;
+    }
+
+    static float fadeDensity(float distance, float fadeStart, float fadeEnd) {
+        float t = glm::clamp((distance - fadeStart) / (fadeEnd - fadeStart), 0.0f, 1.0f);
+        return 1.0f - t * t * (3.0f - 2.0f * t);
+    }
+
+    void setupMeshes() {
+        // a tapered blade of three segments, (position, normal)
+        std::vector<float> blade;
+        const float widths[] = {0.05f, 0.04f, 0.025f, 0.0f};
+        const float heights[] = {0.0f, 0.3f, 0.6f, 0.85f};
+        for (int i = 0; i < 3; i++) {
+            glm::vec3 a(-widths[i], heights[i], 0.0f), b(widths[i], heights[i], 0.0f);
+            glm::vec3 c(-widths[i + 1], heights[i + 1], 0.0f), d(widths[i + 1], heights[i + 1], 0.0f);
+            for (const glm::vec3 &p: {a, b, d, a, d, c}) {
+                blade.insert(blade.end(), {p.x, p.y, p.z, 0.0f, 0.0f, 1.0f});
+            }
+        }
+
+        // a squashed octahedron for rocks
+        std::vector<float> rock;
+        const glm::vec3 tips[] = {glm::vec3(0.0f, 0.6f, 0.0f), glm::vec3(0.0f, -0.2f, 0.0f)};
+        const glm::vec3 ring[] = {glm::vec3(0.5f, 0.1f, 0.0f), glm::vec3(0.0f, 0.15f, 0.45f),
+                                  glm::vec3(-0.55f, 0.1f, 0.0f), glm::vec3(0.0f, 0.05f, -0.5f)};
+        for (int t = 0; t < 2; t++) {
+            for (int i = 0; i < 4; i++) {
+                glm::vec3 a = tips[t], b = ring[i], c = ring[(i + 1) % 4];
+                if (t == 1)
+                    std::swap(b, c);
+                glm::vec3 n = glm::normalize(glm::cross(b - a, c - a));
+                for (const glm::vec3 &p: {a, b, c})
+                    rock.insert(rock.end(), {p.x, p.y, p.z, n.x, n.y, n.z});
+            }
+        }
+
+        const std::vector<float> *meshes[KindCount] = {&blade, &rock};
+        for (int kind = 0; kind < KindCount; kind++) {
+            glGenBuffers(1, &meshVBO[kind]);
+            glBindBuffer(GL_ARRAY_BUFFER, meshVBO[kind]);
+            glBufferData(GL_ARRAY_BUFFER, meshes[kind]->size() * sizeof(float), meshes[kind]->data(), GL_STATIC_DRAW);
+            meshVertexCount[kind] = (int) meshes[kind]->size() / 6;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // binds mesh attributes 0/1 and per-instance attributes 2/3 from `instanceVBO` into the bound VAO
+    void setupDrawAttributes(Kind kind, unsigned int instanceVBO) {
+        glBindBuffer(GL_ARRAY_BUFFER, meshVBO[kind]);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(ScatterInstance), (void*)0);
+        glVertexAttribDivisor(2, 1);
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(ScatterInstance), (void*)offsetof(ScatterInstance, Params));
+        glVertexAttribDivisor(3, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // makes the ring of kind on its first use and grows its slot to hold every resident instance of kind, half as
+    // many again so that tiles streaming in do not grow it every frame. The other slots keep their output
+    void reserveCulled(Kind kind, int slot) {
+        if (!culledVBO[kind][0]) {
+            glGenBuffers(CullRing, culledVBO[kind]);
+            glGenVertexArrays(CullRing, culledVAO[kind]);
+            glGenQueries(CullRing, culledQuery[kind]);
+            for (int i = 0; i < CullRing; i++) {
+                glBindVertexArray(culledVAO[kind][i]);
+                setupDrawAttributes(kind, culledVBO[kind][i]);
+            }
+            glBindVertexArray(0);
+        }
+        long long resident = 0;
+        for (auto &entry: tiles)
+            resident += entry.second.count[kind];
+        if (culledCapacity[kind][slot] > 0 && resident <= culledCapacity[kind][slot])
+            return;
+        culledCapacity[kind][slot] = std::max(resident + resident / 2, 1024LL);
+        glBindBuffer(GL_ARRAY_BUFFER, culledVBO[kind][slot]);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) (culledCapacity[kind][slot] * sizeof(ScatterInstance)), nullptr,
+                     GL_DYNAMIC_COPY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // runs on a worker thread
+    static std::unique_ptr<TileData> generate(int64_t key, uint64_t generation, int tx, int tz,
+                                              const ScatterSettings &s,
+                                              const std::function<float(float, float)> &heightAt) {
+        std::unique_ptr<TileData> data(new TileData());
+        data->key = key;
+        data->generation = generation;
+        float x0 = tx * s.tileSize, z0 = tz * s.tileSize;
+        data->boundsMin = glm::vec3(x0, 1e30f, z0);
+        data->boundsMax = glm::vec3(x0 + s.tileSize, -1e30f, z0 + s.tileSize);
+
+        const float perSquareMeter[KindCount] = {s.grassPerSquareMeter, s.rocksPerSquareMeter};
+        for (int kind = 0; kind < KindCount; kind++) {
+            int count = (int) (perSquareMeter[kind] * s.densityScale * s.tileSize * s.tileSize);
+            // deterministic per tile so a regenerated tile looks the same. The tile is hashed on its own, folding it
+            // into the instance index would repeat one tile's instances in its neighbour at high densities
+            uint32_t tileSeed = Noise::hash(tx, tz, (uint32_t) kind * 0x9e3779b9u);
+            std::vector<ScatterInstance> &instances = data->instances[kind];
+            instances.reserve(count);
+            for (int i = 0; i < count; i++) {
+                auto random = [&](int channel) {
+                    return (float) (Noise::hash(i, channel, tileSeed) & 0xffffffu) / 16777215.0f;
+                };
+                float x = x0 + random(0) * s.tileSize, z = z0 + random(1) * s.tileSize;
+                if (glm::length(glm::vec2(x, z) - s.clearCenter) < s.clearRadius)
+                    continue;
+                float y = heightAt(x, z);
+                float slope = 1.0f - 1.0f / std::sqrt(1.0f + std::pow((heightAt(x + 0.5f, z) - y) * 2.0f, 2.0f)
+                                                      + std::pow((heightAt(x, z + 0.5f) - y) * 2.0f, 2.0f));
+                if (slope > s.maxSlope)
+                    continue;
+                float scale = kind == Grass ? 0.7f + 0.6f * random(2) : 0.4f + 1.6f * random(2) * random(2);
+                ScatterInstance instance;
+                instance.PositionScale = glm::vec4(x, y, z, scale);
+                instance.Params = glm::vec4(random(3) * 6.2831853f, random(4), random(5), 0.0f);
+                instances.push_back(instance);
+                data->boundsMin.y = std::min(data->boundsMin.y, y);
+                data->boundsMax.y = std::max(data->boundsMax.y, y + scale);
+            }
+            std::sort(instances.begin(), instances.end(), [](const ScatterInstance &a, const ScatterInstance &b) {
+                return a.Params.y < b.Params.y;
+            });
+        }
+        if (data->boundsMin.y > data->boundsMax.y)
+            data->boundsMin.y = data->boundsMax.y = 0.0f;
+        return data;
+    }
+
+    void scheduleMissing() {
+        int maxInFlight = (int) pool.Size() * 2;
+        int r = radius();
+        std::vector<std::pair<int, int64_t>> candidates;
+        for (int z = centerZ - r; z <= centerZ + r; z++) {
+            for (int x = centerX - r; x <= centerX + r; x++) {
+                if (inRange(x, z) && !tiles.count(makeKey(x, z))) {
+                    int dx = x - centerX, dz = z - centerZ;
+                    candidates.push_back(std::make_pair(dx * dx + dz * dz, makeKey(x, z)));
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        for (size_t i = 0; i < candidates.size() && inFlight < maxInFlight; i++) {
+            int64_t key = candidates[i].second;
+            Tile &tile = tiles[key];
+            tile.x = (int) (key >> 32);
+            tile.z = (int) (int32_t) (key & 0xffffffff);
+            inFlight++;
+
+            std::shared_ptr<CompletedQueue> queue = completed;
+            ScatterSettings s = settings;
+            std::function<float(float, float)> height = heightAt;
+            uint64_t currentGeneration = generation;
+            int x = tile.x, z = tile.z;
+            pool.Submit([queue, key, currentGeneration, x, z, s, height] {
+                std::unique_ptr<TileData> data = generate(key, currentGeneration, x, z, s, height);
+                std::lock_guard<std::mutex> lock(queue->mutex);
+                queue->items.push_back(std::move(data));
+            });
+        }
+    }
+
+    void collectCompleted() {
+        std::vector<std::unique_ptr<TileData>> items;
+        {
+            std::lock_guard<std::mutex> lock(completed->mutex);
+            size_t count = std::min(completed->items.size(), (size_t) settings.uploadsPerFrame);
+            for (size_t i = 0; i < count; i++)
+                items.push_back(std::move(completed->items[i]));
+            completed->items.erase(completed->items.begin(), completed->items.begin() + count);
+        }
+        for (std::unique_ptr<TileData> &data: items) {
+            inFlight--;
+            auto it = tiles.find(data->key);
+            if (it == tiles.end() || it->second.state != Pending || data->generation != generation)
+                continue;
+            Tile &tile = it->second;
+            tile.boundsMin = data->boundsMin;
+            tile.boundsMax = data->boundsMax;
+            for (int kind = 0; kind < KindCount; kind++) {
+                std::vector<ScatterInstance> &instances = data->instances[kind];
+                tile.count[kind] = (int) instances.size();
+                if (instances.empty())
+                    continue;
+                glGenBuffers(1, &tile.VBO[kind]);
+                glBindBuffer(GL_ARRAY_BUFFER, tile.VBO[kind]);
+                glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(ScatterInstance), &instances[0], GL_STATIC_DRAW);
+
+                glGenVertexArrays(1, &tile.VAO[kind]);
+                glBindVertexArray(tile.VAO[kind]);
+                setupDrawAttributes((Kind) kind, tile.VBO[kind]);
+
+                // the cull pass reads the same buffer one instance per vertex
+                glGenVertexArrays(1, &tile.cullVAO[kind]);
+                glBindVertexArray(tile.cullVAO[kind]);
+                glBindBuffer(GL_ARRAY_BUFFER, tile.VBO[kind]);
+                glEnableVertexAttribArray(2);
+                glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(ScatterInstance), (void*)0);
+                glEnableVertexAttribArray(3);
+                glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(ScatterInstance), (void*)offsetof(ScatterInstance, Params));
+                glBindVertexArray(0);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            tile.state = Resident;
+        }
+    }
+
+    void releaseTile(Tile &tile) {
+        if (tile.state != Resident)
+            return;
+        for (int kind = 0; kind < KindCount; kind++) {
+            if (!tile.VBO[kind])
+                continue;
+            glDeleteBuffers(1, &tile.VBO[kind]);
+            glDeleteVertexArrays(1, &tile.VAO[kind]);
+            glDeleteVertexArrays(1, &tile.cullVAO[kind]);
+        }
+    }
+
+    void evict() {
+        for (auto it = tiles.begin(); it != tiles.end();) {
+            if (inRange(it->second.x, it->second.z)) {
+                ++it;
+                continue;
+            }
+            releaseTile(it->second);
+            it = tiles.erase(it);
+        }
+    }
+
+    void setDrawUniforms(Shader &shader, Kind kind, const glm::vec3 &cameraPosition, float fadeStart, float fadeEnd) {
+        shader.setInt("kind", (int) kind);
+        shader.setVec3("cameraPosition", cameraPosition);
+        shader.setFloat("fadeStart", fadeStart);
+        shader.setFloat("fadeEnd", fadeEnd);
+    }
+
+    void cullInstances(Shader &cullShader, Kind kind, const std::vector<std::pair<Tile *, int>> &visible,
+                       const Frustum &frustum, const glm::vec3 &cameraPosition, float fadeStart, float fadeEnd) {
+        int write = (int) (frame % CullRing);
+        reserveCulled(kind, write);
+        cullShader.use();
+        for (int i = 0; i < 6; i++)
+            cullShader.setVec4("planes[" + std::to_string(i) + "]", frustum.planes[i]);
+        cullShader.setVec3("cameraPosition", cameraPosition);
+        cullShader.setFloat("fadeStart", fadeStart);
+        cullShader.setFloat("fadeEnd", fadeEnd);
+        cullShader.setFloat("boundingRadius", kind == Grass ? 1.0f : 1.2f);
+
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, culledVBO[kind][write]);
+        glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, culledQuery[kind][write]);
+        glBeginTransformFeedback(GL_POINTS);
+        // draws within one transform feedback block append to the output buffer
+        for (const std::pair<Tile *, int> &entry: visible) {
+            glBindVertexArray(entry.first->cullVAO[kind]);
+            glDrawArrays(GL_POINTS, 0, entry.second);
+        }
+        glEndTransformFeedback();
+        glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glBindVertexArray(0);
+        glDisable(GL_RASTERIZER_DISCARD);
+        culledIssued[kind][write] = true;
+    }
+
+    void drawCulled(Shader &shader, Kind kind, const glm::vec3 &cameraPosition, float fadeStart, float fadeEnd) {
+        // the newest output whose count is in, normally last frame's
+        int read = -1;
+        for (int age = 1; age < CullRing && read < 0; age++) {
+            int slot = (int) ((frame + CullRing - age) % CullRing);
+            if (!culledIssued[kind][slot])
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(culledQuery[kind][slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+            glGetQueryObjectuiv(culledQuery[kind][slot], GL_QUERY_RESULT, &culledCount[kind]);
+            read = slot;
+        }
+        // with the GPU further behind the oldest output is drawn with the last known count, which may be off by the
+        // instances that came or went since
+        if (read < 0) {
+            read = (int) ((frame + 1) % CullRing);
+            if (!culledIssued[kind][read])
+                return;
+        }
+        GLuint count = (GLuint) std::min((long long) culledCount[kind], culledCapacity[kind][read]);
+        shader.use();
+        setDrawUniforms(shader, kind, cameraPosition, fadeStart, fadeEnd);
+        glBindVertexArray(culledVAO[kind][read]);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, meshVertexCount[kind], (GLsizei) count);
+        glBindVertexArray(0);
+        drawnInstances += count;
+    }
+};
+
+// steps the density through a range of values and reports frame time against the number of drawn instances
+class ScatterBenchmark {
+public:
+    bool Running() const {
+        return step >= 0;
+    }
+
+    void Start(float currentDensity) {
+        restoreDensity = currentDensity;
+        step = 0;
+        frames = 0;
+        results.clear();
+    }
+
+    // call once per frame after the scatter was drawn, switches the density of `scatter` between steps
+    void Frame(float deltaTime, float scatterMilliseconds, Scatter &scatter) {
+        if (!Running())
+            return;
+        // skip the frames in which the tiles are regenerated
+        if (frames >= WarmupFrames) {
+            cpuSum += deltaTime * 1000.0f;
+            gpuSum += scatterMilliseconds;
+            instanceSum += (double) scatter.DrawnInstances();
+        }
+        float density = densities[step];
+        if (++frames == WarmupFrames + MeasuredFrames) {
+            results.push_back({densities[step], instanceSum / MeasuredFrames, cpuSum / MeasuredFrames, gpuSum / MeasuredFrames});
+            frames = 0;
+            cpuSum = gpuSum = instanceSum = 0.0;
+            if (++step == (int) (sizeof(densities) / sizeof(densities[0]))) {
+                step = -1;
+                report();
+                density = restoreDensity;
+            } else {
+                density = densities[step];
+            }
+        }
+        if (density != scatter.settings.densityScale) {
+            scatter.settings.densityScale = density;
+            scatter.Clear();
+        }
+    }
+
+private:
+    struct Result {
+        float density;
+        double instances;
+        double frameMilliseconds;
+        double scatterMilliseconds;
+    };
+
+    static const int WarmupFrames = 60;
+    static const int MeasuredFrames = 120;
+    const float densities[6] = {0.25f, 0.5f, 1.0f, 2.0f, 4.0f, 8.0f};
+    int step = -1;
+    int frames = 0;
+    double cpuSum = 0.0, gpuSum = 0.0, instanceSum = 0.0;
+    float restoreDensity = 1.0f;
+    std::vector<Result> results;
+
+    void report() const {
+        std::cout << "Scatter benchmark (density, drawn instances, frame ms, scatter GPU ms)" << std::endl;
+        for (const Result &result: results)
+            std::cout << result.density << '\t' << (long long) result.instances << '\t'
+                      << result.frameMilliseconds << '\t' << result.scatterMilliseconds << std::endl;
+    }
+};
+
+#endif //PROJECT_BASE_SCATTER_H
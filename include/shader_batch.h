@@ -0,0 +1,68 @@
+//
+// Startup shader builds. Every program is submitted to the driver before any of them is checked, and with
+// GL_KHR_parallel_shader_compile the driver compiles them on its own threads while the CPU keeps loading. Finish
+// then checks each program as it completes, so the wait is bounded by the slowest program instead of the sum.
+//
+
+#ifndef PROJECT_BASE_SHADER_BATCH_H
+#define PROJECT_BASE_SHADER_BATCH_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+class ShaderBatch {
+public:
+    ShaderBatch() : start(std::chrono::steady_clock::now()) {
+        // let the driver pick how many compiler threads to use
+        if (GLAD_GL_KHR_parallel_shader_compile)
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+    }
+
+    static bool Parallel() {
+        return GLAD_GL_KHR_parallel_shader_compile != 0;
+    }
+
+    // the shader must outlive the batch's Finish, one added twice is checked once
+    void Add(Shader &shader) {
+        if (std::find(shaders.begin(), shaders.end(), &shader) == shaders.end())
+            shaders.push_back(&shader);
+    }
+
+    unsigned int Size() const {
+        return shaders.size();
+    }
+
+    // waits for every added program and reports their errors. Returns the milliseconds since the batch was created.
+    float Finish() {
+        std::vector<Shader *> pending = shaders;
+        while (!pending.empty()) {
+            bool progress = false;
+            for (size_t i = 0; i < pending.size();) {
+                if (!pending[i]->ready()) {
+                    i++;
+                    continue;
+                }
+                pending[i]->finish();
+                pending[i] = pending.back();
+                pending.pop_back();
+                progress = true;
+            }
+            if (!progress)
+                std::this_thread::yield();
+        }
+        shaders.clear();
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+    std::vector<Shader *> shaders;
+};
+
+#endif //PROJECT_BASE_SHADER_BATCH_H
@@ -0,0 +1,73 @@
+//
+// Variants of one vertex/fragment program specialised by #define, e.g. Blinn-Phong or Phong. Each variant is
+// compiled the first time it is asked for and kept, so switching a feature swaps programs instead of branching
+// on a uniform in every fragment.
+//
+
+#ifndef PROJECT_BASE_SHADER_PERMUTATIONS_H
+#define PROJECT_BASE_SHADER_PERMUTATIONS_H
+
+#include <learnopengl/shader.h>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+class ShaderPermutations {
+public:
+    ShaderPermutations(const std::string &vertexPath, const std::string &fragmentPath)
+            : vertexPath(vertexPath), fragmentPath(fragmentPath) {}
+
+    ShaderPermutations(const ShaderPermutations &) = delete;
+    ShaderPermutations &operator=(const ShaderPermutations &) = delete;
+
+    // the program for this set of defines, compiled on first use
+    Shader &Get(const ShaderDefines &defines) {
+        std::string key = defines.Key();
+        auto found = programs.find(key);
+        if (found == programs.end())
+            found = programs.emplace(key, std::unique_ptr<Shader>(
+                    new Shader(vertexPath.c_str(), fragmentPath.c_str(), defines))).first;
+        return *found->second;
+    }
+
+    // compiles a variant ahead of time so the first switch to it does not stall a frame
+    void Prepare(const ShaderDefines &defines) {
+        Get(defines);
+    }
+
+    // rebuilds every compiled variant, each keeps its old program when the new one fails. False when any failed
+    bool Reload() {
+        bool reloaded = true;
+        for (auto &program: programs)
+            reloaded &= program.second->reload();
+        return reloaded;
+    }
+
+    // the files behind the variants, they share one set of sources and only differ in defines
+    std::set<std::string> SourceFiles() const {
+        std::set<std::string> files;
+        for (const auto &program: programs)
+            files.insert(program.second->sourceFiles().begin(), program.second->sourceFiles().end());
+        return files;
+    }
+
+    unsigned int Count() const {
+        return programs.size();
+    }
+
+    // deletes every compiled program, call before the context goes away
+    void Release() {
+        for (auto &program: programs)
+            program.second->deleteProgram();
+        programs.clear();
+    }
+
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::map<std::string, std::unique_ptr<Shader>> programs;
+};
+
+#endif //PROJECT_BASE_SHADER_PERMUTATIONS_H
@@ -0,0 +1,234 @@
+//
+// Ambient light from the skybox as 9 spherical harmonics coefficients per colour channel. Each cubemap face is
+// projected on its own, four texels at a time with SSE, so the six faces run in parallel and their sums are simply
+// added. The irradiance form is what model_shader.fs evaluates: the projection convolved with the clamped cosine and
+// divided by pi, with the basis constants folded in, so a normal costs nine multiply-adds per channel. The result is
+// cached next to the faces as <directory>/irradiance.sh9 and reused while no face is edited after it.
+//
+
+#ifndef PROJECT_BASE_SPHERICAL_HARMONICS_H
+#define PROJECT_BASE_SPHERICAL_HARMONICS_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/filesystem.h>
+
+#include <image_decoder.h>
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SPHERICAL_HARMONICS_SSE2 1
+#endif
+
+// order: l=0, then l=1 (y, z, x), then l=2 (xy, yz, 3z^2-1, xz, x^2-y^2)
+struct SH9 {
+    glm::vec3 coefficients[9];
+
+    SH9() {
+        for (glm::vec3 &coefficient: coefficients)
+            coefficient = glm::vec3(0.0f);
+    }
+
+    SH9 &operator+=(const SH9 &other) {
+        for (int i = 0; i < 9; i++)
+            coefficients[i] += other.coefficients[i];
+        return *this;
+    }
+};
+
+namespace SphericalHarmonics {
+
+const char *const CacheVersion = "sh9 1";
+
+// direction of the centre of a texel of a GL cubemap face, face in GL_TEXTURE_CUBE_MAP_POSITIVE_X order, s and t in
+// [-1, 1] with t growing down the rows as they are stored
+inline glm::vec3 faceDirection(int face, float s, float t) {
+    switch (face) {
+        case 0: return glm::vec3(1.0f, -t, -s);
+        case 1: return glm::vec3(-1.0f, -t, s);
+        case 2: return glm::vec3(s, 1.0f, t);
+        case 3: return glm::vec3(s, -1.0f, -t);
+        case 4: return glm::vec3(s, -t, 1.0f);
+        default: return glm::vec3(-s, -t, -1.0f);
+    }
+}
+
+// adds four texels of a row to the 27 running sums. The texels lie at rowCentre + s * right on the face, t is the
+// row's coordinate. Lanes past the end of the row carry black and add nothing
+struct Accumulator {
+    float sums[9][3][4] = {};
+
+    void Add(const glm::vec3 &rowCentre, const glm::vec3 &right, const float s[4], float t, float texelArea,
+             const float rgb[3][4]) {
+#ifdef SPHERICAL_HARMONICS_SSE2
+        __m128 vs = _mm_loadu_ps(s);
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 lengthSquared = _mm_add_ps(_mm_add_ps(one, _mm_mul_ps(vs, vs)), _mm_set1_ps(t * t));
+        __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+        __m128 x = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(rowCentre.x), _mm_mul_ps(vs, _mm_set1_ps(right.x))),
+                              inverseLength);
+        __m128 y = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(rowCentre.y), _mm_mul_ps(vs, _mm_set1_ps(right.y))),
+                              inverseLength);
+        __m128 z = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(rowCentre.z), _mm_mul_ps(vs, _mm_set1_ps(right.z))),
+                              inverseLength);
+        // solid angle of a texel: its area on the face over the cube of its distance
+        __m128 weight = _mm_mul_ps(_mm_set1_ps(texelArea),
+                                   _mm_mul_ps(inverseLength, _mm_mul_ps(inverseLength, inverseLength)));
+        __m128 basis[9] = {
+                _mm_set1_ps(0.282095f),
+                _mm_mul_ps(_mm_set1_ps(0.488603f), y),
+                _mm_mul_ps(_mm_set1_ps(0.488603f), z),
+                _mm_mul_ps(_mm_set1_ps(0.488603f), x),
+                _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(x, y)),
+                _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(y, z)),
+                _mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(z, z)), one)),
+                _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(x, z)),
+                _mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)))
+        };
+        __m128 color[3];
+        for (int c = 0; c < 3; c++)
+            color[c] = _mm_mul_ps(_mm_loadu_ps(rgb[c]), weight);
+        for (int k = 0; k < 9; k++)
+            for (int c = 0; c < 3; c++)
+                _mm_storeu_ps(sums[k][c], _mm_add_ps(_mm_loadu_ps(sums[k][c]), _mm_mul_ps(basis[k], color[c])));
+#else
+        for (int i = 0; i < 4; i++) {
+            float inverseLength = 1.0f / std::sqrt(1.0f + s[i] * s[i] + t * t);
+            glm::vec3 direction = (rowCentre + s[i] * right) * inverseLength;
+            float x = direction.x, y = direction.y, z = direction.z;
+            float weight = texelArea * inverseLength * inverseLength * inverseLength;
+            float basis[9] = {0.282095f, 0.488603f * y, 0.488603f * z, 0.488603f * x, 1.092548f * x * y,
+                              1.092548f * y * z, 0.315392f * (3.0f * z * z - 1.0f), 1.092548f * x * z,
+                              0.546274f * (x * x - y * y)};
+            for (int k = 0; k < 9; k++)
+                for (int c = 0; c < 3; c++)
+                    sums[k][c][i] += basis[k] * rgb[c][i] * weight;
+        }
+#endif
+    }
+};
+
+// the radiance of one face of a cubemap, not flipped, with channels bytes per texel (the first three are used). The
+// texels are taken as they are stored, in the same space as the textures the shader multiplies the ambient with
+inline SH9 ProjectFace(int face, const unsigned char *pixels, int width, int height, int channels) {
+    glm::vec3 centre = faceDirection(face, 0.0f, 0.0f);
+    glm::vec3 right = faceDirection(face, 1.0f, 0.0f) - centre, down = faceDirection(face, 0.0f, 1.0f) - centre;
+    float texelArea = 4.0f / ((float) width * height);
+    double totals[9][3] = {};
+    for (int y = 0; y < height; y++) {
+        // float lanes are summed per row and the rows in double, a 2048 face would otherwise lose the small texels
+        Accumulator row;
+        float t = 2.0f * (y + 0.5f) / height - 1.0f;
+        glm::vec3 rowCentre = centre + t * down;
+        const unsigned char *texels = pixels + (size_t) y * width * channels;
+        for (int x0 = 0; x0 < width; x0 += 4) {
+            float s[4], rgb[3][4] = {};
+            for (int i = 0; i < 4; i++) {
+                s[i] = 2.0f * (x0 + i + 0.5f) / width - 1.0f;
+                if (x0 + i < width)
+                    for (int c = 0; c < 3; c++)
+                        rgb[c][i] = texels[(size_t) (x0 + i) * channels + (channels >= 3 ? c : 0)] * (1.0f / 255.0f);
+            }
+            row.Add(rowCentre, right, s, t, texelArea, rgb);
+        }
+        for (int k = 0; k < 9; k++)
+            for (int c = 0; c < 3; c++)
+                totals[k][c] += (double) row.sums[k][c][0] + row.sums[k][c][1] + row.sums[k][c][2] +
+                                row.sums[k][c][3];
+    }
+    SH9 result;
+    for (int k = 0; k < 9; k++)
+        result.coefficients[k] = glm::vec3(totals[k][0], totals[k][1], totals[k][2]);
+    return result;
+}
+
+// the radiance projection of all six faces to the coefficients model_shader.fs evaluates
+inline SH9 Irradiance(const SH9 &radiance) {
+    // the clamped cosine's bands, pi, 2pi/3 and pi/4, over pi for a Lambertian surface, times the basis constants
+    const float factors[9] = {1.0f * 0.282095f,
+                              2.0f / 3.0f * 0.488603f, 2.0f / 3.0f * 0.488603f, 2.0f / 3.0f * 0.488603f,
+                              0.25f * 1.092548f, 0.25f * 1.092548f, 0.25f * 0.315392f, 0.25f * 1.092548f,
+                              0.25f * 0.546274f};
+    SH9 irradiance;
+    for (int k = 0; k < 9; k++)
+        irradiance.coefficients[k] = radiance.coefficients[k] * factors[k];
+    return irradiance;
+}
+
+// decodes one face file, not flipped, and projects it
+inline bool ProjectFile(int face, const FileView &file, SH9 &radiance) {
+    ImageInfo info;
+    if (!ImageDecoders::Info(file, info))
+        return false;
+    std::vector<unsigned char> pixels((size_t) info.width * info.height * 3);
+    if (!ImageDecoders::Decode(file, 3, false, pixels.data()))
+        return false;
+    radiance = ProjectFace(face, pixels.data(), info.width, info.height, 3);
+    return true;
+}
+
+// the irradiance of the six face files of a cubemap, one face after the other. For the cooker and reloads, startup
+// projects the faces in parallel
+inline bool ProjectFiles(const std::vector<std::string> &faces, SH9 &irradiance) {
+    SH9 radiance;
+    for (unsigned int i = 0; i < faces.size(); i++) {
+        SH9 face;
+        if (!ProjectFile(i, FileSystem::open(faces[i]), face))
+            return false;
+        radiance += face;
+    }
+    irradiance = Irradiance(radiance);
+    return true;
+}
+
+// where the irradiance of the cubemap with these faces is cached
+inline std::string CachePath(const std::vector<std::string> &faces) {
+    return faces[0].substr(0, faces[0].find_last_of('/') + 1) + "irradiance.sh9";
+}
+
+// the cached irradiance of faces, false when there is none or a face was edited after it
+inline bool Load(const std::vector<std::string> &faces, SH9 &irradiance) {
+    std::string path = CachePath(faces);
+    for (const std::string &face: faces)
+        if (VirtualFileSystem::EditedAfter(face, path))
+            return false;
+    FileView file = FileSystem::open(path);
+    if (!file)
+        return false;
+    std::istringstream in(file.String());
+    std::string version;
+    if (!std::getline(in, version) || version != CacheVersion)
+        return false;
+    for (glm::vec3 &coefficient: irradiance.coefficients)
+        in >> coefficient.r >> coefficient.g >> coefficient.b;
+    return (bool) in;
+}
+
+inline bool Save(const std::string &path, const SH9 &irradiance) {
+    // written under a temporary name first, like the cooked files
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        out.precision(9);
+        out << CacheVersion << '\n';
+        for (const glm::vec3 &coefficient: irradiance.coefficients)
+            out << coefficient.r << ' ' << coefficient.g << ' ' << coefficient.b << '\n';
+        if (!out) {
+            std::cout << "ERROR::SPHERICAL_HARMONICS::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+}
+
+#endif //PROJECT_BASE_SPHERICAL_HARMONICS_H
@@ -0,0 +1,46 @@
+//
+// Bounded lock-free queue between exactly one producer thread and one consumer thread. Each side only writes its
+// own index, the other one is read with acquire ordering, so an element is fully written before it can be seen.
+//
+
+#ifndef PROJECT_BASE_SPSC_QUEUE_H
+#define PROJECT_BASE_SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+template<typename T, size_t Capacity>
+class SpscQueue {
+public:
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+    // producer side, false when the queue is full. value is only moved from when it was queued
+    bool Push(T &&value) {
+        size_t tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail - headIndex.load(std::memory_order_acquire) == Capacity)
+            return false;
+        slots[tail & (Capacity - 1)] = std::move(value);
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, false when the queue is empty
+    bool Pop(T &value) {
+        size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire))
+            return false;
+        value = std::move(slots[head & (Capacity - 1)]);
+        slots[head & (Capacity - 1)] = T();
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T slots[Capacity];
+    // on separate cache lines so the two threads do not keep stealing one line from each other
+    alignas(64) std::atomic<size_t> headIndex{0};
+    alignas(64) std::atomic<size_t> tailIndex{0};
+};
+
+#endif //PROJECT_BASE_SPSC_QUEUE_H
@@ -0,0 +1,210 @@
+//
+// Screen-space ambient occlusion at half or quarter resolution. After a depth prepass the scene framebuffer's depth
+// is copied and reduced to linear depth at the tier's resolution, alternating the nearest and farthest depth of each
+// block in a checkerboard so both sides of an edge survive. The occlusion pass takes a few samples per pixel on a
+// spiral whose rotation repeats every 4x4 pixels, and a separable blur that stops at depth edges averages the 16
+// rotations back together. The lighting pass upsamples the result itself, weighting the four nearest texels by how
+// close their depth is to its own (see ScreenSpaceOcclusion in model_shader.fs).
+//
+
+#ifndef PROJECT_BASE_SSAO_H
+#define PROJECT_BASE_SSAO_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+
+class Ssao {
+public:
+    enum Quality {
+        Off,
+        // quarter resolution, 8 samples
+        Low,
+        // half resolution, 8 samples
+        Medium,
+        // half resolution, 16 samples
+        High
+    };
+
+    struct Settings {
+        // world units around a pixel that can occlude it
+        float radius = 0.5f;
+        float intensity = 1.0f;
+        // ignores the slight occlusion of a flat surface by its own tessellation
+        float bias = 0.01f;
+    };
+
+    // read by every Compute, may change between frames
+    Settings settings;
+
+    Ssao() = default;
+
+    Ssao(const Ssao &) = delete;
+    Ssao &operator=(const Ssao &) = delete;
+
+    // deletes the textures and framebuffers, call before the context goes away
+    void Release() {
+        glDeleteTextures(1, &depthCopy);
+        glDeleteTextures(1, &linearDepth);
+        glDeleteTextures(1, &occlusion);
+        glDeleteTextures(1, &blurred);
+        glDeleteFramebuffers(1, &depthFramebuffer);
+        glDeleteFramebuffers(1, &occlusionFramebuffer);
+        glDeleteFramebuffers(1, &blurFramebuffer);
+        glDeleteVertexArrays(1, &emptyVAO);
+        depthCopy = linearDepth = occlusion = blurred = 0;
+        depthFramebuffer = occlusionFramebuffer = blurFramebuffer = emptyVAO = 0;
+        size = lowSize = glm::ivec2(0);
+    }
+
+    static int Downsample(Quality quality) {
+        return quality == Low ? 4 : 2;
+    }
+
+    static int Samples(Quality quality) {
+        return quality == High ? 16 : 8;
+    }
+
+    // occlusion of the depth in framebuffer, which must hold every opaque surface the lighting pass will shade.
+    // projection is the one the depth was rendered with. Leaves framebuffer bound with the full viewport and depth
+    // testing on
+    void Compute(Shader &depthShader, Shader &occlusionShader, Shader &blurShader, GLuint framebuffer, int width,
+                 int height, const glm::mat4 &projection, Quality quality) {
+        if (width <= 0 || height <= 0 || quality == Off)
+            return;
+        int downsample = Downsample(quality);
+        glm::ivec2 low = glm::max(glm::ivec2(width, height) / downsample, glm::ivec2(1));
+        if (width != size.x || height != size.y || low != lowSize)
+            resize(width, height, low);
+        this->projection = projection;
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthCopy);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+        glDisable(GL_DEPTH_TEST);
+        glDepthMask(GL_FALSE);
+        glViewport(0, 0, lowSize.x, lowSize.y);
+        glBindVertexArray(emptyVAO);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, depthFramebuffer);
+        depthShader.use();
+        depthShader.setInt("depthTexture", 0);
+        depthShader.setInt("downsample", downsample);
+        setDepthParameters(depthShader);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, occlusionFramebuffer);
+        glBindTexture(GL_TEXTURE_2D, linearDepth);
+        occlusionShader.use();
+        occlusionShader.setInt("linearDepth", 0);
+        occlusionShader.setInt("samples", Samples(quality));
+        occlusionShader.setFloat("radius", settings.radius);
+        occlusionShader.setFloat("intensity", settings.intensity);
+        occlusionShader.setFloat("bias", settings.bias);
+        // view space position from a texel's depth, and how many texels a world unit covers at depth 1
+        occlusionShader.setVec2("inverseFocal", glm::vec2(1.0f / projection[0][0], 1.0f / projection[1][1]));
+        occlusionShader.setFloat("projectionScale", projection[1][1] * 0.5f * lowSize.y);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        // horizontal into blurred, vertical back into occlusion
+        blurShader.use();
+        blurShader.setInt("occlusion", 0);
+        blurShader.setInt("linearDepth", 1);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, linearDepth);
+        glActiveTexture(GL_TEXTURE0);
+        glBindFramebuffer(GL_FRAMEBUFFER, blurFramebuffer);
+        glBindTexture(GL_TEXTURE_2D, occlusion);
+        blurShader.setVec2("direction", glm::vec2(1.0f, 0.0f));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindFramebuffer(GL_FRAMEBUFFER, occlusionFramebuffer);
+        glBindTexture(GL_TEXTURE_2D, blurred);
+        blurShader.setVec2("direction", glm::vec2(0.0f, 1.0f));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, width, height);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    // the occlusion and its depth on unit and unit + 1 for a shader built with SSAO defined
+    void Bind(Shader &shader, int unit) const {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, occlusion);
+        glActiveTexture(GL_TEXTURE0 + unit + 1);
+        glBindTexture(GL_TEXTURE_2D, linearDepth);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("ssaoOcclusion", unit);
+        shader.setInt("ssaoDepth", unit + 1);
+        shader.setVec2("ssaoScale", glm::vec2(lowSize) / glm::vec2(size));
+        setDepthParameters(shader);
+    }
+
+    glm::ivec2 Resolution() const {
+        return lowSize;
+    }
+
+private:
+    GLuint depthCopy = 0;
+    GLuint linearDepth = 0;
+    GLuint occlusion = 0;
+    GLuint blurred = 0;
+    GLuint depthFramebuffer = 0;
+    GLuint occlusionFramebuffer = 0;
+    GLuint blurFramebuffer = 0;
+    // the full-screen triangle is made up in the vertex shader, core profiles still want a VAO bound
+    GLuint emptyVAO = 0;
+    glm::ivec2 size = glm::ivec2(0);
+    glm::ivec2 lowSize = glm::ivec2(0);
+    glm::mat4 projection = glm::mat4(1.0f);
+
+    // linear depth is projection[3][2] / (ndc + projection[2][2])
+    void setDepthParameters(Shader &shader) const {
+        shader.setVec2("depthParameters", glm::vec2(projection[2][2], projection[3][2]));
+    }
+
+    static GLuint target(GLenum internalFormat, GLenum format, GLenum type, glm::ivec2 size, GLuint &framebuffer) {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size.x, size.y, 0, format, type, nullptr);
+        // the lighting pass and the blur pick their texels themselves
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        return texture;
+    }
+
+    void resize(int width, int height, glm::ivec2 low) {
+        Release();
+        size = glm::ivec2(width, height);
+        lowSize = low;
+
+        glGenTextures(1, &depthCopy);
+        glBindTexture(GL_TEXTURE_2D, depthCopy);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        linearDepth = target(GL_R32F, GL_RED, GL_FLOAT, lowSize, depthFramebuffer);
+        occlusion = target(GL_R8, GL_RED, GL_UNSIGNED_BYTE, lowSize, occlusionFramebuffer);
+        blurred = target(GL_R8, GL_RED, GL_UNSIGNED_BYTE, lowSize, blurFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenVertexArrays(1, &emptyVAO);
+    }
+};
+
+#endif //PROJECT_BASE_SSAO_H
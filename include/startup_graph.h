@@ -0,0 +1,169 @@
+//
+// Startup work as a dependency graph. Worker tasks (file reads, decoding, imports) run on the ThreadPool as soon as
+// their dependencies are done, Main tasks (anything creating GL objects) run on the thread calling Run, in the order
+// their inputs arrive. External tasks stand for work done outside the graph, e.g. reads in flight in AsyncFileIo,
+// and finish when Complete is called. Every task's start and end is kept for a timeline of the startup.
+//
+
+#ifndef PROJECT_BASE_STARTUP_GRAPH_H
+#define PROJECT_BASE_STARTUP_GRAPH_H
+
+#include <thread_pool.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class StartupGraph {
+public:
+    enum Thread {
+        Worker,
+        Main,
+        // work outside the graph, see AddExternal
+        External
+    };
+
+    // one task of the timeline, times in milliseconds since the graph was created
+    struct Span {
+        std::string name;
+        Thread thread;
+        float start;
+        float end;
+    };
+
+    explicit StartupGraph(ThreadPool &pool) : pool(pool), begin(std::chrono::steady_clock::now()) {}
+
+    StartupGraph(const StartupGraph &) = delete;
+    StartupGraph &operator=(const StartupGraph &) = delete;
+
+    // work runs once every dependency has finished, a worker task may start before Add returns. Tasks may add
+    // further tasks while they run, e.g. one per texture of a model they just imported.
+    unsigned int Add(const std::string &name, Thread thread, std::function<void()> work,
+                     const std::vector<unsigned int> &dependencies = std::vector<unsigned int>()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        unsigned int id = tasks.size();
+        tasks.emplace_back();
+        Task &task = tasks.back();
+        task.name = name;
+        task.thread = thread;
+        task.work = std::move(work);
+        for (unsigned int dependency: dependencies) {
+            if (tasks[dependency].done)
+                continue;
+            task.waiting++;
+            tasks[dependency].dependents.push_back(id);
+        }
+        if (task.waiting == 0)
+            schedule(task);
+        return id;
+    }
+
+    // a task the graph does not run, it starts now and ends with Complete. Others can depend on it like on any task
+    unsigned int AddExternal(const std::string &name) {
+        float start = Milliseconds();
+        std::lock_guard<std::mutex> lock(mutex);
+        unsigned int id = tasks.size();
+        tasks.emplace_back();
+        Task &task = tasks.back();
+        task.name = name;
+        task.thread = External;
+        task.start = start;
+        return id;
+    }
+
+    // ends an external task, from any thread
+    void Complete(unsigned int id) {
+        float end = Milliseconds();
+        std::lock_guard<std::mutex> lock(mutex);
+        finish(tasks[id], tasks[id].start, end);
+    }
+
+    // runs the main thread tasks as they become ready, returns once every task has finished
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            ready.wait(lock, [this] { return !mainReady.empty() || finished == tasks.size(); });
+            if (mainReady.empty())
+                return;
+            Task *task = mainReady.front();
+            mainReady.pop_front();
+            lock.unlock();
+            execute(task);
+            lock.lock();
+        }
+    }
+
+    std::vector<Span> Timeline() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Span> spans;
+        for (const Task &task: tasks)
+            if (task.done)
+                spans.push_back(Span{task.name, task.thread, task.start, task.end});
+        return spans;
+    }
+
+    // time since the graph was created
+    float Milliseconds() const {
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+private:
+    struct Task {
+        std::string name;
+        Thread thread = Worker;
+        std::function<void()> work;
+        // dependencies that have not finished yet
+        unsigned int waiting = 0;
+        std::vector<unsigned int> dependents;
+        bool done = false;
+        float start = 0.0f;
+        float end = 0.0f;
+    };
+
+    ThreadPool &pool;
+    std::chrono::steady_clock::time_point begin;
+    mutable std::mutex mutex;
+    std::condition_variable ready;
+    // a deque keeps tasks in place while others are added
+    std::deque<Task> tasks;
+    std::deque<Task *> mainReady;
+    size_t finished = 0;
+
+    // called with the mutex held
+    void schedule(Task &task) {
+        Task *scheduled = &task;
+        if (task.thread == Main) {
+            mainReady.push_back(scheduled);
+            ready.notify_all();
+        } else
+            pool.Submit([this, scheduled] { execute(scheduled); });
+    }
+
+    void execute(Task *task) {
+        float start = Milliseconds();
+        task->work();
+        float end = Milliseconds();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        finish(*task, start, end);
+    }
+
+    // called with the mutex held
+    void finish(Task &task, float start, float end) {
+        task.work = nullptr;
+        task.start = start;
+        task.end = end;
+        task.done = true;
+        finished++;
+        for (unsigned int dependent: task.dependents)
+            if (--tasks[dependent].waiting == 0)
+                schedule(tasks[dependent]);
+        ready.notify_all();
+    }
+};
+
+#endif //PROJECT_BASE_STARTUP_GRAPH_H
@@ -0,0 +1,379 @@
+//
+// Unbounded procedural terrain. Chunks around the camera are generated on the worker pool, uploaded a few per
+// frame on the render thread and evicted least-recently-used once the resident budget is exceeded.
+//
+
+#ifndef PROJECT_BASE_TERRAIN_H
+#define PROJECT_BASE_TERRAIN_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <frustum.h>
+#include <noise.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct TerrainSettings {
+    float chunkSize = 32.0f;
+    int chunkResolution = 32;       // quads per chunk side
+    int viewRadius = 5;             // in chunks
+    int maxResidentChunks = 160;    // LRU budget, should exceed the view disc (~pi * r^2)
+    int uploadsPerFrame = 2;
+    glm::vec2 flatCenter = glm::vec2(100.0f, 0.0f);   // keeps the ground under the house level
+    float flatRadius = 30.0f;
+    float flatFalloff = 60.0f;
+    FractalSettings fractal;
+};
+
+struct TerrainVertex {
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    // grass, rock, snow, unused
+    glm::vec4 Weights;
+};
+
+class InfiniteTerrain {
+public:
+    TerrainSettings settings;
+
+    InfiniteTerrain(ThreadPool &pool, TerrainSettings terrainSettings = TerrainSettings())
+            : settings(terrainSettings), pool(pool), completed(std::make_shared<CompletedQueue>()) {
+        setupIndices();
+    }
+
+    // deletes the GL objects, call before the context goes away
+    void Release() {
+        for (auto &entry: chunks)
+            if (entry.second.state == Resident)
+                freeBuffers.push_back(entry.second.buffers);
+        for (ChunkBuffers &buffers: freeBuffers) {
+            glDeleteVertexArrays(1, &buffers.VAO);
+            glDeleteBuffers(1, &buffers.VBO);
+        }
+        freeBuffers.clear();
+        chunks.clear();
+        residentCount = 0;
+        glDeleteBuffers(1, &EBO);
+        EBO = 0;
+    }
+
+    // height of the generated surface, identical to what the chunk generator produces
+    float HeightAt(float x, float z) const {
+        return shapeHeight(Noise::Fractal(x, z, settings.fractal), x, z, settings);
+    }
+
+    // schedules generation around the camera, integrates finished chunks and evicts old ones; never blocks
+    void Update(const glm::vec3 &cameraPosition, const glm::vec3 &cameraFront) {
+        frame++;
+        uploadsLastFrame = 0;
+        centerX = (int) std::floor(cameraPosition.x / settings.chunkSize);
+        centerZ = (int) std::floor(cameraPosition.z / settings.chunkSize);
+
+        scheduleMissing(cameraPosition, cameraFront);
+        collectCompleted();
+        uploadReady(cameraPosition);
+        evict();
+    }
+
+    void Draw(Shader &shader, const Frustum &frustum) {
+        drawnLastFrame = 0;
+        for (auto &entry: chunks) {
+            Chunk &chunk = entry.second;
+            if (chunk.state != Resident || !inRange(chunk.x, chunk.z))
+                continue;
+            chunk.lastUsed = frame;
+            if (!frustum.IntersectsBox(chunk.boundsMin, chunk.boundsMax))
+                continue;
+            glBindVertexArray(chunk.buffers.VAO);
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT, 0);
+            drawnLastFrame++;
+        }
+        glBindVertexArray(0);
+    }
+
+    int ResidentCount() const { return residentCount; }
+    int PendingCount() const { return inFlight; }
+    int DrawnLastFrame() const { return drawnLastFrame; }
+    int UploadsLastFrame() const { return uploadsLastFrame; }
+
+private:
+    enum ChunkState {
+        Pending,
+        Ready,
+        Resident
+    };
+
+    struct ChunkBuffers {
+        unsigned int VAO = 0;
+        unsigned int VBO = 0;
+    };
+
+    struct ChunkData {
+        int64_t key;
+        std::vector<TerrainVertex> vertices;
+        glm::vec3 boundsMin, boundsMax;
+    };
+
+    struct Chunk {
+        int x, z;
+        ChunkState state;
+        std::unique_ptr<ChunkData> data;
+        ChunkBuffers buffers;
+        glm::vec3 boundsMin, boundsMax;
+        uint64_t lastUsed = 0;
+    };
+
+    // shared with the jobs so that a job finishing after the terrain is gone writes into live memory
+    struct CompletedQueue {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ChunkData>> items;
+    };
+
+    ThreadPool &pool;
+    std::shared_ptr<CompletedQueue> completed;
+    std::unordered_map<int64_t, Chunk> chunks;
+    std::vector<ChunkBuffers> freeBuffers;
+    unsigned int EBO = 0;
+    int indexCount = 0;
+    int centerX = 0, centerZ = 0;
+    uint64_t frame = 0;
+    int inFlight = 0;
+    int residentCount = 0;
+    int drawnLastFrame = 0;
+    int uploadsLastFrame = 0;
+
+    static int64_t makeKey(int x, int z) {
+        return ((int64_t) x << 32) ^ (int64_t) (uint32_t) z;
+    }
+
+    bool inRange(int x, int z) const {
+        int dx = x - centerX, dz = z - centerZ;
+        return dx * dx + dz * dz <= settings.viewRadius * settings.viewRadius;
+    }
+
+    static float shapeHeight(float noise, float x, float z, const TerrainSettings &s) {
+        float distance = glm::length(glm::vec2(x, z) - s.flatCenter);
+        float t = glm::clamp((distance - s.flatRadius) / s.flatFalloff, 0.0f, 1.0f);
+        return noise * t * t * (3.0f - 2.0f * t);
+    }
+
+    void setupIndices() {
+        int n = settings.chunkResolution + 1;
+        std::vector<unsigned short> indices;
+        indices.reserve(settings.chunkResolution * settings.chunkResolution * 6);
+        for (int z = 0; z < settings.chunkResolution; z++) {
+            for (int x = 0; x < settings.chunkResolution; x++) {
+                unsigned short i = (unsigned short) (z * n + x);
+                indices.push_back(i);
+                indices.push_back((unsigned short) (i + n));
+                indices.push_back((unsigned short) (i + 1));
+                indices.push_back((unsigned short) (i + 1));
+                indices.push_back((unsigned short) (i + n));
+                indices.push_back((unsigned short) (i + n + 1));
+            }
+        }
+        indexCount = (int) indices.size();
+        glGenBuffers(1, &EBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+
+    // runs on a worker thread
+    static std::unique_ptr<ChunkData> generate(int64_t key, int cx, int cz, const TerrainSettings &s) {
+        int n = s.chunkResolution + 1;
+        int border = n + 2;
+        float step = s.chunkSize / (float) s.chunkResolution;
+        float originX = cx * s.chunkSize, originZ = cz * s.chunkSize;
+
+        // heights with a one sample border so that normals are continuous across chunk edges
+        std::vector<float> heights(border * border), xs(border), zs(border);
+        for (int i = 0; i < border; i++)
+            xs[i] = originX + (i - 1) * step;
+        for (int z = 0; z < border; z++) {
+            std::fill(zs.begin(), zs.end(), originZ + (z - 1) * step);
+            Noise::FractalBatch(&xs[0], &zs[0], &heights[z * border], border, s.fractal);
+            for (int x = 0; x < border; x++)
+                heights[z * border + x] = shapeHeight(heights[z * border + x], xs[x], zs[0], s);
+        }
+
+        std::unique_ptr<ChunkData> data(new ChunkData());
+        data->key = key;
+        data->vertices.resize(n * n);
+        data->boundsMin = glm::vec3(originX, 1e30f, originZ);
+        data->boundsMax = glm::vec3(originX + s.chunkSize, -1e30f, originZ + s.chunkSize);
+        for (int z = 0; z < n; z++) {
+            for (int x = 0; x < n; x++) {
+                const float *h = &heights[(z + 1) * border + (x + 1)];
+                TerrainVertex &vertex = data->vertices[z * n + x];
+                vertex.Position = glm::vec3(originX + x * step, h[0], originZ + z * step);
+                vertex.Normal = glm::normalize(glm::vec3(h[-1] - h[1], 2.0f * step, h[-border] - h[border]));
+
+                float slope = 1.0f - vertex.Normal.y;
+                float rock = glm::clamp((slope - 0.15f) * 6.0f, 0.0f, 1.0f);
+                float snow = glm::clamp((h[0] - 30.0f) * 0.1f, 0.0f, 1.0f) * (1.0f - rock);
+                float grass = std::max(0.0f, 1.0f - rock - snow);
+                vertex.Weights = glm::vec4(grass, rock, snow, 0.0f);
+
+                data->boundsMin.y = std::min(data->boundsMin.y, h[0]);
+                data->boundsMax.y = std::max(data->boundsMax.y, h[0]);
+            }
+        }
+        return data;
+    }
+
+    void scheduleMissing(const glm::vec3 &cameraPosition, const glm::vec3 &cameraFront) {
+        int maxInFlight = (int) pool.Size() * 2;
+        if (inFlight >= maxInFlight)
+            return;
+
+        glm::vec2 front(cameraFront.x, cameraFront.z);
+        if (glm::length(front) > 1e-4f)
+            front = glm::normalize(front);
+
+        // chunks in the view direction come first, the ones behind the camera are only slightly penalised so
+        // that turning around does not reveal holes for long
+        std::vector<std::pair<float, int64_t>> candidates;
+        int r = settings.viewRadius;
+        for (int z = centerZ - r; z <= centerZ + r; z++) {
+            for (int x = centerX - r; x <= centerX + r; x++) {
+                if (!inRange(x, z) || chunks.count(makeKey(x, z)))
+                    continue;
+                glm::vec2 toChunk = (glm::vec2((float) x, (float) z) + glm::vec2(0.5f)) * settings.chunkSize
+                                    - glm::vec2(cameraPosition.x, cameraPosition.z);
+                float distance = glm::length(toChunk);
+                float facing = distance > 1e-4f ? glm::dot(toChunk / distance, front) : 1.0f;
+                candidates.push_back(std::make_pair(distance * (1.5f - 0.5f * facing), makeKey(x, z)));
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        for (size_t i = 0; i < candidates.size() && inFlight < maxInFlight; i++) {
+            int64_t key = candidates[i].second;
+            int x = (int) (key >> 32), z = (int) (int32_t) (key & 0xffffffff);
+            Chunk &chunk = chunks[key];
+            chunk.x = x;
+            chunk.z = z;
+            chunk.state = Pending;
+            inFlight++;
+
+            std::shared_ptr<CompletedQueue> queue = completed;
+            TerrainSettings s = settings;
+            pool.Submit([queue, key, x, z, s] {
+                std::unique_ptr<ChunkData> data = generate(key, x, z, s);
+                std::lock_guard<std::mutex> lock(queue->mutex);
+                queue->items.push_back(std::move(data));
+            });
+        }
+    }
+
+    void collectCompleted() {
+        std::vector<std::unique_ptr<ChunkData>> items;
+        {
+            std::lock_guard<std::mutex> lock(completed->mutex);
+            items.swap(completed->items);
+        }
+        for (std::unique_ptr<ChunkData> &data: items) {
+            inFlight--;
+            auto it = chunks.find(data->key);
+            // dropped while it was being generated
+            if (it == chunks.end() || it->second.state != Pending)
+                continue;
+            it->second.boundsMin = data->boundsMin;
+            it->second.boundsMax = data->boundsMax;
+            it->second.data = std::move(data);
+            it->second.state = Ready;
+        }
+    }
+
+    void uploadReady(const glm::vec3 &cameraPosition) {
+        std::vector<std::pair<float, Chunk *>> ready;
+        for (auto &entry: chunks) {
+            if (entry.second.state == Ready) {
+                glm::vec3 center = (entry.second.boundsMin + entry.second.boundsMax) * 0.5f;
+                ready.push_back(std::make_pair(glm::distance(center, cameraPosition), &entry.second));
+            }
+        }
+        std::sort(ready.begin(), ready.end(),
+                  [](const std::pair<float, Chunk *> &a, const std::pair<float, Chunk *> &b) { return a.first < b.first; });
+
+        for (size_t i = 0; i < ready.size() && (int) i < settings.uploadsPerFrame; i++) {
+            Chunk &chunk = *ready[i].second;
+            chunk.buffers = acquireBuffers();
+            const std::vector<TerrainVertex> &vertices = chunk.data->vertices;
+            glBindBuffer(GL_ARRAY_BUFFER, chunk.buffers.VBO);
+            // orphan the old storage so a recycled buffer never waits on draws still reading it
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(TerrainVertex), nullptr, GL_STATIC_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(TerrainVertex), &vertices[0]);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            chunk.data.reset();
+            chunk.state = Resident;
+            chunk.lastUsed = frame;
+            residentCount++;
+            uploadsLastFrame++;
+        }
+    }
+
+    ChunkBuffers acquireBuffers() {
+        if (!freeBuffers.empty()) {
+            ChunkBuffers buffers = freeBuffers.back();
+            freeBuffers.pop_back();
+            return buffers;
+        }
+        ChunkBuffers buffers;
+        glGenVertexArrays(1, &buffers.VAO);
+        glGenBuffers(1, &buffers.VBO);
+        glBindVertexArray(buffers.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(TerrainVertex), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(TerrainVertex), (void*)offsetof(TerrainVertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainVertex), (void*)offsetof(TerrainVertex, Weights));
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return buffers;
+    }
+
+    void evict() {
+        std::vector<std::pair<uint64_t, int64_t>> outOfRange;
+        for (auto it = chunks.begin(); it != chunks.end();) {
+            Chunk &chunk = it->second;
+            if (inRange(chunk.x, chunk.z)) {
+                ++it;
+                continue;
+            }
+            if (chunk.state == Resident) {
+                outOfRange.push_back(std::make_pair(chunk.lastUsed, it->first));
+                ++it;
+            } else {
+                // pending results are discarded in collectCompleted()
+                it = chunks.erase(it);
+            }
+        }
+
+        // keep recently seen chunks around so walking back does not regenerate them
+        std::sort(outOfRange.begin(), outOfRange.end());
+        for (size_t i = 0; i < outOfRange.size() && residentCount > settings.maxResidentChunks; i++) {
+            auto it = chunks.find(outOfRange[i].second);
+            freeBuffers.push_back(it->second.buffers);
+            chunks.erase(it);
+            residentCount--;
+        }
+    }
+};
+
+#endif //PROJECT_BASE_TERRAIN_H
@@ -0,0 +1,92 @@
+//
+// Fixed-size worker pool used for CPU side work that must never block the render thread.
+//
+
+#ifndef PROJECT_BASE_THREAD_POOL_H
+#define PROJECT_BASE_THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // spawns `threads` workers; 0 means one less than the hardware concurrency (the render thread keeps a core)
+    explicit ThreadPool(unsigned int threads = 0) {
+        if (threads == 0) {
+            unsigned int hw = std::thread::hardware_concurrency();
+            threads = hw > 1 ? hw - 1 : 1;
+        }
+        for (unsigned int i = 0; i < threads; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker: workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // queues a job; jobs are started in submission order
+    void Submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    // blocks until every queued and running job has finished
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return jobs.empty() && running == 0; });
+    }
+
+    unsigned int Size() const {
+        return (unsigned int) workers.size();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    unsigned int running = 0;
+    bool stopping = false;
+
+    void workerLoop() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                running++;
+            }
+            job();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running--;
+                if (jobs.empty() && running == 0)
+                    idle.notify_all();
+            }
+        }
+    }
+};
+
+#endif //PROJECT_BASE_THREAD_POOL_H
@@ -0,0 +1,457 @@
+//
+// Bounding volume hierarchy over a triangle soup, for rays cast on the CPU at import time. Built top down with binned
+// surface area splits; every leaf holds its triangles as packets of four in structure of arrays form, so a ray is
+// tested against four triangles at a time with SSE. Occluded answers shadow and occlusion rays, Intersect finds the
+// closest hit. Read only once built, any number of threads may trace at once.
+//
+
+#ifndef PROJECT_BASE_TRIANGLE_BVH_H
+#define PROJECT_BASE_TRIANGLE_BVH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TRIANGLE_BVH_SSE2 1
+#endif
+
+class TriangleBvh {
+public:
+    // leaves are split further above this many triangles, two packets
+    static const unsigned int LeafSize = 8;
+    // past this depth nodes are halved at the median instead, which bounds the depth the trace stack holds
+    static const int MaxDepth = 48;
+
+    // the closest triangle a ray hit, numbered in the order it was added, and where on it
+    struct Hit {
+        float t = 0.0f;
+        unsigned int triangle = 0;
+        // barycentric weights of the second and third vertex
+        float u = 0.0f, v = 0.0f;
+    };
+
+    void Clear() {
+        nodes.clear();
+        packets.clear();
+        triangles.clear();
+    }
+
+    // queues a triangle, it can be hit once Build ran
+    void Add(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c) {
+        Triangle triangle;
+        triangle.v[0] = a;
+        triangle.v[1] = b;
+        triangle.v[2] = c;
+        triangle.lower = glm::min(a, glm::min(b, c));
+        triangle.upper = glm::max(a, glm::max(b, c));
+        triangle.centroid = (a + b + c) * (1.0f / 3.0f);
+        triangle.id = (unsigned int) triangles.size();
+        triangles.push_back(triangle);
+    }
+
+    void Build() {
+        nodes.clear();
+        packets.clear();
+        if (triangles.empty())
+            return;
+        std::vector<unsigned int> order(triangles.size());
+        for (unsigned int i = 0; i < order.size(); i++)
+            order[i] = i;
+        nodes.reserve(2 * triangles.size() / LeafSize + 1);
+        build(order, 0, (unsigned int) order.size(), 0);
+        // only the packets are traced
+        std::vector<Triangle>().swap(triangles);
+    }
+
+    bool Empty() const {
+        return nodes.empty();
+    }
+
+    glm::vec3 Lower() const {
+        return nodes.empty() ? glm::vec3(0.0f) : nodes[0].lower;
+    }
+
+    glm::vec3 Upper() const {
+        return nodes.empty() ? glm::vec3(0.0f) : nodes[0].upper;
+    }
+
+    // true when any triangle, front or back facing, crosses the ray between tMin and tMax. direction need not be
+    // normalized, the distances are in its units
+    bool Occluded(const glm::vec3 &origin, const glm::vec3 &direction, float tMin, float tMax) const {
+        if (nodes.empty())
+            return false;
+        Ray ray(origin, direction, tMin, tMax);
+        float enterRoot;
+        if (!enterBox(nodes[0], ray, enterRoot))
+            return false;
+        // the nearer child is visited first, the farther one waits on the stack
+        unsigned int stack[MaxDepth + 34];
+        int top = 0;
+        unsigned int index = 0;
+        for (;;) {
+            const Node &node = nodes[index];
+            if (node.count == 0) {
+                // the left child directly follows its parent
+                unsigned int left = index + 1, right = node.first;
+                float enterLeft, enterRight;
+                bool hitLeft = enterBox(nodes[left], ray, enterLeft), hitRight = enterBox(nodes[right], ray, enterRight);
+                if (hitLeft && hitRight) {
+                    index = enterLeft <= enterRight ? left : right;
+                    stack[top++] = enterLeft <= enterRight ? right : left;
+                    continue;
+                }
+                if (hitLeft || hitRight) {
+                    index = hitLeft ? left : right;
+                    continue;
+                }
+            } else {
+                float t[4], u[4], v[4];
+                for (unsigned int i = 0; i < node.count; i++)
+                    if (packetTest(packets[node.first + i], origin, direction, tMin, tMax, t, u, v))
+                        return true;
+            }
+            if (top == 0)
+                break;
+            index = stack[--top];
+        }
+        return false;
+    }
+
+    // the closest triangle, front or back facing, the ray crosses between tMin and tMax
+    bool Intersect(const glm::vec3 &origin, const glm::vec3 &direction, float tMin, float tMax, Hit &hit) const {
+        if (nodes.empty())
+            return false;
+        Ray ray(origin, direction, tMin, tMax);
+        float enterRoot;
+        if (!enterBox(nodes[0], ray, enterRoot))
+            return false;
+        // the farther child waits with the distance it is entered at, and is dropped once a closer hit is known
+        struct Entry {
+            unsigned int index;
+            float enter;
+        } stack[MaxDepth + 34];
+        int top = 0;
+        unsigned int index = 0;
+        bool found = false;
+        for (;;) {
+            const Node &node = nodes[index];
+            if (node.count == 0) {
+                unsigned int left = index + 1, right = node.first;
+                float enterLeft, enterRight;
+                bool hitLeft = enterBox(nodes[left], ray, enterLeft), hitRight = enterBox(nodes[right], ray, enterRight);
+                if (hitLeft && hitRight) {
+                    bool leftFirst = enterLeft <= enterRight;
+                    index = leftFirst ? left : right;
+                    stack[top].index = leftFirst ? right : left;
+                    stack[top++].enter = leftFirst ? enterRight : enterLeft;
+                    continue;
+                }
+                if (hitLeft || hitRight) {
+                    index = hitLeft ? left : right;
+                    continue;
+                }
+            } else {
+                float t[4], u[4], v[4];
+                for (unsigned int i = 0; i < node.count; i++) {
+                    const Packet &packet = packets[node.first + i];
+                    int lanes = packetTest(packet, origin, direction, tMin, ray.tMax, t, u, v);
+                    for (int lane = 0; lanes; lane++, lanes >>= 1)
+                        if ((lanes & 1) && t[lane] < ray.tMax) {
+                            ray.tMax = t[lane];
+                            hit.t = t[lane];
+                            hit.triangle = packet.id[lane];
+                            hit.u = u[lane];
+                            hit.v = v[lane];
+                            found = true;
+                        }
+                }
+            }
+            do {
+                if (top == 0)
+                    return found;
+                top--;
+            } while (stack[top].enter > ray.tMax);
+            index = stack[top].index;
+        }
+    }
+
+private:
+    struct Triangle {
+        glm::vec3 v[3];
+        glm::vec3 lower, upper, centroid;
+        unsigned int id;
+    };
+
+    // inner nodes have count 0 and their right child at first, leaves have count packets from first
+    struct Node {
+        glm::vec3 lower;
+        unsigned int first;
+        glm::vec3 upper;
+        unsigned int count;
+    };
+
+    // four triangles as a vertex and two edges each, unused lanes are degenerate and never hit
+    struct Packet {
+        float x[4], y[4], z[4];
+        float e1x[4], e1y[4], e1z[4];
+        float e2x[4], e2y[4], e2z[4];
+        unsigned int id[4];
+    };
+
+    std::vector<Triangle> triangles;
+    std::vector<Node> nodes;
+    std::vector<Packet> packets;
+
+    static float area(const glm::vec3 &lower, const glm::vec3 &upper) {
+        glm::vec3 extent = glm::max(upper - lower, glm::vec3(0.0f));
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+
+    unsigned int build(std::vector<unsigned int> &order, unsigned int begin, unsigned int end, int depth) {
+        unsigned int index = (unsigned int) nodes.size();
+        nodes.push_back(Node());
+        glm::vec3 lower(1e30f), upper(-1e30f), centroidLower(1e30f), centroidUpper(-1e30f);
+        for (unsigned int i = begin; i < end; i++) {
+            const Triangle &triangle = triangles[order[i]];
+            lower = glm::min(lower, triangle.lower);
+            upper = glm::max(upper, triangle.upper);
+            centroidLower = glm::min(centroidLower, triangle.centroid);
+            centroidUpper = glm::max(centroidUpper, triangle.centroid);
+        }
+        nodes[index].lower = lower;
+        nodes[index].upper = upper;
+
+        unsigned int middle = begin;
+        if (end - begin > LeafSize)
+            middle = depth < MaxDepth ? split(order, begin, end, centroidLower, centroidUpper)
+                                      : median(order, begin, end, centroidLower, centroidUpper);
+        if (middle == begin || middle == end) {
+            nodes[index].first = (unsigned int) packets.size();
+            nodes[index].count = (end - begin + 3) / 4;
+            for (unsigned int i = begin; i < end; i += 4)
+                addPacket(order, i, std::min(i + 4, end));
+            return index;
+        }
+        build(order, begin, middle, depth + 1);
+        unsigned int right = build(order, middle, end, depth + 1);
+        nodes[index].first = right;
+        nodes[index].count = 0;
+        return index;
+    }
+
+    // partitions [begin, end) at the cheapest of the bin boundaries along the widest centroid axis
+    unsigned int split(std::vector<unsigned int> &order, unsigned int begin, unsigned int end,
+                       const glm::vec3 &centroidLower, const glm::vec3 &centroidUpper) {
+        const int binCount = 16;
+        glm::vec3 extent = centroidUpper - centroidLower;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        if (extent[axis] <= 0.0f) {
+            // every centroid in one spot, halve the list so leaves stay small
+            return begin + (end - begin) / 2;
+        }
+        float scale = binCount / extent[axis];
+        auto binOf = [&](const Triangle &triangle) {
+            return std::min(binCount - 1, (int) ((triangle.centroid[axis] - centroidLower[axis]) * scale));
+        };
+
+        glm::vec3 binLower[binCount], binUpper[binCount];
+        unsigned int binSize[binCount] = {};
+        for (int b = 0; b < binCount; b++) {
+            binLower[b] = glm::vec3(1e30f);
+            binUpper[b] = glm::vec3(-1e30f);
+        }
+        for (unsigned int i = begin; i < end; i++) {
+            const Triangle &triangle = triangles[order[i]];
+            int b = binOf(triangle);
+            binLower[b] = glm::min(binLower[b], triangle.lower);
+            binUpper[b] = glm::max(binUpper[b], triangle.upper);
+            binSize[b]++;
+        }
+
+        // surface area heuristic, the cost of each boundary from a sweep in each direction
+        float rightCost[binCount];
+        glm::vec3 lower(1e30f), upper(-1e30f);
+        unsigned int rightCount[binCount], count = 0;
+        for (int b = binCount - 1; b > 0; b--) {
+            lower = glm::min(lower, binLower[b]);
+            upper = glm::max(upper, binUpper[b]);
+            count += binSize[b];
+            rightCount[b] = count;
+            rightCost[b] = area(lower, upper) * count;
+        }
+        float bestCost = 1e30f;
+        int best = 0;
+        lower = glm::vec3(1e30f);
+        upper = glm::vec3(-1e30f);
+        count = 0;
+        for (int b = 0; b < binCount - 1; b++) {
+            lower = glm::min(lower, binLower[b]);
+            upper = glm::max(upper, binUpper[b]);
+            count += binSize[b];
+            // both sides keep a triangle, the first and last bin always hold one
+            if (count == 0 || rightCount[b + 1] == 0)
+                continue;
+            float cost = area(lower, upper) * count + rightCost[b + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                best = b + 1;
+            }
+        }
+        if (best == 0)
+            return begin + (end - begin) / 2;
+        auto first = order.begin() + begin;
+        auto middle = std::partition(first, order.begin() + end,
+                                     [&](unsigned int i) { return binOf(triangles[i]) < best; });
+        return (unsigned int) (middle - order.begin());
+    }
+
+    unsigned int median(std::vector<unsigned int> &order, unsigned int begin, unsigned int end,
+                        const glm::vec3 &centroidLower, const glm::vec3 &centroidUpper) {
+        glm::vec3 extent = centroidUpper - centroidLower;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        unsigned int middle = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                         [&](unsigned int a, unsigned int b) {
+                             return triangles[a].centroid[axis] < triangles[b].centroid[axis];
+                         });
+        return middle;
+    }
+
+    void addPacket(const std::vector<unsigned int> &order, unsigned int begin, unsigned int end) {
+        Packet packet = {};
+        for (unsigned int i = begin; i < end; i++) {
+            const Triangle &triangle = triangles[order[i]];
+            int lane = i - begin;
+            glm::vec3 e1 = triangle.v[1] - triangle.v[0], e2 = triangle.v[2] - triangle.v[0];
+            packet.x[lane] = triangle.v[0].x;
+            packet.y[lane] = triangle.v[0].y;
+            packet.z[lane] = triangle.v[0].z;
+            packet.e1x[lane] = e1.x;
+            packet.e1y[lane] = e1.y;
+            packet.e1z[lane] = e1.z;
+            packet.e2x[lane] = e2.x;
+            packet.e2y[lane] = e2.y;
+            packet.e2z[lane] = e2.z;
+            packet.id[lane] = triangle.id;
+        }
+        packets.push_back(packet);
+    }
+
+    // the ray as the slab test wants it
+    struct Ray {
+        float origin[4], inverse[4];
+        float tMin, tMax;
+
+        Ray(const glm::vec3 &o, const glm::vec3 &direction, float near, float far) : tMin(near), tMax(far) {
+            for (int axis = 0; axis < 3; axis++) {
+                origin[axis] = o[axis];
+                // a zero component would turn the slab test into 0 * infinity
+                float component = direction[axis];
+                inverse[axis] = 1.0f / (std::fabs(component) > 1e-20f ? component : std::copysign(1e-20f, component));
+            }
+            origin[3] = inverse[3] = 0.0f;
+        }
+    };
+
+    // whether the ray crosses the node's box, and where it enters it
+    static bool enterBox(const Node &node, const Ray &ray, float &enter) {
+#ifdef TRIANGLE_BVH_SSE2
+        // the fourth lanes hold first and count, they are replaced by tMin and tMax before the reduction
+        __m128 origin = _mm_loadu_ps(ray.origin), inverse = _mm_loadu_ps(ray.inverse);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.lower.x), origin), inverse);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.upper.x), origin), inverse);
+        __m128 lastLane = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+        __m128 entry = _mm_or_ps(_mm_andnot_ps(lastLane, _mm_min_ps(t0, t1)),
+                                 _mm_and_ps(lastLane, _mm_set1_ps(ray.tMin)));
+        __m128 leave = _mm_or_ps(_mm_andnot_ps(lastLane, _mm_max_ps(t0, t1)),
+                                 _mm_and_ps(lastLane, _mm_set1_ps(ray.tMax)));
+        entry = _mm_max_ps(entry, _mm_shuffle_ps(entry, entry, _MM_SHUFFLE(1, 0, 3, 2)));
+        entry = _mm_max_ps(entry, _mm_shuffle_ps(entry, entry, _MM_SHUFFLE(2, 3, 0, 1)));
+        leave = _mm_min_ps(leave, _mm_shuffle_ps(leave, leave, _MM_SHUFFLE(1, 0, 3, 2)));
+        leave = _mm_min_ps(leave, _mm_shuffle_ps(leave, leave, _MM_SHUFFLE(2, 3, 0, 1)));
+        enter = _mm_cvtss_f32(entry);
+        return enter <= _mm_cvtss_f32(leave);
+#else
+        float exit = ray.tMax;
+        enter = ray.tMin;
+        for (int axis = 0; axis < 3; axis++) {
+            float t0 = (node.lower[axis] - ray.origin[axis]) * ray.inverse[axis];
+            float t1 = (node.upper[axis] - ray.origin[axis]) * ray.inverse[axis];
+            enter = std::max(enter, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+        }
+        return enter <= exit;
+#endif
+    }
+
+    // Moller-Trumbore against the four triangles of a packet. Returns the lanes hit between tMin and tMax as a bit
+    // mask, with the distance and barycentrics of every lane
+    static int packetTest(const Packet &packet, const glm::vec3 &origin, const glm::vec3 &direction, float tMin,
+                          float tMax, float tOut[4], float uOut[4], float vOut[4]) {
+#ifdef TRIANGLE_BVH_SSE2
+        __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+        __m128 e1x = _mm_loadu_ps(packet.e1x), e1y = _mm_loadu_ps(packet.e1y), e1z = _mm_loadu_ps(packet.e1z);
+        __m128 e2x = _mm_loadu_ps(packet.e2x), e2y = _mm_loadu_ps(packet.e2y), e2z = _mm_loadu_ps(packet.e2z);
+        // p = d x e2, det = e1 . p
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        // |det| above a tiny epsilon, degenerate padding lanes have det 0
+        __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+        __m128 valid = _mm_cmpgt_ps(absDet, _mm_set1_ps(1e-12f));
+        __m128 inverseDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+        __m128 sx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(packet.x));
+        __m128 sy = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(packet.y));
+        __m128 sz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(packet.z));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)),
+                              inverseDet);
+        // q = s x e1
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)),
+                              inverseDet);
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)),
+                              inverseDet);
+        __m128 zero = _mm_setzero_ps();
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+        valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+        valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, _mm_set1_ps(tMin)));
+        valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(tMax)));
+        _mm_storeu_ps(tOut, t);
+        _mm_storeu_ps(uOut, u);
+        _mm_storeu_ps(vOut, v);
+        return _mm_movemask_ps(valid);
+#else
+        int lanes = 0;
+        for (int i = 0; i < 4; i++) {
+            glm::vec3 e1(packet.e1x[i], packet.e1y[i], packet.e1z[i]), e2(packet.e2x[i], packet.e2y[i], packet.e2z[i]);
+            glm::vec3 p = glm::cross(direction, e2);
+            float det = glm::dot(e1, p);
+            if (std::fabs(det) <= 1e-12f)
+                continue;
+            float inverseDet = 1.0f / det;
+            glm::vec3 s = origin - glm::vec3(packet.x[i], packet.y[i], packet.z[i]);
+            float u = glm::dot(s, p) * inverseDet;
+            glm::vec3 q = glm::cross(s, e1);
+            float v = glm::dot(direction, q) * inverseDet;
+            float t = glm::dot(e2, q) * inverseDet;
+            tOut[i] = t;
+            uOut[i] = u;
+            vOut[i] = v;
+            if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > tMin && t < tMax)
+                lanes |= 1 << i;
+        }
+        return lanes;
+#endif
+    }
+};
+
+#endif //PROJECT_BASE_TRIANGLE_BVH_H
@@ -0,0 +1,146 @@
+//
+// Ambient occlusion baked into the vertices at import time. Every vertex casts a fixed set of cosine distributed rays
+// over the hemisphere around its normal against a TriangleBvh of the whole model; the share that escapes within
+// Settings::distance becomes Vertex::Occlusion, which model_shader.fs multiplies the ambient light with. The vertices
+// are shared out between threads in blocks. A vertex's result depends on nothing but the geometry, so the same model
+// always bakes to the same bytes, however many threads ran.
+//
+
+#ifndef PROJECT_BASE_VERTEX_OCCLUSION_H
+#define PROJECT_BASE_VERTEX_OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include <triangle_bvh.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace VertexOcclusion {
+
+struct Settings {
+    int rays = 64;
+    // how far a ray looks for an occluder, as a fraction of the model's bounding box diagonal
+    float distance = 0.05f;
+};
+
+// off by default, the runtime and asset_cooker turn it on so their caches carry the same flag
+inline std::atomic<bool> &enabledFlag() {
+    static std::atomic<bool> enabled(false);
+    return enabled;
+}
+
+inline void SetEnabled(bool enabled) {
+    enabledFlag().store(enabled);
+}
+
+inline bool Enabled() {
+    return enabledFlag().load();
+}
+
+inline uint32_t hash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// a Hammersley set of count cosine distributed directions around +z
+inline std::vector<glm::vec3> hemisphere(int count) {
+    std::vector<glm::vec3> directions(count);
+    for (int i = 0; i < count; i++) {
+        uint32_t bits = (uint32_t) i;
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        float u = (i + 0.5f) / count, v = (float) bits * 2.3283064365386963e-10f;
+        float radius = std::sqrt(u), angle = 6.28318531f * v;
+        directions[i] = glm::vec3(radius * std::cos(angle), radius * std::sin(angle), std::sqrt(1.0f - u));
+    }
+    return directions;
+}
+
+// share of the rays from position around normal that nothing blocks. The set is turned by an angle hashed from the
+// position, neighbouring vertices then sample different directions and the banding becomes noise
+inline float visibility(const TriangleBvh &bvh, const std::vector<glm::vec3> &directions, const glm::vec3 &position,
+                        const glm::vec3 &normal, float bias, float distance) {
+    glm::vec3 n = glm::normalize(normal);
+    glm::vec3 helper = std::fabs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::vec3 tangent = glm::normalize(glm::cross(helper, n)), bitangent = glm::cross(n, tangent);
+    uint32_t bits[3];
+    std::memcpy(bits, &position[0], sizeof(bits));
+    uint32_t seed = hash(hash(hash(bits[0]) ^ bits[1]) ^ bits[2]);
+    float angle = (float) seed * (6.28318531f / 4294967296.0f);
+    float c = std::cos(angle), s = std::sin(angle);
+    // lifted off the surface so the triangles around the vertex itself are not hit
+    glm::vec3 origin = position + n * bias;
+    int open = 0;
+    for (const glm::vec3 &local: directions) {
+        float x = local.x * c - local.y * s, y = local.x * s + local.y * c;
+        glm::vec3 direction = tangent * x + bitangent * y + n * local.z;
+        if (!bvh.Occluded(origin, direction, 0.0f, distance))
+            open++;
+    }
+    return (float) open / directions.size();
+}
+
+// bakes Occlusion into the vertices of every mesh, each mesh a struct with vertices and indices like MeshData. All
+// the meshes occlude each other, they are meant to be the parts of one model
+template<typename MeshType>
+void Bake(std::vector<MeshType> &meshes, const Settings &settings = Settings()) {
+    TriangleBvh bvh;
+    for (const MeshType &mesh: meshes)
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+            bvh.Add(mesh.vertices[mesh.indices[i]].Position, mesh.vertices[mesh.indices[i + 1]].Position,
+                    mesh.vertices[mesh.indices[i + 2]].Position);
+    bvh.Build();
+    if (bvh.Empty())
+        return;
+    float diagonal = glm::length(bvh.Upper() - bvh.Lower());
+    float distance = diagonal * settings.distance, bias = diagonal * 5e-4f;
+    std::vector<glm::vec3> directions = hemisphere(std::max(settings.rays, 1));
+
+    // every vertex of every mesh in one list, handed out in blocks
+    std::vector<std::pair<unsigned int, unsigned int>> blocks;
+    const unsigned int blockSize = 256;
+    for (unsigned int m = 0; m < meshes.size(); m++)
+        for (unsigned int first = 0; first < meshes[m].vertices.size(); first += blockSize)
+            blocks.emplace_back(m, first);
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t block = next++; block < blocks.size(); block = next++) {
+            auto &vertices = meshes[blocks[block].first].vertices;
+            size_t end = std::min<size_t>(blocks[block].second + blockSize, vertices.size());
+            for (size_t i = blocks[block].second; i < end; i++) {
+                // a vertex without a normal has no hemisphere, it is left open
+                if (glm::dot(vertices[i].Normal, vertices[i].Normal) < 1e-12f) {
+                    vertices[i].Occlusion = 255;
+                    continue;
+                }
+                float open = visibility(bvh, directions, vertices[i].Position, vertices[i].Normal, bias, distance);
+                vertices[i].Occlusion = (unsigned char) std::lround(open * 255.0f);
+            }
+        }
+    };
+    unsigned int threads = std::max(1u, std::min<unsigned int>(std::thread::hardware_concurrency(),
+                                                                (unsigned int) blocks.size()));
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < threads; i++)
+        workers.emplace_back(work);
+    work();
+    for (std::thread &worker: workers)
+        worker.join();
+}
+
+}
+
+#endif //PROJECT_BASE_VERTEX_OCCLUSION_H
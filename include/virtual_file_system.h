@@ -0,0 +1,122 @@
+//
+// One place every loader reads files through. Mounted packs are searched first, newest mount first, unless loose
+// overrides are on: then a file that exists on disk wins over its packed copy, so edited files show up during
+// development without rebuilding the pack. Loose files are mapped too, a read is one open, one fstat and one mmap.
+//
+
+#ifndef PROJECT_BASE_VIRTUAL_FILE_SYSTEM_H
+#define PROJECT_BASE_VIRTUAL_FILE_SYSTEM_H
+
+#include <asset_pack.h>
+
+#include <sys/stat.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class VirtualFileSystem {
+public:
+    // root is the directory pack paths are relative to, paths under it are looked up in the packs by their rest
+    VirtualFileSystem(const std::string &root, bool looseOverrides = true)
+        : root(Normalize(root)), looseOverrides(looseOverrides) {}
+
+    VirtualFileSystem(const VirtualFileSystem &) = delete;
+    VirtualFileSystem &operator=(const VirtualFileSystem &) = delete;
+
+    // not thread safe, mount before any loader thread starts
+    bool Mount(const std::string &packPath) {
+        std::unique_ptr<AssetPack> pack(new AssetPack());
+        if (!pack->Open(packPath))
+            return false;
+        packs.insert(packs.begin(), std::move(pack));
+        return true;
+    }
+
+    bool HasPacks() const {
+        return !packs.empty();
+    }
+
+    bool LooseOverrides() const {
+        return looseOverrides;
+    }
+
+    // the file's bytes, an empty view when it is neither on disk nor in a pack. Safe on any thread
+    FileView Open(const std::string &path) const {
+        if (looseOverrides || packs.empty()) {
+            FileView view = openLoose(path);
+            if (view || packs.empty())
+                return view;
+        }
+        std::string key = PackKey(path);
+        for (const std::unique_ptr<AssetPack> &pack: packs) {
+            FileView view = pack->Find(key);
+            if (view)
+                return view;
+        }
+        return looseOverrides ? FileView() : openLoose(path);
+    }
+
+    bool Exists(const std::string &path) const {
+        return (bool) Open(path);
+    }
+
+    // true when both are loose files and path was modified after derived, e.g. a source edited since it was cooked.
+    // A packed file has no time, it is never out of date
+    static bool EditedAfter(const std::string &path, const std::string &derived) {
+        struct stat source, output;
+        return stat(path.c_str(), &source) == 0 && stat(derived.c_str(), &output) == 0 &&
+               source.st_mtime > output.st_mtime;
+    }
+
+    // the path packs store a file under: normalized and relative to the root
+    std::string PackKey(const std::string &path) const {
+        std::string normalized = Normalize(path);
+        if (!root.empty() && normalized.compare(0, root.size(), root) == 0 &&
+            (normalized.size() == root.size() || normalized[root.size()] == '/'))
+            return normalized.substr(std::min(normalized.size(), root.size() + 1));
+        return normalized;
+    }
+
+    // drops empty and "." segments and folds ".." into its parent where there is one
+    static std::string Normalize(const std::string &path) {
+        std::vector<std::string> segments;
+        size_t start = 0;
+        while (start <= path.size()) {
+            size_t end = path.find('/', start);
+            if (end == std::string::npos)
+                end = path.size();
+            std::string segment = path.substr(start, end - start);
+            if (segment == "..") {
+                if (!segments.empty() && segments.back() != "..")
+                    segments.pop_back();
+                else
+                    segments.push_back(segment);
+            } else if (!segment.empty() && segment != ".")
+                segments.push_back(segment);
+            start = end + 1;
+        }
+        std::string normalized = !path.empty() && path[0] == '/' ? "/" : "";
+        for (size_t i = 0; i < segments.size(); i++)
+            normalized += (i ? "/" : "") + segments[i];
+        return normalized;
+    }
+
+private:
+    std::string root;
+    bool looseOverrides;
+    std::vector<std::unique_ptr<AssetPack>> packs;
+
+    static FileView openLoose(const std::string &path) {
+        std::shared_ptr<MappedFile> file = MappedFile::Open(path);
+        FileView view;
+        if (!file)
+            return view;
+        view.data = file->Data();
+        view.size = file->Size();
+        view.backing = file;
+        return view;
+    }
+};
+
+#endif //PROJECT_BASE_VIRTUAL_FILE_SYSTEM_H
@@ -0,0 +1,586 @@
+//
+// Software virtual texturing. A page table texture maps virtual pages to slots of a fixed size physical atlas,
+// a low resolution feedback pass records which pages are visible and missing pages are produced on the worker
+// pool and uploaded a few per frame. Pages that are not resident fall back to the closest resident ancestor.
+//
+
+#ifndef PROJECT_BASE_VIRTUAL_TEXTURE_H
+#define PROJECT_BASE_VIRTUAL_TEXTURE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/filesystem.h>
+#include <learnopengl/shader.h>
+
+#include <image_decoder.h>
+#include <noise.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct VirtualTextureSettings {
+    int pagesLog2 = 9;              // 512 x 512 pages at mip 0
+    int pageSize = 128;             // texels of payload per page side
+    int pageBorder = 4;             // filtering border on each side
+    int atlasPages = 16;            // physical slots per atlas side, the VRAM budget
+    int feedbackDivisor = 8;        // feedback buffer is this many times smaller than the screen
+    int maxUploadsPerFrame = 8;
+    int maxPendingPages = 32;
+};
+
+// produces page texels; called from worker threads so it must be thread safe
+class VirtualTextureSource {
+public:
+    virtual ~VirtualTextureSource() {}
+
+    // fills size * size RGBA8 texels, texel (0, 0) is virtual texel (x0, y0) of mip level `mip`
+    virtual void Produce(int mip, int x0, int y0, int size, int virtualSize, unsigned char *rgba) const = 0;
+};
+
+// unique terrain surface synthesised from the tiled terrain textures with large scale procedural variation
+class ProceduralTerrainSource : public VirtualTextureSource {
+public:
+    float tiling = 30.0f;           // detail texture repeats over the virtual texture, as the old UVs did
+    float worldSize = 1000.0f;
+
+    ProceduralTerrainSource(const std::string &basePath, const std::string &rockPath) {
+        loadChain(basePath, base);
+        loadChain(rockPath, rock);
+        // the rock map only adds detail, divided by its average as in terrain_shader.fs
+        if (!rock.empty()) {
+            const Level &last = rock.back();
+            for (int i = 0; i < last.width * last.height; i++)
+                rockAverage += glm::vec3(last.rgb[i * 3], last.rgb[i * 3 + 1], last.rgb[i * 3 + 2]);
+            rockAverage = glm::max(rockAverage / (float) (last.width * last.height), glm::vec3(0.05f));
+        }
+        variation.octaves = 5;
+        variation.frequency = 0.01f;
+        variation.amplitude = 1.0f;
+        patches = variation;
+        patches.frequency = 0.004f;
+        patches.seed = 7331u;
+    }
+
+    void Produce(int mip, int x0, int y0, int size, int virtualSize, unsigned char *rgba) const override {
+        if (base.empty() || rock.empty())
+            return;
+        float texelSize = (float) (1 << mip) / (float) virtualSize;
+        // footprint of one page texel in detail texels picks the detail mip
+        float footprint = texelSize * tiling * (float) base[0].width;
+        int level = glm::clamp((int) std::floor(std::log2(std::max(footprint, 1.0f))), 0, (int) base.size() - 1);
+        int rockLevel = std::min(level, (int) rock.size() - 1);
+
+        std::vector<float> xs(size), zs(size), tint(size), rockWeight(size);
+        for (int y = 0; y < size; y++) {
+            float v = ((float) (y0 + y) + 0.5f) * texelSize;
+            for (int x = 0; x < size; x++) {
+                xs[x] = ((float) (x0 + x) + 0.5f) * texelSize * worldSize;
+                zs[x] = v * worldSize;
+            }
+            Noise::FractalBatch(&xs[0], &zs[0], &tint[0], size, variation);
+            Noise::FractalBatch(&xs[0], &zs[0], &rockWeight[0], size, patches);
+            for (int x = 0; x < size; x++) {
+                float u = xs[x] / worldSize * tiling, w = v * tiling;
+                glm::vec3 grass = sample(base[level], u, w);
+                glm::vec3 stone = sample(rock[rockLevel], u * 0.5f, w * 0.5f) / rockAverage *
+                                  glm::vec3(0.55f, 0.5f, 0.45f);
+                float t = glm::clamp(rockWeight[x] * 2.0f + 0.2f, 0.0f, 1.0f);
+                glm::vec3 color = glm::mix(grass, stone, t * t * (3.0f - 2.0f * t)) * (0.85f + 0.3f * tint[x]);
+                unsigned char *out = rgba + (y * size + x) * 4;
+                out[0] = (unsigned char) glm::clamp(color.r * 255.0f, 0.0f, 255.0f);
+                out[1] = (unsigned char) glm::clamp(color.g * 255.0f, 0.0f, 255.0f);
+                out[2] = (unsigned char) glm::clamp(color.b * 255.0f, 0.0f, 255.0f);
+                out[3] = 255;
+            }
+        }
+    }
+
+private:
+    struct Level {
+        int width, height;
+        std::vector<float> rgb;
+    };
+
+    std::vector<Level> base, rock;
+    glm::vec3 rockAverage = glm::vec3(0.0f);
+    FractalSettings variation, patches;
+
+    static void loadChain(const std::string &path, std::vector<Level> &chain) {
+        FileView file = FileSystem::open(path);
+        ImageInfo info;
+        std::vector<unsigned char> data;
+        if (ImageDecoders::Info(file, info))
+            data.resize((size_t) info.width * info.height * 3);
+        if (data.empty() || !ImageDecoders::Decode(file, 3, ImageDecoders::FlipVertically(), data.data())) {
+            std::cout << "Failed to load virtual texture source: " << path << std::endl;
+            return;
+        }
+        int width = info.width, height = info.height;
+        Level level{width, height, std::vector<float>(width * height * 3)};
+        for (int i = 0; i < width * height * 3; i++)
+            level.rgb[i] = data[i] / 255.0f;
+        chain.push_back(std::move(level));
+
+        // box filtered chain so distant pages do not alias
+        while (chain.back().width > 1 && chain.back().height > 1) {
+            const Level &src = chain.back();
+            Level dst{src.width / 2, src.height / 2, std::vector<float>((src.width / 2) * (src.height / 2) * 3)};
+            for (int y = 0; y < dst.height; y++)
+                for (int x = 0; x < dst.width; x++)
+                    for (int c = 0; c < 3; c++)
+                        dst.rgb[(y * dst.width + x) * 3 + c] = 0.25f * (
+                                src.rgb[((2 * y) * src.width + 2 * x) * 3 + c] +
+                                src.rgb[((2 * y) * src.width + 2 * x + 1) * 3 + c] +
+                                src.rgb[((2 * y + 1) * src.width + 2 * x) * 3 + c] +
+                                src.rgb[((2 * y + 1) * src.width + 2 * x + 1) * 3 + c]);
+            chain.push_back(std::move(dst));
+        }
+    }
+
+    // bilinear, repeating
+    static glm::vec3 sample(const Level &level, float u, float v) {
+        float x = u * level.width - 0.5f, y = v * level.height - 0.5f;
+        float fx = std::floor(x), fy = std::floor(y);
+        float tx = x - fx, ty = y - fy;
+        int x0 = ((int) fx % level.width + level.width) % level.width, x1 = (x0 + 1) % level.width;
+        int y0 = ((int) fy % level.height + level.height) % level.height, y1 = (y0 + 1) % level.height;
+        auto at = [&level](int px, int py) {
+            const float *p = &level.rgb[(py * level.width + px) * 3];
+            return glm::vec3(p[0], p[1], p[2]);
+        };
+        return glm::mix(glm::mix(at(x0, y0), at(x1, y0), tx), glm::mix(at(x0, y1), at(x1, y1), tx), ty);
+    }
+};
+
+class VirtualTexture {
+public:
+    VirtualTextureSettings settings;
+    unsigned int pageTable = 0;
+    unsigned int atlas = 0;
+
+    VirtualTexture(ThreadPool &pool, std::shared_ptr<VirtualTextureSource> source,
+                   VirtualTextureSettings textureSettings = VirtualTextureSettings())
+            : settings(textureSettings), pool(pool), source(std::move(source)),
+              completed(std::make_shared<CompletedQueue>()) {
+        mipCount = settings.pagesLog2 + 1;
+        tileSize = settings.pageSize + 2 * settings.pageBorder;
+        for (int mip = 0; mip < mipCount; mip++) {
+            int pages = pagesAt(mip);
+            residency.push_back(std::vector<int>(pages * pages, -1));
+            entries.push_back(std::vector<uint32_t>(pages * pages, 0));
+            dirty.push_back(Rect());
+        }
+        slots.resize(settings.atlasPages * settings.atlasPages);
+        setupTextures();
+
+        // the single page of the coarsest mip is always resident so every lookup has a fallback
+        std::unique_ptr<PageData> root = producePage(*this->source, pageId(mipCount - 1, 0, 0), settings, tileSize);
+        makeResident(*root, true);
+        uploadPageTable();
+    }
+
+    // deletes the GL objects, call before the context goes away
+    void Release() {
+        glDeleteTextures(1, &pageTable);
+        glDeleteTextures(1, &atlas);
+        glDeleteFramebuffers(1, &feedbackFBO);
+        glDeleteTextures(1, &feedbackColor);
+        glDeleteRenderbuffers(1, &feedbackDepth);
+        glDeleteBuffers(2, feedbackPBO);
+        for (GLsync &fence: feedbackFence) {
+            if (fence)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+        pageTable = atlas = feedbackFBO = feedbackColor = feedbackDepth = 0;
+    }
+
+    int VirtualSize() const { return pagesAt(0) * settings.pageSize; }
+    int MipCount() const { return mipCount; }
+    int TileSize() const { return tileSize; }
+    int AtlasSize() const { return tileSize * settings.atlasPages; }
+    int ResidentPages() const { return residentPages; }
+    int PendingPages() const { return pending; }
+    int RequestedLastFrame() const { return requestedLastFrame; }
+    int UploadsLastFrame() const { return uploadsLastFrame; }
+
+    // sets the sampling uniforms shared by the feedback and the shading pass
+    void Bind(Shader &shader, int pageTableUnit, int atlasUnit, float mipBias) const {
+        shader.setInt("pageTable", pageTableUnit);
+        shader.setInt("atlas", atlasUnit);
+        shader.setFloat("virtualSize", (float) VirtualSize());
+        shader.setInt("maxMip", mipCount - 1);
+        shader.setInt("pagesLog2", settings.pagesLog2);
+        shader.setFloat("pageSize", (float) settings.pageSize);
+        shader.setFloat("pageBorder", (float) settings.pageBorder);
+        shader.setFloat("tileSize", (float) tileSize);
+        shader.setFloat("atlasSize", (float) AtlasSize());
+        shader.setFloat("mipBias", mipBias);
+        glActiveTexture(GL_TEXTURE0 + pageTableUnit);
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        glActiveTexture(GL_TEXTURE0 + atlasUnit);
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // binds the feedback target; the caller draws the virtually textured geometry with the feedback shader
+    void BeginFeedback(int screenWidth, int screenHeight) {
+        int width = std::max(1, screenWidth / settings.feedbackDivisor);
+        int height = std::max(1, screenHeight / settings.feedbackDivisor);
+        if (width != feedbackWidth || height != feedbackHeight)
+            setupFeedback(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFBO);
+        glViewport(0, 0, feedbackWidth, feedbackHeight);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // starts the asynchronous read back of the feedback buffer and restores the default framebuffer
+    void EndFeedback(int screenWidth, int screenHeight) {
+        int index = (int) (frame % 2);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPBO[index]);
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (feedbackFence[index])
+            glDeleteSync(feedbackFence[index]);
+        feedbackFence[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, screenWidth, screenHeight);
+    }
+
+    float FeedbackMipBias() const {
+        return -std::log2((float) settings.feedbackDivisor);
+    }
+
+    // consumes the previous frame's feedback, requests missing pages and uploads finished ones; never blocks.
+    // Call once per frame before the feedback pass.
+    void Update() {
+        frame++;
+        readFeedback();
+        uploadCompleted();
+        uploadPageTable();
+    }
+
+private:
+    struct Slot {
+        uint32_t page = 0;
+        uint64_t lastUsed = 0;
+        bool used = false;
+        bool pinned = false;
+    };
+
+    struct PageData {
+        uint32_t page;
+        std::vector<unsigned char> rgba;
+    };
+
+    struct CompletedQueue {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<PageData>> items;
+    };
+
+    struct Rect {
+        int x0 = 1 << 30, y0 = 1 << 30, x1 = -1, y1 = -1;
+
+        bool Empty() const { return x1 < x0; }
+    };
+
+    ThreadPool &pool;
+    std::shared_ptr<VirtualTextureSource> source;
+    std::shared_ptr<CompletedQueue> completed;
+    int mipCount = 0;
+    int tileSize = 0;
+    // per mip level: atlas slot of the resident page or -1, and the RGBA8 page table entry
+    std::vector<std::vector<int>> residency;
+    std::vector<std::vector<uint32_t>> entries;
+    std::vector<Rect> dirty;
+    std::vector<Slot> slots;
+    std::unordered_map<uint32_t, bool> requested;
+    uint64_t frame = 0;
+    int residentPages = 0;
+    int pending = 0;
+    int requestedLastFrame = 0;
+    int uploadsLastFrame = 0;
+
+    unsigned int feedbackFBO = 0, feedbackColor = 0, feedbackDepth = 0;
+    unsigned int feedbackPBO[2] = {0, 0};
+    GLsync feedbackFence[2] = {nullptr, nullptr};
+    int feedbackWidth = 0, feedbackHeight = 0;
+
+    int pagesAt(int mip) const { return 1 << (settings.pagesLog2 - mip); }
+
+    static uint32_t pageId(int mip, int x, int y) {
+        return ((uint32_t) mip << 24) | ((uint32_t) y << 12) | (uint32_t) x;
+    }
+
+    static int pageMip(uint32_t page) { return (int) (page >> 24); }
+    static int pageX(uint32_t page) { return (int) (page & 0xfff); }
+    static int pageY(uint32_t page) { return (int) ((page >> 12) & 0xfff); }
+
+    void setupTextures() {
+        glGenTextures(1, &pageTable);
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        for (int mip = 0; mip < mipCount; mip++)
+            glTexImage2D(GL_TEXTURE_2D, mip, GL_RGBA8, pagesAt(mip), pagesAt(mip), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mipCount - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        for (int mip = 0; mip < mipCount; mip++) {
+            Rect &rect = dirty[mip];
+            rect.x0 = rect.y0 = 0;
+            rect.x1 = rect.y1 = pagesAt(mip) - 1;
+        }
+
+        glGenTextures(1, &atlas);
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, AtlasSize(), AtlasSize(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void setupFeedback(int width, int height) {
+        if (!feedbackFBO) {
+            glGenFramebuffers(1, &feedbackFBO);
+            glGenTextures(1, &feedbackColor);
+            glGenRenderbuffers(1, &feedbackDepth);
+            glGenBuffers(2, feedbackPBO);
+        }
+        feedbackWidth = width;
+        feedbackHeight = height;
+        glBindTexture(GL_TEXTURE_2D, feedbackColor);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FEEDBACK_FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        for (unsigned int pbo: feedbackPBO) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        for (GLsync &fence: feedbackFence) {
+            if (fence)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+
+    // runs on a worker thread
+    static std::unique_ptr<PageData> producePage(const VirtualTextureSource &source, uint32_t page,
+                                                 const VirtualTextureSettings &s, int tileSize) {
+        std::unique_ptr<PageData> data(new PageData());
+        data->page = page;
+        data->rgba.resize(tileSize * tileSize * 4);
+        int virtualSize = (1 << s.pagesLog2) * s.pageSize;
+        source.Produce(pageMip(page), pageX(page) * s.pageSize - s.pageBorder, pageY(page) * s.pageSize - s.pageBorder,
+                       tileSize, virtualSize, &data->rgba[0]);
+        return data;
+    }
+
+    void touch(int mip, int x, int y) {
+        // ancestors serve as fallbacks, keep them warm as well
+        for (; mip < mipCount; mip++, x >>= 1, y >>= 1) {
+            int slot = residency[mip][y * pagesAt(mip) + x];
+            if (slot >= 0)
+                slots[slot].lastUsed = frame;
+        }
+    }
+
+    void readFeedback() {
+        requestedLastFrame = 0;
+        int index = (int) ((frame + 1) % 2);
+        GLsync fence = feedbackFence[index];
+        if (!fence)
+            return;
+        // only consume the read back once the GPU is done with it, otherwise try again next frame
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            return;
+        glDeleteSync(fence);
+        feedbackFence[index] = nullptr;
+
+        std::unordered_map<uint32_t, int> counts;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPBO[index]);
+        const unsigned char *pixels = (const unsigned char *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                                               feedbackWidth * feedbackHeight * 4,
+                                                                               GL_MAP_READ_BIT);
+        if (pixels) {
+            for (int i = 0; i < feedbackWidth * feedbackHeight; i++) {
+                const unsigned char *p = pixels + i * 4;
+                if (p[3] == 0)
+                    continue;
+                int x = p[0] | ((p[2] & 0x0f) << 8);
+                int y = p[1] | ((p[2] & 0xf0) << 4);
+                int mip = p[3] - 1;
+                counts[pageId(mip, x, y)]++;
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        // request the coarsest missing ancestor first so detail refines progressively
+        std::vector<std::pair<std::pair<int, int>, uint32_t>> missing;
+        for (auto &entry: counts) {
+            int mip = pageMip(entry.first), x = pageX(entry.first), y = pageY(entry.first);
+            if (mip >= mipCount || x >= pagesAt(mip) || y >= pagesAt(mip))
+                continue;
+            touch(mip, x, y);
+            for (int m = mipCount - 1; m >= mip; m--) {
+                int ax = x >> (m - mip), ay = y >> (m - mip);
+                if (residency[m][ay * pagesAt(m) + ax] < 0) {
+                    uint32_t page = pageId(m, ax, ay);
+                    if (!requested.count(page))
+                        missing.push_back(std::make_pair(std::make_pair(-m, -entry.second), page));
+                    break;
+                }
+            }
+        }
+        requestedLastFrame = (int) counts.size();
+        std::sort(missing.begin(), missing.end());
+
+        for (size_t i = 0; i < missing.size() && pending < settings.maxPendingPages; i++) {
+            uint32_t page = missing[i].second;
+            if (requested.count(page))
+                continue;
+            requested[page] = true;
+            pending++;
+            std::shared_ptr<CompletedQueue> queue = completed;
+            std::shared_ptr<VirtualTextureSource> producer = source;
+            VirtualTextureSettings s = settings;
+            int tile = tileSize;
+            pool.Submit([queue, producer, page, s, tile] {
+                std::unique_ptr<PageData> data = producePage(*producer, page, s, tile);
+                std::lock_guard<std::mutex> lock(queue->mutex);
+                queue->items.push_back(std::move(data));
+            });
+        }
+    }
+
+    void uploadCompleted() {
+        uploadsLastFrame = 0;
+        std::vector<std::unique_ptr<PageData>> items;
+        {
+            std::lock_guard<std::mutex> lock(completed->mutex);
+            size_t count = std::min(completed->items.size(), (size_t) settings.maxUploadsPerFrame);
+            for (size_t i = 0; i < count; i++)
+                items.push_back(std::move(completed->items[i]));
+            completed->items.erase(completed->items.begin(), completed->items.begin() + count);
+        }
+        for (std::unique_ptr<PageData> &data: items) {
+            pending--;
+            requested.erase(data->page);
+            if (makeResident(*data, false))
+                uploadsLastFrame++;
+        }
+    }
+
+    int allocateSlot() {
+        int victim = -1;
+        for (int i = 0; i < (int) slots.size(); i++) {
+            if (!slots[i].used)
+                return i;
+            // pages seen this frame stay, they would only be requested again
+            if (slots[i].pinned || slots[i].lastUsed >= frame)
+                continue;
+            if (victim < 0 || slots[i].lastUsed < slots[victim].lastUsed)
+                victim = i;
+        }
+        if (victim >= 0)
+            evict(victim);
+        return victim;
+    }
+
+    void evict(int slot) {
+        uint32_t page = slots[slot].page;
+        int mip = pageMip(page), x = pageX(page), y = pageY(page);
+        residency[mip][y * pagesAt(mip) + x] = -1;
+        slots[slot].used = false;
+        residentPages--;
+        markSubtree(mip, x, y);
+    }
+
+    bool makeResident(const PageData &data, bool pinned) {
+        int slot = allocateSlot();
+        if (slot < 0)
+            return false;
+        int mip = pageMip(data.page), x = pageX(data.page), y = pageY(data.page);
+        int slotX = slot % settings.atlasPages, slotY = slot / settings.atlasPages;
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, slotX * tileSize, slotY * tileSize, tileSize, tileSize,
+                        GL_RGBA, GL_UNSIGNED_BYTE, &data.rgba[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        slots[slot].page = data.page;
+        slots[slot].used = true;
+        slots[slot].pinned = pinned;
+        slots[slot].lastUsed = frame;
+        residency[mip][y * pagesAt(mip) + x] = slot;
+        residentPages++;
+        markSubtree(mip, x, y);
+        return true;
+    }
+
+    // recomputes the entries covered by a page whose residency changed, coarse levels first so that every
+    // entry either points at its own page or copies its parent's fallback
+    void markSubtree(int mip, int x, int y) {
+        for (int level = mip; level >= 0; level--) {
+            int shift = mip - level;
+            int x0 = x << shift, y0 = y << shift, size = 1 << shift, pages = pagesAt(level);
+            for (int py = y0; py < y0 + size; py++) {
+                for (int px = x0; px < x0 + size; px++) {
+                    int slot = residency[level][py * pages + px];
+                    uint32_t entry;
+                    if (slot >= 0)
+                        entry = (uint32_t) (slot % settings.atlasPages) | ((uint32_t) (slot / settings.atlasPages) << 8) |
+                                ((uint32_t) level << 16) | 0xff000000u;
+                    else if (level + 1 < mipCount)
+                        entry = entries[level + 1][(py >> 1) * pagesAt(level + 1) + (px >> 1)];
+                    else
+                        entry = 0;
+                    entries[level][py * pages + px] = entry;
+                }
+            }
+            Rect &rect = dirty[level];
+            rect.x0 = std::min(rect.x0, x0);
+            rect.y0 = std::min(rect.y0, y0);
+            rect.x1 = std::max(rect.x1, x0 + size - 1);
+            rect.y1 = std::max(rect.y1, y0 + size - 1);
+        }
+    }
+
+    void uploadPageTable() {
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        for (int mip = 0; mip < mipCount; mip++) {
+            Rect &rect = dirty[mip];
+            if (rect.Empty())
+                continue;
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, pagesAt(mip));
+            glTexSubImage2D(GL_TEXTURE_2D, mip, rect.x0, rect.y0, rect.x1 - rect.x0 + 1, rect.y1 - rect.y0 + 1,
+                            GL_RGBA, GL_UNSIGNED_BYTE, &entries[mip][rect.y0 * pagesAt(mip) + rect.x0]);
+            rect = Rect();
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
+
+#endif //PROJECT_BASE_VIRTUAL_TEXTURE_H
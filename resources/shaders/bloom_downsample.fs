@@ -0,0 +1,57 @@
+#version 330 core
+out vec3 Downsampled;
+
+in vec2 TexCoords;
+
+// the level above, twice the size of this one
+uniform sampler2D source;
+uniform vec2 texelSize;
+// the first level keeps only the light above the threshold
+uniform bool prefilter;
+uniform float threshold;
+uniform float knee;
+
+// the light above the threshold, fading in quadratically over the knee below it
+vec3 Prefilter(vec3 color)
+{
+    float brightness = max(color.r, max(color.g, color.b));
+    float soft = clamp(brightness - threshold + knee, 0.0, 2.0 * knee);
+    soft = soft * soft / (4.0 * knee + 1e-4);
+    return color * max(soft, brightness - threshold) / max(brightness, 1e-4);
+}
+
+// a lone very bright texel would flicker as it moves between blocks, on the first level each block counts less the
+// brighter it is
+float KarisWeight(vec3 color)
+{
+    return 1.0 / (1.0 + dot(color, vec3(0.2126, 0.7152, 0.0722)));
+}
+
+vec3 Sample(vec2 offset)
+{
+    return texture(source, TexCoords + offset * texelSize).rgb;
+}
+
+void main()
+{
+    // 13 taps as five overlapping 2x2 blocks of bilinear samples, the centre block counts for half
+    vec3 a = Sample(vec2(-2.0, 2.0)), b = Sample(vec2(0.0, 2.0)), c = Sample(vec2(2.0, 2.0));
+    vec3 d = Sample(vec2(-2.0, 0.0)), e = Sample(vec2(0.0, 0.0)), f = Sample(vec2(2.0, 0.0));
+    vec3 g = Sample(vec2(-2.0, -2.0)), h = Sample(vec2(0.0, -2.0)), i = Sample(vec2(2.0, -2.0));
+    vec3 j = Sample(vec2(-1.0, 1.0)), k = Sample(vec2(1.0, 1.0));
+    vec3 l = Sample(vec2(-1.0, -1.0)), m = Sample(vec2(1.0, -1.0));
+    vec3 blocks[5] = vec3[]((j + k + l + m) * 0.25, (a + b + d + e) * 0.25, (b + c + e + f) * 0.25,
+                            (d + e + g + h) * 0.25, (e + f + h + i) * 0.25);
+    float weights[5] = float[](0.5, 0.125, 0.125, 0.125, 0.125);
+    vec3 sum = vec3(0.0);
+    float total = 0.0;
+    for(int block = 0; block < 5; block++)
+    {
+        float weight = weights[block] * (prefilter ? KarisWeight(blocks[block]) : 1.0);
+        sum += blocks[block] * weight;
+        total += weight;
+    }
+    Downsampled = sum / total;
+    if(prefilter)
+        Downsampled = Prefilter(Downsampled);
+}
@@ -0,0 +1,22 @@
+#version 330 core
+// added onto the next larger level by the blend state
+out vec3 Upsampled;
+
+in vec2 TexCoords;
+
+// the level below, half the size of this one
+uniform sampler2D source;
+uniform vec2 texelSize;
+
+vec3 Sample(vec2 offset)
+{
+    return texture(source, TexCoords + offset * texelSize).rgb;
+}
+
+void main()
+{
+    // 3x3 tent
+    Upsampled = (Sample(vec2(0.0, 0.0)) * 4.0 +
+                 (Sample(vec2(-1.0, 0.0)) + Sample(vec2(1.0, 0.0)) + Sample(vec2(0.0, -1.0)) + Sample(vec2(0.0, 1.0))) * 2.0 +
+                 Sample(vec2(-1.0, -1.0)) + Sample(vec2(1.0, -1.0)) + Sample(vec2(-1.0, 1.0)) + Sample(vec2(1.0, 1.0))) / 16.0;
+}
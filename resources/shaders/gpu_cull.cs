@@ -0,0 +1,115 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+struct DrawParams {
+    mat4 model;
+    ivec4 textureLayers;
+};
+
+// model space bounding sphere, normal cone and range in the pool of a mesh or meshlet,
+// draw selects its entry in draws
+struct CullObject {
+    vec4 bounds;
+    vec4 cone;
+    uint count;
+    uint firstIndex;
+    int baseVertex;
+    uint draw;
+};
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, binding = 0) readonly buffer DrawBuffer {
+    DrawParams draws[];
+};
+layout (std430, binding = 1) readonly buffer ObjectBuffer {
+    CullObject objects[];
+};
+layout (std430, binding = 2) writeonly buffer CommandBuffer {
+    DrawCommand commands[];
+};
+layout (std430, binding = 3) buffer CounterBuffer {
+    uint visibleCount;
+};
+
+uniform uint objectCount;
+uniform vec4 frustumPlanes[6];
+
+// normal cone test, cone.w above 1 marks objects that never face away as a whole
+uniform bool useConeCulling;
+uniform vec3 cameraPosition;
+
+// last frame's depth pyramid and the matrix it was rendered with
+uniform bool useOcclusion;
+uniform sampler2D hiZ;
+uniform ivec2 hiZSize;
+uniform int hiZLevels;
+uniform mat4 hiZViewProjection;
+
+bool Occluded(vec3 center, float radius)
+{
+    vec2 minUV = vec2(1.0);
+    vec2 maxUV = vec2(0.0);
+    float nearest = 1.0;
+    for(int i = 0; i < 8; i++)
+    {
+        vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = hiZViewProjection * vec4(corner, 1.0);
+        // reaches behind the camera, the screen rectangle is unbounded
+        if(clip.w <= 0.0)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        minUV = min(minUV, ndc.xy * 0.5 + 0.5);
+        maxUV = max(maxUV, ndc.xy * 0.5 + 0.5);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+    minUV = clamp(minUV, 0.0, 1.0);
+    maxUV = clamp(maxUV, 0.0, 1.0);
+
+    // the level where the rectangle spans at most 2x2 texels
+    vec2 extent = (maxUV - minUV) * vec2(hiZSize);
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, hiZLevels - 1);
+    ivec2 levelSize = max(hiZSize >> level, ivec2(1));
+    ivec2 lo = min(ivec2(minUV * vec2(hiZSize)) >> level, levelSize - 1);
+    ivec2 hi = min(ivec2(maxUV * vec2(hiZSize)) >> level, levelSize - 1);
+    float farthest = max(max(texelFetch(hiZ, lo, level).r, texelFetch(hiZ, ivec2(hi.x, lo.y), level).r),
+                         max(texelFetch(hiZ, ivec2(lo.x, hi.y), level).r, texelFetch(hiZ, hi, level).r));
+    return nearest > farthest;
+}
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if(index >= objectCount)
+        return;
+
+    CullObject object = objects[index];
+    mat4 model = draws[object.draw].model;
+    vec3 center = vec3(model * vec4(object.bounds.xyz, 1.0));
+    float scale = max(dot(model[0].xyz, model[0].xyz), max(dot(model[1].xyz, model[1].xyz), dot(model[2].xyz, model[2].xyz)));
+    float radius = object.bounds.w * sqrt(scale);
+
+    for(int i = 0; i < 6; i++)
+        if(dot(frustumPlanes[i].xyz, center) + frustumPlanes[i].w < -radius)
+            return;
+    if(useConeCulling && object.cone.w <= 1.0)
+    {
+        // the model matrix is assumed to scale uniformly, so the axis only needs renormalizing
+        vec3 axis = normalize(mat3(model) * object.cone.xyz);
+        vec3 view = center - cameraPosition;
+        if(dot(view, axis) >= object.cone.w * length(view) + radius)
+            return;
+    }
+    if(useOcclusion && Occluded(center, radius))
+        return;
+
+    // compacted, commands past the visible count were cleared to zero and draw nothing
+    uint slot = atomicAdd(visibleCount, 1u);
+    commands[slot] = DrawCommand(object.count, 1u, object.firstIndex, object.baseVertex, object.draw);
+}
\ No newline at end of file
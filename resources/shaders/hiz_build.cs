@@ -0,0 +1,32 @@
+#version 430 core
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// level 0 copies the depth texture, every further level keeps the farthest depth of the texels below it
+uniform bool fromDepth;
+uniform sampler2D depthTexture;
+layout (r32f, binding = 0) readonly uniform image2D source;
+layout (r32f, binding = 1) writeonly uniform image2D destination;
+uniform ivec2 sourceSize;
+uniform ivec2 destinationSize;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    if(any(greaterThanEqual(texel, destinationSize)))
+        return;
+
+    if(fromDepth)
+    {
+        imageStore(destination, texel, vec4(texelFetch(depthTexture, texel, 0).r));
+        return;
+    }
+
+    // the last row and column of an odd sized level also cover the texel a plain 2x2 reduction would drop
+    ivec2 base = texel * 2;
+    ivec2 extent = ivec2(2) + ivec2(equal(texel, destinationSize - 1)) * (sourceSize & 1);
+    float farthest = 0.0;
+    for(int y = 0; y < extent.y; y++)
+        for(int x = 0; x < extent.x; x++)
+            farthest = max(farthest, imageLoad(source, min(base + ivec2(x, y), sourceSize - 1)).r);
+    imageStore(destination, texel, vec4(farthest));
+}
\ No newline at end of file
@@ -0,0 +1,100 @@
+// FXAA after Timothy Lottes' FXAA 3.11. The luma of a pixel's neighbours tells whether it sits on an edge and which
+// way the edge runs, the edge is followed to both of its ends and the pixel is blended with its neighbour across the
+// edge by how close it is to the nearer end. Luma is read from alpha, written by the pass before
+
+// contrast below max(FxaaThresholdMin, brightest * FxaaThreshold) is left alone
+const float FxaaThreshold = 0.125;
+const float FxaaThresholdMin = 0.0312;
+// how much of the subpixel aliasing is removed
+const float FxaaSubpixel = 0.75;
+const int FxaaSearchSteps = 10;
+
+float FxaaLuma(sampler2D image, vec2 uv)
+{
+    return textureLod(image, uv, 0.0).a;
+}
+
+vec3 Fxaa(sampler2D image, vec2 uv, vec2 texel)
+{
+    vec4 center = textureLod(image, uv, 0.0);
+    float lumaM = center.a;
+    float lumaN = FxaaLuma(image, uv + vec2(0.0, texel.y));
+    float lumaS = FxaaLuma(image, uv - vec2(0.0, texel.y));
+    float lumaE = FxaaLuma(image, uv + vec2(texel.x, 0.0));
+    float lumaW = FxaaLuma(image, uv - vec2(texel.x, 0.0));
+    float rangeMax = max(lumaM, max(max(lumaN, lumaS), max(lumaE, lumaW)));
+    float rangeMin = min(lumaM, min(min(lumaN, lumaS), min(lumaE, lumaW)));
+    float range = rangeMax - rangeMin;
+    if(range < max(FxaaThresholdMin, rangeMax * FxaaThreshold))
+        return center.rgb;
+
+    float lumaNW = FxaaLuma(image, uv + vec2(-texel.x, texel.y));
+    float lumaNE = FxaaLuma(image, uv + texel);
+    float lumaSW = FxaaLuma(image, uv - texel);
+    float lumaSE = FxaaLuma(image, uv + vec2(texel.x, -texel.y));
+
+    // how far the pixel is from the average around it, high on lines thinner than a pixel
+    float average = (2.0 * (lumaN + lumaS + lumaE + lumaW) + lumaNW + lumaNE + lumaSW + lumaSE) / 12.0;
+    float subpixel = smoothstep(0.0, 1.0, clamp(abs(average - lumaM) / range, 0.0, 1.0));
+    subpixel = subpixel * subpixel * FxaaSubpixel;
+
+    // the edge is horizontal when luma changes more from top to bottom than from left to right
+    float horizontalChange = abs(lumaNW + lumaNE - 2.0 * lumaN) + 2.0 * abs(lumaW + lumaE - 2.0 * lumaM) +
+                             abs(lumaSW + lumaSE - 2.0 * lumaS);
+    float verticalChange = abs(lumaNW + lumaSW - 2.0 * lumaW) + 2.0 * abs(lumaN + lumaS - 2.0 * lumaM) +
+                           abs(lumaNE + lumaSE - 2.0 * lumaE);
+    bool horizontal = horizontalChange >= verticalChange;
+
+    // which side of the pixel the edge is on
+    float lumaBelow = horizontal ? lumaS : lumaW;
+    float lumaAbove = horizontal ? lumaN : lumaE;
+    float gradientBelow = abs(lumaBelow - lumaM);
+    float gradientAbove = abs(lumaAbove - lumaM);
+    float across = horizontal ? texel.y : texel.x;
+    float lumaEdge;
+    if(gradientBelow >= gradientAbove)
+    {
+        across = -across;
+        lumaEdge = 0.5 * (lumaBelow + lumaM);
+    }
+    else
+        lumaEdge = 0.5 * (lumaAbove + lumaM);
+    float gradient = 0.25 * max(gradientBelow, gradientAbove);
+
+    // walk along the edge until the luma differs from the edge's on either side, in growing strides
+    vec2 edge = uv + (horizontal ? vec2(0.0, 0.5 * across) : vec2(0.5 * across, 0.0));
+    vec2 along = horizontal ? vec2(texel.x, 0.0) : vec2(0.0, texel.y);
+    vec2 uvBack = edge - along;
+    vec2 uvForward = edge + along;
+    float endBack = FxaaLuma(image, uvBack) - lumaEdge;
+    float endForward = FxaaLuma(image, uvForward) - lumaEdge;
+    bool doneBack = abs(endBack) >= gradient;
+    bool doneForward = abs(endForward) >= gradient;
+    for(int i = 1; i < FxaaSearchSteps && !(doneBack && doneForward); i++)
+    {
+        float stride = i < 5 ? 1.0 : i < 6 ? 1.5 : i < 9 ? 2.0 : 4.0;
+        if(!doneBack)
+        {
+            uvBack -= along * stride;
+            endBack = FxaaLuma(image, uvBack) - lumaEdge;
+            doneBack = abs(endBack) >= gradient;
+        }
+        if(!doneForward)
+        {
+            uvForward += along * stride;
+            endForward = FxaaLuma(image, uvForward) - lumaEdge;
+            doneForward = abs(endForward) >= gradient;
+        }
+    }
+
+    float toBack = horizontal ? uv.x - uvBack.x : uv.y - uvBack.y;
+    float toForward = horizontal ? uvForward.x - uv.x : uvForward.y - uv.y;
+    bool backNearer = toBack < toForward;
+    float pixelOffset = 0.5 - min(toBack, toForward) / (toBack + toForward);
+    // only blend when the luma past the nearer end changes the other way than the pixel's own, otherwise the pixel
+    // is on the far side of the step
+    bool centerDarker = lumaM < lumaEdge;
+    bool blend = ((backNearer ? endBack : endForward) < 0.0) != centerDarker;
+    float offset = max(blend ? pixelOffset : 0.0, subpixel);
+    return textureLod(image, uv + (horizontal ? vec2(0.0, offset * across) : vec2(offset * across, 0.0)), 0.0).rgb;
+}
@@ -0,0 +1,25 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 WorldPos;
+in vec3 Normal;
+in vec4 Weights;
+
+uniform sampler2D texture0;
+uniform sampler2D texture2;
+uniform vec3 lightDirection;
+uniform float uvScale;
+
+void main()
+{
+    vec2 uv = WorldPos.xz * uvScale;
+    vec3 grass = texture(texture0, uv).rgb;
+    // the roughness map only adds detail to the rock, divided by its average as in terrain_shader.fs
+    vec3 detail = texture(texture2, uv * 0.5).rgb / max(textureLod(texture2, uv * 0.5, 16.0).rgb, vec3(0.05));
+    vec3 rock = detail * vec3(0.55, 0.5, 0.45);
+    vec3 snow = vec3(0.9, 0.92, 0.95);
+    vec3 albedo = grass * Weights.x + rock * Weights.y + snow * Weights.z;
+
+    float diff = max(dot(normalize(Normal), normalize(-lightDirection)), 0.0);
+    FragColor = vec4(albedo * (0.35 + 0.65 * diff), 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec4 aWeights;
+
+out vec3 WorldPos;
+out vec3 Normal;
+out vec4 Weights;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    WorldPos = aPos;
+    Normal = aNormal;
+    Weights = aWeights;
+    gl_Position = projection * view * vec4(aPos, 1.0);
+}
\ No newline at end of file
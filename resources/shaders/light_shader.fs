@@ -2,8 +2,10 @@
 out vec4 FragColor;
 
 uniform vec3 color;
+// the pyramids are emissive, above 1 in the HDR target so they bloom
+uniform float intensity;
 
 void main()
 {
-    FragColor = vec4(color, 0.4);
-}
\ No newline at end of file
+    FragColor = vec4(color * intensity, 0.4);
+}
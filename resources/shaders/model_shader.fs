@@ -1,64 +1,130 @@
 #version 330 core
 out vec4 FragColor;
 
-struct DirLight {
-    vec3 direction;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct PointLight {
-    vec3 position;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct SpotLight {
-    bool enabled;
-
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
+#include "include/lights.glsl"
 
 struct Material {
     sampler2D texture_diffuse1;
     sampler2D texture_specular1;
 
+    // set when the model packs its textures into arrays, TextureLayers selects the mesh's textures
+    bool useTextureArrays;
+    sampler2DArray texture_diffuseArray;
+    sampler2DArray texture_specularArray;
+
     float shininess;
 };
 
 in vec3 Normal;
 in vec3 FragPos;
 in vec2 TexCoords;
+// share of the hemisphere the model leaves open, baked per vertex
+in float Occlusion;
+in vec2 LightmapCoords;
+// diffuse, specular, normal and height layer
+flat in ivec4 TextureLayers;
 
 uniform DirLight dirLight;
 uniform PointLight ptLight;
 uniform SpotLight spotLight;
 uniform Material material;
 uniform vec3 viewPosition;
-uniform bool blinn;
+uniform float occlusionStrength;
+
+#ifdef SKY_AMBIENT
+// the skybox's irradiance over pi as 9 spherical harmonics coefficients, see spherical_harmonics.h
+uniform vec3 skyIrradiance[9];
+uniform float skyAmbientStrength;
+
+vec3 SkyAmbient(vec3 n)
+{
+    vec3 irradiance = skyIrradiance[0]
+            + skyIrradiance[1] * n.y + skyIrradiance[2] * n.z + skyIrradiance[3] * n.x
+            + skyIrradiance[4] * (n.x * n.y) + skyIrradiance[5] * (n.y * n.z)
+            + skyIrradiance[6] * (3.0 * n.z * n.z - 1.0) + skyIrradiance[7] * (n.x * n.z)
+            + skyIrradiance[8] * (n.x * n.x - n.y * n.y);
+    // 9 coefficients ring a little below zero opposite a bright sun
+    return max(irradiance, 0.0) * skyAmbientStrength;
+}
+#endif
+
+#ifdef LIGHTMAP
+// the DirLight's and the sky's light on the surface, direct and bounced, baked by lightmap_baker
+uniform sampler2D lightmap;
+// Lightmap::Range
+uniform float lightmapRange;
+
+vec3 BakedLight()
+{
+    // RGBM
+    vec4 rgbm = texture(lightmap, LightmapCoords);
+    return rgbm.rgb * rgbm.a * lightmapRange;
+}
+#endif
+
+#ifdef SSAO
+// occlusion at a fraction of the resolution and its linear depth, see ssao.h
+uniform sampler2D ssaoOcclusion;
+uniform sampler2D ssaoDepth;
+// the occlusion's size over the framebuffer's
+uniform vec2 ssaoScale;
+// projection[2][2] and projection[3][2]
+uniform vec2 depthParameters;
+
+// bilateral upsampling: the four nearest texels weighted bilinearly and by how close their depth is to this
+// fragment's, so the occlusion of a wall does not bleed onto the ground in front of it
+float ScreenSpaceOcclusion()
+{
+    vec2 position = gl_FragCoord.xy * ssaoScale - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = position - vec2(base);
+    ivec2 limit = textureSize(ssaoOcclusion, 0) - 1;
+    float depth = depthParameters.y / (gl_FragCoord.z * 2.0 - 1.0 + depthParameters.x);
+    float sum = 0.0, total = 0.0;
+    for(int i = 0; i < 4; i++)
+    {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), limit);
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float difference = abs(texelFetch(ssaoDepth, texel, 0).r - depth) / depth;
+        float weight = bilinear.x * bilinear.y / (difference + 0.001) + 1e-5;
+        sum += texelFetch(ssaoOcclusion, texel, 0).r * weight;
+        total += weight;
+    }
+    return sum / total;
+}
+#endif
+
+// the ambient terms are darkened by the baked occlusion, the direct ones are not
+float AmbientOcclusion()
+{
+#ifdef SSAO
+    return mix(1.0, Occlusion, occlusionStrength) * ScreenSpaceOcclusion();
+#else
+    return mix(1.0, Occlusion, occlusionStrength);
+#endif
+}
+
+vec3 DiffuseColor()
+{
+    if(material.useTextureArrays)
+        return vec3(texture(material.texture_diffuseArray, vec3(TexCoords, TextureLayers.x)));
+    return vec3(texture(material.texture_diffuse1, TexCoords));
+}
+
+vec3 SpecularColor()
+{
+    if(material.useTextureArrays)
+        return vec3(texture(material.texture_specularArray, vec3(TexCoords, TextureLayers.y)));
+    return vec3(texture(material.texture_specular1, TexCoords));
+}
 
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+float AmbientOcclusion();
+vec3 DiffuseColor();
+vec3 SpecularColor();
 
 void main()
 {
@@ -66,8 +132,9 @@ void main()
     vec3 viewDir = normalize(viewPosition - FragPos);
     vec3 result = CalcDirLight(dirLight, normal, viewDir);
     result += CalcPointLight(ptLight, normal, FragPos, viewDir);
-    if(spotLight.enabled)
-        result += CalcSpotLight(spotLight, normal, FragPos, viewDir);
+#ifdef SPOT_LIGHT
+    result += CalcSpotLight(spotLight, normal, FragPos, viewDir);
+#endif
     FragColor = vec4(result, 1.0);
 }
 
@@ -76,23 +143,22 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     vec3 lightDir = normalize(-light.direction);
     float diff = max(dot(normal, lightDir), 0.0);
 
-    float spec = 0.0f;
-    if(blinn)
-    {
-        vec3 halfwayDir = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess * 4);
-    }
-    else
-    {
-        vec3 reflectDir = reflect(-lightDir, normal);
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    }
+    float spec = SpecularFactor(lightDir, normal, viewDir, material.shininess);
+    vec3 specular = light.specular * spec * SpecularColor();
 
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
+#ifdef LIGHTMAP
+    // the bake already holds the shadows and occlusion, only the view dependent highlight is left live
+    return BakedLight() * DiffuseColor() + specular;
+#else
+#ifdef SKY_AMBIENT
+    vec3 ambient = SkyAmbient(normal) * DiffuseColor() * AmbientOcclusion();
+#else
+    vec3 ambient = light.ambient * DiffuseColor() * AmbientOcclusion();
+#endif
+    vec3 diffuse = light.diffuse * diff * DiffuseColor();
 
     return (ambient + diffuse + specular);
+#endif
 }
 
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
@@ -100,26 +166,16 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     vec3 lightDir = normalize(light.position - fragPos);
     float diff = max(dot(normal, lightDir), 0.0);
 
-    float spec = 0.0f;
-    if(blinn)
-    {
-        vec3 halfwayDir = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess * 4);
-    }
-    else
-    {
-        vec3 reflectDir = reflect(-lightDir, normal);
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    }
+    float spec = SpecularFactor(lightDir, normal, viewDir, material.shininess);
 
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
 
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
+    vec3 ambient = light.ambient * DiffuseColor();
+    vec3 diffuse = light.diffuse * diff * DiffuseColor();
+    vec3 specular = light.specular * spec * SpecularColor();
 
-    ambient *= attenuation;
+    ambient *= attenuation * AmbientOcclusion();
     diffuse *= attenuation;
     specular *= attenuation;
 
@@ -131,17 +187,7 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     vec3 lightDir = normalize(light.position - fragPos);
     float diff = max(dot(normal, lightDir), 0.0);
 
-    float spec = 0.0f;
-    if(blinn)
-    {
-        vec3 halfwayDir = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess * 4);
-    }
-    else
-    {
-        vec3 reflectDir = reflect(-lightDir, normal);
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    }
+    float spec = SpecularFactor(lightDir, normal, viewDir, material.shininess);
 
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
@@ -150,11 +196,11 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
 
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
+    vec3 ambient = light.ambient * DiffuseColor();
+    vec3 diffuse = light.diffuse * diff * DiffuseColor();
+    vec3 specular = light.specular * spec * SpecularColor();
 
-    ambient *= attenuation * intensity;
+    ambient *= attenuation * intensity * AmbientOcclusion();
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
 
@@ -2,19 +2,32 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+// baked ambient occlusion, see vertex_occlusion.h
+layout (location = 6) in float aOcclusion;
+// place in the lightmap, see lightmap.h
+layout (location = 7) in vec2 aLightmapCoords;
 
 out vec3 Normal;
 out vec3 FragPos;
 out vec2 TexCoords;
+out float Occlusion;
+out vec2 LightmapCoords;
+flat out ivec4 TextureLayers;
+// the depth prepass and the lighting pass must land on exactly the same depth
+invariant gl_Position;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform ivec4 textureLayers;
 
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
     Normal = aNormal;
     TexCoords = aTexCoords;
+    Occlusion = aOcclusion;
+    LightmapCoords = aLightmapCoords;
+    TextureLayers = textureLayers;
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
\ No newline at end of file
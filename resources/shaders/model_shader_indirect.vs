@@ -0,0 +1,43 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// index into draws, fed through the command's baseInstance
+layout (location = 5) in uint aDrawID;
+// baked ambient occlusion, see vertex_occlusion.h
+layout (location = 6) in float aOcclusion;
+// place in the lightmap, see lightmap.h
+layout (location = 7) in vec2 aLightmapCoords;
+
+struct DrawParams {
+    mat4 model;
+    ivec4 textureLayers;
+};
+
+layout (std430, binding = 0) readonly buffer DrawBuffer {
+    DrawParams draws[];
+};
+
+out vec3 Normal;
+out vec3 FragPos;
+out vec2 TexCoords;
+out float Occlusion;
+out vec2 LightmapCoords;
+flat out ivec4 TextureLayers;
+// the depth prepass and the lighting pass must land on exactly the same depth
+invariant gl_Position;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    DrawParams draw = draws[aDrawID];
+    FragPos = vec3(draw.model * vec4(aPos, 1.0));
+    Normal = aNormal;
+    TexCoords = aTexCoords;
+    Occlusion = aOcclusion;
+    LightmapCoords = aLightmapCoords;
+    TextureLayers = draw.textureLayers;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
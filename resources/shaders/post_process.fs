@@ -0,0 +1,63 @@
+#version 330 core
+// the post-processing chain. Every define is one stage, and a variant holds the stages PostProcess runs as one
+// full-screen pass (see post_process.h). The per-pixel stages are applied in the order below, the order main.cpp adds
+// them in. A stage that reads around its pixel, like FXAA, only ever comes first in its pass and reads the texture
+// the pass before it finished
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// the HDR scene, or what the previous pass left
+uniform sampler2D source;
+uniform vec2 texelSize;
+
+#ifdef FXAA
+#include "include/fxaa.glsl"
+#endif
+
+#ifdef BLOOM
+// half resolution, filtered up by the sampler
+uniform sampler2D bloom;
+uniform float bloomStrength;
+#endif
+
+#ifdef TONEMAP
+uniform float exposure;
+
+// Narkowicz's fit of the ACES filmic curve, highlights roll off instead of clipping
+vec3 Tonemap(vec3 color)
+{
+    return clamp(color * (2.51 * color + 0.03) / (color * (2.43 * color + 0.59) + 0.14), 0.0, 1.0);
+}
+#endif
+
+#ifdef GRADING
+uniform sampler3D gradingLut;
+
+// the outer texels hold 0 and 1, their centres are half a texel in
+vec3 Grade(vec3 color)
+{
+    float size = float(textureSize(gradingLut, 0).x);
+    return texture(gradingLut, clamp(color, 0.0, 1.0) * ((size - 1.0) / size) + 0.5 / size).rgb;
+}
+#endif
+
+void main()
+{
+#ifdef FXAA
+    vec3 color = Fxaa(source, TexCoords, texelSize);
+#else
+    vec3 color = texelFetch(source, ivec2(gl_FragCoord.xy), 0).rgb;
+#endif
+#ifdef BLOOM
+    color += texture(bloom, TexCoords).rgb * bloomStrength;
+#endif
+#ifdef TONEMAP
+    color = Tonemap(color * exposure);
+#endif
+#ifdef GRADING
+    color = Grade(color);
+#endif
+    // luma for an FXAA pass after this one
+    FragColor = vec4(color, dot(color, vec3(0.299, 0.587, 0.114)));
+}
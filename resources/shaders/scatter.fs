@@ -0,0 +1,27 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 Normal;
+in float Height;
+in float Variation;
+
+uniform vec3 lightDirection;
+uniform int kind;
+
+void main()
+{
+    vec3 albedo;
+    float diff;
+    if (kind == 0)
+    {
+        albedo = mix(vec3(0.08, 0.22, 0.04), vec3(0.35, 0.55, 0.15) + Variation * vec3(0.15, 0.1, 0.0), Height / 0.85);
+        // blades are thin, light them from both sides
+        diff = abs(dot(normalize(Normal), normalize(-lightDirection)));
+    }
+    else
+    {
+        albedo = vec3(0.35, 0.33, 0.3) * (0.8 + 0.4 * Variation);
+        diff = max(dot(normalize(Normal), normalize(-lightDirection)), 0.0);
+    }
+    FragColor = vec4(albedo * (0.45 + 0.55 * diff), 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec4 aPositionScale;
+layout (location = 3) in vec4 aParams;
+
+out vec3 Normal;
+out float Height;
+out float Variation;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 cameraPosition;
+uniform float fadeStart;
+uniform float fadeEnd;
+uniform float time;
+uniform int kind;
+
+void main()
+{
+    // shrink instances whose fade threshold is above the density at their distance instead of popping them
+    float distance = length(aPositionScale.xyz - cameraPosition);
+    float density = 1.0 - smoothstep(fadeStart, fadeEnd, distance);
+    float scale = aPositionScale.w * smoothstep(0.0, 0.1, density - aParams.y);
+
+    float c = cos(aParams.x), s = sin(aParams.x);
+    vec3 local = aPos * scale;
+    if (kind == 0)
+    {
+        // grass bends with the wind, more at the tip
+        float bend = sin(time * 1.7 + aPositionScale.x * 0.3 + aPositionScale.z * 0.2) * 0.15 * aPos.y * aPos.y;
+        local.z += bend * scale;
+    }
+    vec3 world = vec3(c * local.x + s * local.z, local.y, -s * local.x + c * local.z) + aPositionScale.xyz;
+
+    Normal = vec3(c * aNormal.x + s * aNormal.z, aNormal.y, -s * aNormal.x + c * aNormal.z);
+    Height = aPos.y;
+    Variation = aParams.z;
+    gl_Position = projection * view * vec4(world, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#version 330 core
+layout (points) in;
+layout (points, max_vertices = 1) out;
+
+in vec4 vPositionScale[];
+in vec4 vParams[];
+flat in int vVisible[];
+
+out vec4 outPositionScale;
+out vec4 outParams;
+
+void main()
+{
+    if (vVisible[0] == 1)
+    {
+        outPositionScale = vPositionScale[0];
+        outParams = vParams[0];
+        EmitVertex();
+        EndPrimitive();
+    }
+}
\ No newline at end of file
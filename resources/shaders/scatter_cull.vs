@@ -0,0 +1,32 @@
+#version 330 core
+layout (location = 2) in vec4 aPositionScale;
+layout (location = 3) in vec4 aParams;
+
+out vec4 vPositionScale;
+out vec4 vParams;
+flat out int vVisible;
+
+uniform vec4 planes[6];
+uniform vec3 cameraPosition;
+uniform float fadeStart;
+uniform float fadeEnd;
+uniform float boundingRadius;
+
+void main()
+{
+    vPositionScale = aPositionScale;
+    vParams = aParams;
+
+    float distance = length(aPositionScale.xyz - cameraPosition);
+    float density = 1.0 - smoothstep(fadeStart, fadeEnd, distance);
+    vVisible = density > aParams.y ? 1 : 0;
+
+    // bounding sphere centred half way up the instance
+    vec3 center = aPositionScale.xyz + vec3(0.0, 0.5 * aPositionScale.w, 0.0);
+    float radius = boundingRadius * aPositionScale.w;
+    for (int i = 0; i < 6; i++)
+    {
+        if (dot(planes[i].xyz, center) + planes[i].w < -radius)
+            vVisible = 0;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#version 330 core
+out float Occlusion;
+
+uniform sampler2D linearDepth;
+uniform int samples;
+// world units around a pixel that can occlude it
+uniform float radius;
+uniform float intensity;
+uniform float bias;
+// 1 / projection[0][0] and 1 / projection[1][1]
+uniform vec2 inverseFocal;
+// texels one world unit covers at depth 1
+uniform float projectionScale;
+
+vec3 ViewPosition(ivec2 texel)
+{
+    float depth = texelFetch(linearDepth, texel, 0).r;
+    vec2 ndc = (vec2(texel) + 0.5) / vec2(textureSize(linearDepth, 0)) * 2.0 - 1.0;
+    return vec3(ndc * inverseFocal * depth, -depth);
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 limit = textureSize(linearDepth, 0) - 1;
+    vec3 position = ViewPosition(texel);
+    // no G-buffer, the normal comes from the neighbour on the side that continues the surface
+    vec3 right = ViewPosition(min(texel + ivec2(1, 0), limit)) - position;
+    vec3 left = position - ViewPosition(max(texel - ivec2(1, 0), ivec2(0)));
+    vec3 up = ViewPosition(min(texel + ivec2(0, 1), limit)) - position;
+    vec3 down = position - ViewPosition(max(texel - ivec2(0, 1), ivec2(0)));
+    vec3 dx = abs(right.z) < abs(left.z) ? right : left;
+    vec3 dy = abs(up.z) < abs(down.z) ? up : down;
+    vec3 normal = normalize(cross(dx, dy));
+
+    // the spiral's rotation repeats every 4x4 texels, the blur averages the 16 of them out
+    int pattern = (texel.x & 3) + 4 * (texel.y & 3);
+    float rotation = float(pattern) * (6.28318531 / 16.0);
+    float screenRadius = radius * projectionScale / -position.z;
+    float radius2 = radius * radius;
+    float sum = 0.0;
+    for(int i = 0; i < samples; i++)
+    {
+        float alpha = (float(i) + 0.5) / float(samples);
+        float angle = alpha * (7.0 * 6.28318531) + rotation;
+        // at least a texel out, the nearest samples would otherwise land on the pixel itself
+        vec2 offset = vec2(cos(angle), sin(angle)) * max(alpha * screenRadius, 1.0);
+        ivec2 sampleTexel = clamp(texel + ivec2(round(offset)), ivec2(0), limit);
+        vec3 v = ViewPosition(sampleTexel) - position;
+        float vv = dot(v, v);
+        float vn = dot(v, normal);
+        // fades out towards radius, so occluders do not pop in and out at its edge
+        float falloff = max(radius2 - vv, 0.0);
+        sum += falloff * falloff * falloff * max((vn - bias) / (0.01 + vv), 0.0);
+    }
+    Occlusion = max(0.0, 1.0 - sum * intensity * 5.0 / (radius2 * radius2 * radius2 * float(samples)));
+}
@@ -0,0 +1,29 @@
+#version 330 core
+out float Blurred;
+
+uniform sampler2D occlusion;
+uniform sampler2D linearDepth;
+// one texel along x or y
+uniform vec2 direction;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 limit = textureSize(occlusion, 0) - 1;
+    ivec2 stride = ivec2(direction);
+    float depth = texelFetch(linearDepth, texel, 0).r;
+    // four texels to each side cover the 4x4 rotation pattern, texels across a depth edge barely count
+    const float weights[5] = float[](0.153170, 0.144893, 0.122649, 0.092902, 0.062970);
+    float sum = texelFetch(occlusion, texel, 0).r * weights[0];
+    float total = weights[0];
+    for(int i = 1; i <= 4; i++)
+        for(int side = -1; side <= 1; side += 2)
+        {
+            ivec2 neighbour = clamp(texel + stride * i * side, ivec2(0), limit);
+            float neighbourDepth = texelFetch(linearDepth, neighbour, 0).r;
+            float weight = weights[i] * max(0.0, 1.0 - abs(neighbourDepth - depth) / (0.05 * depth));
+            sum += texelFetch(occlusion, neighbour, 0).r * weight;
+            total += weight;
+        }
+    Blurred = sum / total;
+}
@@ -0,0 +1,25 @@
+#version 330 core
+out float LinearDepth;
+
+// the full resolution depth buffer, reduced by downsample in each direction
+uniform sampler2D depthTexture;
+uniform int downsample;
+// projection[2][2] and projection[3][2]
+uniform vec2 depthParameters;
+
+void main()
+{
+    // nearest and farthest of the block alternate in a checkerboard, thin surfaces in front and the background
+    // behind them both keep some texels
+    ivec2 base = ivec2(gl_FragCoord.xy) * downsample;
+    ivec2 limit = textureSize(depthTexture, 0) - 1;
+    bool farthest = ((int(gl_FragCoord.x) + int(gl_FragCoord.y)) & 1) == 1;
+    float depth = farthest ? 0.0 : 1.0;
+    for(int y = 0; y < downsample; y++)
+        for(int x = 0; x < downsample; x++)
+        {
+            float d = texelFetch(depthTexture, min(base + ivec2(x, y), limit), 0).r;
+            depth = farthest ? max(depth, d) : min(depth, d);
+        }
+    LinearDepth = depthParameters.y / (depth * 2.0 - 1.0 + depthParameters.x);
+}
@@ -9,5 +9,9 @@ uniform sampler2D texture2;
 
 void main()
 {
-    FragColor = texture(texture0, TexCoord) * texture(texture1, TexCoord) * texture(texture2, TexCoord) * 3.5;
-}
\ No newline at end of file
+    // the height and roughness maps only add detail: divided by their averages, the last mip level, they vary around
+    // 1 and leave the base texture as bright as it is
+    vec3 detail = texture(texture1, TexCoord).rgb * texture(texture2, TexCoord).rgb;
+    vec3 average = textureLod(texture1, TexCoord, 16.0).rgb * textureLod(texture2, TexCoord, 16.0).rgb;
+    FragColor = vec4(texture(texture0, TexCoord).rgb * detail / max(average, vec3(0.05)), 1.0);
+}
@@ -0,0 +1,31 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 VirtualUV;
+
+uniform sampler2D pageTable;
+uniform sampler2D atlas;
+uniform float virtualSize;
+uniform int maxMip;
+uniform int pagesLog2;
+uniform float pageSize;
+uniform float pageBorder;
+uniform float tileSize;
+uniform float atlasSize;
+uniform float mipBias;
+
+void main()
+{
+    vec2 texel = VirtualUV * virtualSize;
+    float footprint = max(length(dFdx(texel)), length(dFdy(texel)));
+    int mip = clamp(int(floor(log2(max(footprint, 1e-6)) + mipBias)), 0, maxMip);
+
+    // the entry points at the requested page or at its closest resident ancestor
+    int pages = 1 << (pagesLog2 - mip);
+    vec4 entry = texelFetch(pageTable, clamp(ivec2(VirtualUV * pages), ivec2(0), ivec2(pages - 1)), mip) * 255.0;
+    float residentPages = float(1 << (pagesLog2 - int(entry.b + 0.5)));
+    vec2 local = fract(VirtualUV * residentPages);
+    vec2 atlasUV = (floor(entry.rg + 0.5) * tileSize + pageBorder + local * pageSize) / atlasSize;
+
+    FragColor = vec4(textureLod(atlas, atlasUV, 0.0).rgb, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+out vec2 VirtualUV;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// the terrain quad spans [-500, 500] on x and z, the virtual texture covers it once
+uniform float terrainExtent;
+
+void main()
+{
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    VirtualUV = aPos.xz / terrainExtent + 0.5;
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 VirtualUV;
+
+uniform float virtualSize;
+uniform int maxMip;
+uniform int pagesLog2;
+uniform float mipBias;
+
+void main()
+{
+    vec2 texel = VirtualUV * virtualSize;
+    float footprint = max(length(dFdx(texel)), length(dFdy(texel)));
+    int mip = clamp(int(floor(log2(max(footprint, 1e-6)) + mipBias)), 0, maxMip);
+
+    int pages = 1 << (pagesLog2 - mip);
+    ivec2 page = clamp(ivec2(VirtualUV * pages), ivec2(0), ivec2(pages - 1));
+    // 12 bits per page coordinate, alpha holds mip + 1 so that cleared pixels read as "no request"
+    FragColor = vec4(page.x & 255, page.y & 255, (page.x >> 8) | ((page.y >> 8) << 4), mip + 1) / 255.0;
+}
\ No newline at end of file
@@ -14,15 +14,47 @@
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
 
+#include <asset_streamer.h>
+#include <async_file_io.h>
+#include <bloom.h>
+#include <color_grading.h>
+#include <cooked_texture.h>
+#include <frustum.h>
+#include <gpu_timer.h>
+#include <hdr_target.h>
+#include <hiz_pyramid.h>
+#include <hot_reload.h>
+#include <image_decoder.h>
+#include <indirect_draw.h>
+#include <lightmap.h>
+#include <post_process.h>
+#include <scatter.h>
+#include <shader_batch.h>
+#include <shader_permutations.h>
+#include <spherical_harmonics.h>
+#include <ssao.h>
+#include <startup_graph.h>
+#include <terrain.h>
+#include <thread_pool.h>
+#include <vertex_occlusion.h>
+#include <virtual_texture.h>
+
+#include <chrono>
 #include <iostream>
+#include <sstream>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
-unsigned int loadTexture(std::string pathToTex);
-unsigned int loadCubemap(vector<std::string> faces);
+unsigned int loadTexture(std::string pathToTex, unsigned int textureID = 0);
+unsigned int loadCubemap(vector<std::string> faces, unsigned int textureID = 0);
+bool decodeCubemapFace(const FileView &file, DecodedImage &image);
+unsigned int cubemapFromImages(const vector<DecodedImage> &images, unsigned int textureID = 0);
+void cubemapParameters();
+unsigned int uploadLightmap(const FileView &file, unsigned int textureID = 0);
+ShaderDefines modelLighting(bool blinn, bool spotLight, bool skyAmbient, bool lightmap, bool ssao);
 
 struct DirLight {
     glm::vec3 direction;
@@ -82,12 +114,119 @@ struct ProgramState {
     glm::vec3 housePosition = glm::vec3(100.0f, 0.0f, 0.0f);
     glm::vec3 pyramidPosition = housePosition + glm::vec3(-3.0f, 4.0f, 0.0f);
     glm::vec3 pyramidColor = glm::vec3(1.0f, 0.0f, 0.0f);
+    // the pyramids' emitted light, past 1 they bloom
+    float pyramidIntensity = 6.0f;
     float houseScale = 1.0f;
     DirLight dirLight;
     PointLight ptLight;
     SpotLight spotLight;
     bool blinn = true;
     bool randColor = false;
+    // ambient light from the skybox's spherical harmonics instead of dirLight.ambient, once they are available. The
+    // night sky alone is dim, the default strength keeps the house about as bright as the old constant did
+    bool skyAmbient = true;
+    bool skyAmbientAvailable = false;
+    float skyAmbientStrength = 3.0f;
+    // how much of the baked vertex occlusion darkens the ambient light, 0 ignores it
+    float occlusionStrength = 1.0f;
+    // the house's sun and sky light from its baked lightmap instead of the DirLight, when one was baked
+    bool lightmap = true;
+    bool lightmapAvailable = false;
+    // screen-space occlusion of the house's ambient light, an Ssao::Quality
+    int ssaoQuality = Ssao::Medium;
+    // post-processing stages
+    bool bloom = true;
+    bool tonemap = true;
+    bool colorGrading = true;
+    bool fxaa = true;
+    float exposure = 1.0f;
+    Bloom::Settings bloomSettings;
+    ColorGrading::Settings gradingSettings;
+    bool infiniteTerrain = false;
+    bool virtualTexturing = false;
+    bool scatter = false;
+    bool scatterGpuCulling = false;
+    float scatterDensity = 1.0f;
+    bool scatterBenchmarkRequested = false;
+    bool ioBenchmarkRequested = false;
+    bool decodeBenchmarkRequested = false;
+    bool indirectDraw = true;
+    bool gpuCulling = true;
+    bool indirectSupported = false;
+    bool meshletCulling = true;
+    bool coneCulling = true;
+    struct {
+        int resident = 0;
+        int pending = 0;
+        int drawn = 0;
+    } terrainStats;
+    struct {
+        int resident = 0;
+        int pending = 0;
+        int requested = 0;
+        int uploads = 0;
+    } virtualTextureStats;
+    struct {
+        int drawn = 0;
+        int culled = 0;
+        bool indirect = false;
+        bool gpuCulled = false;
+        bool meshlets = false;
+        int meshletCount = 0;
+        int residentMeshes = 0;
+        int meshCount = 0;
+    } houseStats;
+    struct {
+        int programs = 0;
+        float milliseconds = 0.0f;
+        bool parallel = false;
+    } shaderStats;
+    struct {
+        int reloads = 0;
+        int failures = 0;
+        float milliseconds = 0.0f;
+        std::string file;
+    } reloadStats;
+    struct {
+        int pending = 0;
+        int loaded = 0;
+        float milliseconds = 0.0f;
+    } streamStats;
+    struct {
+        float firstFrame = 0.0f;
+        vector<StartupGraph::Span> timeline;
+        bool ioRing = false;
+        bool ioBenchmarkRunning = false;
+        bool decodeBenchmarkRunning = false;
+    } startupStats;
+    struct {
+        bool cooked = false;
+        CookedTexture::Format format = CookedTexture::RGBA8;
+        int faceSize = 0;
+        int levels = 0;
+        float megabytes = 0.0f;
+        // from the first read until the cubemap is uploaded
+        float milliseconds = 0.0f;
+    } skyboxStats;
+    struct {
+        int tiles = 0;
+        long long resident = 0;
+        long long drawn = 0;
+        float milliseconds = 0.0f;
+        bool benchmarkRunning = false;
+    } scatterStats;
+    struct {
+        glm::ivec2 resolution = glm::ivec2(0);
+        // the house's depth prepass and the occlusion passes after it
+        float prepassMilliseconds = 0.0f;
+        float milliseconds = 0.0f;
+    } ssaoStats;
+    struct {
+        vector<PostProcess::Timing> timings;
+        int stages = 0;
+        int passes = 0;
+        bool gradingLut = false;
+    } postStats;
     ProgramState()
             : camera(glm::vec3(0.0f, 5.0f, 0.0f)) {}
     void SaveToFile(std::string filename);
@@ -112,8 +251,9 @@ void ProgramState::SaveToFile(std::string filename) {
 }
 
 void ProgramState::LoadFromFile(std::string filename) {
-    std::ifstream in(filename);
-    if (in) {
+    FileView file = FileSystem::open(filename);
+    std::istringstream in(file.String());
+    if (file) {
         in >> clearColor.r
            >> clearColor.g
            >> clearColor.b
@@ -136,17 +276,26 @@ void DrawImGui(ProgramState *programState);
 
 int main() {
     // Initialization
+    auto launch = std::chrono::steady_clock::now();
+    // assets come from the pack when there is one, loose files under resources/ still override it
+    FileSystem::mount("resources.pack");
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
-    // Window creation
-    GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Scene", NULL, NULL);
+    // Window creation, 4.3 enables the indirect draw paths, 3.3 is the minimum
+    GLFWwindow *window = NULL;
+    const int contextVersions[][2] = {{4, 3}, {3, 3}};
+    for (const auto &version: contextVersions) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Scene", NULL, NULL);
+        if (window != NULL)
+            break;
+    }
     if (window == NULL) {
         std::cout << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
@@ -165,11 +314,16 @@ int main() {
         return -1;
     }
 
-    // Tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
-    stbi_set_flip_vertically_on_load(true);
+    // Decode textures bottom up, as GL expects them (before loading model).
+    ImageDecoders::SetFlipVertically(true);
+    // the house is imported with its ambient occlusion baked into the vertices and a lightmap layout, and cached with
+    // them
+    VertexOcclusion::SetEnabled(true);
+    Lightmap::SetEnabled(true);
 
     programState = new ProgramState;
     programState->LoadFromFile("resources/program_state.txt");
+    programState->indirectSupported = IndirectDrawList::Supported();
     if (programState->ImGuiEnabled) {
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     }
@@ -184,16 +338,310 @@ int main() {
 
     // Configure global opengl state
     glEnable(GL_DEPTH_TEST);
+    // the skybox's smaller mips filter across face edges instead of showing seams
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    // Worker threads for CPU side generation
+    ThreadPool workers;
+
+    // Assets loaded after startup come in through a loader thread with its own shared context
+    AssetStreamer streamer(window);
+
+    // Startup graph: files are read and decoded on the workers while this thread submits shaders and sets up
+    // buffers, the GL objects are created from the results in startup.Run()
+    StartupGraph startup(workers);
+    // the texture files are read in batches, each decode starts when its file is in
+    AsyncFileIo fileIo(workers);
+    // House model, textures packed into arrays so the whole house draws with one binding set. With a warm cache
+    // it starts as simplified meshes with thumbnail textures and the streamer refines it while it is drawn
+    ModelData houseData;
+    vector<FileView> houseTextureFiles;
+    Model *house = NULL;
+    startup.Add("house import", StartupGraph::Worker, [&startup, &fileIo, &houseData, &houseTextureFiles, &house,
+                                                       &streamer]() {
+        houseData = Model::ImportCoarse("resources/objects/house/highpoly_town_house_01.obj", true);
+        vector<unsigned int> decoded;
+        // a coarse import comes with its thumbnails already decoded
+        if (!houseData.coarse)
+            houseTextureFiles.resize(houseData.textures.size());
+        for (unsigned int i = 0; i < houseData.textures.size() && !houseData.coarse; i++) {
+            unsigned int read = startup.AddExternal("read " + houseData.textures[i].path);
+            fileIo.Read(Model::TexturePath(houseData, i),
+                        [&startup, &houseTextureFiles, i, read](const std::string &, const FileView &file) {
+                houseTextureFiles[i] = file;
+                startup.Complete(read);
+            });
+            decoded.push_back(startup.Add("decode " + houseData.textures[i].path, StartupGraph::Worker,
+                                          [&houseData, &houseTextureFiles, i]() {
+                Model::DecodeTexture(houseData, i, houseTextureFiles[i]);
+                houseTextureFiles[i] = FileView();
+            }, {read}));
+        }
+        fileIo.Submit();
+        startup.Add("house upload", StartupGraph::Main, [&houseData, &house, &streamer]() {
+            house = new Model(std::move(houseData));
+            house->SetShaderTextureNamePrefix("material.");
+            streamer.Refine(*house);
+        }, decoded);
+    });
+    // Terrain textures
+    const std::string terrainPaths[] = {"resources/textures/terrain/base.jpg",
+                                        "resources/textures/terrain/height.png",
+                                        "resources/textures/terrain/roughness.jpg"};
+    // cooked textures (see asset_cooker) come with their mips and are already compressed, only their levels are
+    // checked
+    FileView terrainFiles[3];
+    DecodedImage terrainImages[3];
+    CookedTexture::Image terrainCooked[3];
+    unsigned int terrainTextures[3] = {0, 0, 0};
+    for (int i = 0; i < 3; i++) {
+        std::string cooked = CookedTexture::Find(terrainPaths[i]);
+        unsigned int read = startup.AddExternal("read " + terrainPaths[i]);
+        fileIo.Read(cooked.empty() ? terrainPaths[i] : cooked,
+                    [&startup, &terrainFiles, i, read](const std::string &, const FileView &file) {
+            terrainFiles[i] = file;
+            startup.Complete(read);
+        });
+        bool isCooked = !cooked.empty();
+        unsigned int decoded = startup.Add("decode " + terrainPaths[i], StartupGraph::Worker, [&, i, isCooked]() {
+            if (isCooked ? !CookedTexture::Parse(terrainFiles[i], terrainCooked[i])
+                         : !DecodeImage(terrainFiles[i], terrainImages[i], 3))
+                std::cout << "Failed to load textures!" << std::endl;
+            terrainFiles[i] = FileView();
+        }, {read});
+        startup.Add("upload " + terrainPaths[i], StartupGraph::Main, [&, i]() {
+            if (terrainCooked[i].faces) {
+                terrainTextures[i] = CookedTexture::Upload(terrainCooked[i]);
+                terrainCooked[i] = CookedTexture::Image();
+                return;
+            }
+            if (terrainImages[i].pixels.empty())
+                return;
+            glGenTextures(1, &terrainTextures[i]);
+            TextureFromImage(terrainTextures[i], terrainImages[i]);
+            terrainImages[i] = DecodedImage();
+        }, {decoded});
+    }
+    // Skybox faces, or all of them in one cooked cubemap
+    vector<std::string> faces
+            {
+                    FileSystem::getPath("/resources/textures/skybox/right.png"),
+                    FileSystem::getPath("/resources/textures/skybox/left.png"),
+                    FileSystem::getPath("/resources/textures/skybox/top.png"),
+                    FileSystem::getPath("/resources/textures/skybox/bottom.png"),
+                    FileSystem::getPath("/resources/textures/skybox/front.png"),
+                    FileSystem::getPath("/resources/textures/skybox/back.png")
+            };
+    unsigned int cubemapTexture = 0;
+    auto skyboxStart = std::chrono::steady_clock::now();
+    auto skyboxLoaded = [skyboxStart]() {
+        programState->skyboxStats.milliseconds = std::chrono::duration<float, std::milli>(
+                std::chrono::steady_clock::now() - skyboxStart).count();
+    };
+    std::string cookedSkybox = CookedTexture::FindCubemap(faces);
+    FileView skyboxFile;
+    vector<FileView> faceFiles(faces.size());
+    vector<DecodedImage> faceImages(faces.size());
+    // the ambient light of the sky, projected on the workers one face per task unless it is cached
+    SH9 skyIrradiance;
+    bool skyIrradianceCached = SphericalHarmonics::Load(faces, skyIrradiance);
+    bool skyIrradianceReady = skyIrradianceCached;
+    vector<SH9> faceRadiance(faces.size());
+    vector<char> faceProjected(faces.size(), 0);
+    vector<unsigned int> facesProjected;
+    if (!cookedSkybox.empty()) {
+        unsigned int read = startup.AddExternal("read cubemap.ctex");
+        fileIo.Read(cookedSkybox, [&startup, &skyboxFile, read](const std::string &, const FileView &file) {
+            skyboxFile = file;
+            startup.Complete(read);
+        });
+        startup.Add("upload skybox", StartupGraph::Main, [&]() {
+            CookedTexture::Image image;
+            if (CookedTexture::Parse(skyboxFile, image)) {
+                cubemapTexture = CookedTexture::Upload(image);
+                programState->skyboxStats.cooked = true;
+                programState->skyboxStats.format = image.format;
+                programState->skyboxStats.faceSize = image.mips[0].width;
+                programState->skyboxStats.levels = image.levels;
+                programState->skyboxStats.megabytes = CookedTexture::PayloadSize(image) / 1048576.0f;
+            } else
+                std::cerr << "Failed to load cubemap textures!" << std::endl;
+            skyboxFile = FileView();
+            skyboxLoaded();
+        }, {read});
+        // the faces themselves are only needed for the ambient light
+        for (unsigned int i = 0; i < faces.size() && !skyIrradianceCached; i++) {
+            std::string face = faces[i].substr(faces[i].find_last_of('/') + 1);
+            unsigned int faceRead = startup.AddExternal("read " + face);
+            fileIo.Read(faces[i], [&startup, &faceFiles, i, faceRead](const std::string &, const FileView &file) {
+                faceFiles[i] = file;
+                startup.Complete(faceRead);
+            });
+            facesProjected.push_back(startup.Add("project " + face, StartupGraph::Worker, [&, i]() {
+                faceProjected[i] = SphericalHarmonics::ProjectFile(i, faceFiles[i], faceRadiance[i]);
+                faceFiles[i] = FileView();
+            }, {faceRead}));
+        }
+    } else {
+        vector<unsigned int> facesDecoded;
+        for (unsigned int i = 0; i < faces.size(); i++) {
+            std::string face = faces[i].substr(faces[i].find_last_of('/') + 1);
+            unsigned int read = startup.AddExternal("read " + face);
+            fileIo.Read(faces[i], [&startup, &faceFiles, i, read](const std::string &, const FileView &file) {
+                faceFiles[i] = file;
+                startup.Complete(read);
+            });
+            unsigned int decoded = startup.Add("decode " + face, StartupGraph::Worker, [&, i]() {
+                if (!decodeCubemapFace(faceFiles[i], faceImages[i]))
+                    std::cerr << "Failed to load cubemap textures!" << std::endl;
+                faceFiles[i] = FileView();
+            }, {read});
+            facesDecoded.push_back(decoded);
+            if (!skyIrradianceCached)
+                facesProjected.push_back(startup.Add("project " + face, StartupGraph::Worker, [&, i]() {
+                    const DecodedImage &image = faceImages[i];
+                    if (image.pixels.empty())
+                        return;
+                    faceRadiance[i] = SphericalHarmonics::ProjectFace(i, image.pixels.data(), image.width,
+                                                                      image.height, image.channels);
+                    faceProjected[i] = 1;
+                }, {decoded}));
+        }
+        // the images are dropped once uploaded, so the projections go first
+        vector<unsigned int> uploadAfter = facesDecoded;
+        uploadAfter.insert(uploadAfter.end(), facesProjected.begin(), facesProjected.end());
+        startup.Add("upload skybox", StartupGraph::Main, [&]() {
+            cubemapTexture = cubemapFromImages(faceImages);
+            programState->skyboxStats.faceSize = faceImages[0].width;
+            faceImages.clear();
+            skyboxLoaded();
+        }, uploadAfter);
+    }
+    if (!skyIrradianceCached)
+        startup.Add("sky irradiance", StartupGraph::Worker, [&]() {
+            if (std::count(faceProjected.begin(), faceProjected.end(), 0) > 0) {
+                std::cerr << "Failed to project the skybox, ambient light stays constant" << std::endl;
+                return;
+            }
+            SH9 radiance;
+            for (const SH9 &face: faceRadiance)
+                radiance += face;
+            skyIrradiance = SphericalHarmonics::Irradiance(radiance);
+            skyIrradianceReady = true;
+            SphericalHarmonics::Save(SphericalHarmonics::CachePath(faces), skyIrradiance);
+        }, facesProjected);
+    // Static light of the house baked by lightmap_baker, left out when the model was edited after the bake
+    const std::string houseLightmap = Lightmap::Path("resources/objects/house/highpoly_town_house_01.obj");
+    FileView houseLightmapFile;
+    unsigned int houseLightmapTexture = 0;
+    bool houseLightmapFound = !VirtualFileSystem::EditedAfter("resources/objects/house/highpoly_town_house_01.obj",
+                                                              houseLightmap) &&
+                              FileSystem::files().Exists(houseLightmap);
+    if (houseLightmapFound) {
+        unsigned int read = startup.AddExternal("read lightmap");
+        fileIo.Read(houseLightmap, [&startup, &houseLightmapFile, read](const std::string &, const FileView &file) {
+            houseLightmapFile = file;
+            startup.Complete(read);
+        });
+        startup.Add("upload lightmap", StartupGraph::Main, [&houseLightmapFile, &houseLightmapTexture]() {
+            houseLightmapTexture = uploadLightmap(houseLightmapFile);
+            programState->lightmapAvailable = houseLightmapTexture != 0;
+            houseLightmapFile = FileView();
+        }, {read});
+    }
+    fileIo.Submit();
 
-    // Shaders
-    Shader modelShader("resources/shaders/model_shader.vs", "resources/shaders/model_shader.fs");
+    // Shaders, submitted together and only checked once the startup graph is done so the driver compiles meanwhile
+    ShaderBatch shaderBatch;
+    // lighting features are compiled in per variant (BLINN, SPOT_LIGHT, SKY_AMBIENT, LIGHTMAP, SSAO)
+    ShaderPermutations modelShaders("resources/shaders/model_shader.vs", "resources/shaders/model_shader.fs");
     Shader lightShader("resources/shaders/light_shader.vs", "resources/shaders/light_shader.fs");
     Shader skyboxShader("resources/shaders/skybox_shader.vs", "resources/shaders/skybox_shader.fs");
     Shader terrainShader("resources/shaders/terrain_shader.vs", "resources/shaders/terrain_shader.fs");
-
-    // House model
-    Model house("resources/objects/house/highpoly_town_house_01.obj");
-    house.SetShaderTextureNamePrefix("material.");
+    Shader infiniteTerrainShader("resources/shaders/infinite_terrain.vs", "resources/shaders/infinite_terrain.fs");
+    Shader terrainVTShader("resources/shaders/terrain_vt.vs", "resources/shaders/terrain_vt.fs");
+    Shader terrainFeedbackShader("resources/shaders/terrain_vt.vs", "resources/shaders/terrain_vt_feedback.fs");
+    Shader scatterShader("resources/shaders/scatter.vs", "resources/shaders/scatter.fs");
+    Shader scatterCullShader("resources/shaders/scatter_cull.vs", "resources/shaders/scatter_cull.gs",
+                             {"outPositionScale", "outParams"});
+    // SSAO: the house's depth prepass, then depth reduction, occlusion and blur at a fraction of the resolution
+    Shader houseDepthShader("resources/shaders/model_shader.vs", "resources/shaders/depth_only.fs");
+    Shader ssaoDepthShader("resources/shaders/fullscreen.vs", "resources/shaders/ssao_depth.fs");
+    Shader ssaoShader("resources/shaders/fullscreen.vs", "resources/shaders/ssao.fs");
+    Shader ssaoBlurShader("resources/shaders/fullscreen.vs", "resources/shaders/ssao_blur.fs");
+    // bloom's blur, the post-processing chain itself is a set of variants of post_process.fs
+    Shader bloomDownsampleShader("resources/shaders/fullscreen.vs", "resources/shaders/bloom_downsample.fs");
+    Shader bloomUpsampleShader("resources/shaders/fullscreen.vs", "resources/shaders/bloom_upsample.fs");
+    for (Shader *shader: {&lightShader, &skyboxShader, &terrainShader, &infiniteTerrainShader, &terrainVTShader,
+                          &terrainFeedbackShader, &scatterShader, &scatterCullShader, &houseDepthShader,
+                          &ssaoDepthShader, &ssaoShader, &ssaoBlurShader, &bloomDownsampleShader,
+                          &bloomUpsampleShader})
+        shaderBatch.Add(*shader);
+
+    // Multi-draw indirect submission of the house, only with a 4.3 context
+    // with compute culling against a depth pyramid of the previous frame
+    ShaderPermutations *modelIndirectShaders = NULL;
+    Shader *houseDepthIndirectShader = NULL;
+    Shader *gpuCullShader = NULL;
+    Shader *hiZBuildShader = NULL;
+    if (IndirectDrawList::Supported()) {
+        modelIndirectShaders = new ShaderPermutations("resources/shaders/model_shader_indirect.vs",
+                                                      "resources/shaders/model_shader.fs");
+        houseDepthIndirectShader = new Shader("resources/shaders/model_shader_indirect.vs",
+                                              "resources/shaders/depth_only.fs");
+        shaderBatch.Add(*houseDepthIndirectShader);
+        gpuCullShader = new Shader("resources/shaders/gpu_cull.cs");
+        hiZBuildShader = new Shader("resources/shaders/hiz_build.cs");
+        shaderBatch.Add(*gpuCullShader);
+        shaderBatch.Add(*hiZBuildShader);
+    }
+    // the lighting variant the house starts with and each one a single toggle away, so the first switch never waits
+    // on the compiler. Everything else compiles on first use. Programs already in the batch are not added again
+    auto submitLighting = [&](bool skyAmbientAvailable, bool lightmapAvailable, bool assetToggles) {
+        bool toggles[5] = {programState->blinn, programState->spotLight.enabled,
+                           programState->skyAmbient && skyAmbientAvailable, programState->lightmap && lightmapAvailable,
+                           programState->ssaoQuality != Ssao::Off};
+        bool flippable[5] = {true, true, assetToggles && skyAmbientAvailable, assetToggles && lightmapAvailable, true};
+        for (int flipped = -1; flipped < 5; flipped++) {
+            if (flipped >= 0 && !flippable[flipped])
+                continue;
+            bool variant[5];
+            std::copy(toggles, toggles + 5, variant);
+            if (flipped >= 0)
+                variant[flipped] = !variant[flipped];
+            ShaderDefines lighting = modelLighting(variant[0], variant[1], variant[2], variant[3], variant[4]);
+            shaderBatch.Add(modelShaders.Get(lighting));
+            if (modelIndirectShaders)
+                shaderBatch.Add(modelIndirectShaders->Get(lighting));
+        }
+    };
+    // these compile while the startup graph loads. Whether the sky's light and the lightmap load is only known after
+    // it, until then the sky is expected to and the lightmap when its file is there
+    submitLighting(true, houseLightmapFound, false);
+    IndirectDrawList houseDraws;
+    HiZPyramid hiZ;
+    Ssao ssao;
+    GpuTimer prepassTimer, ssaoTimer;
+
+    // The scene renders into an HDR target, the post-processing chain takes it to the screen. Stages that only read
+    // their own pixel share one full-screen pass, FXAA needs the graded picture finished and gets a second one
+    HdrTarget hdrTarget;
+    Bloom bloom;
+    ColorGrading colorGrading;
+    PostProcess postProcess("resources/shaders/fullscreen.vs", "resources/shaders/post_process.fs");
+    PostProcess::Stage &bloomStage = postProcess.Add("bloom", "BLOOM");
+    bloomStage.prepare = [&bloom, &bloomDownsampleShader, &bloomUpsampleShader](GLuint color, int width, int height) {
+        bloom.Compute(bloomDownsampleShader, bloomUpsampleShader, color, width, height);
+    };
+    bloomStage.bind = [&bloom](Shader &shader) { bloom.Bind(shader, 1); };
+    PostProcess::Stage &tonemapStage = postProcess.Add("tonemap", "TONEMAP");
+    tonemapStage.displayRange = true;
+    tonemapStage.bind = [](Shader &shader) { shader.setFloat("exposure", programState->exposure); };
+    PostProcess::Stage &gradingStage = postProcess.Add("grading", "GRADING");
+    gradingStage.bind = [&colorGrading](Shader &shader) { colorGrading.Bind(shader, 2); };
+    PostProcess::Stage &fxaaStage = postProcess.Add("FXAA", "FXAA");
+    fxaaStage.neighbourhood = true;
+    postProcess.Prepare(shaderBatch);
 
     // Pyramid setup
     float pyramidVertices[] = {
@@ -260,12 +708,29 @@ int main() {
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
 
-    unsigned int terrainBase = loadTexture("resources/textures/terrain/base.jpg");
-    terrainShader.setInt("texture0", terrainBase);
-    unsigned int terrainHeight = loadTexture("resources/textures/terrain/height.png");
-    terrainShader.setInt("texture1", terrainHeight);
-    unsigned int terrainRoughness = loadTexture("resources/textures/terrain/roughness.jpg");
-    terrainShader.setInt("texture2", terrainRoughness);
+    // Virtual texture covering the terrain quad with unique detail, built the first time it is switched on. Its source
+    // decodes the detail textures into float mip chains on a worker, the plain terrain draws until they are ready
+    std::unique_ptr<VirtualTexture> virtualTexture;
+    auto virtualTextureSource = std::make_shared<std::shared_ptr<ProceduralTerrainSource>>();
+    auto virtualTextureDecoded = std::make_shared<std::atomic<bool>>(false);
+    bool virtualTextureRequested = false;
+
+    // Infinite terrain setup
+    TerrainSettings terrainSettings;
+    terrainSettings.flatCenter = glm::vec2(programState->housePosition.x, programState->housePosition.z);
+    InfiniteTerrain infiniteTerrain(workers, terrainSettings);
+
+    // Vegetation scattered over whichever terrain is active
+    auto flatHeight = [](float x, float z) { return 0.0f; };
+    auto infiniteHeight = [&infiniteTerrain](float x, float z) { return infiniteTerrain.HeightAt(x, z); };
+    ScatterSettings scatterSettings;
+    scatterSettings.clearCenter = terrainSettings.flatCenter;
+    Scatter scatter(workers, flatHeight, scatterSettings);
+    bool scatterOnInfiniteTerrain = false;
+    GpuTimer scatterTimer;
+    ScatterBenchmark scatterBenchmark;
+    IoBenchmark ioBenchmark;
+    ImageDecodeBenchmark decodeBenchmark;
 
     // Skybox setup
     float skyboxVertices[] = {
@@ -322,19 +787,99 @@ int main() {
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(float), (void*)0);
 
-    vector<std::string> faces
-            {
-                    FileSystem::getPath("/resources/textures/skybox/right.png"),
-                    FileSystem::getPath("/resources/textures/skybox/left.png"),
-                    FileSystem::getPath("/resources/textures/skybox/top.png"),
-                    FileSystem::getPath("/resources/textures/skybox/bottom.png"),
-                    FileSystem::getPath("/resources/textures/skybox/front.png"),
-                    FileSystem::getPath("/resources/textures/skybox/back.png")
-            };
-    unsigned int cubemapTexture = loadCubemap(faces);
+    // Everything decoded so far is uploaded here, as it arrives
+    startup.Run();
+    programState->startupStats.timeline = startup.Timeline();
+    programState->skyAmbientAvailable = skyIrradianceReady;
+    // a lightmap is no use to a house without the layout it was baked for
+    programState->lightmapAvailable = programState->lightmapAvailable && house->HasLightmapLayout();
+    programState->startupStats.ioRing = fileIo.UsesIoUring();
+    // references, reloads streamed in later replace the textures
+    unsigned int &terrainBase = terrainTextures[0];
+    terrainShader.setInt("texture0", terrainBase);
+    unsigned int &terrainHeight = terrainTextures[1];
+    terrainShader.setInt("texture1", terrainHeight);
+    unsigned int &terrainRoughness = terrainTextures[2];
+    terrainShader.setInt("texture2", terrainRoughness);
+    // the sky ambient and lightmap toggles once it is known which of them loaded, and the starting variant again in
+    // case the guess above was wrong
+    submitLighting(programState->skyAmbientAvailable, programState->lightmapAvailable, true);
+    programState->shaderStats.programs = shaderBatch.Size();
+    programState->shaderStats.milliseconds = shaderBatch.Finish();
+    programState->shaderStats.parallel = ShaderBatch::Parallel();
+
     skyboxShader.use();
     skyboxShader.setInt("skybox", 0);
 
+    // Hot reload of edited shaders, textures and models, applied between frames
+    HotReload hotReload;
+    for (Shader *shader: {&lightShader, &skyboxShader, &terrainShader, &infiniteTerrainShader, &terrainVTShader,
+                          &terrainFeedbackShader, &scatterShader, &scatterCullShader, &houseDepthShader,
+                          &ssaoDepthShader, &ssaoShader, &ssaoBlurShader, &bloomDownsampleShader,
+                          &bloomUpsampleShader, houseDepthIndirectShader, gpuCullShader, hiZBuildShader})
+        if (shader)
+            hotReload.Watch(*shader);
+    hotReload.Watch(modelShaders);
+    hotReload.Watch(postProcess.Programs());
+    if (modelIndirectShaders)
+        hotReload.Watch(*modelIndirectShaders);
+    // the house keeps drawing its old meshes until the re-imported ones are resident
+    hotReload.Watch(*house, streamer);
+    for (int i = 0; i < 3; i++) {
+        hotReload.Watch({terrainPaths[i]}, [&streamer, &terrainTextures, i](const std::string &file) {
+            streamer.LoadTexture(file, [&terrainTextures, i](AssetStreamer::TextureAsset &texture) {
+                glDeleteTextures(1, &terrainTextures[i]);
+                terrainTextures[i] = texture.id;
+                texture.id = 0;
+            });
+            return true;
+        });
+    }
+    hotReload.Watch(faces, [&faces, cubemapTexture, &skyIrradiance](const std::string &) {
+        if (loadCubemap(faces, cubemapTexture) == 0)
+            return false;
+        // the ambient light follows the new sky, projected right here as edits to the faces are rare
+        if (SphericalHarmonics::ProjectFiles(faces, skyIrradiance)) {
+            programState->skyAmbientAvailable = true;
+            SphericalHarmonics::Save(SphericalHarmonics::CachePath(faces), skyIrradiance);
+        }
+        return true;
+    });
+    // a re-cooked cubemap replaces the faces as long as they were not edited after it
+    hotReload.Watch({faces[0].substr(0, faces[0].find_last_of('/') + 1) + "cubemap.ctex"},
+                    [&faces, cubemapTexture](const std::string &) {
+        std::string cooked = CookedTexture::FindCubemap(faces);
+        CookedTexture::Image image;
+        if (cooked.empty() || !CookedTexture::Parse(FileSystem::open(cooked), image))
+            return false;
+        CookedTexture::Upload(image, cubemapTexture);
+        return true;
+    });
+    // a re-baked lightmap replaces the old one in place, the first one baked while running switches it on
+    hotReload.Watch({houseLightmap}, [&houseLightmap, &houseLightmapTexture, house](const std::string &) {
+        unsigned int texture = uploadLightmap(FileSystem::open(houseLightmap), houseLightmapTexture);
+        if (texture == 0)
+            return false;
+        houseLightmapTexture = texture;
+        programState->lightmapAvailable = house->HasLightmapLayout();
+        return true;
+    });
+
+    // An artist's grading LUT, when there is one, under the grading sliders. Edits to it are picked up while running
+    const std::string gradingLut = "resources/textures/grading_lut.png";
+    auto loadGradingLut = [&gradingLut, &colorGrading](const std::string &) {
+        DecodedImage image;
+        // the strip's rows are read top down
+        if (!DecodeImage(FileSystem::open(gradingLut), image, 3, false) ||
+            !colorGrading.SetLut(image.pixels.data(), image.width, image.height, image.channels))
+            return false;
+        programState->postStats.gradingLut = true;
+        return true;
+    };
+    if (FileSystem::files().Exists(gradingLut))
+        loadGradingLut(gradingLut);
+    hotReload.Watch({gradingLut}, loadGradingLut);
+
     // Directional light
     DirLight& dirLight = programState->dirLight;
     dirLight.direction = glm::vec3(-10.0, -10.0, -3.0);
@@ -368,28 +913,188 @@ int main() {
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        // Edited files are swapped in before anything of this frame is drawn
+        hotReload.Update();
+        streamer.Update();
+        programState->streamStats.pending = streamer.Pending();
+        programState->streamStats.loaded = streamer.Loaded();
+        programState->streamStats.milliseconds = streamer.LastMilliseconds();
+        programState->houseStats.meshletCount = house->MeshletCount();
+        programState->houseStats.residentMeshes = house->ResidentMeshes();
+        programState->houseStats.meshCount = house->meshes.size();
+        programState->reloadStats.reloads = hotReload.Reloads();
+        programState->reloadStats.failures = hotReload.Failures();
+        programState->reloadStats.milliseconds = hotReload.LastMilliseconds();
+        programState->reloadStats.file = hotReload.LastFile();
+        if (programState->ioBenchmarkRequested) {
+            programState->ioBenchmarkRequested = false;
+            ioBenchmark.Start(FileSystem::getPath("resources"));
+        }
+        programState->startupStats.ioBenchmarkRunning = ioBenchmark.Running();
+        if (programState->decodeBenchmarkRequested) {
+            programState->decodeBenchmarkRequested = false;
+            decodeBenchmark.Start(FileSystem::getPath("resources"));
+        }
+        programState->startupStats.decodeBenchmarkRunning = decodeBenchmark.Running();
+
         // Input
         processInput(window);
 
-        // Render
-        glClearColor(programState->clearColor.r, programState->clearColor.g, programState->clearColor.b, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Terrain streaming, keeps the camera above the generated surface
+        if (programState->infiniteTerrain) {
+            Camera& c = programState->camera;
+            infiniteTerrain.Update(c.Position, c.Front);
+            c.Position.y = std::max(c.Position.y, infiniteTerrain.HeightAt(c.Position.x, c.Position.z) + 1.8f);
+        }
+
+        // Vegetation tiles follow the camera and the active terrain
+        if (programState->scatter) {
+            if (scatterOnInfiniteTerrain != programState->infiniteTerrain) {
+                scatterOnInfiniteTerrain = programState->infiniteTerrain;
+                if (scatterOnInfiniteTerrain)
+                    scatter.SetHeightFunction(infiniteHeight);
+                else
+                    scatter.SetHeightFunction(flatHeight);
+            }
+            if (programState->scatterBenchmarkRequested) {
+                programState->scatterBenchmarkRequested = false;
+                scatterBenchmark.Start(programState->scatterDensity);
+            }
+            if (!scatterBenchmark.Running() && scatter.settings.densityScale != programState->scatterDensity) {
+                scatter.settings.densityScale = programState->scatterDensity;
+                scatter.Clear();
+            }
+            scatter.Update(programState->camera.Position);
+        }
 
         // View/projection transformations
         glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
         glm::mat4 view = programState->camera.GetViewMatrix();
         glm::mat4 model = glm::mat4(1.0f);
 
+        // Virtual texture feedback, records the pages the terrain needs at low resolution
+        int screenWidth, screenHeight;
+        glfwGetFramebufferSize(window, &screenWidth, &screenHeight);
+        bool useVirtualTexture = programState->virtualTexturing && !programState->infiniteTerrain;
+        if (useVirtualTexture && !virtualTexture) {
+            if (!virtualTextureRequested) {
+                virtualTextureRequested = true;
+                workers.Submit([virtualTextureSource, virtualTextureDecoded]() {
+                    *virtualTextureSource = std::make_shared<ProceduralTerrainSource>(
+                            "resources/textures/terrain/base.jpg", "resources/textures/terrain/roughness.jpg");
+                    virtualTextureDecoded->store(true);
+                });
+            }
+            if (virtualTextureDecoded->load())
+                virtualTexture.reset(new VirtualTexture(workers, *virtualTextureSource));
+            useVirtualTexture = virtualTexture != nullptr;
+        }
+        if (useVirtualTexture) {
+            virtualTexture->Update();
+            model = glm::translate(glm::mat4(1.0f), glm::vec3(-50.0f, 0.0f, 0.0f));
+            virtualTexture->BeginFeedback(screenWidth, screenHeight);
+            terrainFeedbackShader.use();
+            virtualTexture->Bind(terrainFeedbackShader, 0, 1, virtualTexture->FeedbackMipBias());
+            terrainFeedbackShader.setFloat("terrainExtent", 1000.0f);
+            terrainFeedbackShader.setMat4("projection", projection);
+            terrainFeedbackShader.setMat4("view", view);
+            terrainFeedbackShader.setMat4("model", model);
+            glBindVertexArray(terrainVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 4);
+            glBindVertexArray(0);
+            virtualTexture->EndFeedback(screenWidth, screenHeight);
+
+            programState->virtualTextureStats.resident = virtualTexture->ResidentPages();
+            programState->virtualTextureStats.pending = virtualTexture->PendingPages();
+            programState->virtualTextureStats.requested = virtualTexture->RequestedLastFrame();
+            programState->virtualTextureStats.uploads = virtualTexture->UploadsLastFrame();
+        }
+
+        // Render, into the HDR target
+        hdrTarget.Bind(screenWidth, screenHeight);
+        glClearColor(programState->clearColor.r, programState->clearColor.g, programState->clearColor.b, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // Terrain render, first so the SSAO depth prepass sees the ground the house stands on
+        if (programState->infiniteTerrain) {
+            infiniteTerrainShader.use();
+            infiniteTerrainShader.setInt("texture0", 0);
+            infiniteTerrainShader.setInt("texture2", 2);
+            infiniteTerrainShader.setFloat("uvScale", 0.06f);
+            infiniteTerrainShader.setVec3("lightDirection", dirLight.direction);
+            infiniteTerrainShader.setMat4("projection", projection);
+            infiniteTerrainShader.setMat4("view", view);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, terrainBase);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, terrainRoughness);
+            glActiveTexture(GL_TEXTURE0);
+            infiniteTerrain.Draw(infiniteTerrainShader, Frustum(projection * view));
+            programState->terrainStats.resident = infiniteTerrain.ResidentCount();
+            programState->terrainStats.pending = infiniteTerrain.PendingCount();
+            programState->terrainStats.drawn = infiniteTerrain.DrawnLastFrame();
+        } else if (useVirtualTexture) {
+            terrainVTShader.use();
+            virtualTexture->Bind(terrainVTShader, 0, 1, 0.0f);
+            terrainVTShader.setFloat("terrainExtent", 1000.0f);
+            terrainVTShader.setMat4("projection", projection);
+            terrainVTShader.setMat4("view", view);
+            model = glm::mat4(1.0f);
+            model = glm::translate(model, glm::vec3(-50.0f, 0.0f, 0.0f));
+            terrainVTShader.setMat4("model", model);
+            glBindVertexArray(terrainVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 4);
+            glBindVertexArray(0);
+        } else {
+            terrainShader.use();
+            terrainShader.setInt("texture0", 0);
+            terrainShader.setMat4("projection", projection);
+            terrainShader.setMat4("view", view);
+            model = glm::mat4(1.0f);
+            model = glm::translate(model, glm::vec3(-50.0f, 0.0f, 0.0f));
+            terrainShader.setMat4("model", model);
+            glBindVertexArray(terrainVAO);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, terrainBase);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, terrainHeight);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, terrainRoughness);
+            glDrawArrays(GL_TRIANGLES, 0, 4);
+            glBindVertexArray(0);
+        }
+
         // Model lighting
-        modelShader.use();
-        modelShader.setFloat("material.shininess", 8.0f);
-        modelShader.setBool("blinn", programState->blinn);
+        bool indirectHouse = programState->indirectDraw && modelIndirectShaders && house->UsesTextureArrays();
+        bool skyAmbient = programState->skyAmbient && programState->skyAmbientAvailable;
+        // a re-import can lose the layout too
+        bool lightmap = programState->lightmap && programState->lightmapAvailable && house->HasLightmapLayout();
+        Ssao::Quality ssaoQuality = (Ssao::Quality) programState->ssaoQuality;
+        ShaderDefines lighting = modelLighting(programState->blinn, programState->spotLight.enabled, skyAmbient,
+                                               lightmap, ssaoQuality != Ssao::Off);
+        Shader &houseShader = (indirectHouse ? *modelIndirectShaders : modelShaders).Get(lighting);
+        houseShader.use();
+        houseShader.setFloat("material.shininess", 8.0f);
 
         // Directional light
-        modelShader.setVec3("dirLight.direction", dirLight.direction);
-        modelShader.setVec3("dirLight.ambient", dirLight.ambient);
-        modelShader.setVec3("dirLight.diffuse", dirLight.diffuse);
-        modelShader.setVec3("dirLight.specular", dirLight.specular);
+        houseShader.setVec3("dirLight.direction", dirLight.direction);
+        houseShader.setVec3("dirLight.ambient", dirLight.ambient);
+        houseShader.setVec3("dirLight.diffuse", dirLight.diffuse);
+        houseShader.setVec3("dirLight.specular", dirLight.specular);
+        if (skyAmbient) {
+            for (int i = 0; i < 9; i++)
+                houseShader.setVec3("skyIrradiance[" + std::to_string(i) + "]", skyIrradiance.coefficients[i]);
+            houseShader.setFloat("skyAmbientStrength", programState->skyAmbientStrength);
+        }
+        houseShader.setFloat("occlusionStrength", programState->occlusionStrength);
+        if (lightmap) {
+            // unit 13 is below the ones the model keeps for its unused samplers
+            glActiveTexture(GL_TEXTURE13);
+            glBindTexture(GL_TEXTURE_2D, houseLightmapTexture);
+            glActiveTexture(GL_TEXTURE0);
+            houseShader.setInt("lightmap", 13);
+            houseShader.setFloat("lightmapRange", Lightmap::Range);
+        }
 
         // Point light
         if(programState->randColor)
@@ -399,53 +1104,119 @@ int main() {
             float blue = (sin(currentFrame * 0.5f) + 1) / 2;
             programState->pyramidColor = glm::vec3(red, green, blue);
         }
-        modelShader.setVec3("ptLight.position", programState->pyramidPosition);
-        modelShader.setVec3("ptLight.ambient", programState->pyramidColor * 0.1f);
-        modelShader.setVec3("ptLight.diffuse", programState->pyramidColor);
-        modelShader.setVec3("ptLight.specular", pointLight.specular);
-        modelShader.setFloat("ptLight.constant", pointLight.constant);
-        modelShader.setFloat("ptLight.linear", pointLight.linear);
-        modelShader.setFloat("ptLight.quadratic", pointLight.quadratic);
+        houseShader.setVec3("ptLight.position", programState->pyramidPosition);
+        houseShader.setVec3("ptLight.ambient", programState->pyramidColor * 0.1f);
+        houseShader.setVec3("ptLight.diffuse", programState->pyramidColor);
+        houseShader.setVec3("ptLight.specular", pointLight.specular);
+        houseShader.setFloat("ptLight.constant", pointLight.constant);
+        houseShader.setFloat("ptLight.linear", pointLight.linear);
+        houseShader.setFloat("ptLight.quadratic", pointLight.quadratic);
 
         // Spotlight
-        modelShader.setBool("spotLight.enabled", programState->spotLight.enabled);
-        modelShader.setVec3("spotLight.position", programState->camera.Position);
-        modelShader.setVec3("spotLight.direction", programState->camera.Front);
-        modelShader.setVec3("spotLight.ambient", spotLight.ambient);
-        modelShader.setVec3("spotLight.diffuse", spotLight.diffuse);
-        modelShader.setVec3("spotLight.specular", spotLight.specular);
-        modelShader.setFloat("spotLight.constant", spotLight.constant);
-        modelShader.setFloat("spotLight.linear", spotLight.linear);
-        modelShader.setFloat("spotLight.quadratic", spotLight.quadratic);
-        modelShader.setFloat("spotLight.cutOff", spotLight.cutOff);
-        modelShader.setFloat("spotLight.outerCutOff", spotLight.outerCutOff);
+        houseShader.setVec3("spotLight.position", programState->camera.Position);
+        houseShader.setVec3("spotLight.direction", programState->camera.Front);
+        houseShader.setVec3("spotLight.ambient", spotLight.ambient);
+        houseShader.setVec3("spotLight.diffuse", spotLight.diffuse);
+        houseShader.setVec3("spotLight.specular", spotLight.specular);
+        houseShader.setFloat("spotLight.constant", spotLight.constant);
+        houseShader.setFloat("spotLight.linear", spotLight.linear);
+        houseShader.setFloat("spotLight.quadratic", spotLight.quadratic);
+        houseShader.setFloat("spotLight.cutOff", spotLight.cutOff);
+        houseShader.setFloat("spotLight.outerCutOff", spotLight.outerCutOff);
 
         // House render
-        modelShader.setMat4("projection", projection);
-        modelShader.setMat4("view", view);
+        houseShader.setMat4("projection", projection);
+        houseShader.setMat4("view", view);
         model = glm::mat4(1.0f);
         model = glm::translate(model, programState->housePosition);
         model = glm::scale(model, glm::vec3(programState->houseScale));
-        modelShader.setMat4("model", model);
-        house.Draw(modelShader);
-
-        // Terrain render
-        terrainShader.use();
-        terrainShader.setInt("texture0", 0);
-        terrainShader.setMat4("projection", projection);
-        terrainShader.setMat4("view", view);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-50.0f, 0.0f, 0.0f));
-        terrainShader.setMat4("model", model);
-        glBindVertexArray(terrainVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, terrainBase);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, terrainHeight);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, terrainRoughness);
-        glDrawArrays(GL_TRIANGLES, 0, 4);
-        glBindVertexArray(0);
+        // the streamer refines the meshes covering most of the screen first
+        house->UpdateCoverage(model, programState->camera.Position, projection[1][1]);
+        bool gpuCulledHouse = indirectHouse && programState->gpuCulling;
+        // GL_CULL_FACE is off, so the cone test is what rejects the back facing clusters
+        MeshletCulling houseMeshlets(projection * view, model, programState->camera.Position, programState->coneCulling);
+        if (gpuCulledHouse) {
+            houseDraws.AddModel(*house, model, programState->meshletCulling);
+            houseDraws.CullOnGpu(*gpuCullShader, Frustum(projection * view), hiZ, programState->camera.Position,
+                                 programState->meshletCulling && programState->coneCulling);
+        } else if (indirectHouse && programState->meshletCulling) {
+            houseDraws.AddModel(*house, model, houseMeshlets);
+        } else if (indirectHouse) {
+            houseDraws.AddModel(*house, model, Frustum(projection * view));
+        }
+        // SSAO: the house's depth goes in first, the occlusion of everything drawn so far is then ready for its
+        // lighting, which only shades the fragments the prepass left in front
+        if (ssaoQuality != Ssao::Off) {
+            Shader &prepassShader = indirectHouse ? *houseDepthIndirectShader : houseDepthShader;
+            prepassTimer.Begin();
+            prepassShader.use();
+            prepassShader.setMat4("projection", projection);
+            prepassShader.setMat4("view", view);
+            prepassShader.setMat4("model", model);
+            if (indirectHouse) {
+                houseDraws.Draw(*house->pool);
+            } else if (programState->meshletCulling) {
+                // a copy, the lighting pass counts the meshlets for the stats
+                MeshletCulling prepassMeshlets = houseMeshlets;
+                house->Draw(prepassShader, prepassMeshlets);
+            } else {
+                house->Draw(prepassShader, model, Frustum(projection * view));
+            }
+            prepassTimer.End();
+            ssaoTimer.Begin();
+            ssao.Compute(ssaoDepthShader, ssaoShader, ssaoBlurShader, hdrTarget.Framebuffer(), screenWidth,
+                         screenHeight, projection, ssaoQuality);
+            ssaoTimer.End();
+            glDepthFunc(GL_LEQUAL);
+            programState->ssaoStats.resolution = ssao.Resolution();
+            programState->ssaoStats.prepassMilliseconds = prepassTimer.Milliseconds();
+            programState->ssaoStats.milliseconds = ssaoTimer.Milliseconds();
+        }
+        houseShader.use();
+        if (ssaoQuality != Ssao::Off)
+            ssao.Bind(houseShader, 11);
+        if (indirectHouse) {
+            house->BindTextureArrays(houseShader);
+            if (ssaoQuality != Ssao::Off)
+                houseDraws.Redraw(*house->pool);
+            else
+                houseDraws.Draw(*house->pool);
+            programState->houseStats.drawn = houseDraws.DrawnLastFrame();
+            programState->houseStats.culled = houseDraws.CulledLastFrame();
+        } else if (programState->meshletCulling) {
+            houseShader.setMat4("model", model);
+            house->Draw(houseShader, houseMeshlets);
+            programState->houseStats.drawn = houseMeshlets.visible;
+            programState->houseStats.culled = houseMeshlets.total - houseMeshlets.visible;
+        } else {
+            houseShader.setMat4("model", model);
+            programState->houseStats.drawn = house->Draw(houseShader, model, Frustum(projection * view));
+            programState->houseStats.culled = house->meshes.size() - programState->houseStats.drawn;
+        }
+        glDepthFunc(GL_LESS);
+        programState->houseStats.indirect = indirectHouse;
+        programState->houseStats.gpuCulled = gpuCulledHouse;
+        programState->houseStats.meshlets = programState->meshletCulling;
+
+        // Vegetation render
+        if (programState->scatter) {
+            scatterTimer.Begin();
+            scatterShader.use();
+            scatterShader.setMat4("projection", projection);
+            scatterShader.setMat4("view", view);
+            scatterShader.setFloat("time", currentFrame);
+            scatterShader.setVec3("lightDirection", dirLight.direction);
+            scatter.Draw(scatterShader, scatterCullShader, Frustum(projection * view), programState->camera.Position,
+                         programState->scatterGpuCulling);
+            scatterTimer.End();
+            scatterBenchmark.Frame(deltaTime, scatterTimer.Milliseconds(), scatter);
+
+            programState->scatterStats.tiles = scatter.TileCount();
+            programState->scatterStats.resident = scatter.ResidentInstances();
+            programState->scatterStats.drawn = scatter.DrawnInstances();
+            programState->scatterStats.milliseconds = scatterTimer.Milliseconds();
+            programState->scatterStats.benchmarkRunning = scatterBenchmark.Running();
+        }
 
         // Skybox render
         glDepthMask(GL_FALSE);
@@ -467,6 +1238,7 @@ int main() {
         glDepthMask(GL_FALSE);
         lightShader.use();
         lightShader.setVec3("color", programState->pyramidColor);
+        lightShader.setFloat("intensity", programState->pyramidIntensity);
         lightShader.setMat4("projection", projection);
         lightShader.setMat4("view", view);
         glBindVertexArray(pyramidVAO);
@@ -491,16 +1263,41 @@ int main() {
         glDisable(GL_BLEND);
         glDepthMask(GL_TRUE);
 
+        // Depth pyramid of the finished scene for next frame's occlusion culling
+        if (gpuCulledHouse)
+            hiZ.Capture(*hiZBuildShader, hdrTarget.Framebuffer(), screenWidth, screenHeight, projection * view);
+        else
+            hiZ.Invalidate();
+
+        // Post-processing, from the HDR target to the screen
+        bloomStage.enabled = programState->bloom;
+        tonemapStage.enabled = programState->tonemap;
+        gradingStage.enabled = programState->colorGrading;
+        fxaaStage.enabled = programState->fxaa;
+        bloom.settings = programState->bloomSettings;
+        colorGrading.settings = programState->gradingSettings;
+        if (programState->colorGrading)
+            colorGrading.Update();
+        postProcess.Render(hdrTarget.Color(), screenWidth, screenHeight);
+        programState->postStats.timings = postProcess.Timings();
+        programState->postStats.stages = postProcess.EnabledStageCount();
+        programState->postStats.passes = postProcess.PassCount();
+
         // ImGui
+
         if (programState->ImGuiEnabled)
             DrawImGui(programState);
 
         // Swap buffers and poll IO events
         glfwSwapBuffers(window);
         glfwPollEvents();
+        if (programState->startupStats.firstFrame == 0.0f)
+            programState->startupStats.firstFrame =
+                    std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - launch).count();
     }
 
     // De-allocate resources, save data and terminate GLFW
+    workers.Wait();
     programState->SaveToFile("resources/program_state.txt");
     delete programState;
 
@@ -508,9 +1305,50 @@ int main() {
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 
-    modelShader.deleteProgram();
+    modelShaders.Release();
+    if (modelIndirectShaders) {
+        modelIndirectShaders->Release();
+        houseDepthIndirectShader->deleteProgram();
+        gpuCullShader->deleteProgram();
+        hiZBuildShader->deleteProgram();
+        delete modelIndirectShaders;
+        delete houseDepthIndirectShader;
+        delete gpuCullShader;
+        delete hiZBuildShader;
+    }
     lightShader.deleteProgram();
     terrainShader.deleteProgram();
+    infiniteTerrainShader.deleteProgram();
+    terrainVTShader.deleteProgram();
+    terrainFeedbackShader.deleteProgram();
+    scatterShader.deleteProgram();
+    scatterCullShader.deleteProgram();
+    houseDepthShader.deleteProgram();
+    ssaoDepthShader.deleteProgram();
+    ssaoShader.deleteProgram();
+    ssaoBlurShader.deleteProgram();
+    bloomDownsampleShader.deleteProgram();
+    bloomUpsampleShader.deleteProgram();
+
+    infiniteTerrain.Release();
+    if (virtualTexture)
+        virtualTexture->Release();
+    scatter.Release();
+    scatterTimer.Release();
+    // the loader may still be refining the house
+    streamer.Release();
+    house->Release();
+    delete house;
+    glDeleteTextures(1, &houseLightmapTexture);
+    houseDraws.Release();
+    hiZ.Release();
+    ssao.Release();
+    prepassTimer.Release();
+    ssaoTimer.Release();
+    postProcess.Release();
+    bloom.Release();
+    colorGrading.Release();
+    hdrTarget.Release();
     skyboxShader.deleteProgram();
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -585,6 +1423,49 @@ void DrawImGui(ProgramState *programState) {
         ImGui::Text("Camera position: (%f, %f, %f)", c.Position.x, c.Position.y, c.Position.z);
         ImGui::Text("Camera (yaw, pitch): (%f, %f)", c.Yaw, c.Pitch);
         ImGui::Checkbox("Camera mouse update", &programState->CameraMouseMovementUpdateEnabled);
+        ImGui::Text("Shaders: %d programs ready %.1f ms after submission (%s)", programState->shaderStats.programs,
+                    programState->shaderStats.milliseconds,
+                    programState->shaderStats.parallel ? "parallel compile" : "driver default");
+        if (programState->reloadStats.reloads > 0)
+            ImGui::Text("Hot reloads: %d (%d failed), last %s in %.1f ms", programState->reloadStats.reloads,
+                        programState->reloadStats.failures, programState->reloadStats.file.c_str(),
+                        programState->reloadStats.milliseconds);
+        if (programState->streamStats.pending > 0 || programState->streamStats.loaded > 0)
+            ImGui::Text("Streamed assets: %d loaded, %d pending, last took %.1f ms on the loader thread",
+                        programState->streamStats.loaded, programState->streamStats.pending,
+                        programState->streamStats.milliseconds);
+        ImGui::End();
+    }
+
+    {
+        ImGui::Begin("Startup");
+        ImGui::Text("Time to first frame: %.1f ms", programState->startupStats.firstFrame);
+        ImGui::Text("File reads: %s", programState->startupStats.ioRing ? "io_uring" : "thread pool");
+        const char *skyboxFormats[] = {"RGBA8", "BC1", "BC3"};
+        if (programState->skyboxStats.cooked)
+            ImGui::Text("Skybox: cooked %s, %d px faces, %d levels, %.1f MB, ready after %.1f ms",
+                        skyboxFormats[programState->skyboxStats.format], programState->skyboxStats.faceSize,
+                        programState->skyboxStats.levels, programState->skyboxStats.megabytes,
+                        programState->skyboxStats.milliseconds);
+        else
+            ImGui::Text("Skybox: 6 decoded faces, %d px, mipmapped on the GPU, ready after %.1f ms",
+                        programState->skyboxStats.faceSize, programState->skyboxStats.milliseconds);
+        if (programState->startupStats.ioBenchmarkRunning)
+            ImGui::Text("I/O benchmark running, results go to stdout");
+        else if (ImGui::Button("Run I/O benchmark"))
+            programState->ioBenchmarkRequested = true;
+        std::string decoders;
+        for (const ImageDecoder *decoder: ImageDecoders::All())
+            decoders += (decoders.empty() ? "" : ", ") + std::string(decoder->Name());
+        ImGui::Text("Image decoders: %s", decoders.c_str());
+        if (programState->startupStats.decodeBenchmarkRunning)
+            ImGui::Text("Decode benchmark running, results go to stdout");
+        else if (ImGui::Button("Run decode benchmark"))
+            programState->decodeBenchmarkRequested = true;
+        for (const StartupGraph::Span &span: programState->startupStats.timeline)
+            ImGui::Text("%7.1f - %7.1f ms  %-6s  %s", span.start, span.end,
+                        span.thread == StartupGraph::Main ? "main" :
+                        span.thread == StartupGraph::External ? "io" : "worker", span.name.c_str());
         ImGui::End();
     }
 
@@ -599,8 +1480,99 @@ void DrawImGui(ProgramState *programState) {
         ImGui::Spacing();
         ImGui::Spacing();
         ImGui::ColorEdit3("Light color", (float *) &programState->pyramidColor);
+        ImGui::SliderFloat("Pyramid emission", &programState->pyramidIntensity, 0.0f, 20.0f);
         ImGui::Checkbox("Random pyramid color", &programState->randColor);
         ImGui::Text("Lighting model: %s", programState->blinn ? "Blinn Phong" : "Phong");
+        if (programState->skyAmbientAvailable) {
+            ImGui::Checkbox("Sky ambient (spherical harmonics)", &programState->skyAmbient);
+            ImGui::SliderFloat("Sky ambient strength", &programState->skyAmbientStrength, 0.0f, 8.0f);
+        } else
+            ImGui::Text("Sky ambient unavailable, using the constant ambient");
+        ImGui::SliderFloat("Baked occlusion", &programState->occlusionStrength, 0.0f, 1.0f);
+        if (programState->lightmapAvailable)
+            ImGui::Checkbox("Baked lightmap (sun and sky)", &programState->lightmap);
+        else
+            ImGui::Text("No lightmap, bake one with lightmap_baker");
+        const char *ssaoTiers[] = {"Off", "Low (quarter resolution)", "Medium (half resolution)",
+                                   "High (half resolution, 16 samples)"};
+        ImGui::Combo("SSAO", &programState->ssaoQuality, ssaoTiers, IM_ARRAYSIZE(ssaoTiers));
+        if (programState->ssaoQuality != Ssao::Off) {
+            ImGui::Text("SSAO at %d x %d", programState->ssaoStats.resolution.x, programState->ssaoStats.resolution.y);
+            ImGui::Text("GPU time: depth prepass %.2f ms, occlusion %.2f ms",
+                        programState->ssaoStats.prepassMilliseconds, programState->ssaoStats.milliseconds);
+        }
+        ImGui::End();
+    }
+
+    {
+        ImGui::Begin("Post-processing");
+        ImGui::Checkbox("Bloom", &programState->bloom);
+        ImGui::SliderFloat("Bloom threshold", &programState->bloomSettings.threshold, 0.0f, 4.0f);
+        ImGui::SliderFloat("Bloom strength", &programState->bloomSettings.strength, 0.0f, 0.5f);
+        ImGui::Checkbox("Tonemap (ACES)", &programState->tonemap);
+        ImGui::SliderFloat("Exposure", &programState->exposure, 0.1f, 4.0f);
+        ImGui::Checkbox("Colour grading", &programState->colorGrading);
+        ImGui::SliderFloat("Contrast", &programState->gradingSettings.contrast, 0.5f, 1.5f);
+        ImGui::SliderFloat("Saturation", &programState->gradingSettings.saturation, 0.0f, 2.0f);
+        ImGui::SliderFloat("Temperature", &programState->gradingSettings.temperature, -1.0f, 1.0f);
+        ImGui::Text("Grading LUT: %s", programState->postStats.gradingLut ? "resources/textures/grading_lut.png" :
+                                       "none, identity");
+        ImGui::Checkbox("FXAA", &programState->fxaa);
+        ImGui::Text("%d stages in %d full-screen passes", programState->postStats.stages,
+                    programState->postStats.passes);
+        for (const PostProcess::Timing &timing: programState->postStats.timings)
+            ImGui::Text("GPU time: %-28s %.2f ms", timing.name.c_str(), timing.milliseconds);
+        ImGui::End();
+    }
+
+    {
+        ImGui::Begin("Geometry");
+        if (programState->indirectSupported) {
+            ImGui::Checkbox("Multi-draw indirect", &programState->indirectDraw);
+            ImGui::Checkbox("GPU culling (frustum + Hi-Z)", &programState->gpuCulling);
+        } else
+            ImGui::Text("Multi-draw indirect and GPU culling need GL 4.3");
+        ImGui::Checkbox("Meshlet culling", &programState->meshletCulling);
+        ImGui::Checkbox("Meshlet cone culling", &programState->coneCulling);
+        ImGui::Text("House submission: %s", programState->houseStats.indirect ? "glMultiDrawElementsIndirect" : "per mesh");
+        ImGui::Text("House culling: %s", programState->houseStats.gpuCulled ? "compute" : "CPU frustum");
+        const char *unit = programState->houseStats.meshlets ? "meshlets" : "meshes";
+        ImGui::Text("House %s drawn: %d", unit, programState->houseStats.drawn);
+        ImGui::Text("House %s culled: %d", unit, programState->houseStats.culled);
+        ImGui::Text("House meshlets: %d", programState->houseStats.meshletCount);
+        ImGui::Text("House resident meshes: %d / %d", programState->houseStats.residentMeshes,
+                    programState->houseStats.meshCount);
+        ImGui::End();
+    }
+
+    {
+        ImGui::Begin("Terrain");
+        ImGui::Checkbox("Infinite terrain", &programState->infiniteTerrain);
+        ImGui::Text("Resident chunks: %d", programState->terrainStats.resident);
+        ImGui::Text("Chunks generating: %d", programState->terrainStats.pending);
+        ImGui::Text("Chunks drawn: %d", programState->terrainStats.drawn);
+        ImGui::Separator();
+        ImGui::Checkbox("Virtual texturing", &programState->virtualTexturing);
+        ImGui::Text("Resident pages: %d", programState->virtualTextureStats.resident);
+        ImGui::Text("Pages in flight: %d", programState->virtualTextureStats.pending);
+        ImGui::Text("Pages requested: %d", programState->virtualTextureStats.requested);
+        ImGui::Text("Page uploads: %d", programState->virtualTextureStats.uploads);
+        ImGui::End();
+    }
+
+    {
+        ImGui::Begin("Vegetation");
+        ImGui::Checkbox("Grass and rocks", &programState->scatter);
+        ImGui::Checkbox("GPU instance culling", &programState->scatterGpuCulling);
+        ImGui::SliderFloat("Density", &programState->scatterDensity, 0.25f, 8.0f);
+        ImGui::Text("Tiles: %d", programState->scatterStats.tiles);
+        ImGui::Text("Instances resident: %lld", programState->scatterStats.resident);
+        ImGui::Text("Instances drawn: %lld", programState->scatterStats.drawn);
+        ImGui::Text("GPU time: %.2f ms", programState->scatterStats.milliseconds);
+        if (programState->scatterStats.benchmarkRunning)
+            ImGui::Text("Benchmark running, results go to stdout");
+        else if (ImGui::Button("Run density benchmark"))
+            programState->scatterBenchmarkRequested = true;
         ImGui::End();
     }
 
@@ -616,6 +1588,12 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
         programState->blinn = !programState->blinn;
     if (key == GLFW_KEY_F && action == GLFW_PRESS)
         programState->spotLight.enabled = !programState->spotLight.enabled;
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+        programState->infiniteTerrain = !programState->infiniteTerrain;
+    if (key == GLFW_KEY_V && action == GLFW_PRESS)
+        programState->virtualTexturing = !programState->virtualTexturing;
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+        programState->scatter = !programState->scatter;
     if (key == GLFW_KEY_F1 && action == GLFW_PRESS) {
         programState->ImGuiEnabled = !programState->ImGuiEnabled;
         if (programState->ImGuiEnabled) {
@@ -628,64 +1606,115 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     }
 }
 
-// 2D texture loading
-unsigned int loadTexture(std::string pathToTex)
+// 2D texture loading, into textureID when one is given so a reload keeps the texture object.
+// Returns 0 when the image cannot be decoded, the given texture is then left as it was
+unsigned int loadTexture(std::string pathToTex, unsigned int textureID)
 {
-    unsigned int textureID;
-    int width, height, nrChannels;
-    unsigned char *data = stbi_load(pathToTex.c_str(), &width, &height, &nrChannels, 0);
-    if (data)
+    unsigned int texture = textureID;
+    if (texture == 0)
+        glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (!DecodeIntoTexture(GL_TEXTURE_2D, vector<FileView>{FileSystem::open(pathToTex)}, 3))
     {
-        glGenTextures(1, &textureID);
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
+        std::cout << "Failed to load textures!" << std::endl;
+        if (textureID == 0)
+            glDeleteTextures(1, &texture);
+        return 0;
     }
-    else
+    MipmapTexture2D();
+    return texture;
+}
+
+// Cubemap loading, into textureID when one is given. Every face is decoded before anything is uploaded, so a
+// reload with a broken face keeps the old cubemap. Returns 0 on failure
+unsigned int loadCubemap(vector<std::string> faces, unsigned int textureID)
+{
+    vector<FileView> files;
+    for (const std::string &face: faces)
+        files.push_back(FileSystem::open(face));
+    unsigned int texture = textureID;
+    if (texture == 0)
+        glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    // cubemap faces are not flipped
+    if (!DecodeIntoTexture(GL_TEXTURE_CUBE_MAP_POSITIVE_X, files, 3, false))
     {
-        std::cout << "Failed to load textures!" << std::endl;
+        std::cerr << "Failed to load cubemap textures!" << std::endl;
+        if (textureID == 0)
+            glDeleteTextures(1, &texture);
+        return 0;
     }
+    cubemapParameters();
+    return texture;
+}
 
-    return textureID;
+// Cubemap faces are not flipped
+bool decodeCubemapFace(const FileView &file, DecodedImage &image)
+{
+    return DecodeImage(file, image, 3, false);
 }
 
-// Cubemap loading
-unsigned int loadCubemap(vector<std::string> faces)
+// Returns 0 when a face is missing
+unsigned int cubemapFromImages(const vector<DecodedImage> &images, unsigned int textureID)
 {
-    stbi_set_flip_vertically_on_load(false);
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    for (const DecodedImage &image: images)
+        if (image.pixels.empty())
+            return 0;
 
-    int width, height, nrChannels;
-    unsigned char* data = nullptr;
-    for (unsigned int i = 0; i < faces.size(); i++)
-    {
-        data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        else
-        {
-            std::cerr << "Failed to load cubemap textures!" << std::endl;
-            stbi_image_free(data);
-            return -1;
-        }
-    }
-    stbi_image_free(data);
+    if (textureID == 0)
+        glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    for (unsigned int i = 0; i < images.size(); i++)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, images[i].width, images[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, images[i].pixels.data());
+    cubemapParameters();
+    return textureID;
+}
 
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+// sampling of the cubemap bound to GL_TEXTURE_CUBE_MAP
+void cubemapParameters()
+{
+    // every level is rebuilt from level 0, a cooked cubemap reloaded from its faces keeps no stale mips in use
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 1000);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
 
-    stbi_set_flip_vertically_on_load(true);
-    return textureID;
-}
\ No newline at end of file
+// A lightmap written by lightmap_baker, into textureID when one is given. Returns 0 when the file is damaged or
+// compressed in a format the driver does not take
+unsigned int uploadLightmap(const FileView &file, unsigned int textureID)
+{
+    CookedTexture::Image image;
+    if (!CookedTexture::Parse(file, image) || (image.format != CookedTexture::RGBA8 && !CookedTexture::Supported()))
+    {
+        std::cout << "ERROR::LIGHTMAP::CANNOT_LOAD" << std::endl;
+        return 0;
+    }
+    unsigned int texture = CookedTexture::Upload(image, textureID);
+    // the padding between charts only holds at full resolution, the smaller mips would blend neighbouring charts
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+// The model shader variant for a set of lighting toggles. The lightmap already holds the sky's light, with it
+// SKY_AMBIENT would only build the same program a second time
+ShaderDefines modelLighting(bool blinn, bool spotLight, bool skyAmbient, bool lightmap, bool ssao)
+{
+    ShaderDefines lighting;
+    if (blinn)
+        lighting.Set("BLINN");
+    if (spotLight)
+        lighting.Set("SPOT_LIGHT");
+    if (skyAmbient && !lightmap)
+        lighting.Set("SKY_AMBIENT");
+    if (lightmap)
+        lighting.Set("LIGHTMAP");
+    if (ssao)
+        lighting.Set("SSAO");
+    return lighting;
+}
@@ -0,0 +1,493 @@
+//
+// Offline asset cooker. Converts resources/ into the forms the runtime loads fastest, then packs them:
+//   models (.obj)               <path>.meshcache, stamped 0, with lightmap coords and vertex occlusion (mesh_cache.h)
+//   textures (.jpg, .png)       <path>.ctex, every mip level, BC1 or BC3 (cooked_texture.h)
+//   skybox directories          <directory>/cubemap.ctex, the six faces with their mips
+//   everything under resources  resources.pack (asset_pack.h)
+// Each output is recorded in cache/asset_cooker.db with the content hashes of the inputs it was made from and of its
+// own bytes; a later run only redoes outputs whose inputs, options or bytes changed. Outputs depend on nothing but the
+// input bytes and the options, so they can be cached and shared by content. Independent outputs cook in parallel.
+//
+// usage: asset_cooker [--root <project directory>] [--uncompressed] [--separate-materials] [--no-occlusion]
+//                     [--no-lightmap-coords] [--no-pack] [--force] [--skybox-size <pixels>]
+//
+
+#include <learnopengl/filesystem.h>
+#include <learnopengl/model.h>
+
+#include <asset_pack.h>
+#include <cooked_texture.h>
+#include <spherical_harmonics.h>
+#include <thread_pool.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// bump when any output format or cooking step changes, every output is redone
+const char *const CookerVersion = "asset_cooker 1";
+const char *const DatabasePath = "cache/asset_cooker.db";
+
+struct Options {
+    std::string root = logl_root;
+    bool compress = true;
+    // the runtime loads the house with texture arrays, whose caches merge meshes per material
+    bool mergeMaterials = true;
+    // the runtime bakes vertex occlusion into its model caches too
+    bool occlusion = true;
+    // and the second UV set lightmap_baker bakes into
+    bool lightmapCoords = true;
+    bool pack = true;
+    bool force = false;
+    // skybox faces are halved until they are no larger than this, 0 keeps the size of the source faces
+    int skyboxSize = 0;
+};
+
+// 64 bit FNV-1a, the same as the pack's path hash
+uint64_t hashBytes(const unsigned char *data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t hashString(const std::string &value, uint64_t hash = 14695981039346656037ull) {
+    return hashBytes((const unsigned char *) value.data(), value.size(), hash);
+}
+
+// what cooked an output and what it was cooked from, all paths relative to the root
+struct OutputRecord {
+    uint64_t recipe = 0;
+    uint64_t output = 0;
+    std::map<std::string, uint64_t> inputs;
+};
+
+// content hashes of files, remembered with the size and modification time they had so unchanged files are not read
+// again, and the record of every output
+class Database {
+public:
+    explicit Database(const std::string &root) : root(root) {}
+
+    void Load(const std::string &path) {
+        std::ifstream in(path);
+        std::string line;
+        if (!std::getline(in, line) || line != CookerVersion)
+            return;
+        OutputRecord *current = nullptr;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string kind, name;
+            fields >> kind;
+            if (kind == "file") {
+                Stamp stamp;
+                fields >> stamp.size >> stamp.modified >> std::hex >> stamp.hash;
+                fields.get();
+                std::getline(fields, name);
+                stamps[name] = stamp;
+            } else if (kind == "output") {
+                OutputRecord record;
+                fields >> std::hex >> record.recipe >> record.output;
+                fields.get();
+                std::getline(fields, name);
+                current = &(records[name] = record);
+            } else if (kind == "input" && current) {
+                uint64_t hash;
+                fields >> std::hex >> hash;
+                fields.get();
+                std::getline(fields, name);
+                current->inputs[name] = hash;
+            }
+        }
+    }
+
+    bool Save(const std::string &path) const {
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::trunc);
+            if (!out)
+                return false;
+            out << CookerVersion << '\n' << std::hex;
+            for (const std::pair<const std::string, Stamp> &stamp: stamps)
+                out << "file " << std::dec << stamp.second.size << ' ' << stamp.second.modified << ' ' << std::hex
+                    << stamp.second.hash << ' ' << stamp.first << '\n';
+            for (const std::pair<const std::string, OutputRecord> &record: records) {
+                out << "output " << record.second.recipe << ' ' << record.second.output << ' ' << record.first << '\n';
+                for (const std::pair<const std::string, uint64_t> &input: record.second.inputs)
+                    out << "input " << input.second << ' ' << input.first << '\n';
+            }
+            if (!out)
+                return false;
+        }
+        return std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    // 0 when the file cannot be read. Any thread
+    uint64_t Hash(const std::string &path) {
+        struct stat info;
+        if (stat((root + '/' + path).c_str(), &info) != 0)
+            return 0;
+        long long modified = (long long) info.st_mtim.tv_sec * 1000000000ll + info.st_mtim.tv_nsec;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::map<std::string, Stamp>::const_iterator known = stamps.find(path);
+            if (known != stamps.end() && known->second.size == (long long) info.st_size &&
+                known->second.modified == modified)
+                return known->second.hash;
+        }
+        std::shared_ptr<MappedFile> file = MappedFile::Open(root + '/' + path);
+        if (!file)
+            return 0;
+        Stamp stamp;
+        stamp.size = info.st_size;
+        stamp.modified = modified;
+        // an empty file still hashes to something else than unreadable
+        stamp.hash = hashBytes(file->Data(), file->Size()) | 1;
+        std::lock_guard<std::mutex> lock(mutex);
+        stamps[path] = stamp;
+        return stamp.hash;
+    }
+
+    // true when output exists with the bytes recorded for it and every recorded input still hashes the same
+    bool UpToDate(const std::string &output, uint64_t recipe, const std::vector<std::string> &inputs) {
+        OutputRecord record;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::map<std::string, OutputRecord>::const_iterator known = records.find(output);
+            if (known == records.end())
+                return false;
+            record = known->second;
+        }
+        if (record.recipe != recipe || Hash(output) != record.output)
+            return false;
+        for (const std::string &input: inputs)
+            if (!record.inputs.count(input))
+                return false;
+        for (const std::pair<const std::string, uint64_t> &input: record.inputs)
+            if (Hash(input.first) != input.second)
+                return false;
+        return true;
+    }
+
+    // after output was cooked from inputs
+    void Remember(const std::string &output, uint64_t recipe, const std::vector<std::string> &inputs) {
+        OutputRecord record;
+        record.recipe = recipe;
+        record.output = Hash(output);
+        for (const std::string &input: inputs)
+            record.inputs[input] = Hash(input);
+        std::lock_guard<std::mutex> lock(mutex);
+        records[output] = record;
+    }
+
+private:
+    struct Stamp {
+        long long size = 0;
+        long long modified = 0;
+        uint64_t hash = 0;
+    };
+
+    std::string root;
+    std::mutex mutex;
+    std::map<std::string, Stamp> stamps;
+    std::map<std::string, OutputRecord> records;
+};
+
+// one output and how to make it. cook returns false on failure and may add inputs it only found while cooking
+struct Job {
+    std::string output;
+    std::string kind;
+    std::vector<std::string> inputs;
+    std::function<bool(std::vector<std::string> &inputs)> cook;
+};
+
+bool endsWith(const std::string &value, const std::string &suffix) {
+    return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// every regular file under directory, relative to root and sorted so the jobs come out the same on every run
+void listFiles(const std::string &root, const std::string &directory, std::vector<std::string> &files) {
+    DIR *dir = opendir((root + '/' + directory).c_str());
+    if (!dir)
+        return;
+    while (dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        std::string path = directory + '/' + name;
+        struct stat info;
+        if (stat((root + '/' + path).c_str(), &info) != 0)
+            continue;
+        if (S_ISDIR(info.st_mode))
+            listFiles(root, path, files);
+        else if (S_ISREG(info.st_mode))
+            files.push_back(path);
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+}
+
+bool isImage(const std::string &path) {
+    return endsWith(path, ".png") || endsWith(path, ".jpg") || endsWith(path, ".jpeg");
+}
+
+bool isOutput(const std::string &path) {
+    return endsWith(path, ".meshcache") || endsWith(path, ".ctex") || endsWith(path, ".sh9") || endsWith(path, ".tmp");
+}
+
+// the material libraries an .obj names, relative to the root
+std::vector<std::string> materialLibraries(const std::string &root, const std::string &model) {
+    std::vector<std::string> libraries;
+    std::ifstream in(root + '/' + model);
+    std::string line, directory = model.substr(0, model.find_last_of('/') + 1);
+    while (std::getline(in, line))
+        if (line.compare(0, 7, "mtllib ") == 0) {
+            std::string name = line.substr(7);
+            name.erase(name.find_last_not_of(" \r\t") + 1);
+            libraries.push_back(VirtualFileSystem::Normalize(directory + name));
+        }
+    return libraries;
+}
+
+bool cookModel(const Options &options, const std::string &model, std::vector<std::string> &inputs) {
+    std::vector<std::string> textures;
+    if (!Model::Cook(options.root + '/' + model, options.mergeMaterials, textures))
+        return false;
+    for (const std::string &texture: materialLibraries(options.root, model))
+        inputs.push_back(texture);
+    // the cache holds thumbnails of the textures
+    for (const std::string &texture: textures)
+        inputs.push_back(VirtualFileSystem::Normalize(texture.substr(options.root.size() + 1)));
+    return true;
+}
+
+CookedTexture::Format textureFormat(const Options &options, const DecodedImage &image) {
+    if (!options.compress)
+        return CookedTexture::RGBA8;
+    for (size_t i = 3; i < image.pixels.size(); i += 4)
+        if (image.pixels[i] != 255)
+            return CookedTexture::BC3;
+    return CookedTexture::BC1;
+}
+
+bool cookTexture(const Options &options, const std::string &texture) {
+    // flipped like every texture the runtime decodes
+    DecodedImage image;
+    if (!DecodeImage(options.root + '/' + texture, image, 4)) {
+        std::cout << "ERROR::ASSET_COOKER::CANNOT_DECODE " << texture << std::endl;
+        return false;
+    }
+    return CookedTexture::Write(options.root + '/' + texture + ".ctex", textureFormat(options, image), image.width,
+                                image.height, {image.pixels.data()});
+}
+
+bool cookCubemap(const Options &options, const std::vector<std::string> &faces, const std::string &output) {
+    std::vector<DecodedImage> images(faces.size());
+    std::vector<const unsigned char *> pixels;
+    bool alpha = false;
+    for (size_t i = 0; i < faces.size(); i++) {
+        DecodedImage &image = images[i];
+        // cubemap faces are not flipped
+        if (!DecodeImage(options.root + '/' + faces[i], image, 4, false) || image.width != images[0].width ||
+            image.height != images[0].height) {
+            std::cout << "ERROR::ASSET_COOKER::CANNOT_DECODE " << faces[i] << std::endl;
+            return false;
+        }
+    }
+    for (DecodedImage &image: images) {
+        while (options.skyboxSize > 0 && std::max(image.width, image.height) > options.skyboxSize) {
+            std::vector<unsigned char> half;
+            CookedTexture::halve(image.pixels, image.width, image.height, half);
+            image.pixels.swap(half);
+            image.width = std::max(1, image.width / 2);
+            image.height = std::max(1, image.height / 2);
+        }
+        alpha |= textureFormat(options, image) == CookedTexture::BC3;
+        pixels.push_back(image.pixels.data());
+    }
+    CookedTexture::Format format = !options.compress ? CookedTexture::RGBA8 : alpha ? CookedTexture::BC3
+                                                                                   : CookedTexture::BC1;
+    return CookedTexture::Write(options.root + '/' + output, format, images[0].width, images[0].height, pixels);
+}
+
+// the ambient light of a skybox, what the runtime would otherwise project at startup
+bool cookIrradiance(const Options &options, const std::vector<std::string> &faces, const std::string &output) {
+    std::vector<std::string> paths;
+    for (const std::string &face: faces)
+        paths.push_back(options.root + '/' + face);
+    SH9 irradiance;
+    if (!SphericalHarmonics::ProjectFiles(paths, irradiance)) {
+        std::cout << "ERROR::ASSET_COOKER::CANNOT_DECODE " << faces[0] << std::endl;
+        return false;
+    }
+    return SphericalHarmonics::Save(options.root + '/' + output, irradiance);
+}
+
+// the six faces of a skybox in directory, in CookedTexture::CubeFaces order, empty when it has not all of them
+std::vector<std::string> cubeFaces(const std::vector<std::string> &files, const std::string &directory) {
+    for (const char *extension: {".png", ".jpg"}) {
+        std::vector<std::string> faces;
+        for (const char *face: CookedTexture::CubeFaces)
+            if (std::binary_search(files.begin(), files.end(), directory + '/' + face + extension))
+                faces.push_back(directory + '/' + face + extension);
+        if (faces.size() == 6)
+            return faces;
+    }
+    return std::vector<std::string>();
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument == "--root" && i + 1 < argc)
+            options.root = argv[++i];
+        else if (argument == "--uncompressed")
+            options.compress = false;
+        else if (argument == "--separate-materials")
+            options.mergeMaterials = false;
+        else if (argument == "--no-occlusion")
+            options.occlusion = false;
+        else if (argument == "--no-lightmap-coords")
+            options.lightmapCoords = false;
+        else if (argument == "--no-pack")
+            options.pack = false;
+        else if (argument == "--force")
+            options.force = true;
+        else if (argument == "--skybox-size" && i + 1 < argc)
+            options.skyboxSize = std::atoi(argv[++i]);
+        else {
+            std::cout << "usage: asset_cooker [--root <project directory>] [--uncompressed] [--separate-materials] "
+                         "[--no-occlusion] [--no-lightmap-coords] [--no-pack] [--force] [--skybox-size <pixels>]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    // the same flip the runtime decodes with, thumbnails and cooked textures must match what it would load
+    ImageDecoders::SetFlipVertically(true);
+    VertexOcclusion::SetEnabled(options.occlusion);
+    Lightmap::SetEnabled(options.lightmapCoords);
+
+    Database database(options.root);
+    std::string databasePath = options.root + '/' + DatabasePath;
+    if (!options.force)
+        database.Load(databasePath);
+
+    std::vector<std::string> files;
+    listFiles(options.root, "resources", files);
+    files.erase(std::remove_if(files.begin(), files.end(), isOutput), files.end());
+
+    std::vector<Job> jobs;
+    for (const std::string &file: files) {
+        std::string directory = file.substr(0, file.find_last_of('/'));
+        std::vector<std::string> faces = cubeFaces(files, directory);
+        if (!faces.empty() && faces[0] == file) {
+            Job job;
+            job.kind = "cubemap " + std::to_string(options.skyboxSize);
+            job.output = directory + "/cubemap.ctex";
+            job.inputs = faces;
+            std::string output = job.output;
+            job.cook = [&options, faces, output](std::vector<std::string> &) {
+                return cookCubemap(options, faces, output);
+            };
+            jobs.push_back(job);
+            Job irradiance;
+            irradiance.kind = "irradiance";
+            irradiance.output = directory + "/irradiance.sh9";
+            irradiance.inputs = faces;
+            std::string irradianceOutput = irradiance.output;
+            irradiance.cook = [&options, faces, irradianceOutput](std::vector<std::string> &) {
+                return cookIrradiance(options, faces, irradianceOutput);
+            };
+            jobs.push_back(irradiance);
+        }
+        // the faces only go into the cubemap
+        if (std::find(faces.begin(), faces.end(), file) != faces.end())
+            continue;
+        Job job;
+        job.inputs.push_back(file);
+        if (endsWith(file, ".obj")) {
+            job.kind = std::string(options.mergeMaterials ? "model merged" : "model") +
+                       (options.occlusion ? " occlusion" : "") + (options.lightmapCoords ? " lightmap" : "");
+            job.output = file + ".meshcache";
+            job.cook = [&options, file](std::vector<std::string> &inputs) {
+                return cookModel(options, file, inputs);
+            };
+        } else if (isImage(file)) {
+            job.kind = "texture";
+            job.output = file + ".ctex";
+            job.cook = [&options, file](std::vector<std::string> &) { return cookTexture(options, file); };
+        } else
+            continue;
+        jobs.push_back(job);
+    }
+
+    std::string format = options.compress ? " bc" : " rgba8";
+    std::mutex mutex;
+    int cooked = 0, upToDate = 0, failed = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool;
+        for (const Job &job: jobs) {
+            uint64_t recipe = hashString(std::string(CookerVersion) + ' ' + job.kind + format);
+            if (database.UpToDate(job.output, recipe, job.inputs)) {
+                upToDate++;
+                continue;
+            }
+            pool.Submit([&, job, recipe] {
+                auto jobStart = std::chrono::steady_clock::now();
+                std::vector<std::string> inputs = job.inputs;
+                bool success = job.cook(inputs);
+                float milliseconds = std::chrono::duration<float, std::milli>(
+                        std::chrono::steady_clock::now() - jobStart).count();
+                if (success)
+                    database.Remember(job.output, recipe, inputs);
+                std::lock_guard<std::mutex> lock(mutex);
+                (success ? cooked : failed)++;
+                std::cout << (success ? "cooked " : "FAILED ") << job.output << " (" << milliseconds << " ms)"
+                          << std::endl;
+            });
+        }
+        pool.Wait();
+    }
+
+    // the pack holds every file the runtime may open, cooked or not, so it can run from the pack alone
+    if (options.pack && failed == 0) {
+        std::vector<std::string> packed;
+        listFiles(options.root, "resources", packed);
+        packed.erase(std::remove_if(packed.begin(), packed.end(),
+                                    [](const std::string &path) { return endsWith(path, ".tmp"); }),
+                     packed.end());
+        std::string pack = "resources.pack";
+        uint64_t recipe = hashString(std::string(CookerVersion) + " pack");
+        if (!database.UpToDate(pack, recipe, packed)) {
+            if (AssetPack::Write(options.root + '/' + pack, options.root, packed)) {
+                database.Remember(pack, recipe, packed);
+                cooked++;
+                std::cout << "cooked " << pack << " (" << packed.size() << " files)" << std::endl;
+            } else
+                failed++;
+        } else
+            upToDate++;
+    }
+
+    mkdir((options.root + "/cache").c_str(), 0755);
+    if (!database.Save(databasePath))
+        std::cout << "ERROR::ASSET_COOKER::CANNOT_WRITE " << DatabasePath << std::endl;
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    std::cout << cooked << " cooked, " << upToDate << " up to date, " << failed
+              << " failed in " << seconds << " s" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
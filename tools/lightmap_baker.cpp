@@ -0,0 +1,472 @@
+//
+// Offline lightmap baker. Imports a model with its second UV set (lightmap.h), path traces the light of the static
+// DirLight and the skybox into every texel of that set and writes it to <model>.lightmap.ctex, RGBM encoded and BC3
+// compressed (cooked_texture.h). Each texel gathers cosine distributed paths of up to --bounces indirect bounces
+// against a TriangleBvh of the model: a shadow ray towards the sun at every vertex of the path and the sky where the
+// path escapes. Surfaces reflect the average colour of their diffuse texture. The texels are shared out between the
+// workers of a ThreadPool in small tiles, so a worker that finishes an easy tile just takes the next one. Every texel
+// draws its own random numbers, the same model and options always bake to the same bytes.
+//
+// The lightmap holds what model_shader.fs would otherwise get from the DirLight's ambient and diffuse terms, so the
+// sun and sky options should match the scene: the defaults are the ones of src/main.cpp.
+//
+// usage: lightmap_baker [--root <project directory>] [--model <path>] [--samples <paths per texel>]
+//                       [--bounces <count>] [--sun-direction <x y z>] [--sun-color <r g b>] [--sky-strength <factor>]
+//                       [--albedo <fallback grey>] [--uncompressed]
+//
+
+#include <learnopengl/filesystem.h>
+#include <learnopengl/model.h>
+
+#include <cooked_texture.h>
+#include <image_decoder.h>
+#include <lightmap.h>
+#include <spherical_harmonics.h>
+#include <thread_pool.h>
+#include <triangle_bvh.h>
+#include <vertex_occlusion.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Options {
+    std::string root = logl_root;
+    std::string model = "resources/objects/house/highpoly_town_house_01.obj";
+    std::string skybox = "resources/textures/skybox";
+    int samples = 128;
+    int bounces = 2;
+    // the DirLight of src/main.cpp, its diffuse colour is the sun's
+    glm::vec3 sunDirection = glm::vec3(-10.0f, -10.0f, -3.0f);
+    glm::vec3 sunColor = glm::vec3(0.1f);
+    // the sun is a small disc, not a point, so shadow edges come out soft instead of aliased
+    float sunRadius = 0.01f;
+    // the runtime's default sky ambient strength
+    float skyStrength = 3.0f;
+    // reflectance of meshes without a diffuse texture
+    float albedo = 0.5f;
+    bool compress = true;
+};
+
+// the skybox as six small faces of linear colours, looked up by direction like a GL cubemap
+class Sky {
+public:
+    static const int Size = 32;
+
+    bool Load(const Options &options) {
+        for (int face = 0; face < 6; face++) {
+            std::string path = options.root + '/' + options.skybox + '/' + CookedTexture::CubeFaces[face] + ".png";
+            FileView file = FileSystem::open(path);
+            ImageInfo info;
+            if (!ImageDecoders::Info(file, info)) {
+                std::cout << "ERROR::LIGHTMAP_BAKER::CANNOT_READ " << path << std::endl;
+                return false;
+            }
+            std::vector<unsigned char> pixels((size_t) info.width * info.height * 3);
+            if (!ImageDecoders::Decode(file, 3, false, pixels.data())) {
+                std::cout << "ERROR::LIGHTMAP_BAKER::CANNOT_DECODE " << path << std::endl;
+                return false;
+            }
+            // box filtered down, the texels a path hits are far larger than the source's
+            faces[face].assign(Size * Size, glm::vec3(0.0f));
+            std::vector<int> counts(Size * Size, 0);
+            for (int y = 0; y < info.height; y++)
+                for (int x = 0; x < info.width; x++) {
+                    int cell = (y * Size / info.height) * Size + x * Size / info.width;
+                    const unsigned char *texel = pixels.data() + ((size_t) y * info.width + x) * 3;
+                    faces[face][cell] += glm::vec3(texel[0], texel[1], texel[2]) * (1.0f / 255.0f);
+                    counts[cell]++;
+                }
+            for (int i = 0; i < Size * Size; i++)
+                faces[face][i] *= options.skyStrength / std::max(counts[i], 1);
+        }
+        return true;
+    }
+
+    // the inverse of SphericalHarmonics::faceDirection
+    glm::vec3 Radiance(const glm::vec3 &direction) const {
+        glm::vec3 magnitude = glm::abs(direction);
+        int face;
+        float s, t;
+        if (magnitude.x >= magnitude.y && magnitude.x >= magnitude.z) {
+            face = direction.x > 0.0f ? 0 : 1;
+            s = (direction.x > 0.0f ? -direction.z : direction.z) / magnitude.x;
+            t = -direction.y / magnitude.x;
+        } else if (magnitude.y >= magnitude.z) {
+            face = direction.y > 0.0f ? 2 : 3;
+            s = direction.x / magnitude.y;
+            t = (direction.y > 0.0f ? direction.z : -direction.z) / magnitude.y;
+        } else {
+            face = direction.z > 0.0f ? 4 : 5;
+            s = (direction.z > 0.0f ? direction.x : -direction.x) / magnitude.z;
+            t = -direction.y / magnitude.z;
+        }
+        int x = std::min(Size - 1, std::max(0, (int) ((s * 0.5f + 0.5f) * Size)));
+        int y = std::min(Size - 1, std::max(0, (int) ((t * 0.5f + 0.5f) * Size)));
+        return faces[face][y * Size + x];
+    }
+
+private:
+    std::vector<glm::vec3> faces[6];
+};
+
+// the model's triangles in the order they went into the BVH, with what a path needs when it hits one
+struct Scene {
+    TriangleBvh bvh;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec3> albedos;
+    Sky sky;
+    glm::vec3 toSun;
+    glm::vec3 sunColor;
+    float sunRadius;
+    int bounces;
+    // how far rays start off the surface they leave
+    float bias;
+};
+
+// one texel of the lightmap with the surface point at its centre
+struct Texel {
+    unsigned int index;
+    glm::vec3 position;
+    glm::vec3 normal;
+    unsigned int triangle;
+};
+
+// a hashed counter, every texel its own sequence
+struct Random {
+    uint32_t state;
+
+    float Next() {
+        state = VertexOcclusion::hash(state + 0x9e3779b9u);
+        return (float) (state >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+// turns a direction around +z into one around normal
+glm::vec3 aroundNormal(const glm::vec3 &local, const glm::vec3 &normal) {
+    glm::vec3 helper = std::fabs(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::vec3 tangent = glm::normalize(glm::cross(helper, normal)), bitangent = glm::cross(normal, tangent);
+    return tangent * local.x + bitangent * local.y + normal * local.z;
+}
+
+glm::vec3 cosineDirection(const glm::vec3 &normal, Random &random) {
+    float u = random.Next(), angle = 6.28318531f * random.Next(), radius = std::sqrt(u);
+    return aroundNormal(glm::vec3(radius * std::cos(angle), radius * std::sin(angle), std::sqrt(1.0f - u)), normal);
+}
+
+// the sun's light on a surface point, geometric the side of the triangle the point is on
+glm::vec3 sunLight(const Scene &scene, const glm::vec3 &position, const glm::vec3 &normal, const glm::vec3 &geometric,
+                   Random &random) {
+    glm::vec3 offset = cosineDirection(scene.toSun, random);
+    glm::vec3 toSun = glm::normalize(scene.toSun + (offset - scene.toSun * glm::dot(offset, scene.toSun)) *
+                                                   scene.sunRadius);
+    float cosine = glm::dot(normal, toSun);
+    if (cosine <= 0.0f || glm::dot(geometric, toSun) <= 0.0f)
+        return glm::vec3(0.0f);
+    if (scene.bvh.Occluded(position + geometric * scene.bias, toSun, 0.0f, 1e30f))
+        return glm::vec3(0.0f);
+    return scene.sunColor * cosine;
+}
+
+// the light arriving at a texel along one path that leaves in direction, in the units model_shader.fs multiplies
+// the diffuse colour with
+glm::vec3 tracePath(const Scene &scene, glm::vec3 position, glm::vec3 normal, glm::vec3 geometric,
+                    glm::vec3 direction, Random &random) {
+    glm::vec3 light(0.0f), throughput(1.0f);
+    for (int bounce = 0;; bounce++) {
+        light += throughput * sunLight(scene, position, normal, geometric, random);
+        TriangleBvh::Hit hit;
+        if (!scene.bvh.Intersect(position + geometric * scene.bias, direction, 0.0f, 1e30f, hit)) {
+            light += throughput * scene.sky.Radiance(direction);
+            break;
+        }
+        if (bounce == scene.bounces)
+            break;
+        throughput *= scene.albedos[hit.triangle];
+        position += geometric * scene.bias + direction * hit.t;
+        // the triangles are two sided, a path bounces off whichever side it hits
+        geometric = scene.normals[hit.triangle];
+        if (glm::dot(geometric, direction) > 0.0f)
+            geometric = -geometric;
+        normal = geometric;
+        direction = cosineDirection(normal, random);
+    }
+    return light;
+}
+
+// every texel whose centre lies on a triangle of the lightmap layout, the first triangle wins where charts touch
+std::vector<Texel> rasterize(const ModelData &data) {
+    const int size = Lightmap::Resolution;
+    std::vector<int> owner((size_t) size * size, -1);
+    std::vector<Texel> texels;
+    unsigned int triangle = 0;
+    for (const MeshData &mesh: data.meshes)
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3, triangle++) {
+            const Vertex *corners[3] = {&mesh.vertices[mesh.indices[i]], &mesh.vertices[mesh.indices[i + 1]],
+                                        &mesh.vertices[mesh.indices[i + 2]]};
+            glm::vec2 uv[3];
+            for (int k = 0; k < 3; k++)
+                uv[k] = glm::vec2(corners[k]->LightmapCoords[0], corners[k]->LightmapCoords[1]) *
+                        ((float) size / 65535.0f);
+            float area = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (uv[1].y - uv[0].y);
+            if (std::fabs(area) < 1e-12f)
+                continue;
+            glm::vec2 lower = glm::min(uv[0], glm::min(uv[1], uv[2])), upper = glm::max(uv[0], glm::max(uv[1], uv[2]));
+            int x0 = std::max(0, (int) std::floor(lower.x - 0.5f)), x1 = std::min(size - 1, (int) std::ceil(upper.x));
+            int y0 = std::max(0, (int) std::floor(lower.y - 0.5f)), y1 = std::min(size - 1, (int) std::ceil(upper.y));
+            for (int y = y0; y <= y1; y++)
+                for (int x = x0; x <= x1; x++) {
+                    glm::vec2 centre(x + 0.5f, y + 0.5f);
+                    float weights[3];
+                    for (int k = 0; k < 3; k++) {
+                        const glm::vec2 &a = uv[(k + 1) % 3], &b = uv[(k + 2) % 3];
+                        weights[k] = ((b.x - a.x) * (centre.y - a.y) - (centre.x - a.x) * (b.y - a.y)) / area;
+                    }
+                    // a little slack so texels on a shared edge are not lost to rounding
+                    if (weights[0] < -1e-4f || weights[1] < -1e-4f || weights[2] < -1e-4f)
+                        continue;
+                    int &texelOwner = owner[(size_t) y * size + x];
+                    if (texelOwner >= 0)
+                        continue;
+                    texelOwner = (int) triangle;
+                    Texel texel;
+                    texel.index = (unsigned int) (y * size + x);
+                    texel.triangle = triangle;
+                    texel.position = glm::vec3(0.0f);
+                    texel.normal = glm::vec3(0.0f);
+                    for (int k = 0; k < 3; k++) {
+                        texel.position += corners[k]->Position * weights[k];
+                        texel.normal += corners[k]->Normal * weights[k];
+                    }
+                    texels.push_back(texel);
+                }
+        }
+    return texels;
+}
+
+// average colour of every mesh's diffuse texture, the fallback grey for meshes without one
+std::vector<glm::vec3> meshAlbedos(ModelData &data, float fallback) {
+    std::vector<glm::vec3> albedos;
+    std::vector<bool> decoded(data.textures.size(), false);
+    for (const MeshData &mesh: data.meshes) {
+        glm::vec3 albedo(fallback);
+        for (const Texture &texture: mesh.textures) {
+            if (texture.type != "texture_diffuse")
+                continue;
+            for (unsigned int i = 0; i < data.textures.size(); i++) {
+                if (data.textures[i].path != texture.path)
+                    continue;
+                if (!decoded[i]) {
+                    Model::DecodeTexture(data, i);
+                    decoded[i] = true;
+                }
+                const DecodedImage &image = data.images[i];
+                if (image.pixels.empty() || image.channels < 3)
+                    break;
+                double sum[3] = {0.0, 0.0, 0.0};
+                for (size_t p = 0; p + 2 < image.pixels.size(); p += image.channels)
+                    for (int c = 0; c < 3; c++)
+                        sum[c] += image.pixels[p + c];
+                double count = 255.0 * (image.pixels.size() / image.channels);
+                albedo = glm::vec3(sum[0] / count, sum[1] / count, sum[2] / count);
+                break;
+            }
+            break;
+        }
+        albedos.push_back(albedo);
+    }
+    return albedos;
+}
+
+// spreads the border texels of the charts into the empty ones next to them, passes texels deep, so bilinear
+// filtering and mips at a chart's edge do not pull in black
+void dilate(std::vector<glm::vec3> &light, std::vector<unsigned char> &covered, int passes) {
+    const int size = Lightmap::Resolution;
+    for (int pass = 0; pass < passes; pass++) {
+        std::vector<glm::vec3> next = light;
+        std::vector<unsigned char> nextCovered = covered;
+        for (int y = 0; y < size; y++)
+            for (int x = 0; x < size; x++) {
+                if (covered[(size_t) y * size + x])
+                    continue;
+                glm::vec3 sum(0.0f);
+                int count = 0;
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int nx = x + dx, ny = y + dy;
+                        if (nx < 0 || ny < 0 || nx >= size || ny >= size || !covered[(size_t) ny * size + nx])
+                            continue;
+                        sum += light[(size_t) ny * size + nx];
+                        count++;
+                    }
+                if (count > 0) {
+                    next[(size_t) y * size + x] = sum / (float) count;
+                    nextCovered[(size_t) y * size + x] = 1;
+                }
+            }
+        light.swap(next);
+        covered.swap(nextCovered);
+    }
+}
+
+// rgb / m and m in alpha, m rounded up so the colour never clips, see Lightmap::Range
+void encodeRgbm(const glm::vec3 &light, unsigned char *out) {
+    float peak = std::max(std::max(light.r, light.g), std::max(light.b, 1e-6f));
+    float m = std::min(1.0f, std::ceil(peak / Lightmap::Range * 255.0f) / 255.0f);
+    for (int c = 0; c < 3; c++)
+        out[c] = (unsigned char) std::lround(glm::clamp(light[c] / (m * Lightmap::Range), 0.0f, 1.0f) * 255.0f);
+    out[3] = (unsigned char) std::lround(m * 255.0f);
+}
+
+bool readVector(int &i, int argc, char **argv, glm::vec3 &value) {
+    if (i + 3 >= argc)
+        return false;
+    for (int k = 0; k < 3; k++)
+        value[k] = (float) std::atof(argv[++i]);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument == "--root" && i + 1 < argc)
+            options.root = argv[++i];
+        else if (argument == "--model" && i + 1 < argc)
+            options.model = argv[++i];
+        else if (argument == "--samples" && i + 1 < argc)
+            options.samples = std::max(1, std::atoi(argv[++i]));
+        else if (argument == "--bounces" && i + 1 < argc)
+            options.bounces = std::max(0, std::atoi(argv[++i]));
+        else if (argument == "--sun-direction" && readVector(i, argc, argv, options.sunDirection))
+            continue;
+        else if (argument == "--sun-color" && readVector(i, argc, argv, options.sunColor))
+            continue;
+        else if (argument == "--sky-strength" && i + 1 < argc)
+            options.skyStrength = (float) std::atof(argv[++i]);
+        else if (argument == "--albedo" && i + 1 < argc)
+            options.albedo = (float) std::atof(argv[++i]);
+        else if (argument == "--uncompressed")
+            options.compress = false;
+        else {
+            std::cout << "usage: lightmap_baker [--root <project directory>] [--model <path>] "
+                         "[--samples <paths per texel>] [--bounces <count>] [--sun-direction <x y z>] "
+                         "[--sun-color <r g b>] [--sky-strength <factor>] [--albedo <fallback grey>] [--uncompressed]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    // imported the way the runtime imports it, so the layout and the cache are the ones it draws with
+    ImageDecoders::SetFlipVertically(true);
+    VertexOcclusion::SetEnabled(true);
+    Lightmap::SetEnabled(true);
+    auto start = std::chrono::steady_clock::now();
+    std::string modelPath = options.root + '/' + options.model;
+    ModelData data = Model::Import(modelPath, true);
+    if (data.meshes.empty()) {
+        std::cout << "ERROR::LIGHTMAP_BAKER::CANNOT_IMPORT " << modelPath << std::endl;
+        return 1;
+    }
+    // without a layout every texel would land on the atlas' corner
+    if (!data.lightmapLayout) {
+        std::cout << "ERROR::LIGHTMAP_BAKER::NO_LAYOUT " << modelPath << std::endl;
+        return 1;
+    }
+
+    Scene scene;
+    if (!scene.sky.Load(options))
+        return 1;
+    std::vector<glm::vec3> albedos = meshAlbedos(data, options.albedo);
+    for (unsigned int m = 0; m < data.meshes.size(); m++) {
+        const MeshData &mesh = data.meshes[m];
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            const glm::vec3 &a = mesh.vertices[mesh.indices[i]].Position, &b = mesh.vertices[mesh.indices[i + 1]].Position,
+                    &c = mesh.vertices[mesh.indices[i + 2]].Position;
+            scene.bvh.Add(a, b, c);
+            glm::vec3 normal = glm::cross(b - a, c - a);
+            float length = glm::length(normal);
+            scene.normals.push_back(length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f));
+            scene.albedos.push_back(glm::clamp(albedos[m], 0.0f, 0.95f));
+        }
+    }
+    scene.bvh.Build();
+    scene.toSun = glm::normalize(-options.sunDirection);
+    scene.sunColor = options.sunColor;
+    scene.sunRadius = options.sunRadius;
+    scene.bounces = options.bounces;
+    scene.bias = glm::length(scene.bvh.Upper() - scene.bvh.Lower()) * 5e-4f;
+
+    std::vector<Texel> texels = rasterize(data);
+    const size_t texelCount = (size_t) Lightmap::Resolution * Lightmap::Resolution;
+    std::vector<glm::vec3> light(texelCount, glm::vec3(0.0f));
+    std::vector<unsigned char> covered(texelCount, 0);
+    std::cout << "baking " << texels.size() << " texels of " << options.model << ", " << options.samples
+              << " paths each" << std::endl;
+
+    // the first direction of every path comes from one stratified set, turned per texel like VertexOcclusion does
+    std::vector<glm::vec3> directions = VertexOcclusion::hemisphere(options.samples);
+    std::atomic<size_t> done(0);
+    std::mutex progressMutex;
+    int reported = 0;
+    {
+        ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        const size_t tileSize = 256;
+        for (size_t first = 0; first < texels.size(); first += tileSize) {
+            pool.Submit([&, first] {
+                size_t end = std::min(first + tileSize, texels.size());
+                for (size_t i = first; i < end; i++) {
+                    const Texel &texel = texels[i];
+                    Random random{VertexOcclusion::hash(texel.index)};
+                    glm::vec3 geometric = scene.normals[texel.triangle];
+                    glm::vec3 normal = glm::dot(texel.normal, texel.normal) > 1e-12f ? glm::normalize(texel.normal)
+                                                                                      : geometric;
+                    if (glm::dot(normal, geometric) < 0.0f)
+                        geometric = -geometric;
+                    float angle = 6.28318531f * random.Next(), c = std::cos(angle), s = std::sin(angle);
+                    glm::vec3 sum(0.0f);
+                    for (const glm::vec3 &local: directions) {
+                        glm::vec3 turned(local.x * c - local.y * s, local.x * s + local.y * c, local.z);
+                        glm::vec3 direction = aroundNormal(turned, normal);
+                        // shading normals can lean a path under the triangle, it starts along the geometric one then
+                        if (glm::dot(direction, geometric) <= 0.0f)
+                            direction = aroundNormal(turned, geometric);
+                        sum += tracePath(scene, texel.position, normal, geometric, direction, random);
+                    }
+                    light[texel.index] = sum / (float) directions.size();
+                    covered[texel.index] = 1;
+                }
+                size_t total = done += end - first;
+                std::lock_guard<std::mutex> lock(progressMutex);
+                int percent = (int) (total * 100 / texels.size());
+                if (percent / 10 > reported / 10) {
+                    reported = percent;
+                    std::cout << percent << "%" << std::endl;
+                }
+            });
+        }
+        pool.Wait();
+    }
+    dilate(light, covered, Lightmap::Padding);
+
+    std::vector<unsigned char> rgbm(texelCount * 4);
+    for (size_t i = 0; i < texelCount; i++)
+        encodeRgbm(light[i], &rgbm[i * 4]);
+    std::string output = Lightmap::Path(modelPath);
+    CookedTexture::Format format = options.compress ? CookedTexture::BC3 : CookedTexture::RGBA8;
+    if (!CookedTexture::Write(output, format, Lightmap::Resolution, Lightmap::Resolution, {rgbm.data()})) {
+        std::cout << "ERROR::LIGHTMAP_BAKER::CANNOT_WRITE " << output << std::endl;
+        return 1;
+    }
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "wrote " << output << " (" << texels.size() * 100 / texelCount << "% of the texels covered, "
+              << seconds << " s)" << std::endl;
+    return 0;
+}